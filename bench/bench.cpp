@@ -0,0 +1,731 @@
+#include <algorithm>
+#include <any>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <river>
+
+#include "perf_counters.hpp"
+
+using namespace river;
+
+/**
+ * Benchmark comparing River against hand-written alternatives on the same
+ * workload.
+ *
+ * The workload scales the README river up to GROUP_COUNT copies of its five
+ * channels. Each operation reads `control.pressure` and
+ * `control.pressure.valid` from a random group, then writes
+ * `control.valve_open` and, every few operations, `system.time` and
+ * `control.pressure` in a random group owned by the calling thread. Groups are
+ * owned round-robin, so every group has a single writer and many readers.
+ *
+ * Every store synchronizes each access separately, as River does:
+ *
+ *   * `struct`: plain structs with a mutex per group.
+ *   * `map`: `std::unordered_map<std::string, std::any>` keyed by channel path,
+ *     with a single mutex.
+ *   * `river/<kind>`: River with each group rivulet locked according to a lock
+ *     kind. `none` is unsynchronized, and is only meaningful as a lower bound.
+ *   * `river/checksums`: `river/single_writer` with checksums, to measure
+ *     their overhead.
+ *
+ * With `--perf`, each store is also run in a second, untimed pass with hardware
+ * performance counters enabled on every thread, and the counts per operation
+ * are reported. Counters are read around the whole pass rather than each
+ * operation, since reading them costs a system call that would dwarf the
+ * operation itself.
+ *
+ * Finally, the time to load a schema of SCHEMA_GROUP_COUNT groups with
+ * Builder::load_schema() and build the river is reported.
+ *
+ * Usage: bench [--perf] [threads] [ops_per_thread]
+ */
+
+namespace {
+/**
+ * Number of README-shaped groups. Each group has five channels.
+ */
+constexpr size_t GROUP_COUNT = 2000;
+
+/**
+ * Every Nth operation also writes the time and pressure.
+ */
+constexpr uint64_t SLOW_WRITE_PERIOD = 4;
+
+/**
+ * Number of README-shaped groups in the schema loading benchmark.
+ */
+constexpr size_t SCHEMA_GROUP_COUNT = 20000;
+
+/**
+ * Bytes currently allocated through operator new.
+ */
+std::atomic<size_t> allocated_bytes {0};
+} /* namespace */
+
+// Count allocated bytes so that the memory used by each store can be reported.
+// The size is stored in front of each allocation so that it can be subtracted
+// on delete.
+void* operator new(const size_t size)
+{
+    void* const block = std::malloc(size + alignof(std::max_align_t));
+    if (!block) {
+        throw std::bad_alloc();
+    }
+    *static_cast<size_t*>(block) = size;
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    return (static_cast<uint8_t*>(block) + alignof(std::max_align_t));
+}
+
+void operator delete(void* const ptr) noexcept
+{
+    if (!ptr) {
+        return;
+    }
+    void* const block =
+        (static_cast<uint8_t*>(ptr) - alignof(std::max_align_t));
+    allocated_bytes.fetch_sub(*static_cast<size_t*>(block),
+                              std::memory_order_relaxed);
+    std::free(block);
+}
+
+void operator delete(void* const ptr, const size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+namespace {
+/**
+ * Fast per-thread random number generator (xorshift64).
+ */
+class Rng final {
+public:
+    explicit Rng(const uint64_t seed)
+        : state(seed | 1)
+    {
+    }
+
+    uint64_t next()
+    {
+        state ^= (state << 13);
+        state ^= (state >> 7);
+        state ^= (state << 17);
+        return state;
+    }
+
+private:
+    uint64_t state;
+};
+
+/**
+ * A store under test.
+ */
+class Store {
+public:
+    virtual ~Store() = default;
+
+    /**
+     * Runs one operation.
+     *
+     * @param read_group  Group to read.
+     * @param write_group Group to write, owned by the calling thread.
+     * @param op          Operation number within the calling thread.
+     */
+    virtual void op(const size_t read_group,
+                    const size_t write_group,
+                    const uint64_t op) = 0;
+};
+
+/**
+ * Plain structs with a mutex per group.
+ */
+class StructStore final : public Store {
+public:
+    StructStore()
+        : groups(GROUP_COUNT)
+    {
+    }
+
+    void op(const size_t read_group,
+            const size_t write_group,
+            const uint64_t op) override
+    {
+        Group& read = groups[read_group];
+        double pressure = 0.0;
+        bool valid = false;
+        {
+            std::lock_guard<std::mutex> lock(read.mutex);
+            pressure = read.pressure;
+        }
+        {
+            std::lock_guard<std::mutex> lock(read.mutex);
+            valid = read.pressure_valid;
+        }
+
+        Group& write = groups[write_group];
+        {
+            std::lock_guard<std::mutex> lock(write.mutex);
+            write.valve_open = ((pressure > 14.7) || !valid);
+        }
+        if ((op % SLOW_WRITE_PERIOD) == 0) {
+            {
+                std::lock_guard<std::mutex> lock(write.mutex);
+                write.time = op;
+            }
+            {
+                std::lock_guard<std::mutex> lock(write.mutex);
+                write.pressure = (14.0 + (op % 2));
+            }
+        }
+    }
+
+private:
+    struct Group final {
+        std::mutex mutex;
+        uint64_t time = 0;
+        bool abort = false;
+        double pressure = 14.7;
+        bool pressure_valid = true;
+        bool valve_open = false;
+    };
+
+    std::vector<Group> groups;
+};
+
+/**
+ * A map from channel path to value, with a single mutex.
+ */
+class MapStore final : public Store {
+public:
+    MapStore()
+        : map()
+        , keys(GROUP_COUNT)
+        , mutex()
+    {
+        for (size_t i = 0; i < GROUP_COUNT; ++i) {
+            const std::string prefix = ("g" + std::to_string(i) + ".");
+            Keys& group_keys = keys[i];
+            group_keys.time = (prefix + "system.time");
+            group_keys.abort = (prefix + "system.abort");
+            group_keys.pressure = (prefix + "control.pressure");
+            group_keys.pressure_valid = (prefix + "control.pressure.valid");
+            group_keys.valve_open = (prefix + "control.valve_open");
+
+            map[group_keys.time] = uint64_t(0);
+            map[group_keys.abort] = false;
+            map[group_keys.pressure] = 14.7;
+            map[group_keys.pressure_valid] = true;
+            map[group_keys.valve_open] = false;
+        }
+    }
+
+    void op(const size_t read_group,
+            const size_t write_group,
+            const uint64_t op) override
+    {
+        const Keys& read = keys[read_group];
+        double pressure = 0.0;
+        bool valid = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pressure = std::any_cast<double>(map.at(read.pressure));
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            valid = std::any_cast<bool>(map.at(read.pressure_valid));
+        }
+
+        const Keys& write = keys[write_group];
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            map.at(write.valve_open) = ((pressure > 14.7) || !valid);
+        }
+        if ((op % SLOW_WRITE_PERIOD) == 0) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                map.at(write.time) = op;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                map.at(write.pressure) = (14.0 + (op % 2));
+            }
+        }
+    }
+
+private:
+    struct Keys final {
+        std::string time;
+        std::string abort;
+        std::string pressure;
+        std::string pressure_valid;
+        std::string valve_open;
+    };
+
+    std::unordered_map<std::string, std::any> map;
+    std::vector<Keys> keys;
+    std::mutex mutex;
+};
+
+/**
+ * Spin lock, used for rivulets with a single writer.
+ */
+class SpinLock final : public Lock {
+public:
+    void acquire() override
+    {
+        while (locked.exchange(true, std::memory_order_acquire)) {
+            while (locked.load(std::memory_order_relaxed)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    void release() override
+    {
+        locked.store(false, std::memory_order_release);
+    }
+
+private:
+    std::atomic<bool> locked {false};
+};
+
+/**
+ * Mutex, used for rivulets with multiple writers.
+ */
+class MutexLock final : public Lock {
+public:
+    void acquire() override
+    {
+        mutex.lock();
+    }
+
+    void release() override
+    {
+        mutex.unlock();
+    }
+
+private:
+    std::mutex mutex;
+};
+
+/**
+ * River with each group locked according to a lock kind, optionally with
+ * checksums.
+ */
+class RiverStore final : public Store {
+public:
+    explicit RiverStore(const LockKind kind, const bool checksums = false)
+        : groups(GROUP_COUNT)
+    {
+        Builder builder;
+        for (size_t i = 0; i < GROUP_COUNT; ++i) {
+            const std::string prefix = ("g" + std::to_string(i));
+            Group& group = groups[i];
+            builder.channel(prefix + ".system.time", uint64_t(0), group.time);
+            builder.channel(prefix + ".system.abort", false, group.abort);
+            builder.channel(prefix + ".control.pressure", 14.7, group.pressure);
+            builder.channel(prefix + ".control.pressure.valid",
+                            true,
+                            group.pressure_valid);
+            builder.channel(prefix + ".control.valve_open",
+                            false,
+                            group.valve_open);
+
+            if (kind == LockKind::SINGLE_WRITER) {
+                builder.lock(prefix, std::shared_ptr<Lock>(new SpinLock));
+            } else if (kind == LockKind::MULTI_WRITER) {
+                builder.lock(prefix, std::shared_ptr<Lock>(new MutexLock));
+            }
+        }
+        Builder::Options options;
+        options.checksums = checksums;
+        builder.build(options, nullptr);
+    }
+
+    void op(const size_t read_group,
+            const size_t write_group,
+            const uint64_t op) override
+    {
+        const Group& read = groups[read_group];
+        const double pressure = read.pressure.get();
+        const bool valid = read.pressure_valid.get();
+
+        Group& write = groups[write_group];
+        write.valve_open.set((pressure > 14.7) || !valid);
+        if ((op % SLOW_WRITE_PERIOD) == 0) {
+            write.time.set(op);
+            write.pressure.set(14.0 + (op % 2));
+        }
+    }
+
+private:
+    struct Group final {
+        Channel<uint64_t> time;
+        Channel<bool> abort;
+        Channel<double> pressure;
+        Channel<bool> pressure_valid;
+        Channel<bool> valve_open;
+    };
+
+    std::vector<Group> groups;
+};
+
+/**
+ * Results of running the workload on a store.
+ */
+struct Result final {
+    double ops_per_second;
+    double p99_ns;
+
+    /**
+     * Performance counter values per operation, if counted.
+     */
+    double counters_per_op[PerfCounters::COUNTER_COUNT];
+};
+
+/**
+ * Runs operations on a store from the calling thread.
+ *
+ * @param store          Store to run on.
+ * @param thread         Thread index.
+ * @param thread_count   Number of threads.
+ * @param ops_per_thread Number of operations to run.
+ * @param start          Flag to wait for before starting.
+ * @param latencies      If not null, the latency of each operation is
+ *                       written here, in nanoseconds.
+ */
+void run_thread(Store& store,
+                const size_t thread,
+                const size_t thread_count,
+                const size_t ops_per_thread,
+                const std::atomic<bool>& start,
+                uint32_t* const latencies)
+{
+    Rng rng(0x9E3779B97F4A7C15ull * (thread + 1));
+    const size_t owned_count =
+        ((GROUP_COUNT - thread + thread_count - 1) / thread_count);
+
+    while (!start.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+
+    for (size_t i = 0; i < ops_per_thread; ++i) {
+        const size_t read_group = (rng.next() % GROUP_COUNT);
+        const size_t write_group =
+            (thread + ((rng.next() % owned_count) * thread_count));
+
+        if (!latencies) {
+            store.op(read_group, write_group, i);
+            continue;
+        }
+
+        const auto begin = std::chrono::steady_clock::now();
+        store.op(read_group, write_group, i);
+        const auto end = std::chrono::steady_clock::now();
+
+        latencies[i] = static_cast<uint32_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin)
+                .count());
+    }
+}
+
+/**
+ * Runs the workload on a store with performance counters enabled.
+ *
+ * @param      store           Store to run on.
+ * @param      thread_count    Number of threads.
+ * @param      ops_per_thread  Number of operations per thread.
+ * @param[out] counters_per_op Counter values per operation.
+ */
+void count(Store& store,
+           const size_t thread_count,
+           const size_t ops_per_thread,
+           double counters_per_op[PerfCounters::COUNTER_COUNT])
+{
+    uint64_t totals[PerfCounters::COUNTER_COUNT] = {};
+    std::mutex totals_mutex;
+
+    std::atomic<bool> start {false};
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&, t]() {
+            // Counters only count the thread that opened them. Start them once
+            // every thread is ready, so that waiting isn't counted.
+            PerfCounters counters;
+            uint64_t values[PerfCounters::COUNTER_COUNT];
+            while (!start.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            counters.start();
+            run_thread(store, t, thread_count, ops_per_thread, start, nullptr);
+            counters.stop(values);
+
+            std::lock_guard<std::mutex> lock(totals_mutex);
+            for (size_t i = 0; i < PerfCounters::COUNTER_COUNT; ++i) {
+                totals[i] += values[i];
+            }
+        });
+    }
+
+    start.store(true, std::memory_order_release);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    for (size_t i = 0; i < PerfCounters::COUNTER_COUNT; ++i) {
+        counters_per_op[i] =
+            (static_cast<double>(totals[i]) / (thread_count * ops_per_thread));
+    }
+}
+
+/**
+ * Runs the workload on a store.
+ *
+ * @param store          Store to run on.
+ * @param thread_count   Number of threads.
+ * @param ops_per_thread Number of operations per thread.
+ *
+ * @returns Results.
+ */
+Result run(Store& store, const size_t thread_count, const size_t ops_per_thread)
+{
+    std::vector<std::vector<uint32_t>> latencies(thread_count);
+    for (std::vector<uint32_t>& thread_latencies : latencies) {
+        thread_latencies.resize(ops_per_thread);
+    }
+
+    // Start all threads at once, so that they contend for the whole run.
+    std::atomic<bool> start {false};
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < thread_count; ++t) {
+        threads.emplace_back(run_thread,
+                             std::ref(store),
+                             t,
+                             thread_count,
+                             ops_per_thread,
+                             std::cref(start),
+                             latencies[t].data());
+    }
+
+    const auto begin = std::chrono::steady_clock::now();
+    start.store(true, std::memory_order_release);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    const auto end = std::chrono::steady_clock::now();
+
+    // Merge the per-thread latencies to find the 99th percentile.
+    std::vector<uint32_t> all_latencies;
+    all_latencies.reserve(thread_count * ops_per_thread);
+    for (const std::vector<uint32_t>& thread_latencies : latencies) {
+        all_latencies.insert(all_latencies.end(),
+                             thread_latencies.begin(),
+                             thread_latencies.end());
+    }
+    const size_t p99_index = ((all_latencies.size() * 99) / 100);
+    std::nth_element(all_latencies.begin(),
+                     all_latencies.begin() + p99_index,
+                     all_latencies.end());
+
+    const double seconds = std::chrono::duration<double>(end - begin).count();
+    return {
+        .ops_per_second = ((thread_count * ops_per_thread) / seconds),
+        .p99_ns = static_cast<double>(all_latencies[p99_index]),
+        .counters_per_op = {},
+    };
+}
+
+/**
+ * Builds a store, runs the workload on it, and prints a row of results.
+ *
+ * @param name           Store name.
+ * @param make_store     Function that builds the store.
+ * @param thread_count   Number of threads.
+ * @param ops_per_thread Number of operations per thread.
+ * @param perf           Whether to also count performance events.
+ *
+ * @returns Results.
+ */
+Result bench(const char* const name,
+             const std::function<Store*()> make_store,
+             const size_t thread_count,
+             const size_t ops_per_thread,
+             const bool perf)
+{
+    const size_t bytes_before = allocated_bytes.load();
+    std::unique_ptr<Store> store(make_store());
+    const size_t bytes = (allocated_bytes.load() - bytes_before);
+
+    Result result = run(*store, thread_count, ops_per_thread);
+    std::printf("%-20s %8zu %14.0f %10.0f %12zu\n",
+                name,
+                thread_count,
+                result.ops_per_second,
+                result.p99_ns,
+                bytes);
+
+    if (perf) {
+        count(*store, thread_count, ops_per_thread, result.counters_per_op);
+    }
+
+    return result;
+}
+
+/**
+ * Times loading a schema and building the river, and prints the results.
+ */
+void bench_schema()
+{
+    std::stringstream schema;
+    for (size_t i = 0; i < SCHEMA_GROUP_COUNT; ++i) {
+        schema << "uint64 group" << i << ".system.time\n"
+               << "double group" << i << ".control.pressure 14.7\n"
+               << "bool group" << i << ".control.pressure.valid true\n"
+               << "bool group" << i << ".control.valve_open\n"
+               << "lock group" << i << ".control single_writer\n"
+               << "float[4] group" << i << ".local 0\n";
+    }
+    const auto make_lock = [](const LockKind) -> std::shared_ptr<Lock> {
+        return std::make_shared<MutexLock>();
+    };
+
+    const auto begin = std::chrono::steady_clock::now();
+    Builder builder;
+    if (builder.load_schema(schema, make_lock) != 0) {
+        std::fprintf(stderr, "failed to load schema\n");
+        return;
+    }
+    const auto loaded = std::chrono::steady_clock::now();
+    if (builder.build() != 0) {
+        std::fprintf(stderr, "failed to build schema\n");
+        return;
+    }
+    const auto built = std::chrono::steady_clock::now();
+
+    std::printf("\nschema: %zu channels loaded in %.1f ms, built in %.1f ms\n",
+                SCHEMA_GROUP_COUNT * 5,
+                std::chrono::duration<double, std::milli>(loaded - begin)
+                    .count(),
+                std::chrono::duration<double, std::milli>(built - loaded)
+                    .count());
+}
+} /* namespace */
+
+int main(int argc, char** argv)
+{
+    // Parse arguments.
+    bool perf = false;
+    std::vector<size_t> positional;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--perf") == 0) {
+            perf = true;
+            continue;
+        }
+        positional.push_back(std::strtoul(argv[i], nullptr, 10));
+    }
+    const size_t hardware_threads =
+        std::max<size_t>(1, std::thread::hardware_concurrency());
+    const size_t max_threads =
+        ((positional.size() > 0) ? positional[0] : hardware_threads);
+    const size_t ops_per_thread =
+        ((positional.size() > 1) ? positional[1] : 1000000);
+    if ((max_threads == 0) || (ops_per_thread == 0)
+        || (positional.size() > 2)) {
+        std::fprintf(stderr,
+                     "usage: %s [--perf] [threads] [ops_per_thread]\n",
+                     argv[0]);
+        return 1;
+    }
+
+    // Fall back to timing only if no counters are available.
+    const PerfCounters probe;
+    if (perf && !probe.error().empty()) {
+        std::printf("performance counters unavailable: %s\n\n",
+                    probe.error().c_str());
+        perf = false;
+    }
+
+    std::printf("%zu channels, %zu ops per thread\n\n",
+                GROUP_COUNT * 5,
+                ops_per_thread);
+    std::printf("%-20s %8s %14s %10s %12s\n",
+                "store",
+                "threads",
+                "ops/s",
+                "p99 (ns)",
+                "memory (B)");
+
+    std::vector<size_t> thread_counts = {1};
+    if (max_threads > 1) {
+        thread_counts.push_back(max_threads);
+    }
+
+    std::vector<std::pair<std::string, size_t>> names;
+    std::vector<Result> results;
+    const auto add = [&](const std::string& name,
+                         const std::function<Store*()> make_store,
+                         const size_t thread_count) {
+        names.emplace_back(name, thread_count);
+        results.push_back(bench(name.c_str(),
+                                make_store,
+                                thread_count,
+                                ops_per_thread,
+                                perf));
+    };
+    for (const size_t thread_count : thread_counts) {
+        add("struct", []() -> Store* { return new StructStore; }, thread_count);
+        add("map", []() -> Store* { return new MapStore; }, thread_count);
+        for (size_t kind = 0; kind < std::size(LOCK_KIND_NAMES); ++kind) {
+            add(std::string("river/") + LOCK_KIND_NAMES[kind],
+                [kind]() -> Store* {
+                    return new RiverStore(static_cast<LockKind>(kind));
+                },
+                thread_count);
+        }
+        add("river/checksums",
+            []() -> Store* {
+                return new RiverStore(LockKind::SINGLE_WRITER, true);
+            },
+            thread_count);
+    }
+
+    bench_schema();
+
+    if (!perf) {
+        return 0;
+    }
+
+    // Print counts per operation, marking counters the CPU doesn't support.
+    std::printf("\n%-20s %8s", "per op", "threads");
+    for (const char* const counter_name : PerfCounters::NAMES) {
+        std::printf(" %14s", counter_name);
+    }
+    std::printf("\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        std::printf("%-20s %8zu", names[i].first.c_str(), names[i].second);
+        for (size_t j = 0; j < PerfCounters::COUNTER_COUNT; ++j) {
+            if (probe.available(static_cast<PerfCounters::Counter>(j))) {
+                std::printf(" %14.2f", results[i].counters_per_op[j]);
+            } else {
+                std::printf(" %14s", "n/a");
+            }
+        }
+        std::printf("\n");
+    }
+
+    return 0;
+}
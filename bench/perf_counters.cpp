@@ -0,0 +1,155 @@
+#include <cerrno>
+#include <cstring>
+
+#include "perf_counters.hpp"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+namespace {
+/**
+ * Opens a counter for the calling thread on any CPU.
+ *
+ * @param type   Event type.
+ * @param config Event config.
+ * @param leader Group leader, or -1 to lead a new group.
+ *
+ * @returns File descriptor, or -1 on failure.
+ */
+int open_counter(const uint32_t type, const uint64_t config, const int leader)
+{
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.read_format = (PERF_FORMAT_GROUP | PERF_FORMAT_ID);
+    attr.disabled = (leader == -1);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return static_cast<int>(syscall(SYS_perf_event_open,
+                                    &attr,
+                                    /* pid= */ 0,
+                                    /* cpu= */ -1,
+                                    leader,
+                                    /* flags= */ 0));
+}
+} /* namespace */
+#endif
+
+PerfCounters::PerfCounters()
+    : fds()
+    , leader(-1)
+    , error_message()
+{
+    for (int& fd : fds) {
+        fd = -1;
+    }
+
+#ifdef __linux__
+    static constexpr struct {
+        uint32_t type;
+        uint64_t config;
+    } events[COUNTER_COUNT] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE,
+         PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+             | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    };
+
+    int first_errno = 0;
+    for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+        fds[i] = open_counter(events[i].type, events[i].config, leader);
+        if (fds[i] == -1) {
+            first_errno = (first_errno ? first_errno : errno);
+            continue;
+        }
+        if (leader == -1) {
+            leader = fds[i];
+        }
+    }
+
+    if (leader == -1) {
+        error_message = (std::string("perf_event_open failed: ")
+                         + std::strerror(first_errno));
+    }
+#else
+    error_message = "performance counters are only supported on Linux";
+#endif
+}
+
+PerfCounters::~PerfCounters()
+{
+#ifdef __linux__
+    for (const int fd : fds) {
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+#endif
+}
+
+bool PerfCounters::available(const Counter counter) const
+{
+    return (fds[counter] != -1);
+}
+
+const std::string& PerfCounters::error() const
+{
+    return error_message;
+}
+
+void PerfCounters::start()
+{
+#ifdef __linux__
+    if (leader != -1) {
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+}
+
+void PerfCounters::stop(uint64_t values[COUNTER_COUNT])
+{
+    for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+        values[i] = 0;
+    }
+
+#ifdef __linux__
+    if (leader == -1) {
+        return;
+    }
+    ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    // With PERF_FORMAT_GROUP | PERF_FORMAT_ID, a read returns the number of
+    // counters followed by a (value, id) pair for each.
+    uint64_t buffer[1 + (2 * COUNTER_COUNT)];
+    if (read(leader, buffer, sizeof(buffer)) < static_cast<ssize_t>(8)) {
+        return;
+    }
+
+    // Match values to counters by ID.
+    const uint64_t count = buffer[0];
+    for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+        uint64_t id = 0;
+        if ((fds[i] == -1) || (ioctl(fds[i], PERF_EVENT_IOC_ID, &id) != 0)) {
+            continue;
+        }
+        for (uint64_t j = 0; j < count; ++j) {
+            if (buffer[2 + (2 * j)] == id) {
+                values[i] = buffer[1 + (2 * j)];
+                break;
+            }
+        }
+    }
+#endif
+}
@@ -0,0 +1,102 @@
+#ifndef RIVER_BENCH_PERF_COUNTERS_HPP
+#define RIVER_BENCH_PERF_COUNTERS_HPP
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Hardware performance counters for the calling thread, read with Linux
+ * `perf_event_open`.
+ *
+ * Counters that the kernel or CPU doesn't support (e.g., in a VM, or when
+ * `perf_event_paranoid` forbids them) are reported as unavailable rather than
+ * failing, and on other platforms no counters are available.
+ */
+class PerfCounters final {
+public:
+    /**
+     * Counted events.
+     */
+    enum Counter : uint8_t {
+        CYCLES = 0,
+        INSTRUCTIONS = 1,
+        L1D_MISSES = 2,
+        LLC_MISSES = 3,
+        BRANCH_MISSES = 4,
+        COUNTER_COUNT = 5,
+    };
+
+    /**
+     * Short names of the counters, indexed by Counter.
+     */
+    static constexpr const char* NAMES[COUNTER_COUNT] = {
+        "cycles",
+        "instructions",
+        "L1d misses",
+        "LLC misses",
+        "branch misses",
+    };
+
+    /**
+     * Constructor. Opens the counters for the calling thread, stopped and
+     * zeroed.
+     */
+    PerfCounters();
+
+    /**
+     * Destructor. Closes the counters.
+     */
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    /**
+     * Gets whether a counter is available.
+     *
+     * @param counter Counter.
+     *
+     * @returns Whether the counter is available.
+     */
+    bool available(const Counter counter) const;
+
+    /**
+     * Gets why no counters are available, if that's the case.
+     *
+     * @returns Reason, or empty if at least one counter is available.
+     */
+    const std::string& error() const;
+
+    /**
+     * Resets and starts all counters.
+     */
+    void start();
+
+    /**
+     * Stops all counters and reads their values.
+     *
+     * @param[out] values Counter values, indexed by Counter. Unavailable
+     *                    counters read as 0.
+     */
+    void stop(uint64_t values[COUNTER_COUNT]);
+
+private:
+    /**
+     * File descriptor of each counter, or -1 if unavailable. The first
+     * available counter leads the group, so that all counters cover the same
+     * interval.
+     */
+    int fds[COUNTER_COUNT];
+
+    /**
+     * File descriptor of the group leader, or -1 if no counters are available.
+     */
+    int leader;
+
+    /**
+     * Why no counters are available.
+     */
+    std::string error_message;
+};
+
+#endif
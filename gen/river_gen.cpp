@@ -0,0 +1,368 @@
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <river>
+
+using namespace river;
+
+/**
+ * Generator of C++ headers with direct accessors for rivers built from a
+ * schema.
+ *
+ * The generator loads the schema with Builder::load_schema() and builds the
+ * river the same way a program would at runtime, then emits a struct with
+ * the offset and size of every channel as constants, a getter, a setter, and
+ * a pointer accessor per channel, and the layout hash of the river. Binding
+ * the struct to a river built at runtime checks the layout hash, so that
+ * hot loops can load and store channels directly while the river stays
+ * usable through the dynamic handles.
+ *
+ * Usage: river_gen [--optimize-layout] <schema> <struct> <header>
+ */
+
+namespace {
+/**
+ * Lock that does nothing. Locks don't affect the layout, so the generator
+ * only needs a placeholder for each lock in the schema.
+ */
+class NullLock final : public Lock {
+public:
+    void acquire() noexcept override
+    {
+    }
+
+    void release() noexcept override
+    {
+    }
+};
+
+/**
+ * A channel in the generated struct.
+ */
+struct Accessor final {
+    /**
+     * Channel path.
+     */
+    std::string path;
+
+    /**
+     * Accessor name, e.g., `control_pressure` for `control.pressure`.
+     */
+    std::string name;
+
+    /**
+     * C++ type of the channel, or empty for flags.
+     */
+    std::string type;
+
+    /**
+     * Offset of the channel in the river memory in bytes.
+     */
+    size_t offset = 0;
+
+    /**
+     * Size of the channel in bytes.
+     */
+    size_t size = 0;
+};
+
+/**
+ * A C++ type of channel elements.
+ */
+struct ElementType final {
+    /**
+     * Type name.
+     */
+    const char* name;
+
+    /**
+     * Size in bytes.
+     */
+    size_t size;
+};
+
+/**
+ * C++ types of the element types in exported layouts. Channels without an
+ * element type, which in schemas are flags, only get pointer accessors.
+ */
+const std::map<std::string, ElementType> ELEMENT_TYPES = {
+    {"bool", {"bool", sizeof(bool)}},
+    {"int8", {"int8_t", sizeof(int8_t)}},
+    {"uint8", {"uint8_t", sizeof(uint8_t)}},
+    {"int16", {"int16_t", sizeof(int16_t)}},
+    {"uint16", {"uint16_t", sizeof(uint16_t)}},
+    {"int32", {"int32_t", sizeof(int32_t)}},
+    {"uint32", {"uint32_t", sizeof(uint32_t)}},
+    {"int64", {"int64_t", sizeof(int64_t)}},
+    {"uint64", {"uint64_t", sizeof(uint64_t)}},
+    {"float", {"float", sizeof(float)}},
+    {"double", {"double", sizeof(double)}},
+};
+
+/**
+ * Converts a channel path to an accessor name.
+ *
+ * @param path Channel path.
+ *
+ * @returns Accessor name, or empty if the path can't be an identifier.
+ */
+std::string accessor_name(const std::string& path)
+{
+    if (std::isdigit(static_cast<unsigned char>(path[0]))) {
+        return "";
+    }
+    std::string name = path;
+    for (char& c : name) {
+        if (c == '.') {
+            c = '_';
+        }
+    }
+    return name;
+}
+
+/**
+ * Converts an accessor name to a constant name.
+ *
+ * @param name Accessor name.
+ *
+ * @returns Constant name.
+ */
+std::string constant_name(const std::string& name)
+{
+    std::string constant = name;
+    for (char& c : constant) {
+        c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    }
+    return constant;
+}
+
+/**
+ * Writes the generated header.
+ *
+ * @param os          Output stream.
+ * @param schema_path Path of the schema file, for the header comment.
+ * @param name        Struct name.
+ * @param hash        Layout hash.
+ * @param accessors   Channel accessors.
+ */
+void write_header(std::ostream& os,
+                  const std::string& schema_path,
+                  const std::string& name,
+                  const uint64_t hash,
+                  const std::vector<Accessor>& accessors)
+{
+    const std::string guard = ("RIVER_GEN_" + constant_name(name) + "_HPP");
+    char hash_text[32];
+    std::snprintf(hash_text,
+                  sizeof(hash_text),
+                  "0x%016llxull",
+                  static_cast<unsigned long long>(hash));
+
+    os << "// Generated by river_gen from " << schema_path
+       << ". Do not edit.\n"
+       << "\n"
+       << "#ifndef " << guard << "\n"
+       << "#define " << guard << "\n"
+       << "\n"
+       << "#include <array>\n"
+       << "#include <cstddef>\n"
+       << "#include <cstdint>\n"
+       << "#include <cstring>\n"
+       << "\n"
+       << "#include <river>\n"
+       << "\n"
+       << "/**\n"
+       << " * Direct accessors for rivers built from " << schema_path << ".\n"
+       << " *\n"
+       << " * Accessors load and store river memory directly, bypassing locks\n"
+       << " * and instrumentation, so callers must synchronize themselves.\n"
+       << " *\n"
+       << " * @see river::River::direct_memory()\n"
+       << " */\n"
+       << "struct " << name << " final {\n"
+       << "    /**\n"
+       << "     * Layout hash of the river, as returned by\n"
+       << "     * river::River::layout_hash().\n"
+       << "     */\n"
+       << "    static constexpr uint64_t LAYOUT_HASH = " << hash_text << ";\n";
+
+    for (const Accessor& accessor : accessors) {
+        const std::string constant = constant_name(accessor.name);
+        os << "\n"
+           << "    /**\n"
+           << "     * Offset and size of `" << accessor.path << "` in bytes.\n"
+           << "     * @{\n"
+           << "     */\n"
+           << "    static constexpr size_t " << constant
+           << "_OFFSET = " << accessor.offset << ";\n"
+           << "    static constexpr size_t " << constant
+           << "_SIZE = " << accessor.size << ";\n"
+           << "    /**\n"
+           << "     * @}\n"
+           << "     */\n";
+    }
+
+    os << "\n"
+       << "    /**\n"
+       << "     * River memory, or null if not bound.\n"
+       << "     */\n"
+       << "    uint8_t* memory = nullptr;\n"
+       << "\n"
+       << "    /**\n"
+       << "     * Binds the accessors to a river.\n"
+       << "     *\n"
+       << "     * @param river River built from the schema.\n"
+       << "     *\n"
+       << "     * @returns Whether the river has the generated layout and can\n"
+       << "     *          be accessed directly, i.e., isn't in frame mode and\n"
+       << "     *          has no checksums, redundancy, or versions.\n"
+       << "     */\n"
+       << "    bool bind(river::River& river)\n"
+       << "    {\n"
+       << "        memory = ((river.layout_hash() == LAYOUT_HASH)\n"
+       << "                      ? river.direct_memory()\n"
+       << "                      : nullptr);\n"
+       << "        return (memory != nullptr);\n"
+       << "    }\n";
+
+    // Channels are packed, so values are copied rather than dereferenced,
+    // which compiles to plain loads and stores.
+    for (const Accessor& accessor : accessors) {
+        const std::string offset = (constant_name(accessor.name) + "_OFFSET");
+        os << "\n"
+           << "    /**\n"
+           << "     * `" << accessor.path << "`.\n"
+           << "     * @{\n"
+           << "     */\n"
+           << "    uint8_t* " << accessor.name << "_ptr() const\n"
+           << "    {\n"
+           << "        return (memory + " << offset << ");\n"
+           << "    }\n";
+        if (!accessor.type.empty()) {
+            os << "\n"
+               << "    " << accessor.type << " " << accessor.name
+               << "() const\n"
+               << "    {\n"
+               << "        " << accessor.type << " value;\n"
+               << "        std::memcpy(&value, memory + " << offset
+               << ", sizeof(value));\n"
+               << "        return value;\n"
+               << "    }\n"
+               << "\n"
+               << "    void set_" << accessor.name << "(const "
+               << accessor.type << "& value)\n"
+               << "    {\n"
+               << "        std::memcpy(memory + " << offset
+               << ", &value, sizeof(value));\n"
+               << "    }\n";
+        }
+        os << "\n"
+           << "    /**\n"
+           << "     * @}\n"
+           << "     */\n";
+    }
+
+    os << "};\n"
+       << "\n"
+       << "#endif\n";
+}
+} /* namespace */
+
+int main(int argc, char** argv)
+{
+    // Parse arguments.
+    bool optimize_layout = false;
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--optimize-layout") == 0) {
+            optimize_layout = true;
+            continue;
+        }
+        positional.push_back(argv[i]);
+    }
+    if (positional.size() != 3) {
+        std::fprintf(stderr,
+                     "usage: %s [--optimize-layout] <schema> <struct> "
+                     "<header>\n",
+                     argv[0]);
+        return 1;
+    }
+    const std::string& schema_path = positional[0];
+    const std::string& name = positional[1];
+    const std::string& header_path = positional[2];
+
+    // Build the river exactly as at runtime.
+    std::ifstream schema(schema_path);
+    if (!schema) {
+        std::fprintf(stderr, "failed to open %s\n", schema_path.c_str());
+        return 1;
+    }
+    Builder builder;
+    const int32_t load_ret = builder.load_schema(
+        schema,
+        [](const LockKind) { return std::make_shared<NullLock>(); });
+    if (load_ret != 0) {
+        std::fprintf(stderr,
+                     "failed to load %s: error %d\n",
+                     schema_path.c_str(),
+                     load_ret);
+        return 1;
+    }
+    Builder::Options options;
+    options.optimize_layout = optimize_layout;
+    std::shared_ptr<River> river;
+    const int32_t build_ret = builder.build(options, &river);
+    if (build_ret != 0) {
+        std::fprintf(stderr, "failed to build river: error %d\n", build_ret);
+        return 1;
+    }
+
+    // Take each channel's type from the built river, so that the accessors
+    // can't disagree with the runtime handles.
+    std::stringstream layout;
+    river->export_layout(layout);
+    std::vector<Accessor> accessors;
+    std::set<std::string> names;
+    Accessor accessor;
+    std::string element_type;
+    while (layout >> accessor.path >> accessor.offset >> accessor.size
+           >> element_type) {
+        accessor.name = accessor_name(accessor.path);
+        if (accessor.name.empty() || !names.insert(accessor.name).second) {
+            std::fprintf(stderr,
+                         "%s has no unique accessor name\n",
+                         accessor.path.c_str());
+            return 1;
+        }
+
+        // Channels of more than one element are arrays.
+        accessor.type.clear();
+        const auto type_it = ELEMENT_TYPES.find(element_type);
+        if (type_it != ELEMENT_TYPES.end()) {
+            const ElementType& type = type_it->second;
+            accessor.type = type.name;
+            if (accessor.size != type.size) {
+                accessor.type = ("std::array<" + accessor.type + ", "
+                                 + std::to_string(accessor.size / type.size)
+                                 + ">");
+            }
+        }
+        accessors.push_back(accessor);
+    }
+
+    std::ofstream header(header_path);
+    write_header(header, schema_path, name, river->layout_hash(), accessors);
+    if (!header) {
+        std::fprintf(stderr, "failed to write %s\n", header_path.c_str());
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,17 +1,142 @@
+#include <algorithm>
 #include <cassert>
 #include <cctype>
+#include <charconv>
 #include <cstring>
 #include <sstream>
+#include <utility>
 
 #include "builder.hpp"
 
 namespace river {
+namespace {
+/**
+ * Looks up a lock kind by name.
+ *
+ * @param      name Lock kind name.
+ * @param[out] kind On success, lock kind.
+ *
+ * @returns Whether the name is a lock kind.
+ */
+bool parse_lock_kind(const std::string_view name, LockKind& kind)
+{
+    const auto name_it = std::find(std::begin(LOCK_KIND_NAMES),
+                                   std::end(LOCK_KIND_NAMES),
+                                   name);
+    if (name_it == std::end(LOCK_KIND_NAMES)) {
+        return false;
+    }
+    kind = static_cast<LockKind>(name_it - std::begin(LOCK_KIND_NAMES));
+    return true;
+}
+
+/**
+ * Parses a schema value.
+ *
+ * @tparam T Value type.
+ *
+ * @param      field Value field.
+ * @param[out] value On success, value.
+ *
+ * @returns Whether the whole field is a valid value.
+ */
+template <typename T>
+bool parse_schema_value(const std::string_view field, T& value)
+{
+    const char* const end = (field.data() + field.size());
+    const std::from_chars_result result =
+        std::from_chars(field.data(), end, value);
+    return ((result.ec == std::errc()) && (result.ptr == end));
+}
+
+template <>
+bool parse_schema_value<bool>(const std::string_view field, bool& value)
+{
+    if ((field == "true") || (field == "1")) {
+        value = true;
+        return true;
+    }
+    if ((field == "false") || (field == "0")) {
+        value = false;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Splits a schema line into whitespace-separated fields, ignoring text
+ * following a `#`.
+ *
+ * @param      line   Line.
+ * @param[out] fields Fields, which point into the line.
+ */
+void split_schema_line(const std::string_view line,
+                       std::vector<std::string_view>& fields)
+{
+    fields.clear();
+    size_t pos = 0;
+    while (pos < line.size()) {
+        if (line[pos] == '#') {
+            return;
+        }
+        if (std::isspace(static_cast<unsigned char>(line[pos]))) {
+            ++pos;
+            continue;
+        }
+        const size_t begin = pos;
+        while ((pos < line.size()) && (line[pos] != '#')
+               && !std::isspace(static_cast<unsigned char>(line[pos]))) {
+            ++pos;
+        }
+        fields.push_back(line.substr(begin, pos - begin));
+    }
+}
+} /* namespace */
+
 Builder::Builder()
     : root(new Node)
     , is_root(true)
 {
 }
 
+int32_t Builder::flags(const std::string& path,
+                       const size_t count,
+                       Flags& flags)
+{
+    if (count == 0) {
+        return ERR_INVALID;
+    }
+
+    const int32_t add_ret =
+        add_channel(path, std::make_shared<FlagsInfo>(count), &flags.link);
+    if (add_ret != 0) {
+        return add_ret;
+    }
+    flags.flag_count = count;
+
+    return 0;
+}
+
+int32_t Builder::flags(const std::string& path, Flags& flags)
+{
+    std::shared_ptr<Node> channel_node;
+    std::shared_ptr<Link> link;
+    const int32_t find_ret = find_channel(path, channel_node, link);
+    if (find_ret != 0) {
+        return find_ret;
+    }
+
+    const FlagsInfo* const info =
+        dynamic_cast<const FlagsInfo*>(channel_node->channel_info.get());
+    if (!info) {
+        return ERR_INVALID;
+    }
+
+    flags.link = link;
+    flags.flag_count = info->count;
+    return 0;
+}
+
 int32_t Builder::rivulet(const std::string& path, Rivulet& rivulet)
 {
     // Tokenize the path.
@@ -69,10 +194,9 @@ int32_t Builder::lock(const std::string& path,
 
     // Check that no node in this subtree already has a lock.
     static const auto check_for_locks =
-        [](const std::shared_ptr<Node> node) -> int32_t {
+        [](const std::shared_ptr<Node>& node) -> int32_t {
         assert(node);
-        assert(node->link);
-        return (node->link->lock ? -1 : 0);
+        return (node->lock ? -1 : 0);
     };
     if (for_each_node(node, check_for_locks)) {
         return ERR_DUPE;
@@ -80,11 +204,9 @@ int32_t Builder::lock(const std::string& path,
 
     // Assign lock to all nodes in this subtree.
     const auto assign_lock =
-        [&lock](const std::shared_ptr<Node> node) -> int32_t {
+        [&lock](const std::shared_ptr<Node>& node) -> int32_t {
         assert(node);
-        assert(node->link);
-        assert(!node->link->lock);
-        node->link->lock = lock;
+        node->lock = lock;
         return 0;
     };
     for_each_node(node, assign_lock);
@@ -92,25 +214,540 @@ int32_t Builder::lock(const std::string& path,
     return 0;
 }
 
-int32_t Builder::build(std::shared_ptr<River>* river_ret)
+int32_t Builder::redundant(const std::string& path)
+{
+    // Tokenize the path.
+    std::vector<std::string> tokens;
+    const int32_t tokenize_ret = tokenize_path(path, tokens);
+    if (tokenize_ret != 0) {
+        return tokenize_ret;
+    }
+
+    // Get node at the path.
+    std::shared_ptr<Node> node;
+    insert_node(root,
+                tokens,
+                /* index= */ 0,
+                /* create= */ false,
+                node);
+
+    // Check that the path exists.
+    if (!node) {
+        return ERR_NOTFOUND;
+    }
+
+    // Check that no node in this subtree is already redundant. Marking the
+    // whole subtree means this also catches redundant ancestors.
+    static const auto check_for_redundant =
+        [](const std::shared_ptr<Node>& node) -> int32_t {
+        assert(node);
+        return (node->redundant ? -1 : 0);
+    };
+    if (for_each_node(node, check_for_redundant)) {
+        return ERR_DUPE;
+    }
+
+    static const auto mark_redundant =
+        [](const std::shared_ptr<Node>& node) -> int32_t {
+        assert(node);
+        node->redundant = true;
+        return 0;
+    };
+    for_each_node(node, mark_redundant);
+
+    return 0;
+}
+
+int32_t Builder::hot(const std::string& path)
+{
+    // Tokenize the path.
+    std::vector<std::string> tokens;
+    const int32_t tokenize_ret = tokenize_path(path, tokens);
+    if (tokenize_ret != 0) {
+        return tokenize_ret;
+    }
+
+    // Get node at the path.
+    std::shared_ptr<Node> node;
+    insert_node(root,
+                tokens,
+                /* index= */ 0,
+                /* create= */ false,
+                node);
+
+    // Check that the path exists.
+    if (!node) {
+        return ERR_NOTFOUND;
+    }
+
+    static const auto mark_hot =
+        [](const std::shared_ptr<Node>& node) -> int32_t {
+        assert(node);
+        node->hot = true;
+        return 0;
+    };
+    for_each_node(node, mark_hot);
+
+    return 0;
+}
+
+int32_t Builder::load_locks(
+    std::istream& is,
+    const std::function<std::shared_ptr<Lock>(const LockKind)> make_lock)
+{
+    std::string line;
+    while (std::getline(is, line)) {
+        // Strip comments.
+        const size_t comment_pos = line.find('#');
+        if (comment_pos != std::string::npos) {
+            line.resize(comment_pos);
+        }
+
+        // Skip blank lines. Otherwise, the line must have exactly a path and a
+        // lock kind.
+        std::stringstream ss(line);
+        std::string path, kind_name, extra;
+        if (!(ss >> path)) {
+            continue;
+        }
+        if (!(ss >> kind_name) || (ss >> extra)) {
+            return ERR_INVALID;
+        }
+
+        // Look up the lock kind by name.
+        LockKind kind = LockKind::NONE;
+        if (!parse_lock_kind(kind_name, kind)) {
+            return ERR_INVALID;
+        }
+
+        // Paths that need no lock are listed only for completeness.
+        if (kind == LockKind::NONE) {
+            continue;
+        }
+
+        const std::shared_ptr<Lock> path_lock = make_lock(kind);
+        if (!path_lock) {
+            return ERR_INVALID;
+        }
+
+        const int32_t lock_ret = lock(path, path_lock);
+        if (lock_ret != 0) {
+            return lock_ret;
+        }
+    }
+
+    return 0;
+}
+
+int32_t Builder::load_profile(std::istream& is)
+{
+    std::string line;
+    while (std::getline(is, line)) {
+        // Strip comments.
+        const size_t comment_pos = line.find('#');
+        if (comment_pos != std::string::npos) {
+            line.resize(comment_pos);
+        }
+
+        // Skip blank lines. Otherwise, the line must have exactly a path, a
+        // thread, and read and write counts.
+        std::stringstream ss(line);
+        std::string path, extra;
+        uint32_t thread = 0;
+        uint64_t reads = 0;
+        uint64_t writes = 0;
+        if (!(ss >> path)) {
+            continue;
+        }
+        if (!(ss >> thread >> reads >> writes) || (ss >> extra)) {
+            return ERR_INVALID;
+        }
+
+        // Tokenize the path.
+        std::vector<std::string> tokens;
+        const int32_t tokenize_ret = tokenize_path(path, tokens);
+        if (tokenize_ret != 0) {
+            return tokenize_ret;
+        }
+
+        // Get node at the path.
+        std::shared_ptr<Node> node;
+        insert_node(root,
+                    tokens,
+                    /* index= */ 0,
+                    /* create= */ false,
+                    node);
+        if (!node) {
+            return ERR_NOTFOUND;
+        }
+
+        node->samples[thread] += (reads + writes);
+    }
+
+    return 0;
+}
+
+int32_t Builder::load_schema(
+    std::istream& is,
+    const std::function<std::shared_ptr<Lock>(const LockKind)> make_lock)
+{
+    using LoadChannel = int32_t (Builder::*)(
+        const std::string&, const size_t, const std::vector<std::string_view>&);
+    static const std::pair<std::string_view, LoadChannel> TYPES[] = {
+        {"bool", &Builder::load_schema_channel<bool>},
+        {"int8", &Builder::load_schema_channel<int8_t>},
+        {"uint8", &Builder::load_schema_channel<uint8_t>},
+        {"int16", &Builder::load_schema_channel<int16_t>},
+        {"uint16", &Builder::load_schema_channel<uint16_t>},
+        {"int32", &Builder::load_schema_channel<int32_t>},
+        {"uint32", &Builder::load_schema_channel<uint32_t>},
+        {"int64", &Builder::load_schema_channel<int64_t>},
+        {"uint64", &Builder::load_schema_channel<uint64_t>},
+        {"float", &Builder::load_schema_channel<float>},
+        {"double", &Builder::load_schema_channel<double>},
+    };
+
+    // Schemas can have many thousands of lines, so the whole schema is read
+    // in large chunks and split in place rather than through string streams.
+    std::string text;
+    char chunk[1 << 16];
+    while (is.read(chunk, sizeof(chunk)) || (is.gcount() > 0)) {
+        text.append(chunk, static_cast<size_t>(is.gcount()));
+    }
+    std::vector<std::string_view> fields;
+    std::vector<std::string_view> values;
+    std::string path;
+    size_t line_begin = 0;
+    while (line_begin < text.size()) {
+        size_t line_end = text.find('\n', line_begin);
+        if (line_end == std::string::npos) {
+            line_end = text.size();
+        }
+        const std::string_view line(&text[line_begin], line_end - line_begin);
+        line_begin = (line_end + 1);
+
+        // Skip blank lines.
+        split_schema_line(line, fields);
+        if (fields.empty()) {
+            continue;
+        }
+        if (fields.size() < 2) {
+            return ERR_INVALID;
+        }
+        path.assign(fields[1].data(), fields[1].size());
+
+        // Lock lines have exactly a path and a lock kind. Paths that need no
+        // lock don't need a lock factory either.
+        if (fields[0] == "lock") {
+            LockKind kind = LockKind::NONE;
+            if ((fields.size() != 3) || !parse_lock_kind(fields[2], kind)) {
+                return ERR_INVALID;
+            }
+            if (kind == LockKind::NONE) {
+                continue;
+            }
+            if (!make_lock) {
+                return ERR_INVALID;
+            }
+            const std::shared_ptr<Lock> path_lock = make_lock(kind);
+            if (!path_lock) {
+                return ERR_INVALID;
+            }
+            const int32_t lock_ret = lock(path, path_lock);
+            if (lock_ret != 0) {
+                return lock_ret;
+            }
+            continue;
+        }
+
+        // Split the element count off the type.
+        std::string_view type_name = fields[0];
+        size_t count = 1;
+        const size_t bracket_pos = type_name.find('[');
+        if (bracket_pos != std::string_view::npos) {
+            if ((type_name.back() != ']')
+                || !parse_schema_value(
+                    type_name.substr(bracket_pos + 1,
+                                     type_name.size() - bracket_pos - 2),
+                    count)
+                || (count == 0)) {
+                return ERR_INVALID;
+            }
+            type_name = type_name.substr(0, bracket_pos);
+        }
+
+        // Flags have a count but no values.
+        if (type_name == "flags") {
+            if ((bracket_pos == std::string_view::npos)
+                || (fields.size() > 2)) {
+                return ERR_INVALID;
+            }
+            Flags flags_handle;
+            const int32_t flags_ret = flags(path, count, flags_handle);
+            if (flags_ret != 0) {
+                return flags_ret;
+            }
+            continue;
+        }
+
+        const auto type_it =
+            std::find_if(std::begin(TYPES),
+                         std::end(TYPES),
+                         [&](const std::pair<std::string_view, LoadChannel>&
+                                 type) { return (type.first == type_name); });
+        if (type_it == std::end(TYPES)) {
+            return ERR_INVALID;
+        }
+        values.assign(fields.begin() + 2, fields.end());
+        const int32_t channel_ret = (this->*(type_it->second))(path,
+                                                               count,
+                                                               values);
+        if (channel_ret != 0) {
+            return channel_ret;
+        }
+    }
+
+    return 0;
+}
+
+size_t Builder::required_size(const Options& options) const
+{
+    LayoutStats stats;
+    layout_node(root, options.optimize_layout, stats);
+    return layout_buffer(options, stats.size, stats.redundant_ranges).size;
+}
+
+int32_t Builder::build(const Options& options,
+                       std::shared_ptr<River>* river_ret)
 {
     // Check that this is the root builder.
     if (!is_root) {
         return ERR_NOTROOT;
     }
 
+    // Report the layout before and after optimization.
+    if (options.layout_report) {
+        LayoutStats before;
+        layout_node(root, /* optimize= */ false, before);
+        print_layout(*options.layout_report, "before", before);
+        LayoutStats after;
+        layout_node(root, /* optimize= */ true, after);
+        print_layout(*options.layout_report, "after", after);
+    }
+
+    // Derived channels are resolved to the indices of their inputs, which
+    // build_node() records in node links, so every one of them needs a link.
+    static const auto link_derived =
+        [](const std::shared_ptr<Node>& node) -> int32_t {
+        const DerivedInfo* const info =
+            dynamic_cast<const DerivedInfo*>(node->channel_info.get());
+        if (!info) {
+            return 0;
+        }
+        if (!node->link) {
+            node->link.reset(new Link);
+        }
+        for (const std::weak_ptr<Node>& input : info->inputs) {
+            const std::shared_ptr<Node> input_node = input.lock();
+            assert(input_node);
+            if (!input_node->link) {
+                input_node->link.reset(new Link);
+            }
+        }
+        return 0;
+    };
+    for_each_node(root, link_derived);
+
+    // Lay out the river and its initial values.
     std::shared_ptr<River> river(new River);
-    build_node(root, river);
+    std::vector<uint8_t> image;
+    std::vector<Replicas::Range> redundant_ranges;
+    std::vector<Node*> nodes;
+    build_node(root,
+               River::NO_PARENT,
+               river,
+               image,
+               options.optimize_layout,
+               redundant_ranges,
+               nodes);
+
+    // Offsets, sizes, and indices in the river metadata are 32 bits.
+    int32_t ret = 0;
+    if ((image.size() > UINT32_MAX) || (river->node_count() >= UINT32_MAX)) {
+        ret = ERR_TOOBIG;
+    }
+
+    // Allocate the river storage, or use the caller's buffer, and copy the
+    // initial values into it.
+    if (ret == 0) {
+        const Storage::Options storage_options {
+            .huge_pages = options.huge_pages,
+            .prefault = options.prefault,
+            .lock = options.lock_memory,
+        };
+        if (!options.buffer) {
+            if (river->storage->allocate(image.size(), storage_options) != 0) {
+                ret = ERR_NOMEM;
+            }
+        } else if ((reinterpret_cast<uintptr_t>(options.buffer)
+                    % Storage::ALIGNMENT)
+                   != 0) {
+            ret = ERR_INVALID;
+        } else if (options.buffer_size
+                   < layout_buffer(options, image.size(), redundant_ranges)
+                         .size) {
+            ret = ERR_NOMEM;
+        } else if (river->storage->assign(options.buffer,
+                                          image.size(),
+                                          storage_options)
+                   != 0) {
+            ret = ERR_NOMEM;
+        }
+    }
+
+    // A replicator can only replicate one river, in frame mode, and its log
+    // must hold a snapshot of the river.
+    if ((ret == 0) && options.replicator
+        && !options.replicator->can_attach(options.frames, image.size())) {
+        ret = ERR_INVALID;
+    }
+
+    // A history must record at least one channel for each of its paths.
+    if ((ret == 0) && options.history
+        && !options.history->can_attach(*river)) {
+        ret = ERR_INVALID;
+    }
+
+    // Set up frame mode, replicas, and checksums once the river storage is
+    // fully populated, so that they start out with the initial channel values.
+    // With a caller-provided buffer, they're placed in it after the storage.
+    if (ret == 0) {
+        std::copy(image.begin(), image.end(), river->storage->data());
+
+        uint8_t* back_buffer = nullptr;
+        uint8_t* checksums = nullptr;
+        uint8_t* replicas = nullptr;
+        if (options.buffer) {
+            const BufferLayout layout =
+                layout_buffer(options, image.size(), redundant_ranges);
+            back_buffer = (options.buffer + layout.back_buffer);
+            checksums = (options.buffer + layout.checksums);
+            replicas = (options.buffer + layout.replicas);
+        }
+        if (options.frames && !river->enable_frames(back_buffer)) {
+            ret = ERR_NOMEM;
+        }
+        river->enable_replicas(redundant_ranges, replicas);
+        if (options.checksums) {
+            river->enable_checksums(checksums);
+        }
+    }
+
+    // Handles must not use a river that failed to build, so unlink them from
+    // it. Their links stay in the metadata tree, so that building again can
+    // link them to a new river.
+    if (ret != 0) {
+        static const auto unlink =
+            [](const std::shared_ptr<Node>& node) -> int32_t {
+            if (node->link) {
+                node->link->river.reset();
+            }
+            return 0;
+        };
+        for_each_node(root, unlink);
+        return ret;
+    }
+
+    // Attach the derived channels while their nodes are still linked, ordered
+    // by node index so that they can be looked up by binary search.
+    const auto add_derivation =
+        [&river](const std::shared_ptr<Node>& node) -> int32_t {
+        const DerivedInfo* const info =
+            dynamic_cast<const DerivedInfo*>(node->channel_info.get());
+        if (!info) {
+            return 0;
+        }
+        std::shared_ptr<Derivation> derivation(new Derivation);
+        derivation->node = node->link->index;
+        for (const std::weak_ptr<Node>& input : info->inputs) {
+            derivation->inputs.push_back(input.lock()->link->index);
+        }
+        derivation->compute = info->compute;
+        river->derivations.push_back(derivation);
+        return 0;
+    };
+    for_each_node(root, add_derivation);
+    std::sort(river->derivations.begin(),
+              river->derivations.end(),
+              [](const std::shared_ptr<Derivation>& lhs,
+                 const std::shared_ptr<Derivation>& rhs) {
+                  return (lhs->node < rhs->node);
+              });
 
     // Remove all river links from the metadata tree so that any future rivers
     // built by this builder don't link to the one we just built.
     static const auto remove_link =
-        [](const std::shared_ptr<Node> node) -> int32_t {
+        [](const std::shared_ptr<Node>& node) -> int32_t {
         node->link.reset();
         return 0;
     };
     for_each_node(root, remove_link);
 
+    // Handles looked up from now on link to this river. This waits until the
+    // build succeeds, so that after a failed build, they still link to the
+    // last river built.
+    for (uint32_t index = 0; index < nodes.size(); ++index) {
+        nodes[index]->built_river = river;
+        nodes[index]->built_index = index;
+    }
+
+    // Derived channels detect changed inputs by their versions.
+    if (options.versions || !river->derivations.empty()) {
+        river->enable_versions();
+    }
+
+#ifdef RIVER_RACE_DETECTOR
+    // Attach the race detector now that the river metadata is complete.
+    river->race_detector.reset(new RaceDetector(*river));
+#endif
+
+    // Attach the profiler now that the river metadata is complete.
+    if (options.profiler) {
+        options.profiler->attach(*river);
+        river->profiler = options.profiler;
+    }
+
+    // Attach the sampler now that the river metadata is complete.
+    if (options.sampler) {
+        options.sampler->attach(*river);
+        river->sampler = options.sampler;
+    }
+
+    // Attach the history now that the river metadata is complete.
+    if (options.history) {
+        options.history->attach(*river);
+        river->history = options.history;
+    }
+
+    // Attach the tracer now that the river metadata is complete.
+    if (options.tracer) {
+        options.tracer->attach(*river);
+        river->tracer = options.tracer;
+    }
+
+    // Attach the replicator last, so that its first snapshot includes
+    // everything above.
+    if (options.replicator) {
+        options.replicator->attach(*river);
+        river->replicator = options.replicator;
+    }
+
+    // The river has its own copy of the metadata, so the tree is no longer
+    // needed unless more rivers will be built from it.
+    if (options.release_tree) {
+        root.reset(new Node);
+    }
+
     // Return river.
     if (river_ret) {
         *river_ret = river;
@@ -119,9 +756,14 @@ int32_t Builder::build(std::shared_ptr<River>* river_ret)
     return 0;
 }
 
+int32_t Builder::build(std::shared_ptr<River>* river_ret)
+{
+    return build(Options(), river_ret);
+}
+
 int32_t Builder::build()
 {
-    return build(nullptr);
+    return build(Options(), nullptr);
 }
 
 int32_t Builder::sub(const std::string& path, Builder& builder)
@@ -150,12 +792,16 @@ int32_t Builder::sub(const std::string& path, Builder& builder)
 int32_t Builder::tokenize_path(const std::string& path,
                                std::vector<std::string>& tokens)
 {
-    std::stringstream ss(path);
-
     // Split path on dots.
-    std::string token;
-    while (std::getline(ss, token, '.')) {
-        tokens.push_back(token);
+    tokens.reserve(std::count(path.begin(), path.end(), '.') + 1);
+    size_t begin = 0;
+    while (begin < path.size()) {
+        size_t end = path.find('.', begin);
+        if (end == std::string::npos) {
+            end = path.size();
+        }
+        tokens.push_back(path.substr(begin, end - begin));
+        begin = (end + 1);
     }
 
     // Check that path is non-empty.
@@ -189,7 +835,7 @@ Builder::Builder(const std::shared_ptr<Node> root_)
 {
 }
 
-void Builder::insert_node(const std::shared_ptr<Node> node,
+void Builder::insert_node(const std::shared_ptr<Node>& node,
                           const std::vector<std::string>& path,
                           const size_t index,
                           const bool create,
@@ -204,16 +850,34 @@ void Builder::insert_node(const std::shared_ptr<Node> node,
         return;
     }
 
-    // Search for a child node matching the current path token.
+    // Search for a child node matching the current path token. Few children
+    // are faster to scan than to index.
     const std::string& token = path[index];
-    for (const std::shared_ptr<Node>& child : node->children) {
-        // Found matching child node; recurse into it.
-        if (child->name == token) {
-            insert_node(child, path, index + 1, create, node_ret);
-            return;
+    size_t child_index = node->children.size();
+    if (node->children.size() < CHILD_INDEX_THRESHOLD) {
+        for (size_t i = 0; i < node->children.size(); ++i) {
+            if (node->children[i]->name == token) {
+                child_index = i;
+                break;
+            }
+        }
+    } else {
+        const auto child_it = node->child_indices.find(token);
+        if (child_it != node->child_indices.end()) {
+            child_index = child_it->second;
         }
     }
 
+    // Found matching child node; recurse into it.
+    if (child_index < node->children.size()) {
+        insert_node(node->children[child_index],
+                    path,
+                    index + 1,
+                    create,
+                    node_ret);
+        return;
+    }
+
     // Node at specified path doesn't exist. If we didn't intend to create a new
     // node, stop here.
     if (!create) {
@@ -221,18 +885,208 @@ void Builder::insert_node(const std::shared_ptr<Node> node,
     }
 
     // Create a new node at this path and recurse into it.
-    const std::shared_ptr<Node> new_child(new Node {
+    const std::shared_ptr<Node> new_child = std::make_shared<Node>(Node {
         .name = token,
         .channel_info = nullptr,
         .link = nullptr,
+        .built_river = {},
+        .built_index = 0,
+        .lock = nullptr,
+        .redundant = false,
+        .hot = false,
+        .samples = {},
         .children = {},
+        .child_indices = {},
     });
     node->children.push_back(new_child);
+
+    // Index the children once there are enough of them.
+    if (node->children.size() == CHILD_INDEX_THRESHOLD) {
+        for (size_t i = 0; i < node->children.size(); ++i) {
+            node->child_indices.emplace(node->children[i]->name, i);
+        }
+    } else if (node->children.size() > CHILD_INDEX_THRESHOLD) {
+        node->child_indices.emplace(token, node->children.size() - 1);
+    }
     insert_node(new_child, path, index + 1, create, node_ret);
 }
 
-void Builder::build_node(const std::shared_ptr<Node> node,
-                         const std::shared_ptr<River> river)
+int32_t Builder::add_channel(const std::string& path,
+                             const std::shared_ptr<ChannelInfoBase> info,
+                             std::shared_ptr<Link>* const link_ret)
+{
+    // Tokenize the path.
+    std::vector<std::string> tokens;
+    const int32_t tokenize_ret = tokenize_path(path, tokens);
+    if (tokenize_ret != 0) {
+        return tokenize_ret;
+    }
+
+    // Add node for the channel to the metadata tree.
+    std::shared_ptr<Node> channel_node;
+    insert_node(root,
+                tokens,
+                /* index= */ 0,
+                /* create= */ true,
+                channel_node);
+
+    // Check that a channel at this path doesn't already exist.
+    if (channel_node->channel_info) {
+        return ERR_DUPE;
+    }
+
+    // Set info for new channel node.
+    channel_node->name = tokens.back();
+    channel_node->channel_info = info;
+
+    // Link the returned handle to the river. Note that the channel node can
+    // already have a link if there's also a rivulet at this path.
+    if (link_ret) {
+        if (!channel_node->link) {
+            channel_node->link = std::make_shared<Link>();
+        }
+        *link_ret = channel_node->link;
+    }
+
+    return 0;
+}
+
+int32_t Builder::find_channel(const std::string& path,
+                              std::shared_ptr<Node>& node_ret,
+                              std::shared_ptr<Link>& link_ret)
+{
+    // Tokenize the path.
+    std::vector<std::string> tokens;
+    const int32_t tokenize_ret = tokenize_path(path, tokens);
+    if (tokenize_ret != 0) {
+        return tokenize_ret;
+    }
+
+    // Get node at the path, which must be a channel.
+    std::shared_ptr<Node> channel_node;
+    insert_node(root,
+                tokens,
+                /* index= */ 0,
+                /* create= */ false,
+                channel_node);
+    if (!channel_node || !channel_node->channel_info) {
+        return ERR_NOTFOUND;
+    }
+
+    // Once the river is built, handles get their own link to it, so that
+    // building again doesn't relink them, like handles that existed when it
+    // was built.
+    node_ret = channel_node;
+    const std::shared_ptr<River> river = channel_node->built_river.lock();
+    if (!channel_node->link && river) {
+        const uint32_t index = channel_node->built_index;
+        link_ret.reset(new Link);
+        link_ret->river = river;
+        link_ret->index = index;
+        link_ret->channel_offset = river->offsets[index];
+        link_ret->channel_size = river->sizes[index];
+        link_ret->lock_index = river->lock_indices[index];
+        return 0;
+    }
+
+    // Otherwise, the handle is linked when the river is built. Note that the
+    // channel node has no link if it was loaded from a schema, or the river
+    // built from it no longer exists.
+    if (!channel_node->link) {
+        channel_node->link.reset(new Link);
+    }
+    link_ret = channel_node->link;
+
+    return 0;
+}
+
+River::Scalar Builder::scalar_type(const std::type_info* const type)
+{
+    static const std::pair<const std::type_info*, River::Scalar> SCALARS[] = {
+        {&typeid(bool), River::Scalar::BOOL},
+        {&typeid(int8_t), River::Scalar::INT8},
+        {&typeid(uint8_t), River::Scalar::UINT8},
+        {&typeid(int16_t), River::Scalar::INT16},
+        {&typeid(uint16_t), River::Scalar::UINT16},
+        {&typeid(int32_t), River::Scalar::INT32},
+        {&typeid(uint32_t), River::Scalar::UINT32},
+        {&typeid(int64_t), River::Scalar::INT64},
+        {&typeid(uint64_t), River::Scalar::UINT64},
+        {&typeid(float), River::Scalar::FLOAT},
+        {&typeid(double), River::Scalar::DOUBLE},
+    };
+    if (type) {
+        for (const auto& scalar : SCALARS) {
+            if (*scalar.first == *type) {
+                return scalar.second;
+            }
+        }
+    }
+    return River::Scalar::NONE;
+}
+
+int32_t Builder::find_linked_channel(const std::shared_ptr<Link>& link,
+                                     std::shared_ptr<Node>& node_ret) const
+{
+    if (!link) {
+        return ERR_INVALID;
+    }
+
+    // Handles share the link of their node, so find the node by its link. Only
+    // channels with typed handles can be found, which excludes flags and
+    // derived channels.
+    const auto find = [&link, &node_ret](const std::shared_ptr<Node>& node) {
+        if ((node->link == link) && node->channel_info
+            && node->channel_info->element_type()) {
+            node_ret = node;
+            return 1;
+        }
+        return 0;
+    };
+    return ((for_each_node(root, find) != 0) ? 0 : ERR_NOTFOUND);
+}
+
+template <typename T>
+int32_t Builder::load_schema_channel(
+    const std::string& path,
+    const size_t count,
+    const std::vector<std::string_view>& values)
+{
+    // Values are given for none, one, or each of the elements.
+    if (!values.empty() && (values.size() != 1) && (values.size() != count)) {
+        return ERR_INVALID;
+    }
+
+    std::vector<uint8_t> init_bytes(count * sizeof(T), 0);
+    for (size_t i = 0; i < values.size(); ++i) {
+        T value {};
+        if (!parse_schema_value(values[i], value)) {
+            return ERR_INVALID;
+        }
+        std::memcpy(&init_bytes[i * sizeof(T)], &value, sizeof(T));
+    }
+    if (values.size() == 1) {
+        for (size_t i = 1; i < count; ++i) {
+            std::memcpy(&init_bytes[i * sizeof(T)],
+                        init_bytes.data(),
+                        sizeof(T));
+        }
+    }
+
+    // Handles are gotten separately, so the channel needs no link yet.
+    return add_channel(
+        path,
+        std::make_shared<SchemaInfo>(typeid(T), std::move(init_bytes)),
+        /* link_ret= */ nullptr);
+}
+
+void Builder::build_node(const std::shared_ptr<Node>& node,
+                         const uint32_t parent,
+                         const std::shared_ptr<River>& river,
+                         std::vector<uint8_t>& image,
+                         const bool optimize_layout,
+                         std::vector<Replicas::Range>& redundant_ranges,
+                         std::vector<Node*>& nodes)
 {
     assert(river);
 
@@ -242,66 +1096,288 @@ void Builder::build_node(const std::shared_ptr<Node> node,
         return;
     }
 
+    // Pad the river so that the node's channel is aligned.
+    const auto& channel_info = node->channel_info;
+    if (channel_info) {
+        const size_t alignment = channel_info->alignment();
+        image.resize(((image.size() + alignment - 1) / alignment) * alignment);
+    }
+
+    // Memory for the node's channel and descendants starts here.
+    const size_t node_offset = image.size();
+
+    // Add the node to the river metadata, unless it's the root node, which has
+    // no name. Offsets that don't fit in 32 bits are truncated here and
+    // rejected by the caller once the river size is known.
+    uint32_t index = parent;
+    uint32_t lock_index = River::NO_LOCK;
+    if (node != root) {
+        index = static_cast<uint32_t>(river->node_count());
+        river->names += node->name;
+        river->name_offsets.push_back(
+            static_cast<uint32_t>(river->names.size()));
+        river->parents.push_back(parent);
+        river->offsets.push_back(static_cast<uint32_t>(node_offset));
+        river->sizes.push_back(
+            static_cast<uint32_t>(channel_info ? channel_info->size() : 0));
+        river->scalars.push_back(
+            (channel_info ? scalar_type(channel_info->element_type())
+                          : River::Scalar::NONE));
+
+        // Nodes in a locked subtree share its lock, so only the subtree root
+        // adds the lock to the lock table.
+        lock_index = River::NO_LOCK;
+        if (node->lock) {
+            const bool parent_shares_lock =
+                ((parent != River::NO_PARENT)
+                 && (river->lock_indices[parent] != River::NO_LOCK)
+                 && (river->locks[river->lock_indices[parent]]
+                     == node->lock));
+            if (parent_shares_lock) {
+                lock_index = river->lock_indices[parent];
+            } else {
+                lock_index = static_cast<uint32_t>(river->locks.size());
+                river->locks.push_back(node->lock);
+            }
+        }
+        river->lock_indices.push_back(lock_index);
+        nodes.push_back(node.get());
+    }
+
     // Establish the link to the river. This is the link held by any channel or
     // rivulet handles represented by this node.
     const auto& link = node->link;
     if (link) {
         link->river = river;
+        link->index = index;
+        link->lock_index = lock_index;
+    }
 
-        // If channel info is present, this node represents a channel; add it
-        // to the river.
-        const auto& channel_info = node->channel_info;
-        if (channel_info) {
-            // Increase size of river to fit the new channel at the end.
-            const size_t old_river_size = river->storage->size();
-            river->storage->resize(old_river_size + channel_info->size());
+    // If channel info is present, this node represents a channel; add it to
+    // the river.
+    if (channel_info) {
+        // Increase size of river to fit the new channel at the end.
+        const size_t channel_offset = image.size();
+        image.resize(channel_offset + channel_info->size());
 
-            // Set the channel size in its link.
-            link->channel_offset = old_river_size;
+        // Copy initial channel value to river.
+        std::memcpy(image.data() + channel_offset,
+                    channel_info->init_val_addr(),
+                    channel_info->size());
 
-            // Copy initial channel value to river.
-            uint8_t* const river_addr = river->storage->data();
-            std::memcpy(river_addr + link->channel_offset,
-                        channel_info->init_val_addr(),
-                        channel_info->size());
+        // Set the channel offset and size in its link.
+        if (link) {
+            link->channel_offset = static_cast<uint32_t>(channel_offset);
+            link->channel_size = static_cast<uint32_t>(channel_info->size());
         }
     }
 
+    // The rivulet rooted at this node starts after the node's own channel and
+    // spans all of its descendants, which are laid out contiguously.
+    const size_t rivulet_offset = image.size();
+
     // Recurse into node's children.
-    for (const std::shared_ptr<Node>& child : node->children) {
-        build_node(child, river);
+    std::vector<std::shared_ptr<Node>> ordered;
+    for (const std::shared_ptr<Node>& child :
+         layout_children(node, optimize_layout, ordered)) {
+        build_node(child,
+                   index,
+                   river,
+                   image,
+                   optimize_layout,
+                   redundant_ranges,
+                   nodes);
+    }
+
+    // Redundancy covers the node's channel and all of its descendants.
+    if (node->redundant) {
+        redundant_ranges.push_back({
+            .offset = node_offset,
+            .size = (image.size() - node_offset),
+        });
     }
 
-    // Compute the size and offset of the rivulet rooted at this node. It's
-    // important that this happens after recursing into the node's children, so
-    // that the offset of the first child (and thus the rivulet) is known.
+    // Set the rivulet size and offset. It's important that this happens after
+    // recursing into the node's children, so that their total size is known.
     if (link) {
-        size_t rivulet_size = 0;
-        const auto sum_size =
-            [&rivulet_size](const std::shared_ptr<Node> node) -> int32_t {
-            assert(node);
+        link->rivulet_offset = static_cast<uint32_t>(rivulet_offset);
+        link->rivulet_size =
+            static_cast<uint32_t>(image.size() - rivulet_offset);
+    }
+}
+
+const std::vector<std::shared_ptr<Builder::Node>>& Builder::layout_children(
+    const std::shared_ptr<Node>& node,
+    const bool optimize,
+    std::vector<std::shared_ptr<Node>>& children) const
+{
+    // Declaration order needs no copy.
+    if (!optimize) {
+        return node->children;
+    }
+    children = node->children;
+
+    // Classify each child rivulet by how many of its channels are hot, find
+    // the strictest alignment of its channels, and find the thread that
+    // sampled it most in loaded profiles.
+    struct Key final {
+        bool any_hot = false;
+        bool any_cold = false;
+        size_t alignment = 1;
+        uint32_t thread = UINT32_MAX;
+        uint64_t samples = 0;
+    };
+    std::vector<std::pair<Key, std::shared_ptr<Node>>> keyed;
+    for (const std::shared_ptr<Node>& child : children) {
+        Key key;
+        std::map<uint32_t, uint64_t> thread_samples;
+        const auto update_key =
+            [&key, &thread_samples](const std::shared_ptr<Node>& node) {
             if (node->channel_info) {
-                rivulet_size += node->channel_info->size();
+                (node->hot ? key.any_hot : key.any_cold) = true;
+                key.alignment = std::max(key.alignment,
+                                         node->channel_info->alignment());
+            }
+            for (const auto& [thread, samples] : node->samples) {
+                thread_samples[thread] += samples;
+                key.samples += samples;
             }
             return 0;
         };
-        for (const std::shared_ptr<Node>& child : node->children) {
-            for_each_node(child, sum_size);
+        for_each_node(child, update_key);
+
+        uint64_t max_samples = 0;
+        for (const auto& [thread, samples] : thread_samples) {
+            if (samples > max_samples) {
+                key.thread = thread;
+                max_samples = samples;
+            }
+        }
+
+        keyed.emplace_back(key, child);
+    }
+
+    // Entirely hot rivulets go first and entirely cold ones last, so that the
+    // hot channels of a partially hot rivulet, which its own children put
+    // first, follow the other hot channels. Within each group, rivulets
+    // mostly accessed by the same thread are kept together so that they share
+    // cache lines, with unsampled rivulets last. Stricter alignment goes
+    // first next, which leaves no padding when sizes are multiples of
+    // alignment, and then more samples. Otherwise, declaration order is kept.
+    const auto rank = [](const Key& key) -> int {
+        return (key.any_hot ? (key.any_cold ? 1 : 0) : 2);
+    };
+    std::stable_sort(keyed.begin(),
+                     keyed.end(),
+                     [&rank](const auto& a, const auto& b) -> bool {
+                         if (rank(a.first) != rank(b.first)) {
+                             return (rank(a.first) < rank(b.first));
+                         }
+                         if (a.first.thread != b.first.thread) {
+                             return (a.first.thread < b.first.thread);
+                         }
+                         if (a.first.alignment != b.first.alignment) {
+                             return (a.first.alignment > b.first.alignment);
+                         }
+                         return (a.first.samples > b.first.samples);
+                     });
+
+    for (size_t i = 0; i < keyed.size(); ++i) {
+        children[i] = keyed[i].second;
+    }
+    return children;
+}
+
+void Builder::layout_node(const std::shared_ptr<Node>& node,
+                          const bool optimize,
+                          LayoutStats& stats) const
+{
+    if (!node) {
+        return;
+    }
+
+    // Memory for the node's channel and descendants starts here.
+    size_t node_offset = stats.size;
+
+    const auto& channel_info = node->channel_info;
+    if (channel_info) {
+        // Pad so that the channel is aligned.
+        const size_t alignment = channel_info->alignment();
+        const size_t offset =
+            (((stats.size + alignment - 1) / alignment) * alignment);
+        stats.padding += (offset - stats.size);
+        stats.size = (offset + channel_info->size());
+        node_offset = offset;
+
+        // Count the cache lines of hot channels, without counting a line
+        // shared with the previous hot channel twice.
+        if (node->hot && (channel_info->size() > 0)) {
+            const size_t first_line =
+                std::max(offset / CACHE_LINE_SIZE, stats.hot_lines_end);
+            const size_t lines_end =
+                ((stats.size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE);
+            if (lines_end > first_line) {
+                stats.hot_lines += (lines_end - first_line);
+                stats.hot_lines_end = lines_end;
+            }
         }
+    }
 
-        // Set the rivulet size and offset. The offset is the offset of the
-        // first channel within the rivulet.
-        link->rivulet_size = rivulet_size;
-        link->rivulet_offset = node->children.empty()
-            ? 0
-            : node->children[0]->link->channel_offset;
+    std::vector<std::shared_ptr<Node>> ordered;
+    for (const std::shared_ptr<Node>& child :
+         layout_children(node, optimize, ordered)) {
+        layout_node(child, optimize, stats);
+    }
+
+    // Redundancy covers the node's channel and all of its descendants.
+    if (node->redundant) {
+        stats.redundant_ranges.push_back({
+            .offset = node_offset,
+            .size = (stats.size - node_offset),
+        });
+    }
+}
+
+void Builder::print_layout(std::ostream& os,
+                           const char* const label,
+                           const LayoutStats& stats)
+{
+    os << label << ": " << stats.size << " bytes, " << stats.padding
+       << " bytes padding, "
+       << ((stats.size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE)
+       << " cache lines, " << stats.hot_lines << " hot cache lines"
+       << std::endl;
+}
+
+Builder::BufferLayout Builder::layout_buffer(
+    const Options& options,
+    const size_t storage_size,
+    const std::vector<Replicas::Range>& redundant_ranges)
+{
+    const auto align = [](const size_t offset) {
+        return (((offset + Storage::ALIGNMENT - 1) / Storage::ALIGNMENT)
+                * Storage::ALIGNMENT);
+    };
+
+    BufferLayout layout;
+    layout.size = storage_size;
+    if (options.frames) {
+        layout.back_buffer = align(layout.size);
+        layout.size = (layout.back_buffer + storage_size);
+    }
+    if (options.checksums) {
+        layout.checksums = align(layout.size);
+        layout.size = (layout.checksums + Checksums::memory_size(storage_size));
     }
+    layout.replicas = layout.size;
+    layout.size += Replicas::memory_size(redundant_ranges);
+    return layout;
 }
 
-int32_t Builder::for_each_node(const std::shared_ptr<Node> node,
+int32_t Builder::for_each_node(const std::shared_ptr<Node>& node,
                                const std::function<int32_t(
-                                   const std::shared_ptr<Node>)>
-                                   func)
+                                   const std::shared_ptr<Node>&)>&
+                                   func) const
 {
     assert(node);
 
@@ -331,7 +1407,7 @@ std::ostream& operator<<(std::ostream& os, const Builder& builder)
 }
 
 std::ostream& Builder::print_helper(std::ostream& os,
-                                    const std::shared_ptr<Node> node,
+                                    const std::shared_ptr<Node>& node,
                                     const bool root,
                                     const uint64_t indent_level)
 {
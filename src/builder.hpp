@@ -1,18 +1,33 @@
 #ifndef RIVER_BUILDER_HPP
 #define RIVER_BUILDER_HPP
 
+#include <array>
 #include <cassert>
 #include <cstdint>
+#include <cstring>
 #include <functional>
 #include <iostream>
+#include <map>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
 #include <vector>
 
 #include "channel.hpp"
+#include "derived.hpp"
+#include "flags.hpp"
+#include "history.hpp"
 #include "link.hpp"
 #include "lock.hpp"
+#include "profiler.hpp"
+#include "replicator.hpp"
 #include "river.hpp"
 #include "rivulet.hpp"
+#include "sampler.hpp"
+#include "tracer.hpp"
 
 namespace river {
 /**
@@ -28,10 +43,167 @@ public:
     static constexpr int32_t ERR_NOTFOUND = 2;
     static constexpr int32_t ERR_DUPE = 3;
     static constexpr int32_t ERR_NOTROOT = 4;
+    static constexpr int32_t ERR_TOOBIG = 5;
+    static constexpr int32_t ERR_NOMEM = 6;
     /**
      * @}
      */
 
+    /**
+     * Options for building a river.
+     */
+    struct Options final {
+        /**
+         * Whether to build the river in frame mode.
+         *
+         * @see River::commit_frame()
+         */
+        bool frames = false;
+
+        /**
+         * Whether to maintain CRC-32C checksums of the river backing memory,
+         * so that it can be checked for corruption.
+         *
+         * Checksums are kept for 64-byte blocks and updated on every write.
+         * Writes lock their blocks and fold the change of the written bytes
+         * into the block checksums, rather than checksumming whole blocks.
+         *
+         * @see River::verify()
+         * @see Scrubber
+         */
+        bool checksums = false;
+
+        /**
+         * Whether to count the stores to each 64-byte block of the river
+         * backing memory, so that readers such as the IPC server can tell
+         * which channels changed without comparing their values.
+         *
+         * This adds an atomic increment per written block to writes, and in
+         * frame mode, to commits instead. Rivers with derived channels always
+         * count stores, since that's how derived channels detect changed
+         * inputs.
+         *
+         * @see Server
+         * @see Builder::derived()
+         */
+        bool versions = false;
+
+        /**
+         * If not null, profiler to attach to the river.
+         *
+         * @see Profiler
+         */
+        std::shared_ptr<Profiler> profiler;
+
+        /**
+         * If not null, tracer to attach to the river.
+         *
+         * @see Tracer
+         */
+        std::shared_ptr<Tracer> tracer;
+
+        /**
+         * If not null, sampler to attach to the river.
+         *
+         * @see Sampler
+         */
+        std::shared_ptr<Sampler> sampler;
+
+        /**
+         * If not null, replicator to append frame commits to. The river must
+         * be built in frame mode, and the replicator's log must hold a
+         * snapshot of the river.
+         *
+         * @see Replicator
+         */
+        std::shared_ptr<Replicator> replicator;
+
+        /**
+         * If not null, history to record channel writes to. Every path of the
+         * history must match an arithmetic channel or a rivulet with one.
+         *
+         * @see History
+         */
+        std::shared_ptr<History> history;
+
+        /**
+         * Whether to release the builder metadata tree once the river is
+         * built.
+         *
+         * The built river keeps its own compact copy of the metadata, and
+         * handles remain valid, so the tree is only needed to build more
+         * rivers. Releasing it leaves the builder empty.
+         */
+        bool release_tree = false;
+
+        /**
+         * Whether to back the river storage with huge pages, falling back to
+         * regular pages if none are available.
+         *
+         * @see Storage::Options::huge_pages
+         */
+        bool huge_pages = false;
+
+        /**
+         * Whether to fault in all river storage pages when the river is
+         * built.
+         *
+         * @see Storage::Options::prefault
+         */
+        bool prefault = false;
+
+        /**
+         * Whether to lock the river storage in RAM. Building fails if the
+         * storage can't be locked.
+         *
+         * @see Storage::Options::lock
+         */
+        bool lock_memory = false;
+
+        /**
+         * If not null, memory to place the river storage in instead of
+         * allocating it, e.g., a static buffer or a region in a dedicated
+         * memory section. The memory must be aligned to Storage::ALIGNMENT,
+         * hold at least Builder::required_size() bytes, and outlive the
+         * river.
+         *
+         * The back buffer in frame mode, the checksums, and the replicas of
+         * redundant rivulets and channels are placed in the memory after the
+         * river storage. The river metadata, e.g., paths, locks, the frame
+         * mode dirty bitmap, and versions, is still allocated on the heap by
+         * Builder::build().
+         */
+        uint8_t* buffer = nullptr;
+
+        /**
+         * Size of buffer in bytes.
+         */
+        size_t buffer_size = 0;
+
+        /**
+         * Whether to reorder channels to minimize padding and pack hot
+         * channels together.
+         *
+         * Within each rivulet, child rivulets that are entirely hot come
+         * first, followed by partially hot and then cold ones. Within each
+         * of these groups, child rivulets most accessed by the same thread in
+         * a loaded profile are kept together, and child rivulets with
+         * stricter alignment and then more samples come first.
+         * Rivulets stay contiguous, but their layout no longer follows
+         * declaration order, which matters to code that reads whole rivulets.
+         *
+         * @see Builder::hot()
+         * @see Builder::load_profile()
+         */
+        bool optimize_layout = false;
+
+        /**
+         * If not null, stream to print a report of the river size, padding,
+         * and cache lines before and after layout optimization to.
+         */
+        std::ostream* layout_report = nullptr;
+    };
+
     /**
      * Default constructor.
      */
@@ -60,39 +232,168 @@ public:
                     Channel<T>& channel)
     {
         static_assert(std::is_copy_constructible<T>::value);
+        return add_channel(path,
+                           std::make_shared<ChannelInfo<T>>(init_val),
+                           &channel.link);
+    }
 
-        // Tokenize the path.
-        std::vector<std::string> tokens;
-        const int32_t tokenize_ret = tokenize_path(path, tokens);
-        if (tokenize_ret != 0) {
-            return tokenize_ret;
+    /**
+     * Gets a handle to a channel that was already added, e.g., by
+     * Builder::load_schema().
+     *
+     * If a river was already built from the builder and still exists, the
+     * handle is linked to it. Otherwise, it's linked when the river is built.
+     *
+     * The channel type must match the type the channel was added with. A
+     * channel of an array type can also be accessed as a `std::array` of its
+     * element type with the same number of elements.
+     *
+     * @tparam T Channel type.
+     *
+     * @param      path    Channel path.
+     * @param[out] channel On success, handle to channel.
+     *
+     * @retval 0            Success.
+     * @retval ERR_INVALID  Path is invalid, or the channel type doesn't
+     *                      match.
+     * @retval ERR_NOTFOUND Channel at path doesn't exist.
+     */
+    template <typename T>
+    int32_t channel(const std::string& path, Channel<T>& channel)
+    {
+        std::shared_ptr<Node> channel_node;
+        std::shared_ptr<Link> link;
+        const int32_t find_ret = find_channel(path, channel_node, link);
+        if (find_ret != 0) {
+            return find_ret;
         }
 
-        // Add node for the channel to the metadata tree.
-        std::shared_ptr<Node> channel_node;
-        insert_node(root,
-                    tokens,
-                    /* index= */ 0,
-                    /* create= */ true,
-                    channel_node);
-
-        // Check that a channel at this path doesn't already exist.
-        if (channel_node->channel_info) {
-            return ERR_DUPE;
+        const ChannelInfoBase& info = *channel_node->channel_info;
+        const std::type_info* const element_type = info.element_type();
+        if (!element_type
+            || (*element_type != typeid(typename ElementType<T>::type))
+            || (info.size() != sizeof(T))) {
+            return ERR_INVALID;
         }
 
-        // Set info for new channel node.
-        channel_node->name = tokens.back();
-        channel_node->channel_info.reset(new ChannelInfo<T>(init_val));
+        channel.link = link;
+        return 0;
+    }
+
+    /**
+     * Adds a channel of bit-packed boolean flags to the river.
+     *
+     * All flags are initially clear. The flags are stored in 64-bit words
+     * aligned to 8 bytes, so the channel may be preceded by padding.
+     *
+     * @param      path  Channel path.
+     * @param      count Number of flags.
+     * @param[out] flags On success, handle to added flags.
+     *
+     * @retval 0           Success.
+     * @retval ERR_INVALID Path is invalid, or count is 0.
+     * @retval ERR_DUPE    Channel at path already exists.
+     */
+    int32_t flags(const std::string& path, const size_t count, Flags& flags);
 
-        // Link the returned channel handle to the river. Note that the channel
-        // node can already have a link if there's also a rivulet at this path.
-        if (!channel_node->link) {
-            channel_node->link.reset(new Link);
+    /**
+     * Gets a handle to flags that were already added, e.g., by
+     * Builder::load_schema().
+     *
+     * Like Builder::channel(), the handle is linked to the river already
+     * built from the builder, if it still exists.
+     *
+     * @param      path  Channel path.
+     * @param[out] flags On success, handle to flags.
+     *
+     * @retval 0            Success.
+     * @retval ERR_INVALID  Path is invalid, or the channel isn't flags.
+     * @retval ERR_NOTFOUND Channel at path doesn't exist.
+     */
+    int32_t flags(const std::string& path, Flags& flags);
+
+    /**
+     * Adds a derived channel to the river, whose value is computed from input
+     * channels by a function.
+     *
+     * The value is cached in the river memory. Reading the derived channel
+     * checks the versions of its inputs, and only calls the function if an
+     * input was written since the value was cached. Versions are kept per
+     * 64-byte block, so writes to other channels sharing a block with an input
+     * also cause the value to be recomputed. The function is called on the
+     * reading thread with the input values, each read under its own lock, so
+     * it must not access the river itself.
+     *
+     * Inputs must be channels added to this builder, and can't be derived
+     * channels themselves. Derived channels can't be written, and can't be
+     * looked up as channels. Rivulets covering a derived channel read its
+     * cached value, which is zero until the derived channel is first read,
+     * and writing over it forces a recompute on the next read.
+     *
+     * In frame mode, the cached value is updated in the front buffer rather
+     * than at commits, so a derived channel must not share a rivulet or lock
+     * with readers that skip the lock in frame mode.
+     *
+     * @tparam T      Derived channel type. This type should be fixed-size,
+     *                copy-constructible, and should not contain pointers.
+     * @tparam Func   Function type, callable with the input values and
+     *                returning a T.
+     * @tparam Inputs Input channel types.
+     *
+     * @param      path    Derived channel path.
+     * @param      func    Function computing the derived value.
+     * @param[out] derived On success, handle to added derived channel.
+     * @param      inputs  Handles to the input channels.
+     *
+     * @retval 0            Success.
+     * @retval ERR_INVALID  Path is invalid, or an input handle isn't from a
+     *                      builder.
+     * @retval ERR_NOTFOUND An input isn't a channel in this builder.
+     * @retval ERR_DUPE     Channel at path already exists.
+     */
+    template <typename T, typename Func, typename... Inputs>
+    int32_t derived(const std::string& path,
+                    const Func func,
+                    Derived<T>& derived,
+                    const Channel<Inputs>&... inputs)
+    {
+        static_assert(std::is_copy_constructible<T>::value);
+        static_assert(sizeof...(Inputs) > 0,
+                      "derived channels must have at least one input");
+        static_assert(std::is_invocable_r<T, const Func&, Inputs&...>::value,
+                      "derived function must map the inputs to a T");
+
+        // Find the input channel nodes.
+        std::vector<std::weak_ptr<Node>> input_nodes;
+        for (const std::shared_ptr<Link>* const input : {&inputs.link...}) {
+            std::shared_ptr<Node> input_node;
+            const int32_t find_ret = find_linked_channel(*input, input_node);
+            if (find_ret != 0) {
+                return find_ret;
+            }
+            input_nodes.push_back(input_node);
         }
-        channel.link = channel_node->link;
 
-        return 0;
+        // Read the inputs in order, then compute the value from them.
+        const auto compute = [func](const River& river,
+                                    const uint32_t* const nodes,
+                                    void* const dest) {
+            std::tuple<Inputs...> values;
+            size_t i = 0;
+            std::apply(
+                [&](Inputs&... value) {
+                    (DerivedBase::read_input(river, nodes[i++], &value), ...);
+                },
+                values);
+            const T result = std::apply(func, values);
+            std::memcpy(dest, &result, sizeof(T));
+        };
+
+        return add_channel(
+            path,
+            std::make_shared<DerivedInfo>(
+                sizeof(T), std::move(input_nodes), compute),
+            &derived.link);
     }
 
     /**
@@ -123,6 +424,138 @@ public:
      */
     int32_t lock(const std::string& path, const std::shared_ptr<Lock> lock);
 
+    /**
+     * Makes a rivulet triple-modular-redundant.
+     *
+     * The rivulet memory, including the channel at its path if any, is kept in
+     * three copies. Writes update all copies, and reads return the bitwise
+     * majority of the copies, so that an upset of a single copy is masked.
+     * River::repair() overwrites dissenting copies with the majority.
+     *
+     * @param path Rivulet path.
+     *
+     * @retval 0            Success.
+     * @retval ERR_INVALID  Path is invalid.
+     * @retval ERR_NOTFOUND Path doesn't exist.
+     * @retval ERR_DUPE     Path is already redundant.
+     */
+    int32_t redundant(const std::string& path);
+
+    /**
+     * Marks the channels in a rivulet as hot, i.e., frequently accessed.
+     *
+     * When the river is built with Builder::Options::optimize_layout, hot
+     * channels are packed into as few cache lines as possible.
+     *
+     * @param path Channel or rivulet path.
+     *
+     * @retval 0            Success.
+     * @retval ERR_INVALID  Path is invalid.
+     * @retval ERR_NOTFOUND Path doesn't exist.
+     */
+    int32_t hot(const std::string& path);
+
+    /**
+     * Adds locks to rivulets according to a lock map.
+     *
+     * Each line of a lock map has the form `<path> <kind>`, where `<kind>` is
+     * the name of a LockKind. Blank lines and text following a `#` are ignored.
+     * Lock maps can be generated with Profiler::recommend_locks().
+     *
+     * If an error occurs, locks added by lines before the erroneous line are
+     * kept.
+     *
+     * @param is        Input stream to read the lock map from.
+     * @param make_lock Function that creates a lock of some kind.
+     *
+     * @retval 0            Success.
+     * @retval ERR_INVALID  Lock map is malformed, or make_lock returned null.
+     * @retval ERR_NOTFOUND A path in the lock map doesn't exist.
+     * @retval ERR_DUPE     A path in the lock map is already locked.
+     */
+    int32_t load_locks(
+        std::istream& is,
+        const std::function<std::shared_ptr<Lock>(const LockKind)> make_lock);
+
+    /**
+     * Loads channel access samples from a profile to guide layout
+     * optimization.
+     *
+     * Each line of a profile has the form `<path> <thread> <reads> <writes>`.
+     * Blank lines and text following a `#` are ignored. Profiles can be
+     * generated with Sampler::export_profile(). Samples from several profiles
+     * add up.
+     *
+     * If an error occurs, samples from lines before the erroneous line are
+     * kept.
+     *
+     * @param is Input stream to read the profile from.
+     *
+     * @retval 0            Success.
+     * @retval ERR_INVALID  Profile is malformed.
+     * @retval ERR_NOTFOUND A path in the profile doesn't exist.
+     *
+     * @see Builder::Options::optimize_layout
+     */
+    int32_t load_profile(std::istream& is);
+
+    /**
+     * Adds channels and locks according to a schema.
+     *
+     * Each line of a schema declares a channel or a lock:
+     *
+     *     <type> <path> [<value>...]
+     *     <type>[<count>] <path> [<value>...]
+     *     flags[<count>] <path>
+     *     lock <path> <kind>
+     *
+     * `<type>` is one of `bool`, `int8`, `uint8`, `int16`, `uint16`, `int32`,
+     * `uint32`, `int64`, `uint64`, `float`, and `double`, and `[<count>]`
+     * makes the channel an array of that many elements. Channels are
+     * initialized to zero if no value is given, to the value if one value is
+     * given, and element-wise if one value per element is given. Boolean
+     * values are `true`, `false`, `1`, or `0`. `<kind>` is the name of a
+     * LockKind, and the locked path must be declared by an earlier line.
+     * Blank lines and text following a `#` are ignored.
+     *
+     * Handles to loaded channels can be gotten with the lookup overloads of
+     * Builder::channel() and Builder::flags(), or Builder::rivulet().
+     *
+     * If an error occurs, channels and locks added by lines before the
+     * erroneous line are kept.
+     *
+     * @param is        Input stream to read the schema from.
+     * @param make_lock Function that creates a lock of some kind. Can be null
+     *                  if the schema has no locks other than none.
+     *
+     * @retval 0            Success.
+     * @retval ERR_INVALID  Schema is malformed, or make_lock is null or
+     *                      returned null.
+     * @retval ERR_NOTFOUND A locked path doesn't exist.
+     * @retval ERR_DUPE     A channel or lock is declared twice.
+     */
+    int32_t load_schema(
+        std::istream& is,
+        const std::function<std::shared_ptr<Lock>(const LockKind)> make_lock =
+            nullptr);
+
+    /**
+     * Gets the size of buffer that Builder::build() needs when building into
+     * caller-provided memory with some options.
+     *
+     * This is the size of the river storage, plus that of the back buffer in
+     * frame mode, the checksums, and the replicas of redundant rivulets and
+     * channels.
+     *
+     * @param options Build options. Only layout options, frame mode, and
+     *                checksums affect the size.
+     *
+     * @returns Size in bytes.
+     *
+     * @see Builder::Options::buffer
+     */
+    size_t required_size(const Options& options) const;
+
     /**
      * Builds the river.
      *
@@ -138,18 +571,34 @@ public:
      * channel and rivulet handles have shared pointers to the river, so that
      * the river exists as long as at least one handle to it also exists.
      *
+     * @param      options   Build options.
      * @param[out] river_ret If not null, will be populated with a pointer to
      *                       the built river.
      *
      * @retval 0           Success.
      * @retval ERR_NOTROOT Builder is not the root builder for the river.
+     * @retval ERR_TOOBIG  River would be larger than 4 GiB, or have more than
+     *                     2^32 - 1 nodes.
+     * @retval ERR_NOMEM   River storage or the back buffer couldn't be
+     *                     allocated, the storage couldn't be locked in RAM,
+     *                     or the provided buffer is too small.
+     * @retval ERR_INVALID The provided buffer is misaligned, or the
+     *                     replicator or history can't be attached.
+     */
+    int32_t build(const Options& options,
+                  std::shared_ptr<River>* const river_ret);
+
+    /**
+     * Builds the river with default options.
+     *
+     * @see Builder::build(const Options&, std::shared_ptr<River>*)
      */
     int32_t build(std::shared_ptr<River>* const river_ret);
 
     /**
      * Builds the river, opting not to save the returned pointer.
      *
-     * @see Builder::build(std::shared_ptr<River>*)
+     * @see Builder::build(const Options&, std::shared_ptr<River>*)
      */
     int32_t build();
 
@@ -171,6 +620,22 @@ public:
     int32_t sub(const std::string& path, Builder& builder);
 
 private:
+    /**
+     * Element type of a channel type, which is the type itself unless it's a
+     * `std::array`.
+     *
+     * @tparam T Channel type.
+     */
+    template <typename T>
+    struct ElementType final {
+        using type = T;
+    };
+
+    template <typename T, size_t N>
+    struct ElementType<std::array<T, N>> final {
+        using type = typename ElementType<T>::type;
+    };
+
     /**
      * Base class for ChannelInfo<T> instantiations.
      */
@@ -189,6 +654,29 @@ private:
          * @see ChannelInfo<T>::size()
          */
         virtual size_t size() const = 0;
+
+        /**
+         * Gets the element type of the channel, which handles must match.
+         *
+         * @returns Element type, or null if the channel isn't accessed
+         *          through typed handles.
+         */
+        virtual const std::type_info* element_type() const
+        {
+            return nullptr;
+        }
+
+        /**
+         * Gets the alignment of the channel in the river backing memory.
+         *
+         * Channels are packed by default.
+         *
+         * @returns Channel alignment in bytes.
+         */
+        virtual size_t alignment() const
+        {
+            return 1;
+        }
     };
 
     /**
@@ -229,6 +717,16 @@ private:
             return sizeof(T);
         }
 
+        /**
+         * Gets the element type of the channel type.
+         *
+         * @returns Element type.
+         */
+        const std::type_info* element_type() const override
+        {
+            return &typeid(typename ElementType<T>::type);
+        }
+
     private:
         /**
          * Channel initial value.
@@ -236,6 +734,187 @@ private:
         const T init_val;
     };
 
+    /**
+     * Holds metadata about a channel of bit-packed flags in the river.
+     */
+    struct FlagsInfo final : public ChannelInfoBase {
+    public:
+        /**
+         * Constructor.
+         *
+         * @param count Number of flags.
+         */
+        explicit FlagsInfo(const size_t count_)
+            : count(count_)
+            , init_words((count_ + 63) / 64, 0)
+        {
+        }
+
+        /**
+         * Gets the address of the initial flag words, which are all clear.
+         *
+         * @returns Initial value address.
+         */
+        const void* init_val_addr() const override
+        {
+            return init_words.data();
+        }
+
+        /**
+         * Gets the size of the flag words in bytes.
+         *
+         * @returns Channel size in bytes.
+         */
+        size_t size() const override
+        {
+            return (init_words.size() * sizeof(uint64_t));
+        }
+
+        /**
+         * Flag words are aligned so that they can be updated atomically.
+         *
+         * @returns Channel alignment in bytes.
+         */
+        size_t alignment() const override
+        {
+            return alignof(uint64_t);
+        }
+
+        /**
+         * Number of flags.
+         */
+        const size_t count;
+
+    private:
+        /**
+         * Initial flag words.
+         */
+        const std::vector<uint64_t> init_words;
+    };
+
+    /**
+     * Holds metadata about a channel loaded from a schema, whose type is only
+     * known at runtime.
+     */
+    struct SchemaInfo final : public ChannelInfoBase {
+    public:
+        /**
+         * Constructor.
+         *
+         * @param element_type_ Element type.
+         * @param init_bytes_   Initial value of the whole channel.
+         */
+        SchemaInfo(const std::type_info& element_type_,
+                   std::vector<uint8_t>&& init_bytes_)
+            : type(element_type_)
+            , init_bytes(std::move(init_bytes_))
+        {
+        }
+
+        /**
+         * Gets the address of the channel initial value.
+         *
+         * @returns Initial value address.
+         */
+        const void* init_val_addr() const override
+        {
+            return init_bytes.data();
+        }
+
+        /**
+         * Gets the size of the channel in bytes.
+         *
+         * @returns Channel size in bytes.
+         */
+        size_t size() const override
+        {
+            return init_bytes.size();
+        }
+
+        /**
+         * Gets the element type of the channel.
+         *
+         * @returns Element type.
+         */
+        const std::type_info* element_type() const override
+        {
+            return &type;
+        }
+
+    private:
+        /**
+         * Element type.
+         */
+        const std::type_info& type;
+
+        /**
+         * Initial value of the whole channel.
+         */
+        const std::vector<uint8_t> init_bytes;
+    };
+
+    struct Node;
+
+    /**
+     * Holds metadata about a derived channel in the river.
+     */
+    struct DerivedInfo final : public ChannelInfoBase {
+    public:
+        /**
+         * Constructor.
+         *
+         * @param size_    Size of the derived channel type in bytes.
+         * @param inputs_  Input channel nodes.
+         * @param compute_ Function computing the derived value.
+         */
+        DerivedInfo(const size_t size_,
+                    std::vector<std::weak_ptr<Node>>&& inputs_,
+                    const decltype(Derivation::compute)& compute_)
+            : inputs(std::move(inputs_))
+            , compute(compute_)
+            , init_bytes(size_, 0)
+        {
+        }
+
+        /**
+         * Gets the address of the channel initial value, which is zero until
+         * the value is first computed.
+         *
+         * @returns Initial value address.
+         */
+        const void* init_val_addr() const override
+        {
+            return init_bytes.data();
+        }
+
+        /**
+         * Gets the size of the derived channel type in bytes.
+         *
+         * @returns Channel size in bytes.
+         */
+        size_t size() const override
+        {
+            return init_bytes.size();
+        }
+
+        /**
+         * Input channel nodes. These are weak, since an input may be an
+         * ancestor of the derived channel.
+         */
+        const std::vector<std::weak_ptr<Node>> inputs;
+
+        /**
+         * Function computing the derived value.
+         */
+        const decltype(Derivation::compute) compute;
+
+    private:
+        /**
+         * Initial value of the channel.
+         */
+        const std::vector<uint8_t> init_bytes;
+    };
+
     /**
      * A node in the river metadata tree.
      */
@@ -257,12 +936,118 @@ private:
          */
         std::shared_ptr<Link> link;
 
+        /**
+         * River last built from the tree, if it still exists, so that handles
+         * looked up after building can be linked to it.
+         */
+        std::weak_ptr<River> built_river;
+
+        /**
+         * Index of this node in the metadata of built_river.
+         */
+        uint32_t built_index = 0;
+
+        /**
+         * Lock protecting the rivulet rooted at this node, or null if it's
+         * unlocked.
+         */
+        std::shared_ptr<Lock> lock;
+
+        /**
+         * Whether the rivulet rooted at this node is redundant.
+         */
+        bool redundant = false;
+
+        /**
+         * Whether the channels in the rivulet rooted at this node are hot.
+         */
+        bool hot = false;
+
+        /**
+         * Number of samples of the channel at this node in loaded profiles,
+         * keyed by profiled thread.
+         */
+        std::map<uint32_t, uint64_t> samples;
+
         /**
          * Child nodes.
          */
         std::vector<std::shared_ptr<Node>> children;
+
+        /**
+         * Index of each child in children by name, once there are at least
+         * CHILD_INDEX_THRESHOLD children, so that paths resolve in constant
+         * time per token even in wide rivulets.
+         */
+        std::unordered_map<std::string, size_t> child_indices;
+    };
+
+    /**
+     * Number of children at which a node starts indexing them by name.
+     */
+    static constexpr size_t CHILD_INDEX_THRESHOLD = 16;
+
+    /**
+     * Size and padding of a river layout, in bytes.
+     */
+    struct LayoutStats final {
+        /**
+         * Total size, including padding.
+         */
+        size_t size = 0;
+
+        /**
+         * Bytes of padding before aligned channels.
+         */
+        size_t padding = 0;
+
+        /**
+         * Number of cache lines that hold at least one byte of a hot channel.
+         */
+        size_t hot_lines = 0;
+
+        /**
+         * One past the last cache line counted in hot_lines.
+         */
+        size_t hot_lines_end = 0;
+
+        /**
+         * Ranges of redundant rivulets and channels.
+         */
+        std::vector<Replicas::Range> redundant_ranges;
     };
 
+    /**
+     * Placement of the parts of a river in caller-provided memory. The river
+     * storage comes first, at offset 0.
+     */
+    struct BufferLayout final {
+        /**
+         * Byte offset of the back buffer, if in frame mode.
+         */
+        size_t back_buffer = 0;
+
+        /**
+         * Byte offset of the checksums, if enabled.
+         */
+        size_t checksums = 0;
+
+        /**
+         * Byte offset of the replicas, if any channel is redundant.
+         */
+        size_t replicas = 0;
+
+        /**
+         * Total size in bytes.
+         */
+        size_t size = 0;
+    };
+
+    /**
+     * Cache line size assumed by the layout optimizer, in bytes.
+     */
+    static constexpr size_t CACHE_LINE_SIZE = 64;
+
     /**
      * River metadata tree root.
      */
@@ -302,20 +1087,170 @@ private:
      *                      it doesn't already exist.
      * @param[out] node_ret If the node already exists, points to the node.
      */
-    void insert_node(const std::shared_ptr<Node> node,
+    void insert_node(const std::shared_ptr<Node>& node,
                      const std::vector<std::string>& path,
                      const size_t index,
                      const bool create,
                      std::shared_ptr<Node>& node_ret);
 
+    /**
+     * Adds a channel node to the river metadata tree.
+     *
+     * @param      path     Channel path.
+     * @param      info     Channel info.
+     * @param[out] link_ret If not null, on success, link for handles to the
+     *                      channel.
+     *
+     * @retval 0           Success.
+     * @retval ERR_INVALID Path is invalid.
+     * @retval ERR_DUPE    Channel at path already exists.
+     */
+    int32_t add_channel(const std::string& path,
+                        const std::shared_ptr<ChannelInfoBase> info,
+                        std::shared_ptr<Link>* const link_ret);
+
+    /**
+     * Finds an existing channel node in the river metadata tree, and the link
+     * for a handle to it.
+     *
+     * If the river was already built, the link is linked to the built river,
+     * like the links of handles that existed when it was built. Otherwise,
+     * it's the node's link, which is linked when the river is built.
+     *
+     * @param      path     Channel path.
+     * @param[out] node_ret On success, channel node.
+     * @param[out] link_ret On success, link for a handle to the channel.
+     *
+     * @retval 0            Success.
+     * @retval ERR_INVALID  Path is invalid.
+     * @retval ERR_NOTFOUND Channel at path doesn't exist.
+     */
+    int32_t find_channel(const std::string& path,
+                         std::shared_ptr<Node>& node_ret,
+                         std::shared_ptr<Link>& link_ret);
+
+    /**
+     * Finds the channel node that a handle is linked to.
+     *
+     * @param      link     Handle link.
+     * @param[out] node_ret On success, channel node.
+     *
+     * @retval 0            Success.
+     * @retval ERR_INVALID  Handle has no link.
+     * @retval ERR_NOTFOUND Handle isn't linked to a channel in this builder
+     *                      that can be accessed through typed handles.
+     */
+    int32_t find_linked_channel(const std::shared_ptr<Link>& link,
+                                std::shared_ptr<Node>& node_ret) const;
+
+    /**
+     * Looks up the scalar type of a channel element type for the river
+     * metadata.
+     *
+     * @param type Element type, or null if the channel has none.
+     *
+     * @returns Scalar type, or River::Scalar::NONE if the type isn't
+     *          arithmetic.
+     */
+    static River::Scalar scalar_type(const std::type_info* const type);
+
+    /**
+     * Adds a channel declared by a schema line.
+     *
+     * @tparam T Element type.
+     *
+     * @param path   Channel path.
+     * @param count  Number of elements.
+     * @param values Initial value fields of the line.
+     *
+     * @retval 0           Success.
+     * @retval ERR_INVALID Path or values are invalid.
+     * @retval ERR_DUPE    Channel at path already exists.
+     */
+    template <typename T>
+    int32_t load_schema_channel(const std::string& path,
+                                const size_t count,
+                                const std::vector<std::string_view>& values);
+
     /**
      * Recursive helper that builds the rivulet rooted at a node.
      *
-     * @param node  Current node in the recursion.
-     * @param river River being built.
+     * @param      node             Current node in the recursion.
+     * @param      parent           Index of the node's parent in the river
+     *                              metadata, or River::NO_PARENT if the parent
+     *                              is the root node.
+     * @param      river            River being built.
+     * @param[out] image            Initial values of the river memory, which
+     *                              are appended to as the river is laid out.
+     * @param      optimize_layout  Whether to lay out children in optimized
+     *                              order.
+     * @param[out] redundant_ranges Ranges of river memory in redundant
+     *                              rivulets are appended to this.
+     * @param[out] nodes            Nodes added to the river metadata are
+     *                              appended to this, in index order.
+     */
+    void build_node(const std::shared_ptr<Node>& node,
+                    const uint32_t parent,
+                    const std::shared_ptr<River>& river,
+                    std::vector<uint8_t>& image,
+                    const bool optimize_layout,
+                    std::vector<Replicas::Range>& redundant_ranges,
+                    std::vector<Node*>& nodes);
+
+    /**
+     * Gets the children of a node in the order they're laid out.
+     *
+     * @param      node     Node.
+     * @param      optimize Whether to use the optimized order rather than
+     *                      declaration order.
+     * @param[out] children Storage for the optimized order.
+     *
+     * @returns Children in layout order. In declaration order, these are the
+     *          node's children themselves, and otherwise children.
+     *
+     * @see Builder::Options::optimize_layout
+     */
+    const std::vector<std::shared_ptr<Node>>& layout_children(
+        const std::shared_ptr<Node>& node,
+        const bool optimize,
+        std::vector<std::shared_ptr<Node>>& children) const;
+
+    /**
+     * Recursive helper that computes layout statistics for the rivulet rooted
+     * at a node without building it. This mirrors Builder::build_node().
+     *
+     * @param         node     Current node in the recursion.
+     * @param         optimize Whether to use the optimized layout.
+     * @param[in,out] stats    Statistics of the layout so far.
+     */
+    void layout_node(const std::shared_ptr<Node>& node,
+                     const bool optimize,
+                     LayoutStats& stats) const;
+
+    /**
+     * Prints layout statistics for a report.
+     *
+     * @param os    Output stream.
+     * @param label Label of the layout.
+     * @param stats Layout statistics.
+     */
+    static void print_layout(std::ostream& os,
+                             const char* const label,
+                             const LayoutStats& stats);
+
+    /**
+     * Places the parts of a river in caller-provided memory.
+     *
+     * @param options          Build options.
+     * @param storage_size     Size of the river storage in bytes.
+     * @param redundant_ranges Ranges of redundant rivulets and channels.
+     *
+     * @returns Placement of the parts.
      */
-    void build_node(const std::shared_ptr<Node> node,
-                    const std::shared_ptr<River> river);
+    static BufferLayout layout_buffer(
+        const Options& options,
+        const size_t storage_size,
+        const std::vector<Replicas::Range>& redundant_ranges);
 
     /**
      * Executes a function for each node in the river metadata tree.
@@ -323,10 +1258,10 @@ private:
      * @param node Current node in the recursion.
      * @param func Function to execute.
      */
-    int32_t for_each_node(const std::shared_ptr<Node> node,
+    int32_t for_each_node(const std::shared_ptr<Node>& node,
                           const std::function<int32_t(
-                              const std::shared_ptr<Node>)>
-                              func);
+                              const std::shared_ptr<Node>&)>&
+                              func) const;
 
     /**
      * Pretty-prints the river metadata.
@@ -348,7 +1283,7 @@ private:
      * @returns Output stream.
      */
     static std::ostream& print_helper(std::ostream& os,
-                                      const std::shared_ptr<Node> node,
+                                      const std::shared_ptr<Node>& node,
                                       const bool root,
                                       const uint64_t indent_level);
 };
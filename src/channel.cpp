@@ -1,10 +1,13 @@
 #include <cassert>
-#include <cstring>
 
 #include "channel.hpp"
+#include "history.hpp"
+#include "profiler.hpp"
+#include "sampler.hpp"
+#include "tracer.hpp"
 
 namespace river {
-void ChannelBase::serialize(void* const dest) const
+void ChannelBase::serialize(void* const dest) const noexcept
 {
     assert(dest);
 
@@ -13,22 +16,72 @@ void ChannelBase::serialize(void* const dest) const
         return;
     }
 
-    // Acquire lock if there is one.
-    if (link->lock) {
-        link->lock->acquire();
+    // Record the access if profiling.
+    if (link->river->profiler) {
+        link->river->profiler->record_channel(link->index, /* write= */ false);
+    }
+
+    // Sample the access if sampling.
+    if (link->river->sampler) {
+        link->river->sampler->record(link->index, /* write= */ false);
+    }
+
+    // Look up the lock protecting the linked memory, if any.
+    Lock* const lock = link->river->lock(link->lock_index);
+
+    // Trace lock and access events if tracing.
+    Tracer* const tracer = link->river->tracer.get();
+
+    // Acquire lock if there is one. In frame mode, reads see the front buffer,
+    // which only changes between frames, so no lock is needed.
+    const bool use_lock = (lock && !link->river->frames());
+    if (use_lock) {
+        if (tracer) {
+            tracer->record(Tracer::Kind::LOCK_WAIT, link->index);
+        }
+        lock->acquire();
+        if (tracer) {
+            tracer->record(Tracer::Kind::LOCK_ACQUIRED, link->index);
+        }
     }
 
+#ifdef RIVER_RACE_DETECTOR
+    // Check for writes overlapping the read of an unlocked channel. Reads in
+    // frame mode can't race with writes.
+    RaceDetector* const race_detector =
+        ((lock || link->river->frames())
+             ? nullptr
+             : link->river->race_detector.get());
+    if (race_detector) {
+        race_detector->check_read(link->index, link->index + 1);
+    }
+#endif
+
     // Copy data from channel to dest.
-    const void* const src = link->river->storage->data() + link->channel_offset;
-    std::memcpy(dest, src, size());
+    if (tracer) {
+        tracer->record(Tracer::Kind::READ_BEGIN, link->index);
+    }
+    link->river->read(link->channel_offset, dest, size());
+    if (tracer) {
+        tracer->record(Tracer::Kind::READ_END, link->index);
+    }
+
+#ifdef RIVER_RACE_DETECTOR
+    if (race_detector) {
+        race_detector->check_read(link->index, link->index + 1);
+    }
+#endif
 
     // Release lock if there is one.
-    if (link->lock) {
-        link->lock->release();
+    if (use_lock) {
+        if (tracer) {
+            tracer->record(Tracer::Kind::LOCK_RELEASE, link->index);
+        }
+        lock->release();
     }
 }
 
-void ChannelBase::deserialize(const void* const src)
+void ChannelBase::deserialize(const void* const src) noexcept
 {
     assert(src);
 
@@ -37,18 +90,69 @@ void ChannelBase::deserialize(const void* const src)
         return;
     }
 
+    // Record the access if profiling.
+    if (link->river->profiler) {
+        link->river->profiler->record_channel(link->index, /* write= */ true);
+    }
+
+    // Sample the access if sampling.
+    if (link->river->sampler) {
+        link->river->sampler->record(link->index, /* write= */ true);
+    }
+
+    // Look up the lock protecting the linked memory, if any.
+    Lock* const lock = link->river->lock(link->lock_index);
+
+    // Trace lock and access events if tracing.
+    Tracer* const tracer = link->river->tracer.get();
+
     // Acquire lock if there is one.
-    if (link->lock) {
-        link->lock->acquire();
+    if (lock) {
+        if (tracer) {
+            tracer->record(Tracer::Kind::LOCK_WAIT, link->index);
+        }
+        lock->acquire();
+        if (tracer) {
+            tracer->record(Tracer::Kind::LOCK_ACQUIRED, link->index);
+        }
+    }
+
+#ifdef RIVER_RACE_DETECTOR
+    // Check for races with other writes of an unlocked channel.
+    RaceDetector* const race_detector =
+        (lock ? nullptr : link->river->race_detector.get());
+    if (race_detector) {
+        race_detector->begin_write(link->index, link->index + 1);
     }
+#endif
 
     // Copy data from src to channel.
-    void* const dest = link->river->storage->data() + link->channel_offset;
-    std::memcpy(dest, src, size());
+    if (tracer) {
+        tracer->record(Tracer::Kind::WRITE_BEGIN, link->index);
+    }
+    link->river->write(link->channel_offset, src, size());
+    if (tracer) {
+        tracer->record(Tracer::Kind::WRITE_END, link->index);
+    }
+
+    // Record the value if keeping history. This happens under the lock, so
+    // that locked channels are recorded in the order they are written.
+    if (link->river->history) {
+        link->river->history->record(link->index, src);
+    }
+
+#ifdef RIVER_RACE_DETECTOR
+    if (race_detector) {
+        race_detector->end_write(link->index, link->index + 1);
+    }
+#endif
 
     // Release lock if there is one.
-    if (link->lock) {
-        link->lock->release();
+    if (lock) {
+        if (tracer) {
+            tracer->record(Tracer::Kind::LOCK_RELEASE, link->index);
+        }
+        lock->release();
     }
 }
 } /* namespace river */
@@ -30,7 +30,7 @@ protected:
      *
      * @param dest Read destination.
      */
-    virtual void serialize(void* const dest) const final;
+    virtual void serialize(void* const dest) const noexcept final;
 
     /**
      * Writes to the channel backing memory.
@@ -39,7 +39,7 @@ protected:
      *
      * @param src Write source.
      */
-    virtual void deserialize(const void* const src) final;
+    virtual void deserialize(const void* const src) noexcept final;
 };
 
 template <typename T>
@@ -57,7 +57,7 @@ public:
      *
      * @returns Channel value.
      */
-    T get() const
+    T get() const noexcept
     {
         T val = T();
         serialize(&val);
@@ -71,7 +71,7 @@ public:
      *
      * @param val New channel value.
      */
-    void set(const T val)
+    void set(const T val) noexcept
     {
         deserialize(&val);
     }
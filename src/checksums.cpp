@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <cassert>
+#include <new>
+#include <thread>
+
+#include "checksums.hpp"
+#include "crc32c.hpp"
+
+namespace river {
+Checksums::Checksums(const uint8_t* const data_,
+                     const size_t size_,
+                     void* const memory)
+    : data(data_)
+    , data_size(size_)
+    , blocks_size((size_ + BLOCK_SIZE - 1) / BLOCK_SIZE)
+    , blocks(memory ? static_cast<Block*>(memory) : new Block[blocks_size])
+    , heap(memory ? nullptr : blocks)
+{
+    static_assert(alignof(Block) <= alignof(uint64_t),
+                  "Provided memory is only 8-byte aligned");
+    assert((reinterpret_cast<uintptr_t>(blocks) % alignof(Block)) == 0);
+
+    for (size_t i = 0; i < blocks_size; ++i) {
+        if (memory) {
+            new (&blocks[i]) Block;
+        }
+        blocks[i].crc.store(compute(i), std::memory_order_relaxed);
+        blocks[i].locked.store(false, std::memory_order_relaxed);
+    }
+}
+
+size_t Checksums::memory_size(const size_t size)
+{
+    return (((size + BLOCK_SIZE - 1) / BLOCK_SIZE) * sizeof(Block));
+}
+
+void Checksums::lock(const size_t offset, const size_t size)
+{
+    if (size == 0) {
+        return;
+    }
+
+    // Lock in ascending order so that overlapping ranges can't deadlock.
+    const size_t last_block = ((offset + size - 1) / BLOCK_SIZE);
+    for (size_t i = (offset / BLOCK_SIZE); i <= last_block; ++i) {
+        lock_block(i);
+    }
+}
+
+void Checksums::update(const size_t offset,
+                       const void* const src,
+                       const size_t size)
+{
+    if (size == 0) {
+        return;
+    }
+
+    const uint8_t* const src_bytes = static_cast<const uint8_t*>(src);
+    const size_t last_block = ((offset + size - 1) / BLOCK_SIZE);
+    for (size_t i = (offset / BLOCK_SIZE); i <= last_block; ++i) {
+        assert(blocks[i].locked.load(std::memory_order_relaxed));
+
+        // Blocks that are overwritten completely are checksummed from scratch.
+        // Others have the change of their overwritten bytes folded in, which
+        // keeps them matching only if the rest of the block does.
+        const size_t begin = std::max(offset, i * BLOCK_SIZE);
+        const size_t end = std::min(offset + size, block_end(i));
+        const uint8_t* const new_bytes = (src_bytes + (begin - offset));
+        uint32_t crc = 0;
+        if ((begin == (i * BLOCK_SIZE)) && (end == block_end(i))) {
+            crc = crc32c(new_bytes, end - begin, 0);
+        } else {
+            crc = (blocks[i].crc.load(std::memory_order_relaxed)
+                   ^ crc32c_delta(data + begin,
+                                  new_bytes,
+                                  end - begin,
+                                  block_end(i) - end));
+        }
+        blocks[i].crc.store(crc, std::memory_order_relaxed);
+    }
+}
+
+void Checksums::unlock(const size_t offset, const size_t size)
+{
+    if (size == 0) {
+        return;
+    }
+
+    const size_t last_block = ((offset + size - 1) / BLOCK_SIZE);
+    for (size_t i = (offset / BLOCK_SIZE); i <= last_block; ++i) {
+        assert(blocks[i].locked.load(std::memory_order_relaxed));
+        blocks[i].locked.store(false, std::memory_order_release);
+    }
+}
+
+bool Checksums::verify(const size_t block)
+{
+    assert(block < blocks_size);
+
+    lock_block(block);
+    const bool match =
+        (compute(block) == blocks[block].crc.load(std::memory_order_relaxed));
+    blocks[block].locked.store(false, std::memory_order_release);
+
+    return match;
+}
+
+size_t Checksums::block_count() const
+{
+    return blocks_size;
+}
+
+uint32_t Checksums::compute(const size_t block) const
+{
+    const size_t offset = (block * BLOCK_SIZE);
+    return crc32c(data + offset, block_end(block) - offset, 0);
+}
+
+size_t Checksums::block_end(const size_t block) const
+{
+    return std::min((block + 1) * BLOCK_SIZE, data_size);
+}
+
+void Checksums::lock_block(const size_t block)
+{
+    std::atomic<bool>& locked = blocks[block].locked;
+    while (locked.exchange(true, std::memory_order_acquire)) {
+        // Wait for the holder without hammering the cache line. Blocks are
+        // only held for the duration of a small copy and checksum.
+        while (locked.load(std::memory_order_relaxed)) {
+            std::this_thread::yield();
+        }
+    }
+}
+} /* namespace river */
@@ -0,0 +1,192 @@
+#ifndef RIVER_CHECKSUMS_HPP
+#define RIVER_CHECKSUMS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace river {
+/**
+ * A region of river memory that failed checksum verification.
+ *
+ * @see River::verify()
+ */
+struct Corruption final {
+    /**
+     * Byte offset of the corrupted region in the river backing memory.
+     */
+    size_t offset;
+
+    /**
+     * Size of the corrupted region in bytes.
+     */
+    size_t size;
+
+    /**
+     * Paths of the channels overlapping the corrupted region.
+     */
+    std::vector<std::string> paths;
+};
+
+/**
+ * CRC-32C checksums of river memory, maintained in fixed-size blocks.
+ *
+ * Every modification of checksummed memory must happen between
+ * Checksums::lock() and Checksums::unlock() on the modified range, and be
+ * announced with Checksums::update() before it's made. The block locks
+ * serialize modifications and verifications of the same block, so that
+ * verification never sees a block whose checksum is being updated. They are
+ * independent of river locks, since unlocked channels can share a block.
+ *
+ * Blocks that a modification covers only in part have their checksums
+ * updated from the old and new contents of the modified bytes alone, so that
+ * a small write doesn't checksum its whole block, and corruption elsewhere in
+ * the block is still detected after the write.
+ */
+class Checksums final {
+public:
+    /**
+     * Size of a checksummed block in bytes.
+     */
+    static constexpr size_t BLOCK_SIZE = 64;
+
+    /**
+     * Constructor. Computes the initial checksum of each block.
+     *
+     * @param data   Checksummed memory. Must outlive the checksums.
+     * @param size   Size of checksummed memory in bytes.
+     * @param memory If not null, memory of Checksums::memory_size() bytes to
+     *               place the block states in instead of allocating it. Must
+     *               be 8-byte aligned and outlive the checksums.
+     */
+    Checksums(const uint8_t* const data,
+              const size_t size,
+              void* const memory = nullptr);
+
+    /**
+     * Gets the size of the memory that the block states of some checksummed
+     * memory take.
+     *
+     * @param size Size of checksummed memory in bytes.
+     *
+     * @returns Size in bytes.
+     */
+    static size_t memory_size(const size_t size);
+
+    /**
+     * Locks the blocks covering a range of memory before modifying it.
+     *
+     * @param offset Byte offset of range.
+     * @param size   Size of range in bytes.
+     */
+    void lock(const size_t offset, const size_t size);
+
+    /**
+     * Updates the checksums of the blocks covering a locked range of memory
+     * for a modification that's about to overwrite it.
+     *
+     * @param offset Byte offset of range.
+     * @param src    New contents of the range.
+     * @param size   Size of range in bytes.
+     */
+    void update(const size_t offset, const void* const src, const size_t size);
+
+    /**
+     * Unlocks the blocks covering a range of memory.
+     *
+     * Checksums aren't updated, so the range must hold the contents that they
+     * were last computed or updated for, e.g., after a modification announced
+     * with Checksums::update(), or after restoring such contents.
+     *
+     * @param offset Byte offset of range.
+     * @param size   Size of range in bytes.
+     */
+    void unlock(const size_t offset, const size_t size);
+
+    /**
+     * Verifies a block against its checksum.
+     *
+     * @param block Block index.
+     *
+     * @returns Whether the block matches its checksum.
+     */
+    bool verify(const size_t block);
+
+    /**
+     * Gets the number of blocks.
+     *
+     * @returns Block count.
+     */
+    size_t block_count() const;
+
+private:
+    /**
+     * State of a single block.
+     */
+    struct Block final {
+        /**
+         * Checksum of the block.
+         */
+        std::atomic<uint32_t> crc;
+
+        /**
+         * Whether the block is locked.
+         */
+        std::atomic<bool> locked;
+    };
+
+    /**
+     * Checksummed memory.
+     */
+    const uint8_t* const data;
+
+    /**
+     * Size of checksummed memory in bytes.
+     */
+    const size_t data_size;
+
+    /**
+     * Number of blocks.
+     */
+    const size_t blocks_size;
+
+    /**
+     * Block states.
+     */
+    Block* const blocks;
+
+    /**
+     * Memory of the block states, unless it was provided.
+     */
+    std::unique_ptr<Block[]> heap;
+
+    /**
+     * Computes the checksum of a block.
+     *
+     * @param block Block index.
+     *
+     * @returns Block checksum.
+     */
+    uint32_t compute(const size_t block) const;
+
+    /**
+     * Gets the end of a block.
+     *
+     * @param block Block index.
+     *
+     * @returns Byte offset one past the last byte of the block.
+     */
+    size_t block_end(const size_t block) const;
+
+    /**
+     * Spins until a block is locked by the calling thread.
+     *
+     * @param block Block index.
+     */
+    void lock_block(const size_t block);
+};
+} /* namespace river */
+
+#endif
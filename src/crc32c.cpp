@@ -0,0 +1,240 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include "crc32c.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#define RIVER_CRC32C_X86
+#endif
+
+namespace river {
+/**
+ * Reflected CRC-32C polynomial.
+ */
+static constexpr uint32_t CRC32C_POLY = 0x82f63b78;
+
+/**
+ * Builds the lookup table for the software implementation.
+ *
+ * @returns Table of checksums of each byte value.
+ */
+static constexpr std::array<uint32_t, 256> make_crc32c_table()
+{
+    std::array<uint32_t, 256> table {};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = ((crc & 1) ? ((crc >> 1) ^ CRC32C_POLY) : (crc >> 1));
+        }
+        table[i] = crc;
+    }
+    return table;
+}
+
+/**
+ * Software lookup table.
+ */
+static constexpr std::array<uint32_t, 256> CRC32C_TABLE = make_crc32c_table();
+
+/**
+ * Software implementation of crc32c() operating on the raw (non-inverted) CRC
+ * register.
+ */
+static uint32_t crc32c_sw(const uint8_t* data, size_t size, uint32_t crc)
+{
+    while (size-- > 0) {
+        crc = (CRC32C_TABLE[(crc ^ *data++) & 0xff] ^ (crc >> 8));
+    }
+    return crc;
+}
+
+/**
+ * Software implementation of checksumming the XOR of two buffers into the raw
+ * CRC register.
+ */
+static uint32_t crc32c_xor_sw(const uint8_t* lhs,
+                              const uint8_t* rhs,
+                              size_t size,
+                              uint32_t crc)
+{
+    while (size-- > 0) {
+        crc = (CRC32C_TABLE[(crc ^ *lhs++ ^ *rhs++) & 0xff] ^ (crc >> 8));
+    }
+    return crc;
+}
+
+/**
+ * Software implementation of appending zero bytes to the raw CRC register.
+ */
+static uint32_t crc32c_shift_sw(uint32_t crc, size_t size)
+{
+    while (size-- > 0) {
+        crc = (CRC32C_TABLE[crc & 0xff] ^ (crc >> 8));
+    }
+    return crc;
+}
+
+#ifdef RIVER_CRC32C_X86
+/**
+ * Hardware implementation of crc32c() operating on the raw (non-inverted) CRC
+ * register.
+ */
+__attribute__((target("sse4.2"))) static uint32_t crc32c_hw(
+    const uint8_t* data,
+    size_t size,
+    uint32_t crc)
+{
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    while (size >= sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += sizeof(word);
+        size -= sizeof(word);
+    }
+    crc = static_cast<uint32_t>(crc64);
+#endif
+    while (size >= sizeof(uint32_t)) {
+        uint32_t word;
+        std::memcpy(&word, data, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+        data += sizeof(word);
+        size -= sizeof(word);
+    }
+    while (size-- > 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+
+#ifdef __x86_64__
+/**
+ * Largest number of zero bytes that the hardware implementation of
+ * crc32c_delta() appends in a single step.
+ */
+static constexpr size_t CRC32C_SHIFT_STEP = 64;
+
+/**
+ * Builds the multipliers for the hardware implementation of crc32c_delta().
+ *
+ * @returns Table of x^(8n - 33) mod P in reflected form, for n zero bytes
+ *          from 5 up to CRC32C_SHIFT_STEP. Smaller n are left 0.
+ */
+static constexpr std::array<uint32_t, CRC32C_SHIFT_STEP + 1>
+make_crc32c_shift_table()
+{
+    std::array<uint32_t, CRC32C_SHIFT_STEP + 1> table {};
+    uint32_t power = 0x80000000; // x^0
+    size_t exponent = 0;
+    for (size_t n = 5; n <= CRC32C_SHIFT_STEP; ++n) {
+        for (; exponent < ((8 * n) - 33); ++exponent) {
+            power = ((power & 1) ? ((power >> 1) ^ CRC32C_POLY) : (power >> 1));
+        }
+        table[n] = power;
+    }
+    return table;
+}
+
+/**
+ * Hardware shift multipliers.
+ */
+static constexpr std::array<uint32_t, CRC32C_SHIFT_STEP + 1>
+    CRC32C_SHIFT_TABLE = make_crc32c_shift_table();
+
+/**
+ * Hardware implementation of appending zero bytes to the raw CRC register.
+ *
+ * Multiplying by x^(8n - 33) and then by x^33, which CRC32 of the 64-bit
+ * product does, multiplies by x^(8n) modulo the polynomial, the same as
+ * appending n zero bytes.
+ */
+__attribute__((target("sse4.2,pclmul"))) static uint32_t crc32c_shift_hw(
+    uint32_t crc,
+    size_t size)
+{
+    while (size >= 5) {
+        const size_t step = std::min(size, CRC32C_SHIFT_STEP);
+        const __m128i product = _mm_clmulepi64_si128(
+            _mm_cvtsi32_si128(static_cast<int>(crc)),
+            _mm_cvtsi32_si128(static_cast<int>(CRC32C_SHIFT_TABLE[step])),
+            0);
+        crc = static_cast<uint32_t>(_mm_crc32_u64(
+            0, static_cast<uint64_t>(_mm_cvtsi128_si64(product))));
+        size -= step;
+    }
+    while (size-- > 0) {
+        crc = _mm_crc32_u8(crc, 0);
+    }
+    return crc;
+}
+
+/**
+ * Hardware implementation of crc32c_delta().
+ */
+__attribute__((target("sse4.2,pclmul"))) static uint32_t crc32c_delta_hw(
+    const uint8_t* lhs,
+    const uint8_t* rhs,
+    size_t size,
+    const size_t tail)
+{
+    uint64_t crc = 0;
+    while (size >= sizeof(uint64_t)) {
+        uint64_t lhs_word;
+        uint64_t rhs_word;
+        std::memcpy(&lhs_word, lhs, sizeof(lhs_word));
+        std::memcpy(&rhs_word, rhs, sizeof(rhs_word));
+        crc = _mm_crc32_u64(crc, lhs_word ^ rhs_word);
+        lhs += sizeof(uint64_t);
+        rhs += sizeof(uint64_t);
+        size -= sizeof(uint64_t);
+    }
+    uint32_t crc32 = static_cast<uint32_t>(crc);
+    while (size-- > 0) {
+        crc32 = _mm_crc32_u8(crc32, static_cast<uint8_t>(*lhs++ ^ *rhs++));
+    }
+    return crc32c_shift_hw(crc32, tail);
+}
+#endif
+#endif
+
+uint32_t crc32c(const void* const data, const size_t size, const uint32_t crc)
+{
+    const uint8_t* const bytes = static_cast<const uint8_t*>(data);
+
+#ifdef RIVER_CRC32C_X86
+    static const bool hw_supported = __builtin_cpu_supports("sse4.2");
+    if (hw_supported) {
+        return ~crc32c_hw(bytes, size, ~crc);
+    }
+#endif
+
+    return ~crc32c_sw(bytes, size, ~crc);
+}
+
+uint32_t crc32c_delta(const void* const old_data,
+                      const void* const new_data,
+                      const size_t size,
+                      const size_t tail)
+{
+    // The checksum of the modified buffer is that of the old one XORed with
+    // the raw checksum of the change followed by the tail as zero bytes. Zero
+    // bytes before the change leave a raw checksum starting from 0 unchanged.
+    const uint8_t* const old_bytes = static_cast<const uint8_t*>(old_data);
+    const uint8_t* const new_bytes = static_cast<const uint8_t*>(new_data);
+
+#if defined(RIVER_CRC32C_X86) && defined(__x86_64__)
+    static const bool hw_supported = (__builtin_cpu_supports("sse4.2")
+                                      && __builtin_cpu_supports("pclmul"));
+    if (hw_supported) {
+        return crc32c_delta_hw(old_bytes, new_bytes, size, tail);
+    }
+#endif
+
+    return crc32c_shift_sw(crc32c_xor_sw(old_bytes, new_bytes, size, 0),
+                           tail);
+}
+} /* namespace river */
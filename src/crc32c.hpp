@@ -0,0 +1,49 @@
+#ifndef RIVER_CRC32C_HPP
+#define RIVER_CRC32C_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace river {
+/**
+ * Computes the CRC-32C (Castagnoli) checksum of a buffer.
+ *
+ * Uses the SSE4.2 CRC32 instruction when the CPU supports it, and a
+ * table-driven software implementation otherwise.
+ *
+ * @param data Buffer to checksum.
+ * @param size Size of buffer in bytes.
+ * @param crc  Checksum of preceding data when checksumming a buffer in pieces,
+ *             or 0 to start a new checksum.
+ *
+ * @returns Checksum.
+ */
+uint32_t crc32c(const void* const data, const size_t size, const uint32_t crc);
+
+/**
+ * Computes how the CRC-32C checksum of a buffer changes when part of it is
+ * modified.
+ *
+ * CRC is linear, so the new checksum is the old one XORed with a value that
+ * only depends on the XOR of the old and new contents of the modified bytes
+ * and on their position from the end of the buffer. This lets a checksum be
+ * updated without reading the unmodified bytes.
+ *
+ * Uses the SSE4.2 CRC32 and PCLMULQDQ instructions when the CPU supports
+ * them, and a table-driven software implementation otherwise.
+ *
+ * @param old_data Old contents of the modified bytes.
+ * @param new_data New contents of the modified bytes.
+ * @param size     Number of modified bytes.
+ * @param tail     Number of bytes following the modified bytes in the
+ *                 buffer.
+ *
+ * @returns Value to XOR into the checksum.
+ */
+uint32_t crc32c_delta(const void* const old_data,
+                      const void* const new_data,
+                      const size_t size,
+                      const size_t tail);
+} /* namespace river */
+
+#endif
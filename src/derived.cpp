@@ -0,0 +1,90 @@
+#include <cassert>
+
+#include "derived.hpp"
+#include "profiler.hpp"
+#include "sampler.hpp"
+
+namespace river {
+void DerivedBase::evaluate(void* const dest) const noexcept
+{
+    assert(dest);
+
+    // Do nothing if not linked to a river.
+    if (!linked()) {
+        return;
+    }
+    River& river = *link->river;
+
+    // Record the access if profiling.
+    if (river.profiler) {
+        river.profiler->record_channel(link->index, /* write= */ false);
+    }
+
+    // Sample the access if sampling.
+    if (river.sampler) {
+        river.sampler->record(link->index, /* write= */ false);
+    }
+
+    Derivation* const derivation = river.derivation(link->index);
+    assert(derivation);
+
+    // Load the input version before reading anything, so that the inputs read
+    // are at least as new as the version. The derived channel's own blocks are
+    // counted too, so that any store over the cached value, e.g., through a
+    // rivulet, forces a recompute. Caching doesn't count as a store.
+    uint64_t version = 1;
+    for (const uint32_t input : derivation->inputs) {
+        version += river.version(river.offsets[input], river.sizes[input]);
+    }
+    version += river.version(link->channel_offset, size());
+
+    // Reads may update the cached value, so the lock is needed even in frame
+    // mode.
+    Lock* const lock = river.lock(link->lock_index);
+
+    // Cached value is current; read it.
+    if (derivation->version.load(std::memory_order_acquire) == version) {
+        if (lock) {
+            lock->acquire();
+        }
+        river.read(link->channel_offset, dest, size());
+        if (lock) {
+            lock->release();
+        }
+        return;
+    }
+
+    // Recompute the value. Inputs are read under their own locks, so the
+    // derived channel's lock can't be held yet.
+    derivation->compute(river, derivation->inputs.data(), dest);
+
+    // Cache the value, unless another reader already cached a newer one.
+    if (lock) {
+        lock->acquire();
+    }
+    if (derivation->version.load(std::memory_order_relaxed) < version) {
+        river.cache(link->channel_offset, dest, size());
+        derivation->version.store(version, std::memory_order_release);
+    }
+    if (lock) {
+        lock->release();
+    }
+}
+
+void DerivedBase::read_input(const River& river,
+                             const uint32_t node,
+                             void* const dest) noexcept
+{
+    // In frame mode, reads see the front buffer, which only changes between
+    // frames, so no lock is needed.
+    Lock* const lock = river.lock(river.lock_indices[node]);
+    const bool use_lock = (lock && !river.frames());
+    if (use_lock) {
+        lock->acquire();
+    }
+    river.read(river.offsets[node], dest, river.sizes[node]);
+    if (use_lock) {
+        lock->release();
+    }
+}
+} /* namespace river */
@@ -0,0 +1,125 @@
+#ifndef RIVER_DERIVED_HPP
+#define RIVER_DERIVED_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "link.hpp"
+
+namespace river {
+/**
+ * A derived channel's inputs and function, and the version of its inputs that
+ * its cached value was computed from.
+ *
+ * @see Builder::derived()
+ */
+struct Derivation final {
+    /**
+     * Index of the derived channel in the river metadata.
+     */
+    uint32_t node;
+
+    /**
+     * Indices of the input channels in the river metadata, in the order they
+     * are passed to the function.
+     */
+    std::vector<uint32_t> inputs;
+
+    /**
+     * Reads the inputs, given their indices, and computes the derived value
+     * into the destination.
+     */
+    std::function<void(const River&, const uint32_t* const, void* const)>
+        compute;
+
+    /**
+     * One more than the version of the inputs and derived channel that the
+     * cached value was computed from, or 0 if it was never computed.
+     */
+    std::atomic<uint64_t> version {0};
+};
+
+/**
+ * Base class for Derived<T> instantiations.
+ */
+class DerivedBase : public Linkable {
+protected:
+    /**
+     * Destructor.
+     */
+    virtual ~DerivedBase() = default;
+
+    /**
+     * @see Derived<T>::size()
+     */
+    virtual size_t size() const = 0;
+
+    /**
+     * Reads the derived value, recomputing it first if any of its inputs, or
+     * the derived channel itself, was written since it was cached.
+     *
+     * This will copy exactly Derived<T>::size() bytes to dest.
+     *
+     * @param dest Read destination.
+     */
+    virtual void evaluate(void* const dest) const noexcept final;
+
+    /**
+     * Reads an input channel under its lock.
+     *
+     * @param river River.
+     * @param node  Index of the input channel in the river metadata.
+     * @param dest  Read destination.
+     */
+    static void read_input(const River& river,
+                           const uint32_t node,
+                           void* const dest) noexcept;
+
+    /**
+     * Befriend Builder so that it can read inputs from derived functions.
+     */
+    friend class Builder;
+};
+
+template <typename T>
+/**
+ * Handle to a derived channel, whose value is computed from other channels.
+ *
+ * The value is cached in the river and only recomputed when read after one of
+ * its inputs was written. Since reads may update the cache, a derived channel
+ * read from several threads at once must be locked. In frame mode, the cache
+ * is updated in the front buffer, between commits.
+ *
+ * @see Builder::derived()
+ */
+class Derived final : public DerivedBase {
+public:
+    /**
+     * Gets the value of the derived channel.
+     *
+     * This returns 0 if the river is not built.
+     *
+     * @returns Derived value.
+     */
+    T get() const noexcept
+    {
+        T val = T();
+        evaluate(&val);
+        return val;
+    }
+
+    /**
+     * Gets the size of the derived channel type in bytes.
+     *
+     * @returns Derived channel type size in bytes.
+     */
+    size_t size() const final override
+    {
+        return sizeof(T);
+    }
+};
+} /* namespace river */
+
+#endif
@@ -0,0 +1,783 @@
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+
+#include "expressions.hpp"
+
+namespace river {
+namespace {
+/**
+ * Loads a channel element from the values read by an evaluation.
+ *
+ * @tparam T Element type.
+ *
+ * @param src Element address.
+ *
+ * @returns Element value.
+ */
+template <typename T>
+double load(const uint8_t* const src) noexcept
+{
+    T value;
+    std::memcpy(&value, src, sizeof(T));
+    return static_cast<double>(value);
+}
+
+/**
+ * Gets whether a character can start a path.
+ *
+ * @param c Character.
+ *
+ * @returns Whether c can start a path.
+ */
+bool starts_path(const char c)
+{
+    return (std::isalpha(static_cast<unsigned char>(c)) || (c == '_'));
+}
+
+/**
+ * Gets whether a character can continue a path token.
+ *
+ * @param c Character.
+ *
+ * @returns Whether c can be in a path token.
+ */
+bool in_path(const char c)
+{
+    return (std::isalnum(static_cast<unsigned char>(c)) || (c == '_'));
+}
+} /* namespace */
+
+class Expressions::Compiler final {
+public:
+    /**
+     * Constructor.
+     *
+     * @param expressions_ Engine that the expression is compiled for.
+     * @param source_      Expression source.
+     */
+    Compiler(const Expressions& expressions_, const std::string& source_)
+        : code()
+        , constants()
+        , loads()
+        , register_count(1)
+        , expressions(expressions_)
+        , source(source_)
+        , pos(0)
+        , depth(0)
+    {
+    }
+
+    /**
+     * Compiles the expression so that its value ends up in register 0.
+     *
+     * @retval 0            Success.
+     * @retval ERR_INVALID  Expression is malformed or too deeply nested.
+     * @retval ERR_NOTFOUND A path isn't an arithmetic channel or an element
+     *                      of one.
+     */
+    int32_t compile()
+    {
+        const int32_t ret = parse_select(0);
+        if (ret != 0) {
+            return ret;
+        }
+        skip_space();
+        return ((pos == source.size()) ? 0 : ERR_INVALID);
+    }
+
+    /**
+     * Compiled code. Load operands are indices in loads, and constant operands
+     * are indices in constants.
+     */
+    std::vector<Instruction> code;
+
+    /**
+     * Constants of the expression.
+     */
+    std::vector<double> constants;
+
+    /**
+     * Channel elements loaded by the expression.
+     */
+    std::vector<Load> loads;
+
+    /**
+     * Number of registers used.
+     */
+    size_t register_count;
+
+private:
+    /**
+     * Maximum nesting depth of an expression, which bounds the recursion.
+     */
+    static constexpr size_t MAX_DEPTH = 256;
+
+    /**
+     * Number of binary operator precedence levels.
+     */
+    static constexpr size_t LEVEL_COUNT = 6;
+
+    /**
+     * A binary operator.
+     */
+    struct Binary final {
+        /**
+         * Precedence level, from loosest to tightest binding.
+         */
+        size_t level;
+
+        /**
+         * Operator token.
+         */
+        const char* token;
+
+        /**
+         * Operation.
+         */
+        Op op;
+    };
+
+    /**
+     * Binary operators. Tokens that are prefixes of other tokens on the same
+     * level come after them.
+     */
+    static constexpr Binary BINARIES[] = {
+        {0, "||", Op::OR},
+        {1, "&&", Op::AND},
+        {2, "==", Op::EQUAL},
+        {2, "!=", Op::NOT_EQUAL},
+        {3, "<=", Op::LESS_EQUAL},
+        {3, ">=", Op::GREATER_EQUAL},
+        {3, "<", Op::LESS},
+        {3, ">", Op::GREATER},
+        {4, "+", Op::ADD},
+        {4, "-", Op::SUBTRACT},
+        {5, "*", Op::MULTIPLY},
+        {5, "/", Op::DIVIDE},
+        {5, "%", Op::MODULO},
+    };
+
+    /**
+     * Engine that the expression is compiled for.
+     */
+    const Expressions& expressions;
+
+    /**
+     * Expression source.
+     */
+    const std::string& source;
+
+    /**
+     * Current position in the source.
+     */
+    size_t pos;
+
+    /**
+     * Current nesting depth.
+     */
+    size_t depth;
+
+    /**
+     * Skips whitespace.
+     */
+    void skip_space()
+    {
+        while ((pos < source.size())
+               && std::isspace(static_cast<unsigned char>(source[pos]))) {
+            ++pos;
+        }
+    }
+
+    /**
+     * Consumes a token if it's next.
+     *
+     * @param token Token.
+     *
+     * @returns Whether the token was consumed.
+     */
+    bool accept(const char* const token)
+    {
+        skip_space();
+        const size_t length = std::strlen(token);
+        if (source.compare(pos, length, token) != 0) {
+            return false;
+        }
+        pos += length;
+        return true;
+    }
+
+    /**
+     * Appends an instruction.
+     *
+     * @param op      Operation.
+     * @param dest    Destination register.
+     * @param first   First operand register.
+     * @param second  Second operand register.
+     * @param operand Operand.
+     */
+    void emit(const Op op,
+              const size_t dest,
+              const size_t first = 0,
+              const size_t second = 0,
+              const uint32_t operand = 0)
+    {
+        code.push_back(Instruction {
+            .op = op,
+            .dest = static_cast<uint8_t>(dest),
+            .first = static_cast<uint8_t>(first),
+            .second = static_cast<uint8_t>(second),
+            .operand = operand,
+        });
+        register_count = std::max({register_count, dest + 1, first + 1,
+                                   second + 1});
+    }
+
+    /**
+     * Parses a conditional expression, or any expression binding tighter.
+     *
+     * @param reg Register to compute the value into. Registers after it are
+     *            free.
+     *
+     * @retval 0            Success.
+     * @retval ERR_INVALID  Expression is malformed or too deeply nested.
+     * @retval ERR_NOTFOUND A path isn't an arithmetic channel.
+     */
+    int32_t parse_select(const size_t reg)
+    {
+        int32_t ret = parse_binary(0, reg);
+        if ((ret != 0) || !accept("?")) {
+            return ret;
+        }
+        if ((reg + 2) >= REGISTER_COUNT) {
+            return ERR_INVALID;
+        }
+        ret = parse_select(reg + 1);
+        if (ret != 0) {
+            return ret;
+        }
+        if (!accept(":")) {
+            return ERR_INVALID;
+        }
+        ret = parse_select(reg + 2);
+        if (ret != 0) {
+            return ret;
+        }
+        emit(Op::SELECT, reg, reg + 1, reg + 2);
+        return 0;
+    }
+
+    /**
+     * Parses a chain of binary operators of a precedence level, or any
+     * expression binding tighter.
+     *
+     * @see Compiler::parse_select()
+     */
+    int32_t parse_binary(const size_t level, const size_t reg)
+    {
+        if (level == LEVEL_COUNT) {
+            return parse_unary(reg);
+        }
+
+        int32_t ret = parse_binary(level + 1, reg);
+        while (ret == 0) {
+            const Binary* const binary =
+                std::find_if(std::begin(BINARIES),
+                             std::end(BINARIES),
+                             [&](const Binary& candidate) {
+                                 return ((candidate.level == level)
+                                         && accept(candidate.token));
+                             });
+            if (binary == std::end(BINARIES)) {
+                break;
+            }
+            if ((reg + 1) >= REGISTER_COUNT) {
+                return ERR_INVALID;
+            }
+            ret = parse_binary(level + 1, reg + 1);
+            if (ret == 0) {
+                emit(binary->op, reg, reg, reg + 1);
+            }
+        }
+        return ret;
+    }
+
+    /**
+     * Parses a unary expression.
+     *
+     * @see Compiler::parse_select()
+     */
+    int32_t parse_unary(const size_t reg)
+    {
+        if (depth == MAX_DEPTH) {
+            return ERR_INVALID;
+        }
+        ++depth;
+
+        int32_t ret = 0;
+        if (accept("-")) {
+            ret = parse_unary(reg);
+            if (ret == 0) {
+                // Fold negative constants.
+                Instruction& last = code.back();
+                if ((last.op == Op::CONSTANT) && (last.dest == reg)) {
+                    constants[last.operand] = -constants[last.operand];
+                } else {
+                    emit(Op::NEGATE, reg, reg);
+                }
+            }
+        } else if (accept("!")) {
+            ret = parse_unary(reg);
+            if (ret == 0) {
+                emit(Op::NOT, reg, reg);
+            }
+        } else {
+            ret = parse_primary(reg);
+        }
+
+        --depth;
+        return ret;
+    }
+
+    /**
+     * Parses a number, path, function call, or parenthesized expression.
+     *
+     * @see Compiler::parse_select()
+     */
+    int32_t parse_primary(const size_t reg)
+    {
+        if (accept("(")) {
+            const int32_t ret = parse_select(reg);
+            if (ret != 0) {
+                return ret;
+            }
+            return (accept(")") ? 0 : ERR_INVALID);
+        }
+
+        skip_space();
+        if (pos == source.size()) {
+            return ERR_INVALID;
+        }
+
+        // Numbers.
+        const char c = source[pos];
+        if (std::isdigit(static_cast<unsigned char>(c)) || (c == '.')) {
+            double number = 0.0;
+            const char* const end = (source.data() + source.size());
+            const std::from_chars_result result =
+                std::from_chars(source.data() + pos, end, number);
+            if (result.ec != std::errc()) {
+                return ERR_INVALID;
+            }
+            pos = static_cast<size_t>(result.ptr - source.data());
+            return constant(reg, number);
+        }
+
+        if (!starts_path(c)) {
+            return ERR_INVALID;
+        }
+
+        // Paths are tokens separated by dots, where every token but the first
+        // may start with a digit.
+        const size_t path_begin = pos;
+        while ((pos < source.size()) && in_path(source[pos])) {
+            ++pos;
+        }
+        while (((pos + 1) < source.size()) && (source[pos] == '.')
+               && in_path(source[pos + 1])) {
+            ++pos;
+            while ((pos < source.size()) && in_path(source[pos])) {
+                ++pos;
+            }
+        }
+        const std::string path = source.substr(path_begin, pos - path_begin);
+
+        // Functions.
+        static const std::pair<const char*, Op> FUNCTIONS[] = {
+            {"abs", Op::ABS},
+            {"min", Op::MIN},
+            {"max", Op::MAX},
+        };
+        for (const auto& function : FUNCTIONS) {
+            if ((path == function.first) && accept("(")) {
+                return call(function.second, reg);
+            }
+        }
+
+        if (path == "true") {
+            return constant(reg, 1.0);
+        }
+        if (path == "false") {
+            return constant(reg, 0.0);
+        }
+
+        return channel(path, reg);
+    }
+
+    /**
+     * Parses the arguments of a function call, whose opening parenthesis was
+     * consumed.
+     *
+     * @param op  Function operation, which is unary for ABS and binary
+     *            otherwise.
+     * @param reg Register to compute the value into.
+     *
+     * @see Compiler::parse_select()
+     */
+    int32_t call(const Op op, const size_t reg)
+    {
+        int32_t ret = parse_select(reg);
+        if (ret != 0) {
+            return ret;
+        }
+        if (op == Op::ABS) {
+            emit(op, reg, reg);
+        } else {
+            if (!accept(",") || ((reg + 1) >= REGISTER_COUNT)) {
+                return ERR_INVALID;
+            }
+            ret = parse_select(reg + 1);
+            if (ret != 0) {
+                return ret;
+            }
+            emit(op, reg, reg, reg + 1);
+        }
+        return (accept(")") ? 0 : ERR_INVALID);
+    }
+
+    /**
+     * Emits a load of a constant.
+     *
+     * @param reg   Register to load into.
+     * @param value Constant value.
+     *
+     * @retval 0 Success.
+     */
+    int32_t constant(const size_t reg, const double value)
+    {
+        constants.push_back(value);
+        emit(Op::CONSTANT,
+             reg,
+             0,
+             0,
+             static_cast<uint32_t>(constants.size() - 1));
+        return 0;
+    }
+
+    /**
+     * Emits a load of a channel, or an element of an array channel if an
+     * index follows.
+     *
+     * @param path Channel path.
+     * @param reg  Register to load into.
+     *
+     * @see Compiler::parse_select()
+     */
+    int32_t channel(const std::string& path, const size_t reg)
+    {
+        static constexpr size_t SCALAR_SIZES[] = {
+            0,
+            sizeof(bool),
+            sizeof(int8_t),
+            sizeof(uint8_t),
+            sizeof(int16_t),
+            sizeof(uint16_t),
+            sizeof(int32_t),
+            sizeof(uint32_t),
+            sizeof(int64_t),
+            sizeof(uint64_t),
+            sizeof(float),
+            sizeof(double),
+        };
+
+        const auto channel_it = expressions.channels.find(path);
+        if (channel_it == expressions.channels.end()) {
+            return ERR_NOTFOUND;
+        }
+        const River& river = *expressions.river;
+        const uint32_t node = channel_it->second;
+        const River::Scalar scalar = river.scalars[node];
+        const size_t element_size = SCALAR_SIZES[static_cast<size_t>(scalar)];
+        const size_t count = (river.sizes[node] / element_size);
+
+        // Parse the element index, if any. Channels that aren't arrays can
+        // only be loaded whole.
+        size_t element = 0;
+        if (accept("[")) {
+            skip_space();
+            const char* const end = (source.data() + source.size());
+            const std::from_chars_result result =
+                std::from_chars(source.data() + pos, end, element);
+            if (result.ec != std::errc()) {
+                return ERR_INVALID;
+            }
+            pos = static_cast<size_t>(result.ptr - source.data());
+            if (!accept("]")) {
+                return ERR_INVALID;
+            }
+            if (element >= count) {
+                return ERR_NOTFOUND;
+            }
+        } else if (count != 1) {
+            return ERR_NOTFOUND;
+        }
+
+        loads.push_back(Load {
+            .offset = static_cast<uint32_t>(river.offsets[node]
+                                            + (element * element_size)),
+            .size = static_cast<uint32_t>(element_size),
+            .lock_index = river.lock_indices[node],
+        });
+
+        // Load operations are in the same order as scalar types.
+        const Op op =
+            static_cast<Op>(static_cast<uint8_t>(Op::LOAD_BOOL)
+                            + (static_cast<uint8_t>(scalar)
+                               - static_cast<uint8_t>(River::Scalar::BOOL)));
+        emit(op, reg, 0, 0, static_cast<uint32_t>(loads.size() - 1));
+        return 0;
+    }
+};
+
+Expressions::Expressions(const std::shared_ptr<River> river_)
+    : river(river_)
+    , channels()
+    , groups()
+    , value_offsets()
+    , values()
+    , constants()
+    , code()
+    , registers(1, 0.0)
+    , results()
+{
+    assert(river);
+
+    for (size_t i = 0; i < river->node_count(); ++i) {
+        if (river->scalars[i] != River::Scalar::NONE) {
+            channels.emplace(river->path(i), static_cast<uint32_t>(i));
+        }
+    }
+}
+
+int32_t Expressions::add(const std::string& source, size_t& index)
+{
+    Compiler compiler(*this, source);
+    const int32_t ret = compiler.compile();
+    if (ret != 0) {
+        return ret;
+    }
+
+    // Resolve the expression's loads and constants to the engine's.
+    const uint32_t constant_base = static_cast<uint32_t>(constants.size());
+    constants.insert(constants.end(),
+                     compiler.constants.begin(),
+                     compiler.constants.end());
+    for (Instruction instruction : compiler.code) {
+        if (instruction.op == Op::CONSTANT) {
+            instruction.operand += constant_base;
+        } else if (instruction.op <= Op::LOAD_DOUBLE) {
+            instruction.operand = allocate(compiler.loads[instruction.operand]);
+        }
+        code.push_back(instruction);
+    }
+
+    index = results.size();
+    code.push_back(Instruction {
+        .op = Op::STORE,
+        .dest = 0,
+        .first = 0,
+        .second = 0,
+        .operand = static_cast<uint32_t>(index),
+    });
+    results.push_back(0.0);
+    if (registers.size() < compiler.register_count) {
+        registers.resize(compiler.register_count, 0.0);
+    }
+    return 0;
+}
+
+void Expressions::evaluate()
+{
+    // Read every channel under each lock with one acquisition. In frame mode,
+    // reads see the front buffer, so no lock is needed.
+    for (const Group& group : groups) {
+        Lock* const lock = river->lock(group.lock_index);
+        const bool use_lock = (lock && !river->frames());
+        if (use_lock) {
+            lock->acquire();
+        }
+        for (const Copy& copy : group.copies) {
+            river->read(copy.river_offset,
+                        values.data() + copy.value_offset,
+                        copy.size);
+        }
+        if (use_lock) {
+            lock->release();
+        }
+    }
+
+    double* const regs = registers.data();
+    const uint8_t* const data = values.data();
+    for (const Instruction& instruction : code) {
+        double& dest = regs[instruction.dest];
+        const double first = regs[instruction.first];
+        const double second = regs[instruction.second];
+        const uint8_t* const value = (data + instruction.operand);
+        switch (instruction.op) {
+            case Op::LOAD_BOOL:
+                dest = ((*value != 0) ? 1.0 : 0.0);
+                break;
+            case Op::LOAD_INT8:
+                dest = load<int8_t>(value);
+                break;
+            case Op::LOAD_UINT8:
+                dest = load<uint8_t>(value);
+                break;
+            case Op::LOAD_INT16:
+                dest = load<int16_t>(value);
+                break;
+            case Op::LOAD_UINT16:
+                dest = load<uint16_t>(value);
+                break;
+            case Op::LOAD_INT32:
+                dest = load<int32_t>(value);
+                break;
+            case Op::LOAD_UINT32:
+                dest = load<uint32_t>(value);
+                break;
+            case Op::LOAD_INT64:
+                dest = load<int64_t>(value);
+                break;
+            case Op::LOAD_UINT64:
+                dest = load<uint64_t>(value);
+                break;
+            case Op::LOAD_FLOAT:
+                dest = load<float>(value);
+                break;
+            case Op::LOAD_DOUBLE:
+                dest = load<double>(value);
+                break;
+            case Op::CONSTANT:
+                dest = constants[instruction.operand];
+                break;
+            case Op::NEGATE:
+                dest = -first;
+                break;
+            case Op::NOT:
+                dest = ((first == 0.0) ? 1.0 : 0.0);
+                break;
+            case Op::ABS:
+                dest = std::fabs(first);
+                break;
+            case Op::ADD:
+                dest = (first + second);
+                break;
+            case Op::SUBTRACT:
+                dest = (first - second);
+                break;
+            case Op::MULTIPLY:
+                dest = (first * second);
+                break;
+            case Op::DIVIDE:
+                dest = (first / second);
+                break;
+            case Op::MODULO:
+                dest = std::fmod(first, second);
+                break;
+            case Op::MIN:
+                dest = std::min(first, second);
+                break;
+            case Op::MAX:
+                dest = std::max(first, second);
+                break;
+            case Op::LESS:
+                dest = ((first < second) ? 1.0 : 0.0);
+                break;
+            case Op::LESS_EQUAL:
+                dest = ((first <= second) ? 1.0 : 0.0);
+                break;
+            case Op::GREATER:
+                dest = ((first > second) ? 1.0 : 0.0);
+                break;
+            case Op::GREATER_EQUAL:
+                dest = ((first >= second) ? 1.0 : 0.0);
+                break;
+            case Op::EQUAL:
+                dest = ((first == second) ? 1.0 : 0.0);
+                break;
+            case Op::NOT_EQUAL:
+                dest = ((first != second) ? 1.0 : 0.0);
+                break;
+            case Op::AND:
+                dest = (((first != 0.0) && (second != 0.0)) ? 1.0 : 0.0);
+                break;
+            case Op::OR:
+                dest = (((first != 0.0) || (second != 0.0)) ? 1.0 : 0.0);
+                break;
+            case Op::SELECT:
+                dest = ((dest != 0.0) ? first : second);
+                break;
+            case Op::STORE:
+                results[instruction.operand] = dest;
+                break;
+        }
+    }
+}
+
+double Expressions::value(const size_t index) const
+{
+    assert(index < results.size());
+    return results[index];
+}
+
+size_t Expressions::size() const
+{
+    return results.size();
+}
+
+uint32_t Expressions::allocate(const Load& load)
+{
+    // Each channel element is read once, however many expressions use it.
+    const auto offset_it = value_offsets.find(load.offset);
+    if (offset_it != value_offsets.end()) {
+        return offset_it->second;
+    }
+    const uint32_t value_offset = static_cast<uint32_t>(values.size());
+    values.resize(values.size() + load.size);
+    value_offsets.emplace(load.offset, value_offset);
+
+    auto group_it = std::find_if(groups.begin(),
+                                 groups.end(),
+                                 [&load](const Group& group) {
+                                     return (group.lock_index
+                                             == load.lock_index);
+                                 });
+    if (group_it == groups.end()) {
+        groups.push_back(Group {
+            .lock_index = load.lock_index,
+            .copies = {},
+        });
+        group_it = (groups.end() - 1);
+    }
+
+    // Extend the last copy if the element follows it in both the river and
+    // the values, e.g., consecutive channels of a rivulet.
+    std::vector<Copy>& copies = group_it->copies;
+    if (!copies.empty()
+        && ((copies.back().river_offset + copies.back().size) == load.offset)
+        && ((copies.back().value_offset + copies.back().size)
+            == value_offset)) {
+        copies.back().size += load.size;
+    } else {
+        copies.push_back(Copy {
+            .river_offset = load.offset,
+            .value_offset = value_offset,
+            .size = load.size,
+        });
+    }
+    return value_offset;
+}
+} /* namespace river */
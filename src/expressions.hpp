@@ -0,0 +1,293 @@
+#ifndef RIVER_EXPRESSIONS_HPP
+#define RIVER_EXPRESSIONS_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "river.hpp"
+
+namespace river {
+/**
+ * Engine that evaluates expressions over channels, e.g., limit checks and
+ * derived values that operators reconfigure at runtime.
+ *
+ * Expressions are parsed once and compiled into bytecode for a register
+ * machine, with channel paths resolved against the river. Evaluating reads
+ * every channel that any expression uses, under each lock with a single
+ * acquisition, then runs the bytecode of all expressions in one loop over
+ * the copied values.
+ *
+ * Expressions use C syntax and precedence over numbers, `true`, `false`, and
+ * channel paths, e.g., `control.pressure > 14.7 || !control.pressure.valid`.
+ * Supported operators are `?:`, `||`, `&&`, `==`, `!=`, `<`, `<=`, `>`, `>=`,
+ * `+`, `-`, `*`, `/`, `%`, unary `-`, and `!`, along with the functions
+ * `abs()`, `min()`, and `max()`. Channels must be of an arithmetic type, and
+ * elements of array channels are accessed with constant indices, e.g.,
+ * `control.gains[1]`. All values are evaluated as doubles, with comparisons
+ * and logical operators yielding 1 or 0.
+ *
+ * Like the IPC server, evaluation reads the river directly, bypassing the
+ * race detector and instrumentation.
+ */
+class Expressions final {
+public:
+    /**
+     * Error codes that Expressions::add() can return.
+     * @{
+     */
+    static constexpr int32_t ERR_INVALID = 1;
+    static constexpr int32_t ERR_NOTFOUND = 2;
+    /**
+     * @}
+     */
+
+    /**
+     * Constructor.
+     *
+     * @param river River that expressions are evaluated over.
+     */
+    explicit Expressions(const std::shared_ptr<River> river);
+
+    /**
+     * Compiles an expression and adds it to the engine.
+     *
+     * @param      source Expression source.
+     * @param[out] index  On success, index of the expression's value.
+     *
+     * @retval 0            Success.
+     * @retval ERR_INVALID  Expression is malformed or too deeply nested.
+     * @retval ERR_NOTFOUND A path isn't an arithmetic channel or an element
+     *                      of one.
+     */
+    int32_t add(const std::string& source, size_t& index);
+
+    /**
+     * Evaluates all expressions.
+     *
+     * This never allocates.
+     */
+    void evaluate();
+
+    /**
+     * Gets the value of an expression from the last evaluation.
+     *
+     * Values are 0 until the first evaluation.
+     *
+     * @param index Expression index.
+     *
+     * @returns Expression value.
+     */
+    double value(const size_t index) const;
+
+    /**
+     * Gets the number of expressions.
+     *
+     * @returns Expression count.
+     */
+    size_t size() const;
+
+private:
+    /**
+     * Bytecode operations.
+     *
+     * Loads are specialized by channel type, so that conversions don't branch
+     * on the type at runtime.
+     */
+    enum class Op : uint8_t {
+        LOAD_BOOL,
+        LOAD_INT8,
+        LOAD_UINT8,
+        LOAD_INT16,
+        LOAD_UINT16,
+        LOAD_INT32,
+        LOAD_UINT32,
+        LOAD_INT64,
+        LOAD_UINT64,
+        LOAD_FLOAT,
+        LOAD_DOUBLE,
+        CONSTANT,
+        NEGATE,
+        NOT,
+        ABS,
+        ADD,
+        SUBTRACT,
+        MULTIPLY,
+        DIVIDE,
+        MODULO,
+        MIN,
+        MAX,
+        LESS,
+        LESS_EQUAL,
+        GREATER,
+        GREATER_EQUAL,
+        EQUAL,
+        NOT_EQUAL,
+        AND,
+        OR,
+        SELECT,
+        STORE,
+    };
+
+    /**
+     * A bytecode instruction.
+     *
+     * Unary operations compute dest from first, and binary operations compute
+     * dest from first and second. SELECT writes first to dest if dest is
+     * nonzero, and second otherwise.
+     */
+    struct Instruction final {
+        /**
+         * Operation.
+         */
+        Op op;
+
+        /**
+         * Destination register.
+         */
+        uint8_t dest;
+
+        /**
+         * First operand register.
+         */
+        uint8_t first;
+
+        /**
+         * Second operand register.
+         */
+        uint8_t second;
+
+        /**
+         * Offset of the value for loads, constant index for CONSTANT, and
+         * expression index for STORE.
+         */
+        uint32_t operand;
+    };
+
+    /**
+     * A copy of river memory into the values read by an evaluation.
+     */
+    struct Copy final {
+        /**
+         * Byte offset in the river backing memory.
+         */
+        uint32_t river_offset;
+
+        /**
+         * Byte offset in the values.
+         */
+        uint32_t value_offset;
+
+        /**
+         * Size in bytes.
+         */
+        uint32_t size;
+    };
+
+    /**
+     * Copies of memory protected by the same lock.
+     */
+    struct Group final {
+        /**
+         * Lock index in the river lock table, or River::NO_LOCK.
+         */
+        uint32_t lock_index;
+
+        /**
+         * Copies, which are coalesced where contiguous.
+         */
+        std::vector<Copy> copies;
+    };
+
+    /**
+     * A channel element loaded by an expression being compiled.
+     */
+    struct Load final {
+        /**
+         * Byte offset in the river backing memory.
+         */
+        uint32_t offset;
+
+        /**
+         * Size in bytes.
+         */
+        uint32_t size;
+
+        /**
+         * Lock index in the river lock table, or River::NO_LOCK.
+         */
+        uint32_t lock_index;
+    };
+
+    /**
+     * Parser that compiles one expression.
+     */
+    class Compiler;
+
+    /**
+     * Number of registers, which is limited by their 8-bit indices.
+     */
+    static constexpr size_t REGISTER_COUNT = 256;
+
+    /**
+     * River that expressions are evaluated over.
+     */
+    const std::shared_ptr<River> river;
+
+    /**
+     * Index of each arithmetic channel in the river metadata by path.
+     */
+    std::unordered_map<std::string, uint32_t> channels;
+
+    /**
+     * Copies made by each evaluation, grouped by lock.
+     */
+    std::vector<Group> groups;
+
+    /**
+     * Offset in the values of each channel element read, by offset in the
+     * river backing memory.
+     */
+    std::unordered_map<uint32_t, uint32_t> value_offsets;
+
+    /**
+     * Channel values read by the last evaluation, back to back.
+     */
+    std::vector<uint8_t> values;
+
+    /**
+     * Constants of all expressions.
+     */
+    std::vector<double> constants;
+
+    /**
+     * Bytecode of all expressions, back to back. Each expression ends with a
+     * STORE of its value.
+     */
+    std::vector<Instruction> code;
+
+    /**
+     * Registers, with room for the registers used by any expression.
+     */
+    std::vector<double> registers;
+
+    /**
+     * Values of the expressions.
+     */
+    std::vector<double> results;
+
+    /**
+     * Allocates the values read for a channel element, reading it with the
+     * other memory under its lock.
+     *
+     * @param load Channel element.
+     *
+     * @returns Offset of the element in the values.
+     */
+    uint32_t allocate(const Load& load);
+};
+} /* namespace river */
+
+#endif
@@ -0,0 +1,225 @@
+#include <algorithm>
+
+#include "flags.hpp"
+#include "profiler.hpp"
+#include "sampler.hpp"
+#include "tracer.hpp"
+
+namespace river {
+Flags::Flags()
+    : flag_count(0)
+{
+}
+
+void Flags::set(const size_t index) noexcept
+{
+    update(index, /* value= */ true);
+}
+
+void Flags::clear(const size_t index) noexcept
+{
+    update(index, /* value= */ false);
+}
+
+bool Flags::test(const size_t index) const noexcept
+{
+    // Do nothing if not linked to a river.
+    if (!linked() || (index >= flag_count)) {
+        return false;
+    }
+
+    // Record the access if profiling.
+    if (link->river->profiler) {
+        link->river->profiler->record_channel(link->index, /* write= */ false);
+    }
+
+    // Sample the access if sampling.
+    if (link->river->sampler) {
+        link->river->sampler->record(link->index, /* write= */ false);
+    }
+
+    // Look up the lock protecting the linked memory, if any.
+    Lock* const lock = link->river->lock(link->lock_index);
+
+    // Trace lock and access events if tracing.
+    Tracer* const tracer = link->river->tracer.get();
+
+    // Acquire lock if there is one. In frame mode, reads see the front buffer,
+    // which only changes between frames, so no lock is needed.
+    const bool use_lock = (lock && !link->river->frames());
+    if (use_lock) {
+        if (tracer) {
+            tracer->record(Tracer::Kind::LOCK_WAIT, link->index);
+        }
+        lock->acquire();
+        if (tracer) {
+            tracer->record(Tracer::Kind::LOCK_ACQUIRED, link->index);
+        }
+    }
+
+    if (tracer) {
+        tracer->record(Tracer::Kind::READ_BEGIN, link->index);
+    }
+    const uint64_t word =
+        link->river->load_word(link->channel_offset + ((index / 64) * 8));
+    if (tracer) {
+        tracer->record(Tracer::Kind::READ_END, link->index);
+    }
+
+    // Release lock if there is one.
+    if (use_lock) {
+        if (tracer) {
+            tracer->record(Tracer::Kind::LOCK_RELEASE, link->index);
+        }
+        lock->release();
+    }
+
+    return ((word >> (index % 64)) & 1);
+}
+
+bool Flags::any() const noexcept
+{
+    return (scan(/* any= */ true) > 0);
+}
+
+size_t Flags::count() const noexcept
+{
+    return scan(/* any= */ false);
+}
+
+size_t Flags::size() const noexcept
+{
+    return (linked() ? flag_count : 0);
+}
+
+void Flags::update(const size_t index, const bool value) noexcept
+{
+    // Do nothing if not linked to a river.
+    if (!linked() || (index >= flag_count)) {
+        return;
+    }
+
+    // Record the access if profiling.
+    if (link->river->profiler) {
+        link->river->profiler->record_channel(link->index, /* write= */ true);
+    }
+
+    // Sample the access if sampling.
+    if (link->river->sampler) {
+        link->river->sampler->record(link->index, /* write= */ true);
+    }
+
+    // Look up the lock protecting the linked memory, if any.
+    Lock* const lock = link->river->lock(link->lock_index);
+
+    // Trace lock and access events if tracing.
+    Tracer* const tracer = link->river->tracer.get();
+
+    // Acquire lock if there is one.
+    if (lock) {
+        if (tracer) {
+            tracer->record(Tracer::Kind::LOCK_WAIT, link->index);
+        }
+        lock->acquire();
+        if (tracer) {
+            tracer->record(Tracer::Kind::LOCK_ACQUIRED, link->index);
+        }
+    }
+
+    if (tracer) {
+        tracer->record(Tracer::Kind::WRITE_BEGIN, link->index);
+    }
+    link->river->update_bits(link->channel_offset + ((index / 64) * 8),
+                             uint64_t(1) << (index % 64),
+                             value);
+    if (tracer) {
+        tracer->record(Tracer::Kind::WRITE_END, link->index);
+    }
+
+    // Release lock if there is one.
+    if (lock) {
+        if (tracer) {
+            tracer->record(Tracer::Kind::LOCK_RELEASE, link->index);
+        }
+        lock->release();
+    }
+}
+
+size_t Flags::scan(const bool any) const noexcept
+{
+    // Do nothing if not linked to a river.
+    if (!linked()) {
+        return 0;
+    }
+
+    // Record the access if profiling.
+    if (link->river->profiler) {
+        link->river->profiler->record_channel(link->index, /* write= */ false);
+    }
+
+    // Sample the access if sampling.
+    if (link->river->sampler) {
+        link->river->sampler->record(link->index, /* write= */ false);
+    }
+
+    // Look up the lock protecting the linked memory, if any.
+    Lock* const lock = link->river->lock(link->lock_index);
+
+    // Trace lock and access events if tracing.
+    Tracer* const tracer = link->river->tracer.get();
+
+    // Acquire lock if there is one. In frame mode, reads see the front buffer,
+    // which only changes between frames, so no lock is needed.
+    const bool use_lock = (lock && !link->river->frames());
+    if (use_lock) {
+        if (tracer) {
+            tracer->record(Tracer::Kind::LOCK_WAIT, link->index);
+        }
+        lock->acquire();
+        if (tracer) {
+            tracer->record(Tracer::Kind::LOCK_ACQUIRED, link->index);
+        }
+    }
+
+    // Read the flags a cache line at a time. Each word is loaded atomically,
+    // like in Flags::test(), since unlocked flags may be set concurrently. The
+    // words in a line are counted independently, so that the compiler can
+    // vectorize the loop. Bits past the last flag are never set, so they
+    // don't need to be masked off.
+    if (tracer) {
+        tracer->record(Tracer::Kind::READ_BEGIN, link->index);
+    }
+    size_t set_count = 0;
+    uint64_t words[8];
+    for (size_t pos = 0; pos < link->channel_size; pos += sizeof(words)) {
+        const size_t size = std::min(sizeof(words), link->channel_size - pos);
+        for (size_t i = 0; i < (size / sizeof(uint64_t)); ++i) {
+            words[i] = link->river->load_word(link->channel_offset + pos
+                                              + (i * sizeof(uint64_t)));
+        }
+
+        size_t line_count = 0;
+        for (size_t i = 0; i < (size / sizeof(uint64_t)); ++i) {
+            line_count += __builtin_popcountll(words[i]);
+        }
+        set_count += line_count;
+
+        if (any && (set_count > 0)) {
+            break;
+        }
+    }
+    if (tracer) {
+        tracer->record(Tracer::Kind::READ_END, link->index);
+    }
+
+    // Release lock if there is one.
+    if (use_lock) {
+        if (tracer) {
+            tracer->record(Tracer::Kind::LOCK_RELEASE, link->index);
+        }
+        lock->release();
+    }
+
+    return set_count;
+}
+} /* namespace river */
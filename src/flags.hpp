@@ -0,0 +1,112 @@
+#ifndef RIVER_FLAGS_HPP
+#define RIVER_FLAGS_HPP
+
+#include <cstdint>
+
+#include "link.hpp"
+
+namespace river {
+/**
+ * Handle to a river channel holding a fixed number of boolean flags, packed
+ * into bits.
+ *
+ * Flags take one bit each rather than the byte a Channel<bool> takes, and
+ * setting or clearing a flag is an atomic read-modify-write of the word that
+ * holds it, so unlocked flags in the same word can be updated from different
+ * threads. Since bit updates are atomic, unlocked flags are not checked by the
+ * race detector.
+ *
+ * @see Builder::flags()
+ */
+class Flags final : public Linkable {
+public:
+    /**
+     * Default constructor. The handle is not linked until it's passed to
+     * Builder::flags() and the river is built.
+     */
+    Flags();
+
+    /**
+     * Sets a flag.
+     *
+     * This has no effect if the river is not built or the index is out of
+     * range.
+     *
+     * @param index Flag index.
+     */
+    void set(const size_t index) noexcept;
+
+    /**
+     * Clears a flag.
+     *
+     * This has no effect if the river is not built or the index is out of
+     * range.
+     *
+     * @param index Flag index.
+     */
+    void clear(const size_t index) noexcept;
+
+    /**
+     * Gets whether a flag is set.
+     *
+     * This returns false if the river is not built or the index is out of
+     * range.
+     *
+     * @param index Flag index.
+     *
+     * @returns Whether the flag is set.
+     */
+    bool test(const size_t index) const noexcept;
+
+    /**
+     * Gets whether any flag is set.
+     *
+     * @returns Whether any flag is set.
+     */
+    bool any() const noexcept;
+
+    /**
+     * Gets the number of flags that are set.
+     *
+     * @returns Set flag count.
+     */
+    size_t count() const noexcept;
+
+    /**
+     * Gets the number of flags.
+     *
+     * @returns Flag count.
+     */
+    size_t size() const noexcept;
+
+private:
+    /**
+     * Befriend Builder so that it can set the flag count.
+     */
+    friend class Builder;
+
+    /**
+     * Number of flags.
+     */
+    size_t flag_count;
+
+    /**
+     * Sets or clears a flag.
+     *
+     * @param index Flag index.
+     * @param value Whether to set the flag.
+     */
+    void update(const size_t index, const bool value) noexcept;
+
+    /**
+     * Scans the words holding the flags, stopping early if requested.
+     *
+     * @param any If true, stop at the first set flag.
+     *
+     * @returns Number of set flags seen.
+     */
+    size_t scan(const bool any) const noexcept;
+};
+} /* namespace river */
+
+#endif
@@ -0,0 +1,313 @@
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+
+#include "history.hpp"
+
+namespace river {
+namespace {
+/**
+ * Converts a value of a channel element type to a double.
+ *
+ * @param src Value.
+ *
+ * @returns Converted value.
+ */
+template <typename T>
+double convert(const void* const src)
+{
+    T value;
+    std::memcpy(&value, src, sizeof(value));
+    return static_cast<double>(value);
+}
+
+/**
+ * Reads the steady clock.
+ *
+ * @returns Time in nanoseconds.
+ */
+uint64_t steady_now()
+{
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+}
+} /* namespace */
+
+History::History(const std::vector<std::string>& paths_,
+                 const Options& options)
+    : paths(paths_)
+    , resolutions()
+    , clock(options.clock ? options.clock : steady_now)
+    , series(nullptr)
+    , series_size(0)
+    , series_indices()
+    , series_paths()
+{
+    // Resolutions without buckets would divide by 0.
+    for (const Resolution& resolution : options.resolutions) {
+        if ((resolution.period > 0) && (resolution.count > 0)) {
+            resolutions.push_back(resolution);
+        }
+    }
+    std::sort(resolutions.begin(),
+              resolutions.end(),
+              [](const Resolution& lhs, const Resolution& rhs) {
+                  return (lhs.period < rhs.period);
+              });
+}
+
+History::History(const std::vector<std::string>& paths_)
+    : History(paths_, Options())
+{
+}
+
+size_t History::scalar_size(const River::Scalar scalar)
+{
+    switch (scalar) {
+    case River::Scalar::BOOL:
+        return sizeof(bool);
+    case River::Scalar::INT8:
+    case River::Scalar::UINT8:
+        return 1;
+    case River::Scalar::INT16:
+    case River::Scalar::UINT16:
+        return 2;
+    case River::Scalar::INT32:
+    case River::Scalar::UINT32:
+    case River::Scalar::FLOAT:
+        return 4;
+    case River::Scalar::INT64:
+    case River::Scalar::UINT64:
+    case River::Scalar::DOUBLE:
+        return 8;
+    case River::Scalar::NONE:
+        break;
+    }
+    return 0;
+}
+
+double History::load(const River::Scalar scalar, const void* const src)
+{
+    switch (scalar) {
+    case River::Scalar::BOOL:
+        return convert<bool>(src);
+    case River::Scalar::INT8:
+        return convert<int8_t>(src);
+    case River::Scalar::UINT8:
+        return convert<uint8_t>(src);
+    case River::Scalar::INT16:
+        return convert<int16_t>(src);
+    case River::Scalar::UINT16:
+        return convert<uint16_t>(src);
+    case River::Scalar::INT32:
+        return convert<int32_t>(src);
+    case River::Scalar::UINT32:
+        return convert<uint32_t>(src);
+    case River::Scalar::INT64:
+        return convert<int64_t>(src);
+    case River::Scalar::UINT64:
+        return convert<uint64_t>(src);
+    case River::Scalar::FLOAT:
+        return convert<float>(src);
+    case River::Scalar::DOUBLE:
+        return convert<double>(src);
+    case River::Scalar::NONE:
+        break;
+    }
+    return 0.0;
+}
+
+int32_t History::query(const std::string& path,
+                       const uint64_t begin,
+                       const uint64_t end,
+                       const size_t points,
+                       std::vector<Point>& result) const
+{
+    const auto found =
+        std::find(series_paths.begin(), series_paths.end(), path);
+    if (found == series_paths.end()) {
+        return ERR_NOTFOUND;
+    }
+    const Series& channel_series = series[found - series_paths.begin()];
+
+    result.clear();
+    if ((end <= begin) || resolutions.empty()) {
+        return 0;
+    }
+
+    // Pick the coarsest resolution that satisfies the request, falling back
+    // to the finest one that still holds the start of the range.
+    const uint64_t time = now();
+    const auto holds = [begin, time](const Resolution& resolution) {
+        return (((begin / resolution.period) + resolution.count)
+                > (time / resolution.period));
+    };
+    const size_t none = resolutions.size();
+    size_t chosen = none;
+    for (size_t i = resolutions.size(); (i > 0) && (chosen == none); --i) {
+        const Resolution& resolution = resolutions[i - 1];
+        const uint64_t buckets = (((end - 1) / resolution.period)
+                                  - (begin / resolution.period) + 1);
+        if ((buckets >= points) && holds(resolution)) {
+            chosen = i - 1;
+        }
+    }
+    for (size_t i = 0; (i < resolutions.size()) && (chosen == none); ++i) {
+        if (holds(resolutions[i])) {
+            chosen = i;
+        }
+    }
+    if (chosen == none) {
+        chosen = resolutions.size() - 1;
+    }
+    const Resolution& resolution = resolutions[chosen];
+
+    // Skip to the chosen ring.
+    size_t ring = 0;
+    for (size_t i = 0; i < chosen; ++i) {
+        ring += resolutions[i].count;
+    }
+
+    // Only the last count buckets up to now can still be in the ring.
+    const uint64_t current = (time / resolution.period);
+    const uint64_t oldest = ((current >= resolution.count)
+                                 ? (current - resolution.count + 1)
+                                 : 0);
+    const uint64_t last = std::min((end - 1) / resolution.period, current);
+    const uint64_t first =
+        std::max<uint64_t>((begin / resolution.period), oldest);
+    if (first > last) {
+        return 0;
+    }
+
+    // Allocate outside the spin lock.
+    result.reserve(static_cast<size_t>(last - first + 1));
+
+    while (channel_series.busy.exchange(true, std::memory_order_acquire)) {
+    }
+    for (uint64_t index = first; index <= last; ++index) {
+        const Bucket& bucket =
+            channel_series.buckets[ring + (index % resolution.count)];
+        if (bucket.index == index) {
+            result.push_back({index * resolution.period,
+                              resolution.period,
+                              bucket.min,
+                              bucket.max,
+                              (bucket.sum / static_cast<double>(bucket.count)),
+                              bucket.count});
+        }
+    }
+    channel_series.busy.store(false, std::memory_order_release);
+
+    return 0;
+}
+
+uint64_t History::now() const
+{
+    return clock();
+}
+
+std::vector<uint32_t> History::find_channels(const River& river) const
+{
+    // A channel is recorded if its path or the path of a rivulet above it is
+    // listed.
+    std::vector<bool> recorded(river.node_count(), false);
+    for (const std::string& path : paths) {
+        bool matched = false;
+        for (size_t i = 0; i < river.node_count(); ++i) {
+            const River::Scalar scalar = river.scalars[i];
+            if ((scalar == River::Scalar::NONE)
+                || (river.sizes[i] != scalar_size(scalar))) {
+                continue;
+            }
+            const std::string node_path = river.path(i);
+            if ((node_path == path)
+                || ((node_path.size() > path.size())
+                    && (node_path.compare(0, path.size(), path) == 0)
+                    && (node_path[path.size()] == '.'))) {
+                recorded[i] = true;
+                matched = true;
+            }
+        }
+        if (!matched) {
+            return std::vector<uint32_t>();
+        }
+    }
+
+    std::vector<uint32_t> channels;
+    for (size_t i = 0; i < recorded.size(); ++i) {
+        if (recorded[i]) {
+            channels.push_back(static_cast<uint32_t>(i));
+        }
+    }
+    return channels;
+}
+
+bool History::can_attach(const River& river) const
+{
+    return (paths.empty() || !find_channels(river).empty());
+}
+
+void History::attach(const River& river)
+{
+    const std::vector<uint32_t> channels = find_channels(river);
+
+    size_t ring_size = 0;
+    for (const Resolution& resolution : resolutions) {
+        ring_size += resolution.count;
+    }
+
+    series_size = channels.size();
+    series.reset(new Series[series_size]);
+    series_indices.assign(river.node_count(), NO_SERIES);
+    series_paths.clear();
+    for (size_t i = 0; i < series_size; ++i) {
+        Series& channel_series = series[i];
+        channel_series.scalar = river.scalars[channels[i]];
+        channel_series.busy.store(false, std::memory_order_relaxed);
+        channel_series.buckets.reset(new Bucket[ring_size]);
+        for (size_t j = 0; j < ring_size; ++j) {
+            channel_series.buckets[j] = {UINT64_MAX, 0.0, 0.0, 0.0, 0};
+        }
+        series_indices[channels[i]] = static_cast<uint32_t>(i);
+        series_paths.push_back(river.path(channels[i]));
+    }
+}
+
+void History::record(const size_t index, const void* const src)
+{
+    assert(src);
+
+    if ((index >= series_indices.size())
+        || (series_indices[index] == NO_SERIES)) {
+        return;
+    }
+    Series& channel_series = series[series_indices[index]];
+    const double value = load(channel_series.scalar, src);
+    const uint64_t time = clock();
+
+    while (channel_series.busy.exchange(true, std::memory_order_acquire)) {
+    }
+    Bucket* ring = channel_series.buckets.get();
+    for (const Resolution& resolution : resolutions) {
+        const uint64_t bucket_index = (time / resolution.period);
+        Bucket& bucket = ring[bucket_index % resolution.count];
+        if (bucket.index == bucket_index) {
+            bucket.min = std::min(bucket.min, value);
+            bucket.max = std::max(bucket.max, value);
+            bucket.sum += value;
+            ++bucket.count;
+        } else if ((bucket.index == UINT64_MAX)
+                   || (bucket.index < bucket_index)) {
+            // Reuse the bucket once the ring wraps around. Writes timestamped
+            // before the bucket's current interval are dropped.
+            bucket = {bucket_index, value, value, value, 1};
+        }
+        ring += resolution.count;
+    }
+    channel_series.busy.store(false, std::memory_order_release);
+}
+} /* namespace river */
@@ -0,0 +1,326 @@
+#ifndef RIVER_HISTORY_HPP
+#define RIVER_HISTORY_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "river.hpp"
+
+namespace river {
+/**
+ * Downsampled history of channel values, for trends over longer durations
+ * than a per-write trace can hold.
+ *
+ * A history is attached to a river when it's built by passing it in
+ * Builder::Options, and records the arithmetic channels at or under a set of
+ * paths. Every write of a recorded channel through its handle updates the
+ * minimum, maximum, sum, and count of the current bucket at each resolution,
+ * by default 1 s, 1 min, and 1 h. Buckets are kept in rings that are
+ * allocated when the history is attached, so recording never allocates, and
+ * the oldest bucket of a resolution is reused once the ring wraps around.
+ *
+ * Recording takes a per-channel spin lock that only contends with queries of
+ * the same channel. Writes bypassing handles, e.g., through the IPC server or
+ * a replicator, are not recorded.
+ */
+class History final {
+public:
+    /**
+     * Error codes that History::query() can return.
+     * @{
+     */
+    static constexpr int32_t ERR_NOTFOUND = 1;
+    /**
+     * @}
+     */
+
+    /**
+     * A resolution that values are aggregated at.
+     */
+    struct Resolution final {
+        /**
+         * Duration of each bucket in nanoseconds.
+         */
+        uint64_t period;
+
+        /**
+         * Number of buckets kept, so that the resolution covers the last
+         * (period * count) nanoseconds.
+         */
+        size_t count;
+    };
+
+    /**
+     * Aggregate of the values written during one bucket.
+     */
+    struct Point final {
+        /**
+         * Start of the bucket in nanoseconds.
+         */
+        uint64_t time;
+
+        /**
+         * Duration of the bucket in nanoseconds.
+         */
+        uint64_t period;
+
+        /**
+         * Smallest value written.
+         */
+        double min;
+
+        /**
+         * Largest value written.
+         */
+        double max;
+
+        /**
+         * Mean of the values written.
+         */
+        double mean;
+
+        /**
+         * Number of values written.
+         */
+        uint64_t count;
+    };
+
+    /**
+     * History options.
+     */
+    struct Options final {
+        /**
+         * Resolutions to aggregate at. The default keeps 10 min of 1 s
+         * buckets, 1 day of 1 min buckets, and 30 days of 1 h buckets, which
+         * takes about 110 KiB per recorded channel.
+         */
+        std::vector<Resolution> resolutions = {
+            {1000000000ull, 600},
+            {60000000000ull, 1440},
+            {3600000000000ull, 720},
+        };
+
+        /**
+         * Clock that timestamps writes, in nanoseconds. If null, the steady
+         * clock is used.
+         */
+        std::function<uint64_t()> clock;
+    };
+
+    /**
+     * Constructor.
+     *
+     * @param paths   Paths of the channels to record. A path may also name a
+     *                rivulet, to record every arithmetic channel under it.
+     *                Array channels are not recorded.
+     * @param options History options.
+     */
+    History(const std::vector<std::string>& paths, const Options& options);
+
+    /**
+     * Constructor, with default options.
+     *
+     * @param paths Paths of the channels to record.
+     */
+    explicit History(const std::vector<std::string>& paths);
+
+    /**
+     * Gets the aggregates of a channel over a time range, at the coarsest
+     * resolution that has at least the requested number of buckets in the
+     * range and still holds its start. If no resolution satisfies both, the
+     * finest resolution that holds the start is used, or the coarsest if
+     * none does.
+     *
+     * Buckets that no value was written in are skipped, so fewer points than
+     * requested can be returned.
+     *
+     * @param      path   Channel path.
+     * @param      begin  Start of the time range in nanoseconds, inclusive.
+     * @param      end    End of the time range in nanoseconds, exclusive.
+     * @param      points Requested number of points.
+     * @param[out] result On success, points in increasing order of time.
+     *
+     * @retval 0            Success.
+     * @retval ERR_NOTFOUND The channel isn't recorded.
+     */
+    int32_t query(const std::string& path,
+                  const uint64_t begin,
+                  const uint64_t end,
+                  const size_t points,
+                  std::vector<Point>& result) const;
+
+    /**
+     * Gets the current time of the history clock.
+     *
+     * @returns Time in nanoseconds.
+     */
+    uint64_t now() const;
+
+private:
+    /**
+     * Befriend Builder and ChannelBase so that they can attach the history and
+     * record writes.
+     * @{
+     */
+    friend class Builder;
+    friend class ChannelBase;
+    /**
+     * @}
+     */
+
+    /**
+     * Aggregate of the values written during one bucket.
+     */
+    struct Bucket final {
+        /**
+         * Time divided by the resolution period, or UINT64_MAX if the bucket
+         * is empty.
+         */
+        uint64_t index;
+
+        /**
+         * Smallest value written.
+         */
+        double min;
+
+        /**
+         * Largest value written.
+         */
+        double max;
+
+        /**
+         * Sum of the values written.
+         */
+        double sum;
+
+        /**
+         * Number of values written.
+         */
+        uint64_t count;
+    };
+
+    /**
+     * Buckets of one recorded channel.
+     */
+    struct Series final {
+        /**
+         * Element type of the channel.
+         */
+        River::Scalar scalar;
+
+        /**
+         * Spin lock serializing updates and queries of the buckets.
+         */
+        mutable std::atomic<bool> busy;
+
+        /**
+         * Buckets of each resolution back to back, each ring holding
+         * Resolution::count buckets.
+         */
+        std::unique_ptr<Bucket[]> buckets;
+    };
+
+    /**
+     * Series index of nodes that aren't recorded.
+     */
+    static constexpr uint32_t NO_SERIES = UINT32_MAX;
+
+    /**
+     * Paths of the channels to record.
+     */
+    const std::vector<std::string> paths;
+
+    /**
+     * Resolutions, from finest to coarsest.
+     */
+    std::vector<Resolution> resolutions;
+
+    /**
+     * Clock that timestamps writes.
+     */
+    std::function<uint64_t()> clock;
+
+    /**
+     * Recorded channels.
+     */
+    std::unique_ptr<Series[]> series;
+
+    /**
+     * Number of recorded channels.
+     */
+    size_t series_size;
+
+    /**
+     * Index of each node's series, or NO_SERIES.
+     */
+    std::vector<uint32_t> series_indices;
+
+    /**
+     * Full paths of the recorded channels, by series index.
+     */
+    std::vector<std::string> series_paths;
+
+    /**
+     * Gets the size of a channel element type.
+     *
+     * @param scalar Element type.
+     *
+     * @returns Size in bytes, or 0 for River::Scalar::NONE.
+     */
+    static size_t scalar_size(const River::Scalar scalar);
+
+    /**
+     * Loads a channel value as a double.
+     *
+     * @param scalar Element type of the channel.
+     * @param src    Value.
+     *
+     * @returns Converted value.
+     */
+    static double load(const River::Scalar scalar, const void* const src);
+
+    /**
+     * Finds the channels that a river would record.
+     *
+     * @param river River to search.
+     *
+     * @returns Node indices of the channels in increasing order, or an empty
+     *          vector if any path matches none.
+     */
+    std::vector<uint32_t> find_channels(const River& river) const;
+
+    /**
+     * Checks whether the history can be attached to a river.
+     *
+     * @param river River to check. Its metadata must be complete.
+     *
+     * @returns Whether every path matches an arithmetic channel, or a rivulet
+     *          with at least one under it.
+     */
+    bool can_attach(const River& river) const;
+
+    /**
+     * Attaches the history to a river, discarding any previously recorded
+     * values.
+     *
+     * @param river River to record. Must be fully built.
+     */
+    void attach(const River& river);
+
+    /**
+     * Records a write of the channel at a node.
+     *
+     * This never allocates.
+     *
+     * @param index Node index.
+     * @param src   Value written.
+     */
+    void record(const size_t index, const void* const src);
+};
+} /* namespace river */
+
+#endif
@@ -1,7 +1,7 @@
 #include "link.hpp"
 
 namespace river {
-bool Linkable::linked() const
+bool Linkable::linked() const noexcept
 {
     return (link && link->river);
 }
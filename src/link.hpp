@@ -1,14 +1,18 @@
 #ifndef RIVER_LINK_HPP
 #define RIVER_LINK_HPP
 
+#include <cstdint>
 #include <memory>
 
-#include "lock.hpp"
 #include "river.hpp"
 
 namespace river {
 /**
  * Metadata about a memory region within a river.
+ *
+ * Offsets, sizes, and indices are 32 bits, like in the river metadata, so
+ * that links pack densely. The lock is referenced by its index in the river
+ * lock table rather than owned by the link.
  */
 struct Link final {
     /**
@@ -18,13 +22,28 @@ struct Link final {
      */
     std::shared_ptr<River> river;
 
+    /**
+     * Index of the linked node in the river metadata.
+     *
+     * This is undefined if the river is not built.
+     */
+    uint32_t index;
+
     /**
      * Byte offset of the channel in the river backing memory.
      *
      * This is undefined if the link is not linking a channel or the river is
      * not built.
      */
-    size_t channel_offset;
+    uint32_t channel_offset;
+
+    /**
+     * Size of the channel in bytes.
+     *
+     * This is undefined if the link is not linking a channel or the river is
+     * not built.
+     */
+    uint32_t channel_size;
 
     /**
      * Byte offset of the rivulet in the river backing memory.
@@ -32,7 +51,7 @@ struct Link final {
      * This is undefined if the link is not linking a rivulet or the river is
      * not built.
      */
-    size_t rivulet_offset;
+    uint32_t rivulet_offset;
 
     /**
      * Size of the rivulet in bytes.
@@ -40,14 +59,15 @@ struct Link final {
      * This is undefined if the link is not linking a rivulet or the river is
      * not built.
      */
-    size_t rivulet_size;
+    uint32_t rivulet_size;
 
     /**
-     * Lock protecting the linked memory of the river.
+     * Index of the lock protecting the linked memory in the river lock table.
      *
-     * This is null if the linked memory is unlocked or the river is not built.
+     * This is River::NO_LOCK if the linked memory is unlocked, and undefined
+     * if the river is not built.
      */
-    std::shared_ptr<Lock> lock;
+    uint32_t lock_index;
 };
 
 /**
@@ -63,13 +83,20 @@ public:
      *
      * @returns Whether handle is linked.
      */
-    virtual bool linked() const final;
+    virtual bool linked() const noexcept final;
 
 protected:
     /**
-     * Befriend Builder so that it can set the link.
+     * Befriend Builder so that it can set the link, and Task and Watchpoints
+     * so that they can determine which river memory a handle accesses.
+     * @{
      */
     friend class Builder;
+    friend class Task;
+    friend class Watchpoints;
+    /**
+     * @}
+     */
 
     /**
      * River link.
@@ -1,9 +1,16 @@
 #ifndef RIVER_LOCK_HPP
 #define RIVER_LOCK_HPP
 
+#include <cstdint>
+
 namespace river {
 /**
  * Interface for a lock.
+ *
+ * Locks are acquired and released by channel, flags, and rivulet accesses,
+ * which never allocate or throw once the river is built. Implementations must
+ * keep to the same rules, since an exception escaping an access terminates
+ * the program.
  */
 class Lock {
 public:
@@ -17,6 +24,39 @@ public:
      */
     virtual void release() = 0;
 };
+
+/**
+ * Kinds of locks that a rivulet may need, based on how it's accessed.
+ *
+ * @see Profiler::recommend_locks()
+ */
+enum class LockKind : uint8_t {
+    /**
+     * Rivulet is not shared between threads, or is only ever read, and needs no
+     * lock.
+     */
+    NONE = 0,
+
+    /**
+     * Rivulet is written by one thread and read by others. A lock that favors
+     * readers, such as a seqlock, is a good fit.
+     */
+    SINGLE_WRITER = 1,
+
+    /**
+     * Rivulet is written by multiple threads and needs mutual exclusion.
+     */
+    MULTI_WRITER = 2,
+};
+
+/**
+ * Names of lock kinds as they appear in lock maps, indexed by LockKind.
+ */
+inline constexpr const char* LOCK_KIND_NAMES[] = {
+    "none",
+    "single_writer",
+    "multi_writer",
+};
 } /* namespace river */
 
 #endif
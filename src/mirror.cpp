@@ -0,0 +1,65 @@
+#include <cassert>
+
+#include "mirror.hpp"
+
+namespace river {
+Mirror::Mirror(const std::shared_ptr<River> river_,
+               const std::shared_ptr<ReplicationLog> log_)
+    : river(river_)
+    , log(log_)
+    , layout_hash(river_->layout_hash())
+    , applied_frame(0)
+{
+    assert(log && log->header);
+}
+
+int32_t Mirror::apply() noexcept
+{
+    ReplicationLog::Header& header = *log->header;
+    if (header.layout_hash.load(std::memory_order_acquire) != layout_hash) {
+        return ERR_LAYOUT;
+    }
+
+    const size_t river_size = river->storage->size();
+    const uint64_t head = header.head.load(std::memory_order_acquire);
+    uint64_t pos = header.tail.load(std::memory_order_relaxed);
+    while (pos < head) {
+        ReplicationLog::FrameHeader frame;
+        log->copy_out(pos, &frame, sizeof(frame));
+        pos += sizeof(frame);
+
+        for (uint64_t i = 0; i < frame.record_count; ++i) {
+            ReplicationLog::RecordHeader record;
+            log->copy_out(pos, &record, sizeof(record));
+            if ((size_t(record.offset) + record.size) > river_size) {
+                return ERR_CORRUPT;
+            }
+
+            // Write straight from the log, in two pieces if the record wraps
+            // around the end of the ring.
+            size_t first_size = 0;
+            const uint8_t* const first =
+                log->span(pos + sizeof(record), record.size, first_size);
+            river->write(record.offset, first, first_size);
+            if (first_size < record.size) {
+                river->write(record.offset + first_size,
+                             log->ring,
+                             record.size - first_size);
+            }
+            pos += ReplicationLog::record_size(record.size);
+        }
+
+        river->commit_frame();
+        applied_frame = frame.frame;
+        header.tail.store(pos, std::memory_order_release);
+        header.applied.store(applied_frame, std::memory_order_release);
+    }
+
+    return 0;
+}
+
+uint64_t Mirror::frame() const noexcept
+{
+    return applied_frame;
+}
+} /* namespace river */
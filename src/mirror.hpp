@@ -0,0 +1,93 @@
+#ifndef RIVER_MIRROR_HPP
+#define RIVER_MIRROR_HPP
+
+#include <cstdint>
+#include <memory>
+
+#include "replication_log.hpp"
+#include "river.hpp"
+
+namespace river {
+/**
+ * Applies frames replicated from a river in another process to a standby
+ * river built from the same schema.
+ *
+ * The mirror applies whole frames only, so the standby river always holds the
+ * state of the primary river at the end of some frame, whose number is
+ * available as an applied-frame marker. Applying a frame writes its blocks to
+ * the standby river and commits a frame, so rivers in frame mode expose each
+ * applied frame to readers at once.
+ *
+ * @see Replicator
+ */
+class Mirror final {
+public:
+    /**
+     * Error codes that Mirror::apply() can return.
+     * @{
+     */
+    static constexpr int32_t ERR_LAYOUT = 1;
+    static constexpr int32_t ERR_CORRUPT = 2;
+    /**
+     * @}
+     */
+
+    /**
+     * Constructor.
+     *
+     * @param river Standby river.
+     * @param log   Log to apply frames from. Must have been opened.
+     */
+    Mirror(const std::shared_ptr<River> river,
+           const std::shared_ptr<ReplicationLog> log);
+
+    /**
+     * Applies every frame published to the log so far, and frees them in the
+     * log.
+     *
+     * This writes the standby river without acquiring locks, so like
+     * River::commit_frame(), it must not be called concurrently with any
+     * reads or writes of the standby river.
+     *
+     * @retval 0           Success, including when there was nothing to
+     *                     apply.
+     * @retval ERR_LAYOUT  No primary river is attached to the log yet, or its
+     *                     layout differs from the standby river's.
+     * @retval ERR_CORRUPT Log holds a write outside the standby river.
+     */
+    int32_t apply() noexcept;
+
+    /**
+     * Gets the number of the last frame applied.
+     *
+     * @returns Frame number in the primary river, or 0 if no frames have been
+     *          applied yet.
+     *
+     * @see River::frame()
+     */
+    uint64_t frame() const noexcept;
+
+private:
+    /**
+     * Standby river.
+     */
+    const std::shared_ptr<River> river;
+
+    /**
+     * Log to apply frames from.
+     */
+    const std::shared_ptr<ReplicationLog> log;
+
+    /**
+     * Layout hash of the standby river.
+     */
+    const uint64_t layout_hash;
+
+    /**
+     * Number of the last frame applied.
+     */
+    uint64_t applied_frame;
+};
+} /* namespace river */
+
+#endif
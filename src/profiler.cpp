@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <cassert>
+
+#include "profiler.hpp"
+#include "thread.hpp"
+
+namespace river {
+Profiler::Profiler()
+    : paths()
+    , parents()
+    , accesses(nullptr)
+{
+}
+
+void Profiler::recommend_locks(std::ostream& os) const
+{
+    const size_t node_count = paths.size();
+
+    // Derive child lists from parent indices.
+    std::vector<std::vector<size_t>> children(node_count);
+    std::vector<size_t> top_level;
+    for (size_t i = 0; i < node_count; ++i) {
+        if (parents[i] == River::NO_PARENT) {
+            top_level.push_back(i);
+        } else {
+            children[parents[i]].push_back(i);
+        }
+    }
+
+    // Summarize the readers and writers of each subtree. Nodes are in
+    // depth-first order, so iterating backwards visits every child before its
+    // parent.
+    std::vector<Summary> readers(node_count);
+    std::vector<Summary> writers(node_count);
+    for (size_t i = node_count; i-- > 0;) {
+        const NodeAccesses& node_accesses = accesses[i];
+        readers[i].add(node_accesses.channel_readers);
+        readers[i].add(node_accesses.rivulet_readers);
+        writers[i].add(node_accesses.channel_writers);
+        writers[i].add(node_accesses.rivulet_writers);
+
+        if (parents[i] != River::NO_PARENT) {
+            readers[parents[i]].add(readers[i]);
+            writers[parents[i]].add(writers[i]);
+        }
+    }
+
+    for (const size_t index : top_level) {
+        recommend_node(os, index, children, readers, writers);
+    }
+}
+
+void Profiler::Summary::add(const ThreadSet& set)
+{
+    for (const std::atomic<uint32_t>& slot : set.slots) {
+        const uint32_t id = slot.load(std::memory_order_relaxed);
+        if (id == 0) {
+            continue;
+        }
+
+        if (std::find(threads.begin(), threads.end(), id) == threads.end()) {
+            if (threads.size() == THREAD_SLOTS) {
+                overflow = true;
+            } else {
+                threads.push_back(id);
+            }
+        }
+    }
+
+    if (set.overflow.load(std::memory_order_relaxed)) {
+        overflow = true;
+    }
+}
+
+void Profiler::Summary::add(const Summary& other)
+{
+    for (const uint32_t id : other.threads) {
+        if (std::find(threads.begin(), threads.end(), id) == threads.end()) {
+            if (threads.size() == THREAD_SLOTS) {
+                overflow = true;
+            } else {
+                threads.push_back(id);
+            }
+        }
+    }
+
+    if (other.overflow) {
+        overflow = true;
+    }
+}
+
+size_t Profiler::Summary::count() const
+{
+    return (overflow ? (THREAD_SLOTS + 1) : threads.size());
+}
+
+void Profiler::attach(const River& river)
+{
+    paths.clear();
+    for (size_t i = 0; i < river.node_count(); ++i) {
+        paths.push_back(river.path(i));
+    }
+    parents = river.parents;
+
+    // Value-initialize so that every thread set starts out empty.
+    accesses.reset(new NodeAccesses[paths.size()]());
+}
+
+void Profiler::record_channel(const size_t index, const bool write)
+{
+    assert(index < paths.size());
+    NodeAccesses& node_accesses = accesses[index];
+    record(write ? node_accesses.channel_writers
+                 : node_accesses.channel_readers);
+}
+
+void Profiler::record_rivulet(const size_t index, const bool write)
+{
+    assert(index < paths.size());
+    NodeAccesses& node_accesses = accesses[index];
+    record(write ? node_accesses.rivulet_writers
+                 : node_accesses.rivulet_readers);
+}
+
+void Profiler::record(ThreadSet& set)
+{
+    const uint32_t id = this_thread_id();
+
+    // Find the thread in the set or claim an empty slot for it. In the common
+    // case the thread is already in the first slot and this is a single load.
+    for (std::atomic<uint32_t>& slot : set.slots) {
+        uint32_t slot_id = slot.load(std::memory_order_relaxed);
+        if (slot_id == 0) {
+            slot.compare_exchange_strong(slot_id,
+                                         id,
+                                         std::memory_order_relaxed);
+            slot_id = slot.load(std::memory_order_relaxed);
+        }
+
+        if (slot_id == id) {
+            return;
+        }
+    }
+
+    // All slots are taken by other threads.
+    set.overflow.store(true, std::memory_order_relaxed);
+}
+
+void Profiler::recommend_node(
+    std::ostream& os,
+    const size_t index,
+    const std::vector<std::vector<size_t>>& children,
+    const std::vector<Summary>& readers,
+    const std::vector<Summary>& writers) const
+{
+    // Subtrees touched by at most one thread, or only ever read, need no lock.
+    Summary threads = readers[index];
+    threads.add(writers[index]);
+    if ((threads.count() <= 1) || (writers[index].count() == 0)) {
+        return;
+    }
+
+    // With a single writer, one lock for the whole subtree keeps readers
+    // consistent without any writer contention.
+    if (writers[index].count() == 1) {
+        os << paths[index] << " "
+           << LOCK_KIND_NAMES[static_cast<size_t>(LockKind::SINGLE_WRITER)]
+           << "\n";
+        return;
+    }
+
+    // With multiple writers, push locks down to the children where possible
+    // to reduce contention. This isn't possible if the node's own channel is
+    // contended or the whole rivulet is accessed, since a lock covers the
+    // entire subtree below it and rivulet accesses only use the rivulet's own
+    // lock.
+    const NodeAccesses& node_accesses = accesses[index];
+    Summary own_threads;
+    own_threads.add(node_accesses.channel_readers);
+    own_threads.add(node_accesses.channel_writers);
+    Summary own_writers;
+    own_writers.add(node_accesses.channel_writers);
+    const bool own_contended =
+        ((own_threads.count() > 1) && (own_writers.count() > 0));
+
+    Summary rivulet_threads;
+    rivulet_threads.add(node_accesses.rivulet_readers);
+    rivulet_threads.add(node_accesses.rivulet_writers);
+    const bool rivulet_accessed = (rivulet_threads.count() > 0);
+
+    if (own_contended || rivulet_accessed || children[index].empty()) {
+        os << paths[index] << " "
+           << LOCK_KIND_NAMES[static_cast<size_t>(LockKind::MULTI_WRITER)]
+           << "\n";
+        return;
+    }
+
+    for (const size_t child : children[index]) {
+        recommend_node(os, child, children, readers, writers);
+    }
+}
+} /* namespace river */
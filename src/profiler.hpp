@@ -0,0 +1,209 @@
+#ifndef RIVER_PROFILER_HPP
+#define RIVER_PROFILER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lock.hpp"
+#include "river.hpp"
+
+namespace river {
+/**
+ * Records which threads access which parts of a river.
+ *
+ * A profiler is attached to a river when it's built by passing it in
+ * Builder::Options. While attached, every channel and rivulet access records
+ * the accessing thread. After a representative run, the profiler can recommend
+ * where locks are needed.
+ *
+ * Recording is lock-free and adds a few atomic loads to each access, so a
+ * profiler should only be attached during profiling runs.
+ */
+class Profiler final {
+public:
+    /**
+     * Constructor.
+     */
+    Profiler();
+
+    /**
+     * Writes a lock map recommending locks based on the accesses recorded so
+     * far.
+     *
+     * Each line of the lock map has the form `<path> <kind>`, where `<kind>` is
+     * the name of a LockKind. Rivulets that are not shared between threads are
+     * not listed. Shared rivulets with a single writer thread are locked as a
+     * whole. Rivulets with multiple writer threads are locked at the finest
+     * granularity that still covers every contended channel and every
+     * whole-rivulet access.
+     *
+     * The output can be loaded into a builder with Builder::load_locks().
+     *
+     * @param os Output stream.
+     */
+    void recommend_locks(std::ostream& os) const;
+
+private:
+    /**
+     * Befriend Builder, ChannelBase, DerivedBase, Flags, and Rivulet so that
+     * they can attach the profiler and record accesses.
+     * @{
+     */
+    friend class Builder;
+    friend class ChannelBase;
+    friend class DerivedBase;
+    friend class Flags;
+    friend class Rivulet;
+    /**
+     * @}
+     */
+
+    /**
+     * Number of distinct threads tracked per access set before it overflows.
+     */
+    static constexpr size_t THREAD_SLOTS = 4;
+
+    /**
+     * Lock-free set of the threads that performed some kind of access.
+     */
+    struct ThreadSet final {
+        /**
+         * Thread IDs in the set. Unused slots are 0.
+         */
+        std::atomic<uint32_t> slots[THREAD_SLOTS];
+
+        /**
+         * Whether more threads were seen than there are slots.
+         */
+        std::atomic<bool> overflow;
+    };
+
+    /**
+     * Accesses to a single node in the river metadata tree.
+     */
+    struct NodeAccesses final {
+        /**
+         * Threads that read or wrote the channel at the node.
+         * @{
+         */
+        ThreadSet channel_readers;
+        ThreadSet channel_writers;
+        /**
+         * @}
+         */
+
+        /**
+         * Threads that read or wrote the whole rivulet at the node.
+         * @{
+         */
+        ThreadSet rivulet_readers;
+        ThreadSet rivulet_writers;
+        /**
+         * @}
+         */
+    };
+
+    /**
+     * Plain set of threads used when summarizing accesses.
+     */
+    struct Summary final {
+        /**
+         * Distinct thread IDs, up to THREAD_SLOTS of them.
+         */
+        std::vector<uint32_t> threads;
+
+        /**
+         * Whether there are more threads than fit in the set.
+         */
+        bool overflow = false;
+
+        /**
+         * Adds the threads in a thread set.
+         *
+         * @param set Set to add.
+         */
+        void add(const ThreadSet& set);
+
+        /**
+         * Adds the threads in another summary.
+         *
+         * @param other Summary to add.
+         */
+        void add(const Summary& other);
+
+        /**
+         * Gets the number of threads, saturating past THREAD_SLOTS.
+         *
+         * @returns Thread count.
+         */
+        size_t count() const;
+    };
+
+    /**
+     * Paths of the nodes in the profiled river, indexed by node index.
+     */
+    std::vector<std::string> paths;
+
+    /**
+     * Parent index of each node in the profiled river.
+     */
+    std::vector<uint32_t> parents;
+
+    /**
+     * Recorded accesses, indexed by node index.
+     */
+    std::unique_ptr<NodeAccesses[]> accesses;
+
+    /**
+     * Attaches the profiler to a built river, discarding any previously
+     * recorded accesses.
+     *
+     * @param river River to profile.
+     */
+    void attach(const River& river);
+
+    /**
+     * Records a read or write of the channel at a node.
+     *
+     * @param index Node index.
+     * @param write Whether the access is a write.
+     */
+    void record_channel(const size_t index, const bool write);
+
+    /**
+     * Records a read or write of the rivulet at a node.
+     *
+     * @param index Node index.
+     * @param write Whether the access is a write.
+     */
+    void record_rivulet(const size_t index, const bool write);
+
+    /**
+     * Adds the calling thread to a thread set.
+     *
+     * @param set Thread set.
+     */
+    static void record(ThreadSet& set);
+
+    /**
+     * Recursive helper that recommends locks for the subtree at a node.
+     *
+     * @param os       Output stream.
+     * @param index    Node index.
+     * @param children Child indices of each node.
+     * @param readers  Subtree reader summary of each node.
+     * @param writers  Subtree writer summary of each node.
+     */
+    void recommend_node(std::ostream& os,
+                        const size_t index,
+                        const std::vector<std::vector<size_t>>& children,
+                        const std::vector<Summary>& readers,
+                        const std::vector<Summary>& writers) const;
+};
+} /* namespace river */
+
+#endif
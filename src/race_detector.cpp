@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <iostream>
+
+#include "race_detector.hpp"
+#include "river.hpp"
+#include "thread.hpp"
+
+namespace river {
+RaceDetector::RaceDetector(const River& river_)
+    : river(river_)
+    , states(nullptr)
+    , subtree_ends(nullptr)
+    , handler()
+{
+    const size_t node_count = river.node_count();
+
+    // Value-initialize so that no node starts out with a writer.
+    states.reset(new NodeState[node_count]());
+
+    // Nodes are in depth-first order, so a subtree spans from its root to the
+    // end of its last child's subtree. Iterating backwards visits every child
+    // before its parent.
+    subtree_ends.reset(new size_t[node_count]);
+    for (size_t i = 0; i < node_count; ++i) {
+        subtree_ends[i] = (i + 1);
+    }
+    for (size_t i = node_count; i-- > 0;) {
+        const size_t parent = river.parents[i];
+        if (parent != River::NO_PARENT) {
+            subtree_ends[parent] = std::max(subtree_ends[parent],
+                                            subtree_ends[i]);
+        }
+    }
+}
+
+void RaceDetector::on_race(const std::function<void(const Race&)> handler_)
+{
+    handler = handler_;
+}
+
+void RaceDetector::check_read(const size_t begin, const size_t end)
+{
+    const uint32_t thread = this_thread_id();
+    for (size_t i = begin; i < end; ++i) {
+        const uint32_t writer =
+            states[i].writer.load(std::memory_order_acquire);
+        if ((writer != 0) && (writer != thread)) {
+            report(Race::Kind::OVERLAP, i, writer);
+        }
+    }
+}
+
+void RaceDetector::begin_write(const size_t begin, const size_t end)
+{
+    const uint32_t thread = this_thread_id();
+    const uint32_t epoch = static_cast<uint32_t>(river.epoch());
+    const uint64_t last_write = ((uint64_t(thread) << 32) | epoch);
+
+    for (size_t i = begin; i < end; ++i) {
+        NodeState& state = states[i];
+
+        // Claim the node for writing; any other writer means two writes
+        // overlap.
+        const uint32_t writer =
+            state.writer.exchange(thread, std::memory_order_acq_rel);
+        if ((writer != 0) && (writer != thread)) {
+            report(Race::Kind::OVERLAP, i, writer);
+        }
+
+        // Check that the last write was from this thread or an earlier epoch.
+        // The store is skipped for repeated writes from the same thread.
+        const uint64_t prev_write =
+            state.last_write.load(std::memory_order_relaxed);
+        if (prev_write != last_write) {
+            const uint32_t prev_thread =
+                static_cast<uint32_t>(prev_write >> 32);
+            const uint32_t prev_epoch = static_cast<uint32_t>(prev_write);
+            if ((prev_thread != 0) && (prev_thread != thread)
+                && (prev_epoch == epoch)) {
+                report(Race::Kind::UNSYNCHRONIZED_WRITES, i, prev_thread);
+            }
+            state.last_write.store(last_write, std::memory_order_relaxed);
+        }
+    }
+}
+
+void RaceDetector::end_write(const size_t begin, const size_t end)
+{
+    for (size_t i = begin; i < end; ++i) {
+        states[i].writer.store(0, std::memory_order_release);
+    }
+}
+
+void RaceDetector::hand_off(const size_t begin, const size_t end)
+{
+    const uint32_t thread = this_thread_id();
+    const uint32_t epoch = static_cast<uint32_t>(river.epoch());
+    const uint64_t last_write = ((uint64_t(thread) << 32) | epoch);
+
+    for (size_t i = begin; i < end; ++i) {
+        states[i].last_write.store(last_write, std::memory_order_relaxed);
+    }
+}
+
+size_t RaceDetector::subtree_end(const size_t index) const
+{
+    return subtree_ends[index];
+}
+
+void RaceDetector::report(const Race::Kind kind,
+                          const size_t index,
+                          const uint32_t other_thread)
+{
+    const Race race {
+        .kind = kind,
+        .path = river.path(index),
+        .thread = this_thread_id(),
+        .other_thread = other_thread,
+        .epoch = river.epoch(),
+    };
+
+    if (handler) {
+        handler(race);
+        return;
+    }
+
+    std::cerr << "river: race on `" << race.path << "` in epoch " << race.epoch
+              << ": thread " << race.thread
+              << ((kind == Race::Kind::OVERLAP)
+                      ? " accessed it while thread "
+                      : " wrote it after an unsynchronized write by thread ")
+              << race.other_thread
+              << ((kind == Race::Kind::OVERLAP) ? " was writing it" : "")
+              << std::endl;
+}
+} /* namespace river */
@@ -0,0 +1,201 @@
+#ifndef RIVER_RACE_DETECTOR_HPP
+#define RIVER_RACE_DETECTOR_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace river {
+class River;
+
+/**
+ * A data race detected on an unlocked channel.
+ *
+ * @see RaceDetector
+ */
+struct Race final {
+    /**
+     * Kinds of races.
+     */
+    enum class Kind : uint8_t {
+        /**
+         * A channel was accessed while another thread was writing it.
+         */
+        OVERLAP = 0,
+
+        /**
+         * A channel was written by two different threads within one epoch.
+         */
+        UNSYNCHRONIZED_WRITES = 1,
+    };
+
+    /**
+     * Kind of race.
+     */
+    Kind kind;
+
+    /**
+     * Path of the raced channel.
+     */
+    std::string path;
+
+    /**
+     * ID of the thread that detected the race.
+     *
+     * @see this_thread_id()
+     */
+    uint32_t thread;
+
+    /**
+     * ID of the other thread involved in the race.
+     */
+    uint32_t other_thread;
+
+    /**
+     * Epoch the race was detected in.
+     */
+    uint64_t epoch;
+};
+
+/**
+ * Lightweight race detector for unlocked channels.
+ *
+ * The detector is compiled into the library when RIVER_RACE_DETECTOR is
+ * defined, which is the default for debug builds. When compiled in, a detector
+ * is attached to every river that's built.
+ *
+ * For each channel, the detector tracks which thread is currently writing it,
+ * and the thread and epoch of its last write. It reports two kinds of races on
+ * channels that are not covered by a lock:
+ *
+ *   * A read or write that overlaps another thread's write.
+ *   * Writes from two different threads within the same epoch. Threads that
+ *     hand off ownership of a channel should advance the river epoch at the
+ *     hand-off with River::advance_epoch(). Committing a frame also advances
+ *     the epoch. Hand-offs of specific channels, like the ones between
+ *     scheduled tasks, are marked with RaceDetector::hand_off() instead.
+ *
+ * Reads in frame mode never race with writes, since they see the front buffer,
+ * so they aren't checked. Reads only check for overlap without writing any
+ * shared state, which keeps the cost of the detector low enough to leave it on
+ * during integration tests.
+ */
+class RaceDetector final {
+public:
+    /**
+     * Constructor.
+     *
+     * @param river River to check. Must be fully built.
+     */
+    explicit RaceDetector(const River& river);
+
+    /**
+     * Sets the function called when a race is detected.
+     *
+     * By default, races are printed to stderr.
+     *
+     * @param handler Race handler.
+     */
+    void on_race(const std::function<void(const Race&)> handler);
+
+    /**
+     * Checks unlocked nodes being read for overlapping writes.
+     *
+     * This should be called both before and after reading, so that writes
+     * that start or end during the read are caught.
+     *
+     * @param begin First node index.
+     * @param end   One past the last node index.
+     */
+    void check_read(const size_t begin, const size_t end);
+
+    /**
+     * Called before writing unlocked nodes.
+     *
+     * @param begin First node index.
+     * @param end   One past the last node index.
+     */
+    void begin_write(const size_t begin, const size_t end);
+
+    /**
+     * Called after writing unlocked nodes.
+     *
+     * @param begin First node index.
+     * @param end   One past the last node index.
+     */
+    void end_write(const size_t begin, const size_t end);
+
+    /**
+     * Hands off nodes to the calling thread, as if it had last written them.
+     *
+     * This marks a hand-off of only the given nodes, e.g., to a scheduled task
+     * whose predecessors just finished, where advancing the river epoch would
+     * also hide races between unrelated threads.
+     *
+     * @param begin First node index.
+     * @param end   One past the last node index.
+     */
+    void hand_off(const size_t begin, const size_t end);
+
+    /**
+     * Gets one past the index of the last node in the subtree at a node.
+     *
+     * @param index Node index.
+     *
+     * @returns Subtree end index.
+     */
+    size_t subtree_end(const size_t index) const;
+
+private:
+    /**
+     * Detector state for a single node.
+     */
+    struct NodeState final {
+        /**
+         * ID of the thread currently writing the node, or 0 if none.
+         */
+        std::atomic<uint32_t> writer;
+
+        /**
+         * Thread ID (upper 32 bits) and epoch (lower 32 bits) of the last
+         * write to the node.
+         */
+        std::atomic<uint64_t> last_write;
+    };
+
+    /**
+     * Checked river.
+     */
+    const River& river;
+
+    /**
+     * Per-node state, indexed by node index.
+     */
+    std::unique_ptr<NodeState[]> states;
+
+    /**
+     * One past the last node in each node's subtree.
+     */
+    std::unique_ptr<size_t[]> subtree_ends;
+
+    /**
+     * Race handler.
+     */
+    std::function<void(const Race&)> handler;
+
+    /**
+     * Reports a race.
+     *
+     * @param kind         Race kind.
+     * @param index        Raced node index.
+     * @param other_thread Other thread involved in the race.
+     */
+    void report(const Race::Kind kind,
+                const size_t index,
+                const uint32_t other_thread);
+};
+} /* namespace river */
+
+#endif
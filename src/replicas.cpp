@@ -0,0 +1,360 @@
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#include "replicas.hpp"
+
+namespace river {
+namespace {
+/**
+ * Number of bytes processed at a time when voting. Words within a chunk are
+ * processed independently, so that the compiler can vectorize the loops.
+ */
+constexpr size_t CHUNK_SIZE = 64;
+
+/**
+ * Number of words in a chunk.
+ */
+constexpr size_t CHUNK_WORDS = (CHUNK_SIZE / sizeof(uint64_t));
+
+/**
+ * A chunk of memory loaded into words. Bytes past the end of the memory are
+ * zero in every copy, so they never disagree.
+ */
+struct Chunk final {
+    uint64_t words[CHUNK_WORDS];
+
+    /**
+     * Loads a chunk.
+     *
+     * @param src  Source memory.
+     * @param size Number of bytes to load, at most CHUNK_SIZE.
+     */
+    void load(const uint8_t* const src, const size_t size)
+    {
+        if (size < CHUNK_SIZE) {
+            std::memset(words, 0, sizeof(words));
+        }
+        std::memcpy(words, src, size);
+    }
+};
+
+/**
+ * Computes the bitwise majority of three chunks.
+ *
+ * @param      a      First copy.
+ * @param      b      Second copy.
+ * @param      c      Third copy.
+ * @param[out] result Majority.
+ *
+ * @returns Whether any of the copies disagree.
+ */
+bool majority(const Chunk& a, const Chunk& b, const Chunk& c, Chunk& result)
+{
+    uint64_t disagree = 0;
+    for (size_t i = 0; i < CHUNK_WORDS; ++i) {
+        result.words[i] = ((a.words[i] & b.words[i]) | (a.words[i] & c.words[i])
+                           | (b.words[i] & c.words[i]));
+        disagree |= ((a.words[i] ^ b.words[i]) | (a.words[i] ^ c.words[i]));
+    }
+    return (disagree != 0);
+}
+
+/**
+ * Counts the bytes in which two chunks differ.
+ *
+ * @param a First chunk.
+ * @param b Second chunk.
+ *
+ * @returns Number of differing bytes.
+ */
+size_t count_differences(const Chunk& a, const Chunk& b)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < CHUNK_WORDS; ++i) {
+        for (uint64_t diff = (a.words[i] ^ b.words[i]); diff != 0;
+             diff >>= 8) {
+            count += ((diff & 0xFF) != 0);
+        }
+    }
+    return count;
+}
+
+/**
+ * Merges overlapping and adjacent ranges, so that every byte belongs to at
+ * most one range.
+ *
+ * @param ranges Ranges in any order.
+ *
+ * @returns Merged non-empty ranges, sorted by offset.
+ */
+std::vector<Replicas::Range> merge(std::vector<Replicas::Range> ranges)
+{
+    std::sort(ranges.begin(),
+              ranges.end(),
+              [](const Replicas::Range& a, const Replicas::Range& b) -> bool {
+                  return (a.offset < b.offset);
+              });
+    std::vector<Replicas::Range> merged;
+    for (const Replicas::Range& range : ranges) {
+        if (range.size == 0) {
+            continue;
+        }
+        if (!merged.empty()
+            && (range.offset <= (merged.back().offset + merged.back().size))) {
+            const size_t end = std::max(merged.back().offset
+                                            + merged.back().size,
+                                        range.offset + range.size);
+            merged.back().size = (end - merged.back().offset);
+            continue;
+        }
+        merged.push_back(range);
+    }
+    return merged;
+}
+} /* namespace */
+
+Replicas::Replicas(uint8_t* const data_,
+                   const std::vector<Range>& ranges,
+                   uint8_t* const memory)
+    : data(data_)
+    , regions(nullptr)
+    , regions_size(0)
+    , replicas()
+    , heap(nullptr)
+{
+    // Lay out the regions back to back in the replicas.
+    const std::vector<Range> merged = merge(ranges);
+    regions_size = merged.size();
+    regions.reset(new Region[regions_size]);
+    size_t replica_size = 0;
+    for (size_t i = 0; i < regions_size; ++i) {
+        regions[i].offset = merged[i].offset;
+        regions[i].size = merged[i].size;
+        regions[i].replica_offset = replica_size;
+        regions[i].locked.store(false, std::memory_order_relaxed);
+        replica_size += merged[i].size;
+    }
+
+    // Place the replicas in the provided memory, or allocate it.
+    uint8_t* replica_memory = memory;
+    if (!replica_memory) {
+        heap.reset(new uint8_t[2 * replica_size]);
+        replica_memory = heap.get();
+    }
+    replicas[0] = replica_memory;
+    replicas[1] = (replica_memory + replica_size);
+
+    // Replicas start out identical to the primary.
+    for (uint8_t* const replica : replicas) {
+        for (size_t i = 0; i < regions_size; ++i) {
+            std::memcpy(replica + regions[i].replica_offset,
+                        data + regions[i].offset,
+                        regions[i].size);
+        }
+    }
+}
+
+size_t Replicas::memory_size(const std::vector<Range>& ranges)
+{
+    size_t size = 0;
+    for (const Range& range : merge(ranges)) {
+        size += range.size;
+    }
+    return (2 * size);
+}
+
+void Replicas::write(const size_t offset,
+                     const void* const src,
+                     const size_t size)
+{
+    size_t begin = 0;
+    size_t end = 0;
+    overlapping(offset, size, begin, end);
+
+    // Lock in ascending order so that overlapping writes can't deadlock.
+    for (size_t i = begin; i < end; ++i) {
+        lock_region(regions[i]);
+    }
+
+    std::memcpy(data + offset, src, size);
+
+    // Copy the redundant parts of the write to the replicas.
+    const uint8_t* const src_bytes = static_cast<const uint8_t*>(src);
+    for (size_t i = begin; i < end; ++i) {
+        const Region& region = regions[i];
+        const size_t overlap_begin = std::max(offset, region.offset);
+        const size_t overlap_end =
+            std::min(offset + size, region.offset + region.size);
+        for (uint8_t* const replica : replicas) {
+            std::memcpy(replica + region.replica_offset
+                            + (overlap_begin - region.offset),
+                        src_bytes + (overlap_begin - offset),
+                        overlap_end - overlap_begin);
+        }
+    }
+
+    for (size_t i = begin; i < end; ++i) {
+        regions[i].locked.store(false, std::memory_order_release);
+    }
+}
+
+void Replicas::read(const size_t offset,
+                    void* const dest,
+                    const size_t size) const
+{
+    std::memcpy(dest, data + offset, size);
+
+    // Replace the redundant parts of the read with the majority of the copies.
+    size_t begin = 0;
+    size_t end = 0;
+    overlapping(offset, size, begin, end);
+    uint8_t* const dest_bytes = static_cast<uint8_t*>(dest);
+    for (size_t i = begin; i < end; ++i) {
+        const Region& region = regions[i];
+        const size_t overlap_begin = std::max(offset, region.offset);
+        const size_t overlap_end =
+            std::min(offset + size, region.offset + region.size);
+        const size_t replica_offset =
+            (region.replica_offset + (overlap_begin - region.offset));
+
+        for (size_t pos = 0; pos < (overlap_end - overlap_begin);
+             pos += CHUNK_SIZE) {
+            const size_t chunk_size =
+                std::min(CHUNK_SIZE, overlap_end - overlap_begin - pos);
+            Chunk a, b, c, result;
+            a.load(data + overlap_begin + pos, chunk_size);
+            b.load(replicas[0] + replica_offset + pos, chunk_size);
+            c.load(replicas[1] + replica_offset + pos, chunk_size);
+            if (majority(a, b, c, result)) {
+                std::memcpy(dest_bytes + (overlap_begin - offset) + pos,
+                            result.words,
+                            chunk_size);
+            }
+        }
+    }
+}
+
+void Replicas::update_bits(const size_t offset,
+                           const uint64_t mask,
+                           const bool set)
+{
+    size_t begin = 0;
+    size_t end = 0;
+    overlapping(offset, sizeof(uint64_t), begin, end);
+    for (size_t i = begin; i < end; ++i) {
+        lock_region(regions[i]);
+    }
+
+    uint64_t* const word = reinterpret_cast<uint64_t*>(data + offset);
+    const uint64_t value =
+        (set ? __atomic_or_fetch(word, mask, __ATOMIC_ACQ_REL)
+             : __atomic_and_fetch(word, ~mask, __ATOMIC_ACQ_REL));
+
+    // Copy the redundant bytes of the updated word to the replicas.
+    const uint8_t* const value_bytes = reinterpret_cast<const uint8_t*>(&value);
+    for (size_t i = begin; i < end; ++i) {
+        const Region& region = regions[i];
+        const size_t overlap_begin = std::max(offset, region.offset);
+        const size_t overlap_end =
+            std::min(offset + sizeof(uint64_t), region.offset + region.size);
+        for (uint8_t* const replica : replicas) {
+            std::memcpy(replica + region.replica_offset
+                            + (overlap_begin - region.offset),
+                        value_bytes + (overlap_begin - offset),
+                        overlap_end - overlap_begin);
+        }
+    }
+
+    for (size_t i = begin; i < end; ++i) {
+        regions[i].locked.store(false, std::memory_order_release);
+    }
+}
+
+size_t Replicas::repair(const size_t offset, const size_t size)
+{
+    size_t begin = 0;
+    size_t end = 0;
+    overlapping(offset, size, begin, end);
+
+    size_t repaired = 0;
+    for (size_t i = begin; i < end; ++i) {
+        Region& region = regions[i];
+        const size_t overlap_begin = std::max(offset, region.offset);
+        const size_t overlap_end =
+            std::min(offset + size, region.offset + region.size);
+        const size_t replica_offset =
+            (region.replica_offset + (overlap_begin - region.offset));
+        uint8_t* const copies[] = {
+            data + overlap_begin,
+            replicas[0] + replica_offset,
+            replicas[1] + replica_offset,
+        };
+
+        lock_region(region);
+        for (size_t pos = 0; pos < (overlap_end - overlap_begin);
+             pos += CHUNK_SIZE) {
+            const size_t chunk_size =
+                std::min(CHUNK_SIZE, overlap_end - overlap_begin - pos);
+            Chunk chunks[3], result;
+            for (size_t j = 0; j < 3; ++j) {
+                chunks[j].load(copies[j] + pos, chunk_size);
+            }
+
+            // Fast path for chunks where all copies agree, which is nearly
+            // always the case.
+            if (!majority(chunks[0], chunks[1], chunks[2], result)) {
+                continue;
+            }
+
+            // Overwrite each dissenting copy with the majority.
+            for (size_t j = 0; j < 3; ++j) {
+                const size_t differences =
+                    count_differences(chunks[j], result);
+                if (differences > 0) {
+                    std::memcpy(copies[j] + pos, result.words, chunk_size);
+                    repaired += differences;
+                }
+            }
+        }
+        region.locked.store(false, std::memory_order_release);
+    }
+
+    return repaired;
+}
+
+void Replicas::overlapping(const size_t offset,
+                           const size_t size,
+                           size_t& begin,
+                           size_t& end) const
+{
+    const Region* const first = regions.get();
+    const Region* const last = (first + regions_size);
+
+    // Regions are sorted and disjoint, so the overlapping regions are those
+    // ending after the range begins and beginning before the range ends.
+    begin = (std::partition_point(first,
+                                  last,
+                                  [offset](const Region& region) -> bool {
+                                      return ((region.offset + region.size)
+                                              <= offset);
+                                  })
+             - first);
+    end = (std::partition_point(first + begin,
+                                last,
+                                [offset, size](const Region& region) -> bool {
+                                    return (region.offset < (offset + size));
+                                })
+           - first);
+}
+
+void Replicas::lock_region(Region& region)
+{
+    while (region.locked.exchange(true, std::memory_order_acquire)) {
+        // Regions are only held for the duration of a small copy or a repair.
+        while (region.locked.load(std::memory_order_relaxed)) {
+            std::this_thread::yield();
+        }
+    }
+}
+} /* namespace river */
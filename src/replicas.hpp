@@ -0,0 +1,178 @@
+#ifndef RIVER_REPLICAS_HPP
+#define RIVER_REPLICAS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace river {
+/**
+ * Triple-modular-redundant copies of ranges of river memory.
+ *
+ * Each redundant range of the primary memory has two replicas. Writes update
+ * the primary and both replicas, and reads take the bitwise majority of the
+ * three copies, so that an upset of any single copy is masked.
+ * Replicas::repair() writes the majority back to the dissenting copy, so that
+ * upsets don't accumulate until two copies of the same bit disagree with the
+ * third.
+ *
+ * Writes and repairs of a range are serialized by a spin lock per range,
+ * which is independent of river locks. Reads don't take range locks.
+ */
+class Replicas final {
+public:
+    /**
+     * A range of memory.
+     */
+    struct Range final {
+        /**
+         * Byte offset of range.
+         */
+        size_t offset;
+
+        /**
+         * Size of range in bytes.
+         */
+        size_t size;
+    };
+
+    /**
+     * Constructor. Copies the initial contents of the redundant ranges into
+     * the replicas.
+     *
+     * @param data   Primary memory. Must outlive the replicas.
+     * @param ranges Redundant ranges. Ranges may be given in any order and may
+     *               overlap.
+     * @param memory If not null, memory of Replicas::memory_size() bytes to
+     *               place the replicas in instead of allocating it. Must
+     *               outlive the replicas.
+     */
+    Replicas(uint8_t* const data,
+             const std::vector<Range>& ranges,
+             uint8_t* const memory = nullptr);
+
+    /**
+     * Gets the size of the memory that the replicas of some ranges take.
+     *
+     * @param ranges Redundant ranges.
+     *
+     * @returns Size in bytes.
+     */
+    static size_t memory_size(const std::vector<Range>& ranges);
+
+    /**
+     * Writes to the primary memory, and to the replicas of any redundant
+     * ranges written.
+     *
+     * @param offset Byte offset to write at.
+     * @param src    Write source.
+     * @param size   Number of bytes to write.
+     */
+    void write(const size_t offset, const void* const src, const size_t size);
+
+    /**
+     * Reads from the primary memory, voting on the contents of any redundant
+     * ranges read.
+     *
+     * @param offset Byte offset to read at.
+     * @param dest   Read destination.
+     * @param size   Number of bytes to read.
+     */
+    void read(const size_t offset, void* const dest, const size_t size) const;
+
+    /**
+     * Atomically sets or clears bits of a 64-bit word in the primary memory,
+     * and updates the replicas if the word is redundant.
+     *
+     * @param offset Byte offset of word. Must be 8-byte aligned in memory.
+     * @param mask   Bits to update.
+     * @param set    Whether to set the bits, as opposed to clearing them.
+     */
+    void update_bits(const size_t offset, const uint64_t mask, const bool set);
+
+    /**
+     * Repairs the copies of redundant memory within a range that disagree
+     * with the majority.
+     *
+     * @param offset Byte offset of range.
+     * @param size   Size of range in bytes.
+     *
+     * @returns Number of bytes repaired.
+     */
+    size_t repair(const size_t offset, const size_t size);
+
+private:
+    /**
+     * A redundant range and the location of its replicas.
+     */
+    struct Region final {
+        /**
+         * Byte offset of the range in the primary memory.
+         */
+        size_t offset;
+
+        /**
+         * Size of the range in bytes.
+         */
+        size_t size;
+
+        /**
+         * Byte offset of the range in each replica.
+         */
+        size_t replica_offset;
+
+        /**
+         * Whether the region is locked.
+         */
+        std::atomic<bool> locked;
+    };
+
+    /**
+     * Primary memory.
+     */
+    uint8_t* const data;
+
+    /**
+     * Redundant regions, sorted by offset and disjoint.
+     */
+    std::unique_ptr<Region[]> regions;
+
+    /**
+     * Number of redundant regions.
+     */
+    size_t regions_size;
+
+    /**
+     * The two replicas. Each holds the redundant regions back to back.
+     */
+    uint8_t* replicas[2];
+
+    /**
+     * Memory of the replicas, unless it was provided.
+     */
+    std::unique_ptr<uint8_t[]> heap;
+
+    /**
+     * Gets the regions overlapping a range.
+     *
+     * @param      offset Byte offset of range.
+     * @param      size   Size of range in bytes.
+     * @param[out] begin  Index of first overlapping region.
+     * @param[out] end    One past the index of the last overlapping region.
+     */
+    void overlapping(const size_t offset,
+                     const size_t size,
+                     size_t& begin,
+                     size_t& end) const;
+
+    /**
+     * Spins until a region is locked by the calling thread.
+     *
+     * @param region Region to lock.
+     */
+    static void lock_region(Region& region);
+};
+} /* namespace river */
+
+#endif
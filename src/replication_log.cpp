@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "replication_log.hpp"
+
+namespace river {
+ReplicationLog::ReplicationLog()
+    : header(nullptr)
+    , ring(nullptr)
+    , mapped_size(0)
+    , owned_name()
+{
+}
+
+size_t ReplicationLog::capacity() const
+{
+    return (header ? header->capacity : 0);
+}
+
+size_t ReplicationLog::record_size(const size_t size) noexcept
+{
+    return (sizeof(RecordHeader) + ((size + 7) & ~size_t(7)));
+}
+
+uint8_t* ReplicationLog::span(const uint64_t pos,
+                              const size_t size,
+                              size_t& span_size) const noexcept
+{
+    const size_t index = (pos % header->capacity);
+    span_size = std::min(size, (header->capacity - index));
+    return (ring + index);
+}
+
+void ReplicationLog::copy_in(const uint64_t pos,
+                             const void* const src,
+                             const size_t size) noexcept
+{
+    size_t first_size = 0;
+    uint8_t* const first = span(pos, size, first_size);
+    std::memcpy(first, src, first_size);
+    std::memcpy(ring,
+                static_cast<const uint8_t*>(src) + first_size,
+                size - first_size);
+}
+
+void ReplicationLog::copy_out(const uint64_t pos,
+                              void* const dest,
+                              const size_t size) const noexcept
+{
+    size_t first_size = 0;
+    const uint8_t* const first = span(pos, size, first_size);
+    std::memcpy(dest, first, first_size);
+    std::memcpy(
+        static_cast<uint8_t*>(dest) + first_size, ring, size - first_size);
+}
+
+#ifdef __linux__
+ReplicationLog::~ReplicationLog()
+{
+    if (header) {
+        munmap(header, mapped_size);
+    }
+    if (!owned_name.empty()) {
+        shm_unlink(owned_name.c_str());
+    }
+}
+
+int32_t ReplicationLog::create(const std::string& name, const size_t capacity)
+{
+    if (header || (capacity == 0) || ((capacity % 8) != 0)) {
+        return ERR_INVALID;
+    }
+
+    // Replace any stale object left behind by an earlier producer.
+    shm_unlink(name.c_str());
+    const int fd = shm_open(
+        name.c_str(), (O_RDWR | O_CREAT | O_EXCL), (S_IRUSR | S_IWUSR));
+    if (fd < 0) {
+        return ERR_SHM;
+    }
+    const size_t size = (sizeof(Header) + capacity);
+    const bool mapped = ((ftruncate(fd, static_cast<off_t>(size)) == 0)
+                         && map(fd, size));
+    close(fd);
+    if (!mapped) {
+        shm_unlink(name.c_str());
+        return ERR_SHM;
+    }
+    owned_name = name;
+
+    // The new object is zero-filled, so only the capacity needs setting
+    // before the magic number tells consumers that the ring is ready.
+    new (header) Header;
+    header->capacity = capacity;
+    header->layout_hash.store(0, std::memory_order_relaxed);
+    header->head.store(0, std::memory_order_relaxed);
+    header->tail.store(0, std::memory_order_relaxed);
+    header->applied.store(0, std::memory_order_relaxed);
+    header->magic.store(MAGIC, std::memory_order_release);
+
+    return 0;
+}
+
+int32_t ReplicationLog::open(const std::string& name)
+{
+    if (header) {
+        return ERR_INVALID;
+    }
+
+    const int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        return ERR_SHM;
+    }
+    struct stat status;
+    if ((fstat(fd, &status) != 0)
+        || (static_cast<size_t>(status.st_size) <= sizeof(Header))) {
+        close(fd);
+        return ERR_INVALID;
+    }
+    const size_t size = static_cast<size_t>(status.st_size);
+    const bool mapped = map(fd, size);
+    close(fd);
+    if (!mapped) {
+        return ERR_SHM;
+    }
+
+    if ((header->magic.load(std::memory_order_acquire) != MAGIC)
+        || ((sizeof(Header) + header->capacity) != size)) {
+        munmap(header, mapped_size);
+        header = nullptr;
+        ring = nullptr;
+        return ERR_INVALID;
+    }
+
+    return 0;
+}
+
+bool ReplicationLog::map(const int fd, const size_t size)
+{
+    void* const memory =
+        mmap(nullptr, size, (PROT_READ | PROT_WRITE), MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED) {
+        return false;
+    }
+    header = static_cast<Header*>(memory);
+    ring = (static_cast<uint8_t*>(memory) + sizeof(Header));
+    mapped_size = size;
+    return true;
+}
+#else
+ReplicationLog::~ReplicationLog()
+{
+}
+
+int32_t ReplicationLog::create(const std::string&, const size_t)
+{
+    return ERR_SHM;
+}
+
+int32_t ReplicationLog::open(const std::string&)
+{
+    return ERR_SHM;
+}
+
+bool ReplicationLog::map(const int, const size_t)
+{
+    return false;
+}
+#endif
+} /* namespace river */
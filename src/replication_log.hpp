@@ -0,0 +1,258 @@
+#ifndef RIVER_REPLICATION_LOG_HPP
+#define RIVER_REPLICATION_LOG_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace river {
+/**
+ * Single-producer, single-consumer ring of river writes in POSIX shared
+ * memory, which a Replicator in one process appends committed frames to and a
+ * Mirror in another process applies.
+ *
+ * The ring holds whole frames. Each frame is a frame number and record count,
+ * followed by records of a river offset, a size, and the written bytes,
+ * padded to 8 bytes. The producer publishes a frame by advancing the head
+ * once all of its records are in the ring, and the consumer frees frames by
+ * advancing the tail, so neither side ever blocks or locks.
+ */
+class ReplicationLog final {
+public:
+    /**
+     * Error codes that ReplicationLog::create() and ReplicationLog::open()
+     * can return.
+     * @{
+     */
+    static constexpr int32_t ERR_INVALID = 1;
+    static constexpr int32_t ERR_SHM = 2;
+    /**
+     * @}
+     */
+
+    /**
+     * Constructor.
+     *
+     * The log has no ring until created or opened.
+     */
+    ReplicationLog();
+
+    /**
+     * Destructor. Unmaps the ring, and removes the shared memory object if
+     * this log created it.
+     */
+    ~ReplicationLog();
+
+    /**
+     * Logs are not copyable or movable, since they own their mapping.
+     * @{
+     */
+    ReplicationLog(const ReplicationLog&) = delete;
+    ReplicationLog& operator=(const ReplicationLog&) = delete;
+    /**
+     * @}
+     */
+
+    /**
+     * Creates a ring in a new shared memory object, replacing any existing
+     * object with the same name.
+     *
+     * The capacity must hold at least one snapshot of the river, i.e., the
+     * river size plus 32 bytes, and should hold several frames of writes so
+     * that the consumer can fall behind briefly without forcing a snapshot.
+     *
+     * @param name     Shared memory object name, e.g., `/control`.
+     * @param capacity Ring capacity in bytes. Must be a nonzero multiple of 8.
+     *
+     * @retval 0           Success.
+     * @retval ERR_INVALID Log already has a ring, or capacity is invalid.
+     * @retval ERR_SHM     Shared memory couldn't be set up, or isn't
+     *                     supported on this platform.
+     */
+    int32_t create(const std::string& name, const size_t capacity);
+
+    /**
+     * Opens a ring created by another log.
+     *
+     * @param name Shared memory object name.
+     *
+     * @retval 0           Success.
+     * @retval ERR_INVALID Log already has a ring, or the object isn't a ring.
+     * @retval ERR_SHM     Shared memory couldn't be opened, or isn't
+     *                     supported on this platform.
+     */
+    int32_t open(const std::string& name);
+
+    /**
+     * Gets the ring capacity.
+     *
+     * @returns Capacity in bytes, or 0 if the log has no ring.
+     */
+    size_t capacity() const;
+
+private:
+    /**
+     * Befriend Replicator and Mirror so that they can produce and consume
+     * frames.
+     * @{
+     */
+    friend class Mirror;
+    friend class Replicator;
+    /**
+     * @}
+     */
+
+    /**
+     * Magic number identifying a ring.
+     */
+    static constexpr uint64_t MAGIC = 0x676f6c7265766972ull;
+
+    /**
+     * Header at the start of the shared memory, followed by the ring.
+     */
+    struct Header final {
+        /**
+         * MAGIC, once the ring is initialized.
+         */
+        std::atomic<uint64_t> magic;
+
+        /**
+         * Ring capacity in bytes.
+         */
+        uint64_t capacity;
+
+        /**
+         * Layout hash of the producer's river, or 0 if no river is attached.
+         *
+         * @see River::layout_hash()
+         */
+        std::atomic<uint64_t> layout_hash;
+
+        /**
+         * Position after the last published frame, written by the producer.
+         * Positions increase forever and wrap around the ring.
+         */
+        alignas(64) std::atomic<uint64_t> head;
+
+        /**
+         * Position after the last applied frame, written by the consumer.
+         */
+        alignas(64) std::atomic<uint64_t> tail;
+
+        /**
+         * Number of the last applied frame, written by the consumer.
+         */
+        std::atomic<uint64_t> applied;
+    };
+
+    /**
+     * Header of each frame in the ring.
+     */
+    struct FrameHeader final {
+        /**
+         * Frame number in the producer's river.
+         *
+         * @see River::frame()
+         */
+        uint64_t frame;
+
+        /**
+         * Number of records in the frame.
+         */
+        uint64_t record_count;
+    };
+
+    /**
+     * Header of each record in the ring, followed by the written bytes.
+     */
+    struct RecordHeader final {
+        /**
+         * Offset of the write in the river backing memory.
+         */
+        uint32_t offset;
+
+        /**
+         * Size of the write in bytes.
+         */
+        uint32_t size;
+    };
+
+    /**
+     * Shared memory header, or null if the log has no ring.
+     */
+    Header* header;
+
+    /**
+     * Ring memory.
+     */
+    uint8_t* ring;
+
+    /**
+     * Size of the mapping in bytes.
+     */
+    size_t mapped_size;
+
+    /**
+     * Shared memory object name, if this log created it.
+     */
+    std::string owned_name;
+
+    /**
+     * Maps a shared memory object.
+     *
+     * @param fd   Shared memory file descriptor.
+     * @param size Size to map in bytes.
+     *
+     * @returns Whether the object was mapped.
+     */
+    bool map(const int fd, const size_t size);
+
+    /**
+     * Gets the size of a record in the ring, including padding.
+     *
+     * @param size Size of the written bytes.
+     *
+     * @returns Record size in bytes.
+     */
+    static size_t record_size(const size_t size) noexcept;
+
+    /**
+     * Copies bytes into the ring, wrapping around its end.
+     *
+     * @param pos  Ring position.
+     * @param src  Copy source.
+     * @param size Number of bytes.
+     */
+    void copy_in(const uint64_t pos,
+                 const void* const src,
+                 const size_t size) noexcept;
+
+    /**
+     * Copies bytes out of the ring, wrapping around its end.
+     *
+     * @param pos  Ring position.
+     * @param dest Copy destination.
+     * @param size Number of bytes.
+     */
+    void copy_out(const uint64_t pos,
+                  void* const dest,
+                  const size_t size) const noexcept;
+
+    /**
+     * Gets the contiguous span of the ring starting at a position.
+     *
+     * @param      pos       Ring position.
+     * @param      size      Number of bytes wanted.
+     * @param[out] span_size Number of contiguous bytes at the returned
+     *                       address, at most size.
+     *
+     * @returns Address of the position in the ring.
+     */
+    uint8_t* span(const uint64_t pos,
+                  const size_t size,
+                  size_t& span_size) const noexcept;
+};
+} /* namespace river */
+
+#endif
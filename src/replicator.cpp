@@ -0,0 +1,127 @@
+#include <cassert>
+
+#include "replicator.hpp"
+#include "river.hpp"
+
+namespace river {
+Replicator::Replicator(const std::shared_ptr<ReplicationLog> log_)
+    : log(log_)
+    , river(nullptr)
+    , frame_start(0)
+    , frame_end(0)
+    , record_count(0)
+    , frame_dropped(false)
+    , snapshot_needed(true)
+    , dropped_count(0)
+{
+    assert(log && log->header);
+}
+
+uint64_t Replicator::dropped() const
+{
+    return dropped_count;
+}
+
+uint64_t Replicator::acknowledged() const
+{
+    return log->header->applied.load(std::memory_order_acquire);
+}
+
+bool Replicator::can_attach(const bool frames, const size_t river_size) const
+{
+    const size_t snapshot_size = (sizeof(ReplicationLog::FrameHeader)
+                                  + ReplicationLog::record_size(river_size));
+    return (!river && frames && (snapshot_size <= log->capacity()));
+}
+
+void Replicator::attach(const River& river_)
+{
+    assert(can_attach(river_.frames(), river_.storage->size()));
+    river = &river_;
+    log->header->layout_hash.store(river->layout_hash(),
+                                   std::memory_order_release);
+}
+
+bool Replicator::reserve(const size_t size) noexcept
+{
+    const uint64_t tail =
+        log->header->tail.load(std::memory_order_acquire);
+    if ((frame_end + size - tail) > log->capacity()) {
+        frame_dropped = true;
+        return false;
+    }
+    frame_end += size;
+    return true;
+}
+
+void Replicator::begin_frame() noexcept
+{
+    frame_start = log->header->head.load(std::memory_order_relaxed);
+    frame_end = frame_start;
+    record_count = 0;
+    frame_dropped = false;
+    reserve(sizeof(ReplicationLog::FrameHeader));
+}
+
+void Replicator::append(const size_t offset,
+                        const void* const src,
+                        const size_t size) noexcept
+{
+    // A snapshot replaces the writes of this frame.
+    if (frame_dropped || snapshot_needed) {
+        return;
+    }
+
+    const uint64_t record_pos = frame_end;
+    if (!reserve(ReplicationLog::record_size(size))) {
+        return;
+    }
+    const ReplicationLog::RecordHeader record {
+        .offset = static_cast<uint32_t>(offset),
+        .size = static_cast<uint32_t>(size),
+    };
+    log->copy_in(record_pos, &record, sizeof(record));
+    log->copy_in(record_pos + sizeof(record), src, size);
+    ++record_count;
+}
+
+void Replicator::end_frame(const uint64_t frame) noexcept
+{
+    // Send the whole river, read straight into the log, if the mirror needs
+    // to catch up.
+    if (snapshot_needed && !frame_dropped) {
+        const size_t river_size = river->storage->size();
+        const uint64_t record_pos = frame_end;
+        if (reserve(ReplicationLog::record_size(river_size))) {
+            const ReplicationLog::RecordHeader record {
+                .offset = 0,
+                .size = static_cast<uint32_t>(river_size),
+            };
+            log->copy_in(record_pos, &record, sizeof(record));
+
+            size_t first_size = 0;
+            uint8_t* const first =
+                log->span(record_pos + sizeof(record), river_size, first_size);
+            river->read(0, first, first_size);
+            if (first_size < river_size) {
+                river->read(first_size, log->ring, river_size - first_size);
+            }
+            record_count = 1;
+        }
+    }
+
+    if (frame_dropped) {
+        ++dropped_count;
+        snapshot_needed = true;
+        return;
+    }
+
+    const ReplicationLog::FrameHeader frame_header {
+        .frame = frame,
+        .record_count = record_count,
+    };
+    log->copy_in(frame_start, &frame_header, sizeof(frame_header));
+    log->header->head.store(frame_end, std::memory_order_release);
+    snapshot_needed = false;
+}
+} /* namespace river */
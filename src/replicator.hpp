@@ -0,0 +1,159 @@
+#ifndef RIVER_REPLICATOR_HPP
+#define RIVER_REPLICATOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "replication_log.hpp"
+
+namespace river {
+class River;
+
+/**
+ * Replicates a river's committed frames to a mirror in another process.
+ *
+ * A replicator is attached to a river built in frame mode by passing it in
+ * Builder::Options. Each frame commit appends the committed blocks to the
+ * replicator's log, and publishes them once the whole frame is in the log, so
+ * the mirror only ever applies whole frames. Appending copies into the ring
+ * and never allocates, locks, or waits on the mirror.
+ *
+ * If a frame doesn't fit because the mirror has fallen behind, the frame is
+ * dropped, and the next frame that fits is sent as a snapshot of the whole
+ * river instead, which the mirror catches up from. The first frame is always
+ * a snapshot, so the mirror starts out identical to the river.
+ *
+ * @see Mirror
+ */
+class Replicator final {
+public:
+    /**
+     * Constructor.
+     *
+     * @param log Log to append frames to. Must have been created.
+     */
+    explicit Replicator(const std::shared_ptr<ReplicationLog> log);
+
+    /**
+     * Gets the number of frames dropped because the log was full.
+     *
+     * @returns Dropped frame count.
+     */
+    uint64_t dropped() const;
+
+    /**
+     * Gets the number of the last frame that the mirror has applied.
+     *
+     * @returns Frame number, or 0 if the mirror hasn't applied any frames.
+     *
+     * @see River::frame()
+     */
+    uint64_t acknowledged() const;
+
+private:
+    /**
+     * Befriend Builder and River so that they can attach the replicator and
+     * append frames.
+     * @{
+     */
+    friend class Builder;
+    friend class River;
+    /**
+     * @}
+     */
+
+    /**
+     * Log to append frames to.
+     */
+    const std::shared_ptr<ReplicationLog> log;
+
+    /**
+     * River the replicator is attached to, or null.
+     */
+    const River* river;
+
+    /**
+     * Position of the frame being appended in the log.
+     */
+    uint64_t frame_start;
+
+    /**
+     * Position after the last record appended to the frame.
+     */
+    uint64_t frame_end;
+
+    /**
+     * Number of records appended to the frame.
+     */
+    uint64_t record_count;
+
+    /**
+     * Whether the frame has been dropped.
+     */
+    bool frame_dropped;
+
+    /**
+     * Whether the next frame must be a snapshot.
+     */
+    bool snapshot_needed;
+
+    /**
+     * Number of frames dropped.
+     */
+    uint64_t dropped_count;
+
+    /**
+     * Checks whether the replicator can be attached to a river.
+     *
+     * @param frames     Whether the river is built in frame mode.
+     * @param river_size River size in bytes.
+     *
+     * @returns Whether the replicator isn't attached to another river, the
+     *          river is in frame mode, and the log can hold a snapshot of the
+     *          river.
+     */
+    bool can_attach(const bool frames, const size_t river_size) const;
+
+    /**
+     * Attaches the replicator to a river.
+     *
+     * @param river River built in frame mode.
+     */
+    void attach(const River& river);
+
+    /**
+     * Starts appending a frame.
+     */
+    void begin_frame() noexcept;
+
+    /**
+     * Appends a committed write to the frame.
+     *
+     * @param offset Offset of the write in the river backing memory.
+     * @param src    Written bytes.
+     * @param size   Size of the write in bytes.
+     */
+    void append(const size_t offset,
+                const void* const src,
+                const size_t size) noexcept;
+
+    /**
+     * Finishes appending a frame, and publishes it if it fit.
+     *
+     * @param frame Frame number.
+     */
+    void end_frame(const uint64_t frame) noexcept;
+
+    /**
+     * Reserves room for a record or frame header in the frame.
+     *
+     * @param size Number of bytes.
+     *
+     * @returns Whether the log had room.
+     */
+    bool reserve(const size_t size) noexcept;
+};
+} /* namespace river */
+
+#endif
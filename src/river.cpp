@@ -1,8 +1,556 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <sstream>
+
+#include "derived.hpp"
+#include "replicator.hpp"
 #include "river.hpp"
 
 namespace river {
 River::River()
-    : storage(new std::vector<uint8_t>)
+    : storage(new Storage)
+    , back_storage()
+    , dirty(nullptr)
+    , dirty_words(0)
+    , versions(nullptr)
+    , frame_count(0)
+    , epoch_count(0)
+    , names()
+    , name_offsets(1, 0)
+    , parents()
+    , offsets()
+    , sizes()
+    , scalars()
+    , lock_indices()
+    , locks()
+    , derivations()
+    , profiler(nullptr)
+    , tracer(nullptr)
+    , sampler(nullptr)
+    , replicator(nullptr)
+    , history(nullptr)
+    , race_detector(nullptr)
+    , checksums(nullptr)
+    , replicas(nullptr)
+{
+}
+
+void River::commit_frame() noexcept
+{
+    // Do nothing if not in frame mode.
+    if (!dirty) {
+        return;
+    }
+
+    const size_t river_size = storage->size();
+    if (replicator) {
+        replicator->begin_frame();
+    }
+
+    // Copy each run of consecutive dirty blocks from the back buffer to the
+    // front buffer, clearing the dirty bits as we go.
+    size_t run_start = 0;
+    size_t run_size = 0;
+    for (size_t i = 0; i < dirty_words; ++i) {
+        const uint64_t word = dirty[i].exchange(0, std::memory_order_acquire);
+
+        // Fast path for words with no dirty blocks.
+        if (word == 0) {
+            if (run_size > 0) {
+                commit_range(run_start, run_size);
+                run_size = 0;
+            }
+            continue;
+        }
+
+        for (size_t bit = 0; bit < 64; ++bit) {
+            const size_t block_offset = ((i * 64) + bit) * DIRTY_BLOCK_SIZE;
+            if (block_offset >= river_size) {
+                break;
+            }
+
+            const bool block_dirty = ((word >> bit) & 1);
+            if (block_dirty) {
+                // Start a new run or extend the current one.
+                if (run_size == 0) {
+                    run_start = block_offset;
+                }
+                run_size += DIRTY_BLOCK_SIZE;
+            } else if (run_size > 0) {
+                // Run ended; flush it.
+                commit_range(run_start, run_size);
+                run_size = 0;
+            }
+        }
+    }
+
+    // Flush the final run, which may extend past the end of the river.
+    if (run_size > 0) {
+        if ((run_start + run_size) > river_size) {
+            run_size = (river_size - run_start);
+        }
+        commit_range(run_start, run_size);
+    }
+
+    ++frame_count;
+    if (replicator) {
+        replicator->end_frame(frame_count);
+    }
+    advance_epoch();
+}
+
+uint64_t River::frame() const noexcept
+{
+    return frame_count;
+}
+
+bool River::frames() const noexcept
+{
+    return (dirty != nullptr);
+}
+
+void River::advance_epoch() noexcept
+{
+    epoch_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t River::epoch() const noexcept
+{
+    return epoch_count.load(std::memory_order_relaxed);
+}
+
+void River::on_race(const std::function<void(const Race&)> handler)
+{
+    if (race_detector) {
+        race_detector->on_race(handler);
+    }
+}
+
+size_t River::verify(const std::function<void(const Corruption&)> handler)
+{
+    return verify(0, storage->size(), handler);
+}
+
+size_t River::repair()
+{
+    return repair(0, storage->size());
+}
+
+void River::export_layout(std::ostream& os) const
 {
+    // Element type names by Scalar, as in schemas.
+    static const char* const SCALAR_NAMES[] = {
+        "bytes",
+        "bool",
+        "int8",
+        "uint8",
+        "int16",
+        "uint16",
+        "int32",
+        "uint32",
+        "int64",
+        "uint64",
+        "float",
+        "double",
+    };
+
+    // Only channels occupy memory of their own.
+    for (size_t i = 0; i < node_count(); ++i) {
+        if (sizes[i] > 0) {
+            os << path(i) << " " << offsets[i] << " " << sizes[i] << " "
+               << SCALAR_NAMES[static_cast<size_t>(scalars[i])] << "\n";
+        }
+    }
+}
+
+uint64_t River::layout_hash() const
+{
+    std::stringstream layout;
+    export_layout(layout);
+
+    uint64_t hash = 0xcbf29ce484222325;
+    for (const char c : layout.str()) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+uint8_t* River::direct_memory() noexcept
+{
+    if (dirty || checksums || replicas || versions) {
+        return nullptr;
+    }
+    return storage->data();
+}
+
+size_t River::node_count() const
+{
+    return parents.size();
+}
+
+std::string River::path(const size_t index) const
+{
+    assert(index < node_count());
+
+    // Collect the names from the node up to the top level, then join them in
+    // reverse.
+    size_t length = 0;
+    std::vector<uint32_t> lineage;
+    for (uint32_t node = static_cast<uint32_t>(index); node != NO_PARENT;
+         node = parents[node]) {
+        lineage.push_back(node);
+        length += ((name_offsets[node + 1] - name_offsets[node]) + 1);
+    }
+
+    std::string path;
+    path.reserve(length);
+    for (size_t i = lineage.size(); i-- > 0;) {
+        const uint32_t node = lineage[i];
+        path.append(names,
+                    name_offsets[node],
+                    name_offsets[node + 1] - name_offsets[node]);
+        if (i > 0) {
+            path.push_back('.');
+        }
+    }
+
+    return path;
+}
+
+Lock* River::lock(const uint32_t lock_index) const
+{
+    return ((lock_index == NO_LOCK) ? nullptr : locks[lock_index].get());
+}
+
+Derivation* River::derivation(const uint32_t node) const
+{
+    const auto it = std::lower_bound(
+        derivations.begin(),
+        derivations.end(),
+        node,
+        [](const std::shared_ptr<Derivation>& derivation, const uint32_t node) {
+            return (derivation->node < node);
+        });
+    if ((it == derivations.end()) || ((*it)->node != node)) {
+        return nullptr;
+    }
+    return it->get();
+}
+
+bool River::enable_frames(uint8_t* const memory)
+{
+    // Back buffer starts out identical to the front buffer.
+    if (memory) {
+        back_storage.assign(memory, storage->size(), Storage::Options());
+    } else if (back_storage.allocate(storage->size(), Storage::Options())
+               != 0) {
+        return false;
+    }
+    std::copy(storage->data(),
+              storage->data() + storage->size(),
+              back_storage.data());
+
+    // Allocate a dirty bitmap with one bit per block.
+    const size_t blocks =
+        ((storage->size() + DIRTY_BLOCK_SIZE - 1) / DIRTY_BLOCK_SIZE);
+    dirty_words = ((blocks + 63) / 64);
+    dirty.reset(new std::atomic<uint64_t>[dirty_words]);
+    for (size_t i = 0; i < dirty_words; ++i) {
+        dirty[i].store(0, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+void River::enable_checksums(void* const memory)
+{
+    checksums.reset(new Checksums(storage->data(), storage->size(), memory));
+}
+
+void River::enable_replicas(const std::vector<Replicas::Range>& ranges,
+                            uint8_t* const memory)
+{
+    if (!ranges.empty()) {
+        replicas.reset(new Replicas(storage->data(), ranges, memory));
+    }
+}
+
+void River::enable_versions()
+{
+    const size_t blocks =
+        ((storage->size() + DIRTY_BLOCK_SIZE - 1) / DIRTY_BLOCK_SIZE);
+    versions.reset(new std::atomic<uint64_t>[blocks]);
+    for (size_t i = 0; i < blocks; ++i) {
+        versions[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+uint64_t River::version(const size_t offset, const size_t size) const
+{
+    if (!versions || (size == 0)) {
+        return 0;
+    }
+
+    uint64_t sum = 0;
+    const size_t first_block = (offset / DIRTY_BLOCK_SIZE);
+    const size_t last_block = ((offset + size - 1) / DIRTY_BLOCK_SIZE);
+    for (size_t block = first_block; block <= last_block; ++block) {
+        sum += versions[block].load(std::memory_order_acquire);
+    }
+    return sum;
+}
+
+void River::bump_versions(const size_t offset, const size_t size)
+{
+    if (!versions || (size == 0)) {
+        return;
+    }
+
+    // Bump after the store, so that a reader that sees the new version also
+    // sees the stored data.
+    const size_t first_block = (offset / DIRTY_BLOCK_SIZE);
+    const size_t last_block = ((offset + size - 1) / DIRTY_BLOCK_SIZE);
+    for (size_t block = first_block; block <= last_block; ++block) {
+        versions[block].fetch_add(1, std::memory_order_release);
+    }
+}
+
+size_t River::verify(const size_t offset,
+                     const size_t size,
+                     const std::function<void(const Corruption&)> handler)
+{
+    if (!checksums || (size == 0)) {
+        return 0;
+    }
+
+    size_t corrupted = 0;
+    const size_t last_block = ((offset + size - 1) / Checksums::BLOCK_SIZE);
+    for (size_t block = (offset / Checksums::BLOCK_SIZE); block <= last_block;
+         ++block) {
+        if (checksums->verify(block)) {
+            continue;
+        }
+        ++corrupted;
+
+        // Report the corrupted block along with the channels overlapping it.
+        Corruption corruption;
+        corruption.offset = (block * Checksums::BLOCK_SIZE);
+        corruption.size = std::min(Checksums::BLOCK_SIZE,
+                                   storage->size() - corruption.offset);
+        const size_t corruption_end = (corruption.offset + corruption.size);
+
+        // Channel offsets never decrease with node index, so the first
+        // overlapping channel is either the first node at or after the block,
+        // or the channel just before it if that channel extends into the block.
+        size_t node = (std::lower_bound(offsets.begin(),
+                                        offsets.end(),
+                                        corruption.offset)
+                       - offsets.begin());
+        if ((node > 0)
+            && ((offsets[node - 1] + sizes[node - 1]) > corruption.offset)) {
+            --node;
+        }
+        for (; (node < offsets.size()) && (offsets[node] < corruption_end);
+             ++node) {
+            if (sizes[node] > 0) {
+                corruption.paths.push_back(path(node));
+            }
+        }
+
+        if (handler) {
+            handler(corruption);
+        }
+    }
+
+    return corrupted;
+}
+
+void River::commit_range(const size_t offset, const size_t size)
+{
+    store(offset, back_storage.data() + offset, size);
+    if (replicator) {
+        replicator->append(offset, back_storage.data() + offset, size);
+    }
+}
+
+size_t River::repair(const size_t offset, const size_t size)
+{
+    if (!replicas) {
+        return 0;
+    }
+
+    // Repairs modify the backing memory, so like any other write, they hold the
+    // checksum block locks so that verification never sees a partial repair.
+    // The checksums already match the majority that the repair restores, and
+    // recomputing them would seal any corruption outside redundant memory.
+    if (checksums) {
+        checksums->lock(offset, size);
+    }
+    const size_t repaired = replicas->repair(offset, size);
+    if (checksums) {
+        checksums->unlock(offset, size);
+    }
+
+    return repaired;
+}
+
+void River::store(const size_t offset, const void* const src, const size_t size)
+{
+    overwrite(offset, src, size);
+    bump_versions(offset, size);
+}
+
+void River::overwrite(const size_t offset,
+                      const void* const src,
+                      const size_t size)
+{
+    assert((offset + size) <= storage->size());
+
+    if (checksums) {
+        checksums->lock(offset, size);
+        repair_locked(offset, size);
+        checksums->update(offset, src, size);
+    }
+
+    if (replicas) {
+        replicas->write(offset, src, size);
+    } else {
+        std::memcpy(storage->data() + offset, src, size);
+    }
+
+    if (checksums) {
+        checksums->unlock(offset, size);
+    }
+}
+
+void River::repair_locked(const size_t offset, const size_t size)
+{
+    // Checksums are updated from the old contents of the modified bytes, so an
+    // upset of a redundant copy about to be overwritten must be repaired
+    // first, or the checksum would stay off after the write corrects it.
+    if (replicas) {
+        replicas->repair(offset, size);
+    }
+}
+
+void River::cache(const size_t offset, const void* const src, const size_t size)
+{
+    if (dirty) {
+        assert((offset + size) <= back_storage.size());
+        std::memcpy(back_storage.data() + offset, src, size);
+    }
+    overwrite(offset, src, size);
+}
+
+void River::read(const size_t offset, void* const dest, const size_t size) const
+{
+    assert((offset + size) <= storage->size());
+
+    if (replicas) {
+        replicas->read(offset, dest, size);
+        return;
+    }
+
+    std::memcpy(dest, storage->data() + offset, size);
+}
+
+void River::write(const size_t offset, const void* const src, const size_t size)
+{
+    // Not in frame mode; write straight to the river.
+    if (!dirty) {
+        store(offset, src, size);
+        return;
+    }
+
+    // Write to the back buffer.
+    assert((offset + size) <= back_storage.size());
+    std::memcpy(back_storage.data() + offset, src, size);
+
+    mark_dirty(offset, size);
+}
+
+uint64_t River::load_word(const size_t offset) const
+{
+    assert((offset + sizeof(uint64_t)) <= storage->size());
+
+    if (replicas) {
+        uint64_t word = 0;
+        replicas->read(offset, &word, sizeof(word));
+        return word;
+    }
+
+    return __atomic_load_n(
+        reinterpret_cast<const uint64_t*>(storage->data() + offset),
+        __ATOMIC_ACQUIRE);
+}
+
+void River::update_bits(const size_t offset,
+                        const uint64_t mask,
+                        const bool set)
+{
+    // In frame mode, update the back buffer, which has neither checksums nor
+    // replicas.
+    if (dirty) {
+        assert((offset + sizeof(uint64_t)) <= back_storage.size());
+        uint64_t* const word =
+            reinterpret_cast<uint64_t*>(back_storage.data() + offset);
+        if (set) {
+            __atomic_fetch_or(word, mask, __ATOMIC_ACQ_REL);
+        } else {
+            __atomic_fetch_and(word, ~mask, __ATOMIC_ACQ_REL);
+        }
+        mark_dirty(offset, sizeof(uint64_t));
+        return;
+    }
+
+    assert((offset + sizeof(uint64_t)) <= storage->size());
+
+    if (checksums) {
+        // Nothing else modifies the word while its block is locked, so its
+        // new value is known up front.
+        checksums->lock(offset, sizeof(uint64_t));
+        repair_locked(offset, sizeof(uint64_t));
+        const uint64_t word = load_word(offset);
+        const uint64_t updated = (set ? (word | mask) : (word & ~mask));
+        checksums->update(offset, &updated, sizeof(updated));
+    }
+
+    if (replicas) {
+        replicas->update_bits(offset, mask, set);
+    } else {
+        uint64_t* const word =
+            reinterpret_cast<uint64_t*>(storage->data() + offset);
+        if (set) {
+            __atomic_fetch_or(word, mask, __ATOMIC_ACQ_REL);
+        } else {
+            __atomic_fetch_and(word, ~mask, __ATOMIC_ACQ_REL);
+        }
+    }
+
+    if (checksums) {
+        checksums->unlock(offset, sizeof(uint64_t));
+    }
+
+    bump_versions(offset, sizeof(uint64_t));
+}
+
+void River::mark_dirty(const size_t offset, const size_t size)
+{
+    if (size == 0) {
+        return;
+    }
+    const size_t first_block = (offset / DIRTY_BLOCK_SIZE);
+    const size_t last_block = ((offset + size - 1) / DIRTY_BLOCK_SIZE);
+    for (size_t block = first_block; block <= last_block; ++block) {
+        const uint64_t mask = (uint64_t(1) << (block % 64));
+        std::atomic<uint64_t>& word = dirty[block / 64];
+
+        // Skip the atomic RMW if the block is already dirty, which is the
+        // common case for repeated writes within a frame.
+        if (!(word.load(std::memory_order_relaxed) & mask)) {
+            word.fetch_or(mask, std::memory_order_release);
+        }
+    }
 }
 } /* namespace river */
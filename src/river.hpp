@@ -1,11 +1,28 @@
 #ifndef RIVER_RIVER_HPP
 #define RIVER_RIVER_HPP
 
+#include <atomic>
 #include <cstdint>
+#include <functional>
 #include <memory>
+#include <ostream>
+#include <string>
 #include <vector>
 
+#include "checksums.hpp"
+#include "lock.hpp"
+#include "race_detector.hpp"
+#include "replicas.hpp"
+#include "storage.hpp"
+
 namespace river {
+struct Derivation;
+class Profiler;
+class History;
+class Replicator;
+class Sampler;
+class Tracer;
+
 /**
  * River backing memory.
  *
@@ -20,23 +37,594 @@ public:
      */
     River();
 
+    /**
+     * Commits the current frame of a river built in frame mode.
+     *
+     * In frame mode, writes made during a frame go to a back buffer and are not
+     * visible to readers until the frame is committed. Committing copies every
+     * block of the back buffer that was written during the frame into the
+     * front buffer, so that all writes from the frame become visible at once.
+     *
+     * Within a frame, readers only ever see the front buffer, which doesn't
+     * change until the next commit, so reads don't acquire locks. Writes still
+     * acquire locks, since multiple writers may share a rivulet. This method
+     * must not be called concurrently with any reads or writes of the river.
+     *
+     * This has no effect if the river is not in frame mode.
+     */
+    void commit_frame() noexcept;
+
+    /**
+     * Gets the number of frames committed so far.
+     *
+     * @returns Frame count.
+     */
+    uint64_t frame() const noexcept;
+
+    /**
+     * Gets whether the river is in frame mode.
+     *
+     * @returns Whether river is in frame mode.
+     */
+    bool frames() const noexcept;
+
+    /**
+     * Advances the river epoch.
+     *
+     * Epochs mark points where threads synchronize, e.g., where one thread
+     * hands off ownership of unlocked channels to another. The race detector
+     * reports writes to an unlocked channel from two different threads within
+     * the same epoch. Committing a frame also advances the epoch.
+     *
+     * This may be called concurrently with accesses to the river.
+     *
+     * @see RaceDetector
+     */
+    void advance_epoch() noexcept;
+
+    /**
+     * Gets the current river epoch.
+     *
+     * @returns Epoch.
+     */
+    uint64_t epoch() const noexcept;
+
+    /**
+     * Sets the function called when the race detector detects a race.
+     *
+     * This has no effect unless the library is compiled with the race
+     * detector.
+     *
+     * @param handler Race handler.
+     *
+     * @see RaceDetector
+     */
+    void on_race(const std::function<void(const Race&)> handler);
+
+    /**
+     * Verifies the river backing memory against its checksums.
+     *
+     * This may be called concurrently with accesses to the river. In frame
+     * mode, the front buffer is verified.
+     *
+     * This has no effect if the river was not built with checksums.
+     *
+     * @param handler Function called for each corrupted region found.
+     *
+     * @returns Number of corrupted regions found.
+     *
+     * @see Builder::Options::checksums
+     */
+    size_t verify(const std::function<void(const Corruption&)> handler);
+
+    /**
+     * Repairs upsets in redundant rivulets by overwriting each copy that
+     * disagrees with the other two.
+     *
+     * This may be called concurrently with accesses to the river. In frame
+     * mode, the front buffer is repaired.
+     *
+     * Repairs restore the written contents, so they leave checksums as they
+     * are, and corruption that redundancy can't mask is still found by
+     * River::verify().
+     *
+     * This has no effect if the river has no redundant rivulets.
+     *
+     * @returns Number of bytes repaired.
+     *
+     * @see Builder::redundant()
+     */
+    size_t repair();
+
+    /**
+     * Exports the layout of the river's channels.
+     *
+     * Each line of the layout has the form `<path> <offset> <size> <type>`,
+     * with the offset and size of the channel in the river memory in bytes,
+     * and its element type as named in schemas, e.g., `double`, or `bytes`
+     * for channels without one, like flags and derived channels. Channels are
+     * listed in metadata order.
+     *
+     * @param os Output stream to write the layout to.
+     */
+    void export_layout(std::ostream& os) const;
+
+    /**
+     * Gets a hash of the layout of the river's channels.
+     *
+     * Rivers with the same channel paths, offsets, sizes, and element types
+     * have the same layout hash, so accessors generated from a schema can
+     * check that they match a river built at runtime.
+     *
+     * @returns 64-bit FNV-1a hash of the exported layout.
+     *
+     * @see River::export_layout()
+     */
+    uint64_t layout_hash() const;
+
+    /**
+     * Gets the river memory for direct loads and stores, e.g., by accessors
+     * generated from a schema.
+     *
+     * Direct accesses bypass locks, instrumentation, and the race detector,
+     * so callers must synchronize them themselves. Rivers in frame mode, with
+     * checksums, with redundant rivulets, or that keep versions for derived
+     * channels or Builder::Options::versions can't be accessed directly,
+     * since direct writes would skip the bookkeeping those need.
+     *
+     * @returns River memory, or null if the river can't be accessed directly.
+     */
+    uint8_t* direct_memory() noexcept;
+
 private:
     /**
-     * Befriend Builder, ChannelBase, and Rivulet so that they can access the
-     * river backing memory.
+     * Befriend Builder, ChannelBase, DerivedBase, Expressions, Flags, History,
+     * Mirror, Profiler, RaceDetector, Replicator, Rivulet, Sampler, Scheduler,
+     * Scrubber, Server, Tracer, and Watchpoints so that they can access the
+     * river backing memory and metadata.
      * @{
      */
     friend class Builder;
     friend class ChannelBase;
+    friend class DerivedBase;
+    friend class Expressions;
+    friend class Flags;
+    friend class History;
+    friend class Mirror;
+    friend class Profiler;
+    friend class RaceDetector;
+    friend class Replicator;
     friend class Rivulet;
+    friend class Sampler;
+    friend class Scheduler;
+    friend class Scrubber;
+    friend class Server;
+    friend class Tracer;
+    friend class Watchpoints;
     /**
      * @}
      */
 
+    /**
+     * Parent index of top-level nodes in the river metadata.
+     */
+    static constexpr uint32_t NO_PARENT = UINT32_MAX;
+
+    /**
+     * Lock index of unlocked nodes in the river metadata.
+     */
+    static constexpr uint32_t NO_LOCK = UINT32_MAX;
+
+    /**
+     * Element types of channels, as recorded in the river metadata.
+     */
+    enum class Scalar : uint8_t {
+        NONE = 0,
+        BOOL = 1,
+        INT8 = 2,
+        UINT8 = 3,
+        INT16 = 4,
+        UINT16 = 5,
+        INT32 = 6,
+        UINT32 = 7,
+        INT64 = 8,
+        UINT64 = 9,
+        FLOAT = 10,
+        DOUBLE = 11,
+    };
+
+    /**
+     * Size of the blocks that dirty memory is tracked in, in bytes.
+     */
+    static constexpr size_t DIRTY_BLOCK_SIZE = 64;
+
     /**
      * River backing memory.
+     *
+     * In frame mode, this is the front buffer.
+     */
+    std::unique_ptr<Storage> storage;
+
+    /**
+     * Back buffer written to during a frame.
+     *
+     * This is empty if the river is not in frame mode.
+     */
+    Storage back_storage;
+
+    /**
+     * Bitmap of back buffer blocks written since the last commit.
+     *
+     * Bit N is set if the block at byte offset N * DIRTY_BLOCK_SIZE is dirty.
+     * This is null if the river is not in frame mode.
+     */
+    std::unique_ptr<std::atomic<uint64_t>[]> dirty;
+
+    /**
+     * Number of words in the dirty bitmap.
+     */
+    size_t dirty_words;
+
+    /**
+     * Number of stores to each block of the river backing memory, with blocks
+     * of DIRTY_BLOCK_SIZE bytes.
+     *
+     * This is null unless the river was built with versions.
+     *
+     * @see Builder::Options::versions
+     */
+    std::unique_ptr<std::atomic<uint64_t>[]> versions;
+
+    /**
+     * Number of frames committed so far.
+     */
+    uint64_t frame_count;
+
+    /**
+     * Current epoch.
+     */
+    std::atomic<uint64_t> epoch_count;
+
+    /**
+     * The river metadata is a flat table with an entry for each node in the
+     * builder metadata tree, excluding the root, in depth-first order. A
+     * node's index in the table is its node index. Offsets and sizes are 32
+     * bits, which limits rivers to 4 GiB.
+     * @{
+     */
+
+    /**
+     * Names of the nodes, back to back. The name of node N spans from
+     * name_offsets[N] to name_offsets[N + 1]. Full paths are assembled from
+     * names on demand with River::path(), since they're only needed for
+     * reporting.
+     */
+    std::string names;
+
+    /**
+     * Offset of each node's name in names, plus a final entry for the end of
+     * the last name.
+     */
+    std::vector<uint32_t> name_offsets;
+
+    /**
+     * Index of each node's parent, or NO_PARENT for top-level nodes.
+     */
+    std::vector<uint32_t> parents;
+
+    /**
+     * Byte offset of each node's channel in the river backing memory. For
+     * nodes that aren't channels, this is where the channel would be, so that
+     * offsets never decrease with node index.
+     */
+    std::vector<uint32_t> offsets;
+
+    /**
+     * Size of each node's channel in bytes, or 0 for nodes that aren't
+     * channels.
+     */
+    std::vector<uint32_t> sizes;
+
+    /**
+     * Element type of each node's channel, or Scalar::NONE for nodes that
+     * aren't channels, and channels that aren't of an arithmetic type or an
+     * array of one.
+     */
+    std::vector<Scalar> scalars;
+
+    /**
+     * Index of each node's lock in locks, or NO_LOCK if the node is unlocked.
+     */
+    std::vector<uint32_t> lock_indices;
+
+    /**
+     * Locks of the river, one for each locked subtree.
+     */
+    std::vector<std::shared_ptr<Lock>> locks;
+
+    /**
+     * @}
+     */
+
+    /**
+     * Derived channels, ordered by node index.
+     */
+    std::vector<std::shared_ptr<Derivation>> derivations;
+
+    /**
+     * Profiler recording accesses to the river, or null if not profiling.
+     */
+    std::shared_ptr<Profiler> profiler;
+
+    /**
+     * Tracer recording lock and access events, or null if not tracing.
+     */
+    std::shared_ptr<Tracer> tracer;
+
+    /**
+     * Sampler counting channel accesses, or null if not sampling.
+     */
+    std::shared_ptr<Sampler> sampler;
+
+    /**
+     * Replicator that frame commits are appended to, or null if not
+     * replicating.
+     */
+    std::shared_ptr<Replicator> replicator;
+
+    /**
+     * History recording channel writes, or null if not recording.
+     */
+    std::shared_ptr<History> history;
+
+    /**
+     * Race detector checking accesses to unlocked channels. This is null
+     * unless the library is compiled with the race detector.
+     */
+    std::unique_ptr<RaceDetector> race_detector;
+
+    /**
+     * Checksums of the river backing memory, or null if the river was not
+     * built with checksums.
+     */
+    std::unique_ptr<Checksums> checksums;
+
+    /**
+     * Replicas of redundant rivulets, or null if the river has none.
+     */
+    std::unique_ptr<Replicas> replicas;
+
+    /**
+     * Gets the number of nodes in the river metadata.
+     *
+     * @returns Node count.
+     */
+    size_t node_count() const;
+
+    /**
+     * Assembles the full path of a node, e.g., `foo.bar.baz`.
+     *
+     * @param index Node index.
+     *
+     * @returns Node path.
+     */
+    std::string path(const size_t index) const;
+
+    /**
+     * Looks up a lock in the lock table.
+     *
+     * @param lock_index Lock index, or NO_LOCK.
+     *
+     * @returns Lock, or null if the lock index is NO_LOCK.
+     */
+    Lock* lock(const uint32_t lock_index) const;
+
+    /**
+     * Looks up a derived channel.
+     *
+     * @param node Index of the derived channel in the river metadata.
+     *
+     * @returns Derivation, or null if the node isn't a derived channel.
+     */
+    Derivation* derivation(const uint32_t node) const;
+
+    /**
+     * Puts the river in frame mode.
+     *
+     * This is called by the builder once all channels have been added to the
+     * river storage.
+     *
+     * @param memory If not null, memory the size of the river storage to
+     *               place the back buffer in instead of allocating it.
+     *
+     * @returns Whether the back buffer could be allocated.
+     */
+    bool enable_frames(uint8_t* const memory);
+
+    /**
+     * Starts maintaining checksums of the river backing memory.
+     *
+     * This is called by the builder once all channels have been added to the
+     * river storage.
+     *
+     * @param memory If not null, memory of Checksums::memory_size() bytes to
+     *               place the checksums in instead of allocating it.
+     */
+    void enable_checksums(void* const memory);
+
+    /**
+     * Starts keeping replicas of redundant ranges of the river backing memory.
+     *
+     * This is called by the builder once all channels have been added to the
+     * river storage.
+     *
+     * @param ranges Redundant ranges.
+     * @param memory If not null, memory of Replicas::memory_size() bytes to
+     *               place the replicas in instead of allocating it.
+     */
+    void enable_replicas(const std::vector<Replicas::Range>& ranges,
+                         uint8_t* const memory);
+
+    /**
+     * Starts counting stores to each block of the river backing memory.
+     *
+     * This is called by the builder once the river is otherwise fully built.
+     */
+    void enable_versions();
+
+    /**
+     * Gets the version of a range of the river backing memory, which changes
+     * whenever the range is stored to.
+     *
+     * The version is loaded with acquire ordering, so data read after it is at
+     * least as new as the stores it counts.
+     *
+     * @param offset Byte offset of range.
+     * @param size   Size of range in bytes.
+     *
+     * @returns Sum of the versions of the blocks covering the range, or 0 if
+     *          the river was not built with versions.
+     */
+    uint64_t version(const size_t offset, const size_t size) const;
+
+    /**
+     * Counts a store to the blocks covering a range.
+     *
+     * @param offset Byte offset of range.
+     * @param size   Size of range in bytes.
+     */
+    void bump_versions(const size_t offset, const size_t size);
+
+    /**
+     * Verifies the blocks of the river backing memory covering a range.
+     *
+     * @param offset  Byte offset of range.
+     * @param size    Size of range in bytes.
+     * @param handler Function called for each corrupted block found.
+     *
+     * @returns Number of corrupted blocks found.
+     */
+    size_t verify(const size_t offset,
+                  const size_t size,
+                  const std::function<void(const Corruption&)> handler);
+
+    /**
+     * Copies a range of the back buffer to the front buffer in frame mode.
+     *
+     * @param offset Byte offset of range.
+     * @param size   Size of range in bytes.
+     */
+    void commit_range(const size_t offset, const size_t size);
+
+    /**
+     * Repairs the redundant memory within a range.
+     *
+     * @param offset Byte offset of range.
+     * @param size   Size of range in bytes.
+     *
+     * @returns Number of bytes repaired.
+     */
+    size_t repair(const size_t offset, const size_t size);
+
+    /**
+     * Stores data in the river backing memory, i.e., the front buffer in
+     * frame mode, keeping checksums and replicas up to date.
+     *
+     * @param offset Byte offset to store at.
+     * @param src    Store source.
+     * @param size   Number of bytes to store.
+     */
+    void store(const size_t offset, const void* const src, const size_t size);
+
+    /**
+     * Stores data in the river backing memory like River::store(), but
+     * without counting the store in the versions.
+     *
+     * @param offset Byte offset to store at.
+     * @param src    Store source.
+     * @param size   Number of bytes to store.
+     */
+    void overwrite(const size_t offset,
+                   const void* const src,
+                   const size_t size);
+
+    /**
+     * Repairs the redundant memory within a range whose checksum blocks are
+     * locked for a modification.
+     *
+     * @param offset Byte offset of range.
+     * @param size   Size of range in bytes.
+     */
+    void repair_locked(const size_t offset, const size_t size);
+
+    /**
+     * Stores the cached value of a derived channel.
+     *
+     * The value is a function of the river backing memory, so it's stored
+     * like River::overwrite() in any mode, and also copied to the back buffer
+     * in frame mode so that commits don't revert it. It isn't counted in the
+     * versions, so caching a value never invalidates another.
+     *
+     * @param offset Byte offset to store at.
+     * @param src    Store source.
+     * @param size   Number of bytes to store.
+     */
+    void cache(const size_t offset, const void* const src, const size_t size);
+
+    /**
+     * Reads from the river.
+     *
+     * In frame mode, this reads the front buffer. Redundant memory is voted
+     * on.
+     *
+     * @param offset Byte offset to read at.
+     * @param dest   Read destination.
+     * @param size   Number of bytes to read.
+     */
+    void read(const size_t offset, void* const dest, const size_t size) const;
+
+    /**
+     * Writes to the river.
+     *
+     * In frame mode, this writes the back buffer and marks the written blocks
+     * as dirty.
+     *
+     * @param offset Byte offset to write at.
+     * @param src    Write source.
+     * @param size   Number of bytes to write.
+     */
+    void write(const size_t offset, const void* const src, const size_t size);
+
+    /**
+     * Atomically loads a 64-bit word from the river.
+     *
+     * In frame mode, this reads the front buffer. Redundant memory is voted
+     * on.
+     *
+     * @param offset Byte offset of word. Must be 8-byte aligned in memory.
+     *
+     * @returns Word value.
+     */
+    uint64_t load_word(const size_t offset) const;
+
+    /**
+     * Atomically sets or clears bits of a 64-bit word in the river.
+     *
+     * In frame mode, this updates the back buffer and marks the word as dirty.
+     *
+     * @param offset Byte offset of word. Must be 8-byte aligned in memory.
+     * @param mask   Bits to update.
+     * @param set    Whether to set the bits, as opposed to clearing them.
+     */
+    void update_bits(const size_t offset, const uint64_t mask, const bool set);
+
+    /**
+     * Marks blocks of the back buffer as dirty in frame mode.
+     *
+     * @param offset Byte offset of written range.
+     * @param size   Size of written range in bytes.
      */
-    std::shared_ptr<std::vector<uint8_t>> storage;
+    void mark_dirty(const size_t offset, const size_t size);
 };
 } /* namespace river */
 
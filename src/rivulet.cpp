@@ -1,54 +1,148 @@
+#include "profiler.hpp"
+#include "tracer.hpp"
 #include "rivulet.hpp"
 #include <cassert>
 #include <cstring>
 #include <iostream>
 
 namespace river {
-void Rivulet::read(void* const dest) const
+void Rivulet::read(void* const dest) const noexcept
 {
     // Do nothing if dest is null or not linked to a river.
     if (!dest || !linked()) {
         return;
     }
 
-    // Acquire lock if there is one.
-    if (link->lock) {
-        link->lock->acquire();
+    // Record the access if profiling.
+    if (link->river->profiler) {
+        link->river->profiler->record_rivulet(link->index, /* write= */ false);
+    }
+
+    // Look up the lock protecting the linked memory, if any.
+    Lock* const lock = link->river->lock(link->lock_index);
+
+    // Trace lock and access events if tracing.
+    Tracer* const tracer = link->river->tracer.get();
+
+    // Acquire lock if there is one. In frame mode, reads see the front buffer,
+    // which only changes between frames, so no lock is needed.
+    const bool use_lock = (lock && !link->river->frames());
+    if (use_lock) {
+        if (tracer) {
+            tracer->record(Tracer::Kind::LOCK_WAIT, link->index);
+        }
+        lock->acquire();
+        if (tracer) {
+            tracer->record(Tracer::Kind::LOCK_ACQUIRED, link->index);
+        }
+    }
+
+#ifdef RIVER_RACE_DETECTOR
+    // Check for writes overlapping the read of an unlocked rivulet, which
+    // spans all nodes below the rivulet node. Reads in frame mode can't race
+    // with writes.
+    RaceDetector* const race_detector =
+        ((lock || link->river->frames())
+             ? nullptr
+             : link->river->race_detector.get());
+    const size_t nodes_begin = (link->index + 1);
+    const size_t nodes_end =
+        (race_detector ? race_detector->subtree_end(link->index) : 0);
+    if (race_detector) {
+        race_detector->check_read(nodes_begin, nodes_end);
     }
+#endif
 
     // Copy data from rivulet to dest.
-    const void* const src = link->river->storage->data() + link->rivulet_offset;
-    std::memcpy(dest, src, link->rivulet_size);
+    if (tracer) {
+        tracer->record(Tracer::Kind::READ_BEGIN, link->index);
+    }
+    link->river->read(link->rivulet_offset, dest, link->rivulet_size);
+    if (tracer) {
+        tracer->record(Tracer::Kind::READ_END, link->index);
+    }
+
+#ifdef RIVER_RACE_DETECTOR
+    if (race_detector) {
+        race_detector->check_read(nodes_begin, nodes_end);
+    }
+#endif
 
     // Release lock if there is one.
-    if (link->lock) {
-        link->lock->release();
+    if (use_lock) {
+        if (tracer) {
+            tracer->record(Tracer::Kind::LOCK_RELEASE, link->index);
+        }
+        lock->release();
     }
 }
 
-void Rivulet::write(const void* const src)
+void Rivulet::write(const void* const src) noexcept
 {
     // Do nothing if src is null or not linked to a river.
     if (!src || !linked()) {
         return;
     }
 
+    // Record the access if profiling.
+    if (link->river->profiler) {
+        link->river->profiler->record_rivulet(link->index, /* write= */ true);
+    }
+
+    // Look up the lock protecting the linked memory, if any.
+    Lock* const lock = link->river->lock(link->lock_index);
+
+    // Trace lock and access events if tracing.
+    Tracer* const tracer = link->river->tracer.get();
+
     // Acquire lock if there is one.
-    if (link->lock) {
-        link->lock->acquire();
+    if (lock) {
+        if (tracer) {
+            tracer->record(Tracer::Kind::LOCK_WAIT, link->index);
+        }
+        lock->acquire();
+        if (tracer) {
+            tracer->record(Tracer::Kind::LOCK_ACQUIRED, link->index);
+        }
+    }
+
+#ifdef RIVER_RACE_DETECTOR
+    // Check for races with other writes of an unlocked rivulet.
+    RaceDetector* const race_detector =
+        (lock ? nullptr : link->river->race_detector.get());
+    const size_t nodes_begin = (link->index + 1);
+    const size_t nodes_end =
+        (race_detector ? race_detector->subtree_end(link->index) : 0);
+    if (race_detector) {
+        race_detector->begin_write(nodes_begin, nodes_end);
     }
+#endif
 
     // Copy data from src to rivulet.
-    void* const dest = link->river->storage->data() + link->rivulet_offset;
-    std::memcpy(dest, src, link->rivulet_size);
+    if (tracer) {
+        tracer->record(Tracer::Kind::WRITE_BEGIN, link->index);
+    }
+    link->river->write(link->rivulet_offset, src, link->rivulet_size);
+    if (tracer) {
+        tracer->record(Tracer::Kind::WRITE_END, link->index);
+    }
+
+#ifdef RIVER_RACE_DETECTOR
+    if (race_detector) {
+        race_detector->end_write(nodes_begin, nodes_end);
+    }
+#endif
 
     // Release lock if there is one.
-    if (link->lock) {
-        link->lock->release();
+    if (lock) {
+        if (tracer) {
+            tracer->record(Tracer::Kind::LOCK_RELEASE, link->index);
+        }
+        lock->release();
     }
 }
 
-size_t Rivulet::size() const
+size_t Rivulet::size() const noexcept
 {
     if (!linked()) {
         return 0;
@@ -56,4 +150,16 @@ size_t Rivulet::size() const
 
     return link->rivulet_size;
 }
+
+size_t Rivulet::verify(
+    const std::function<void(const Corruption&)> handler) const
+{
+    if (!linked()) {
+        return 0;
+    }
+
+    return link->river->verify(link->rivulet_offset,
+                               link->rivulet_size,
+                               handler);
+}
 } /* namespace river */
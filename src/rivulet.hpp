@@ -1,6 +1,9 @@
 #ifndef RIVER_RIVULET_HPP
 #define RIVER_RIVULET_HPP
 
+#include <functional>
+
+#include "checksums.hpp"
 #include "link.hpp"
 
 namespace river {
@@ -14,11 +17,13 @@ public:
     /**
      * Reads the rivulet memory.
      *
-     * This will copy exactly Rivulet::size() bytes to dest.
+     * This will copy exactly Rivulet::size() bytes to dest. Derived channels
+     * in the rivulet read as their cached values, which are zero until first
+     * read through their handles.
      *
      * @param dest Read destination.
      */
-    void read(void* const dest) const;
+    void read(void* const dest) const noexcept;
 
     /**
      * Writes the rivulet memory.
@@ -27,14 +32,29 @@ public:
      *
      * @param dest Read destination.
      */
-    void write(const void* const src);
+    void write(const void* const src) noexcept;
 
     /**
      * Gets the size of the rivulet in bytes.
      *
      * @returns Rivulet size in bytes.
      */
-    size_t size() const;
+    size_t size() const noexcept;
+
+    /**
+     * Verifies the rivulet memory against the river checksums.
+     *
+     * This has no effect if the rivulet is not linked or the river was not
+     * built with checksums.
+     *
+     * @param handler Function called for each corrupted region found. Regions
+     *                are checksummed blocks, which may extend past the rivulet.
+     *
+     * @returns Number of corrupted regions found.
+     *
+     * @see River::verify()
+     */
+    size_t verify(const std::function<void(const Corruption&)> handler) const;
 };
 } /* namespace river */
 
@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <cassert>
+
+#include "sampler.hpp"
+#include "thread.hpp"
+
+namespace river {
+namespace {
+/**
+ * Next sampler serial number. Serial numbers start at 1, so that 0 never
+ * matches a thread's cached slot.
+ */
+std::atomic<uint64_t> next_serial(1);
+} /* namespace */
+
+Sampler::Sampler(const size_t max_threads, const uint32_t period_)
+    : serial(next_serial.fetch_add(1, std::memory_order_relaxed))
+    , slots_size(max_threads)
+    , period(std::max<uint32_t>(1, period_))
+    , slots(new Slot[max_threads])
+    , dropped_count(0)
+    , paths()
+{
+    for (size_t i = 0; i < slots_size; ++i) {
+        slots[i].thread.store(0, std::memory_order_relaxed);
+        slots[i].countdown = period;
+    }
+}
+
+void Sampler::export_profile(std::ostream& os) const
+{
+    // Number threads in the order they claimed their slots, skipping slots
+    // that were never claimed.
+    uint32_t thread = 0;
+    for (size_t i = 0; i < slots_size; ++i) {
+        const Slot& slot = slots[i];
+        if ((slot.thread.load(std::memory_order_acquire) == 0)
+            || !slot.counts) {
+            continue;
+        }
+
+        for (size_t index = 0; index < paths.size(); ++index) {
+            const uint64_t reads =
+                slot.counts[index * 2].load(std::memory_order_relaxed);
+            const uint64_t writes =
+                slot.counts[(index * 2) + 1].load(std::memory_order_relaxed);
+            if ((reads > 0) || (writes > 0)) {
+                os << paths[index] << " " << thread << " " << reads << " "
+                   << writes << "\n";
+            }
+        }
+        ++thread;
+    }
+}
+
+uint64_t Sampler::dropped() const
+{
+    return dropped_count.load(std::memory_order_relaxed);
+}
+
+void Sampler::attach(const River& river)
+{
+    paths.clear();
+    for (size_t i = 0; i < river.node_count(); ++i) {
+        paths.push_back(river.path(i));
+    }
+
+    // Value-initialize so that every count starts out at 0.
+    for (size_t i = 0; i < slots_size; ++i) {
+        slots[i].countdown = period;
+        slots[i].counts.reset(new std::atomic<uint64_t>[paths.size() * 2]());
+    }
+}
+
+void Sampler::record(const size_t index, const bool write)
+{
+    Slot* const slot = thread_slot();
+    if (!slot) {
+        dropped_count.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // Only every period-th access of the thread is counted.
+    if (--slot->countdown > 0) {
+        return;
+    }
+    slot->countdown = period;
+
+    // Only the owning thread writes the counts, so they need no RMW.
+    assert(index < paths.size());
+    std::atomic<uint64_t>& count = slot->counts[(index * 2) + (write ? 1 : 0)];
+    count.store(count.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+}
+
+Sampler::Slot* Sampler::thread_slot()
+{
+    // Cache the slot of the last sampler this thread recorded to, so that the
+    // common case is a single comparison.
+    static thread_local uint64_t cached_serial = 0;
+    static thread_local Slot* cached_slot = nullptr;
+    if (cached_serial == serial) {
+        return cached_slot;
+    }
+
+    // Find the slot this thread already claimed, or claim an unclaimed one.
+    const uint32_t id = this_thread_id();
+    Slot* found = nullptr;
+    for (size_t i = 0; (i < slots_size) && !found; ++i) {
+        uint32_t owner = slots[i].thread.load(std::memory_order_relaxed);
+        if (owner == 0) {
+            slots[i].thread.compare_exchange_strong(owner,
+                                                    id,
+                                                    std::memory_order_acq_rel);
+            owner = slots[i].thread.load(std::memory_order_relaxed);
+        }
+        if (owner == id) {
+            found = &slots[i];
+        }
+    }
+
+    cached_serial = serial;
+    cached_slot = found;
+    return found;
+}
+} /* namespace river */
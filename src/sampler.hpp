@@ -0,0 +1,158 @@
+#ifndef RIVER_SAMPLER_HPP
+#define RIVER_SAMPLER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "river.hpp"
+
+namespace river {
+/**
+ * Samples channel reads and writes to find which channels are accessed most,
+ * and by which threads.
+ *
+ * A sampler is attached to a river when it's built by passing it in
+ * Builder::Options. While attached, every channel and flags access counts
+ * down a per-thread counter, and every Nth access of each thread is counted
+ * against the accessed channel. After a representative run, the sampler can
+ * export a profile, which Builder::load_profile() uses to lay out channels
+ * accessed by the same thread next to each other, hottest first.
+ *
+ * Like a Tracer, each thread claims its own slot of counters on its first
+ * access, so sampling never allocates, blocks, or writes memory shared with
+ * other threads. Accesses from threads beyond the number of slots are counted
+ * instead. Unlike a Profiler, a sampler is cheap enough to leave attached in
+ * production runs.
+ */
+class Sampler final {
+public:
+    /**
+     * Constructor.
+     *
+     * @param max_threads Number of threads that can be sampled.
+     * @param period      Number of accesses per sample on each thread. A
+     *                    period of 1 counts every access.
+     */
+    Sampler(const size_t max_threads, const uint32_t period);
+
+    /**
+     * Writes the samples counted so far as a profile.
+     *
+     * Each line of the profile has the form
+     * `<path> <thread> <reads> <writes>`, where `<thread>` numbers the
+     * sampled threads from 0 in the order they first accessed the river, and
+     * `<reads>` and `<writes>` are sample counts. Channels a thread never
+     * sampled are not listed for it.
+     *
+     * The output can be loaded into a builder with Builder::load_profile().
+     *
+     * @param os Output stream.
+     */
+    void export_profile(std::ostream& os) const;
+
+    /**
+     * Gets the number of accesses not sampled because their thread had no
+     * slot.
+     *
+     * @returns Dropped access count.
+     */
+    uint64_t dropped() const;
+
+private:
+    /**
+     * Befriend Builder, ChannelBase, DerivedBase, and Flags so that they can
+     * attach the sampler and record accesses.
+     * @{
+     */
+    friend class Builder;
+    friend class ChannelBase;
+    friend class DerivedBase;
+    friend class Flags;
+    /**
+     * @}
+     */
+
+    /**
+     * Sample counters of one thread.
+     */
+    struct alignas(64) Slot final {
+        /**
+         * ID of the owning thread, or 0 if unclaimed.
+         */
+        std::atomic<uint32_t> thread;
+
+        /**
+         * Number of accesses left until the next sample. Only the owning
+         * thread touches this.
+         */
+        uint32_t countdown;
+
+        /**
+         * Read and write sample counts, indexed by (node index * 2) for reads
+         * and (node index * 2 + 1) for writes. Only the owning thread writes
+         * these.
+         */
+        std::unique_ptr<std::atomic<uint64_t>[]> counts;
+    };
+
+    /**
+     * Unique serial number of this sampler, used to cache the calling
+     * thread's slot.
+     */
+    const uint64_t serial;
+
+    /**
+     * Number of slots.
+     */
+    const size_t slots_size;
+
+    /**
+     * Number of accesses per sample.
+     */
+    const uint32_t period;
+
+    /**
+     * Per-thread slots.
+     */
+    std::unique_ptr<Slot[]> slots;
+
+    /**
+     * Number of accesses not sampled.
+     */
+    std::atomic<uint64_t> dropped_count;
+
+    /**
+     * Full paths of the river nodes.
+     */
+    std::vector<std::string> paths;
+
+    /**
+     * Attaches the sampler to a river, discarding any previously counted
+     * samples.
+     *
+     * @param river River to sample. Must be fully built.
+     */
+    void attach(const River& river);
+
+    /**
+     * Records a read or write of the channel at a node.
+     *
+     * @param index Node index.
+     * @param write Whether the access is a write.
+     */
+    void record(const size_t index, const bool write);
+
+    /**
+     * Gets the slot of the calling thread, claiming one if needed.
+     *
+     * @returns Slot, or null if all slots are claimed by other threads.
+     */
+    Slot* thread_slot();
+};
+} /* namespace river */
+
+#endif
@@ -0,0 +1,358 @@
+#include <algorithm>
+#include <cassert>
+
+#include "scheduler.hpp"
+
+namespace river {
+Task::Task(const std::function<void()> func_)
+    : func(func_)
+    , accesses()
+{
+}
+
+Task& Task::reads(const ChannelBase& channel)
+{
+    accesses.push_back(
+        {.link = channel.link, .channel = true, .write = false});
+    return *this;
+}
+
+Task& Task::reads(const Flags& flags)
+{
+    accesses.push_back({.link = flags.link, .channel = true, .write = false});
+    return *this;
+}
+
+Task& Task::reads(const Rivulet& rivulet)
+{
+    accesses.push_back(
+        {.link = rivulet.link, .channel = false, .write = false});
+    return *this;
+}
+
+Task& Task::writes(const ChannelBase& channel)
+{
+    accesses.push_back({.link = channel.link, .channel = true, .write = true});
+    return *this;
+}
+
+Task& Task::writes(const Flags& flags)
+{
+    accesses.push_back({.link = flags.link, .channel = true, .write = true});
+    return *this;
+}
+
+Task& Task::writes(const Rivulet& rivulet)
+{
+    accesses.push_back({.link = rivulet.link, .channel = false, .write = true});
+    return *this;
+}
+
+bool Task::conflict(const Access& a, const Access& b)
+{
+    // Reads never conflict with each other.
+    if (!a.write && !b.write) {
+        return false;
+    }
+
+    // Accesses through unlinked handles have no effect, and accesses to
+    // different rivers never overlap.
+    if (!a.link || !a.link->river || !b.link || !b.link->river
+        || (a.link->river != b.link->river)) {
+        return false;
+    }
+
+    // Compute the memory range touched by each access.
+    const size_t a_begin =
+        (a.channel ? a.link->channel_offset : a.link->rivulet_offset);
+    const size_t a_end =
+        a_begin + (a.channel ? a.link->channel_size : a.link->rivulet_size);
+    const size_t b_begin =
+        (b.channel ? b.link->channel_offset : b.link->rivulet_offset);
+    const size_t b_end =
+        b_begin + (b.channel ? b.link->channel_size : b.link->rivulet_size);
+
+    return ((a_begin < b_end) && (b_begin < a_end));
+}
+
+Scheduler::Scheduler(const size_t thread_count)
+    : tasks()
+    , graph_valid(true)
+    , successor_offsets()
+    , successors()
+    , predecessor_counts()
+    , rivers()
+    , pending(nullptr)
+    , remaining(0)
+    , queued(0)
+    , queues()
+    , workers()
+    , stopping(false)
+    , wait_mutex()
+    , work_cv()
+    , done_cv()
+{
+    // Create all queues before starting any workers, since workers steal from
+    // each other's queues.
+    for (size_t i = 0; i < thread_count; ++i) {
+        queues.emplace_back(new Queue);
+    }
+
+    for (size_t i = 0; i < thread_count; ++i) {
+        workers.emplace_back(&Scheduler::work, this, i);
+    }
+}
+
+Scheduler::~Scheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(wait_mutex);
+        stopping = true;
+    }
+    work_cv.notify_all();
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+int32_t Scheduler::add(const Task& task)
+{
+    if (!task.func) {
+        return ERR_INVALID;
+    }
+
+    tasks.push_back(task);
+    graph_valid = false;
+
+    return 0;
+}
+
+void Scheduler::run()
+{
+    if (!graph_valid) {
+        build_graph();
+    }
+
+    // The previous frame has finished, so every river hand-off between frames
+    // is synchronized.
+    for (const std::shared_ptr<River>& river : rivers) {
+        river->advance_epoch();
+    }
+
+    // With no workers, run tasks serially in the order they were added. This
+    // trivially satisfies all dependencies, since a task only ever depends on
+    // tasks added before it.
+    if (workers.empty()) {
+        for (size_t i = 0; i < tasks.size(); ++i) {
+            execute(i, nullptr);
+        }
+        return;
+    }
+
+    if (tasks.empty()) {
+        return;
+    }
+
+    // Reset dependency counters for the frame.
+    remaining.store(tasks.size(), std::memory_order_relaxed);
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        pending[i].store(predecessor_counts[i], std::memory_order_relaxed);
+    }
+
+    // Distribute tasks with no dependencies across worker queues.
+    size_t next_queue = 0;
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        if (predecessor_counts[i] == 0) {
+            push(i, *queues[next_queue]);
+            next_queue = ((next_queue + 1) % queues.size());
+        }
+    }
+
+    // Wait for the frame to finish.
+    std::unique_lock<std::mutex> lock(wait_mutex);
+    done_cv.wait(lock, [this]() -> bool {
+        return (remaining.load(std::memory_order_acquire) == 0);
+    });
+}
+
+void Scheduler::build_graph()
+{
+    const size_t task_count = tasks.size();
+    successor_offsets.assign(task_count + 1, 0);
+    successors.clear();
+    predecessor_counts.assign(task_count, 0);
+    pending.reset(new std::atomic<uint32_t>[task_count]);
+
+    // Give each queue room for every task, so that pushes never allocate.
+    // Idle workers may be checking their queues, so take the queue locks.
+    for (const std::unique_ptr<Queue>& queue : queues) {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        queue->tasks.reset(new size_t[task_count]);
+        queue->front = 0;
+        queue->count = 0;
+    }
+
+    // Collect the rivers accessed by the tasks.
+    rivers.clear();
+    for (const Task& task : tasks) {
+        for (const Task::Access& access : task.accesses) {
+            if (access.link && access.link->river
+                && (std::find(rivers.begin(),
+                              rivers.end(),
+                              access.link->river)
+                    == rivers.end())) {
+                rivers.push_back(access.link->river);
+            }
+        }
+    }
+
+    // Task J depends on an earlier task I if any of their accesses conflict.
+    for (size_t i = 0; i < task_count; ++i) {
+        successor_offsets[i] = successors.size();
+        for (size_t j = (i + 1); j < task_count; ++j) {
+            bool conflict = false;
+            for (const Task::Access& a : tasks[i].accesses) {
+                for (const Task::Access& b : tasks[j].accesses) {
+                    if (Task::conflict(a, b)) {
+                        conflict = true;
+                        break;
+                    }
+                }
+                if (conflict) {
+                    break;
+                }
+            }
+
+            if (conflict) {
+                successors.push_back(j);
+                ++predecessor_counts[j];
+            }
+        }
+    }
+    successor_offsets[task_count] = successors.size();
+
+    graph_valid = true;
+}
+
+void Scheduler::execute(const size_t index, Queue* const queue)
+{
+    const Task& task = tasks[index];
+
+#ifdef RIVER_RACE_DETECTOR
+    // A task that depended on others starts after they finished, possibly on
+    // other threads, which hands off the memory it declared to this thread.
+    // Only that memory is handed off, so that races between other tasks
+    // running concurrently are still detected.
+    if (queue && (predecessor_counts[index] > 0)) {
+        for (const Task::Access& access : task.accesses) {
+            RaceDetector* const race_detector =
+                ((access.link && access.link->river)
+                     ? access.link->river->race_detector.get()
+                     : nullptr);
+            if (race_detector) {
+                const size_t begin = access.link->index;
+                race_detector->hand_off(
+                    begin,
+                    (access.channel ? (begin + 1)
+                                    : race_detector->subtree_end(begin)));
+            }
+        }
+    }
+#endif
+
+    task.func();
+
+    // Serial execution has no bookkeeping.
+    if (!queue) {
+        return;
+    }
+
+    // Ready any successors whose last dependency was this task. They go on
+    // this worker's queue, since they likely touch memory that's now in this
+    // core's cache.
+    for (size_t i = successor_offsets[index]; i < successor_offsets[index + 1];
+         ++i) {
+        const size_t successor = successors[i];
+        if (pending[successor].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            push(successor, *queue);
+        }
+    }
+
+    // Wake the frame runner if this was the last task.
+    if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        std::lock_guard<std::mutex> lock(wait_mutex);
+        done_cv.notify_all();
+    }
+}
+
+void Scheduler::push(const size_t index, Queue& queue)
+{
+    // Count the task before it becomes visible, so that the count never
+    // underflows when another worker pops it immediately.
+    queued.fetch_add(1, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        assert(queue.count < tasks.size());
+        queue.tasks[(queue.front + queue.count) % tasks.size()] = index;
+        ++queue.count;
+    }
+
+    // Wake a sleeping worker. Taking the mutex ensures that a worker about to
+    // sleep either sees the new count or receives the notification.
+    {
+        std::lock_guard<std::mutex> lock(wait_mutex);
+    }
+    work_cv.notify_one();
+}
+
+bool Scheduler::pop(const size_t worker, size_t& index)
+{
+    // Try the worker's own queue first, newest task first.
+    {
+        Queue& queue = *queues[worker];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.count > 0) {
+            --queue.count;
+            index = queue.tasks[(queue.front + queue.count) % tasks.size()];
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    // Steal the oldest task from another worker.
+    for (size_t i = 1; i < queues.size(); ++i) {
+        Queue& queue = *queues[(worker + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.count > 0) {
+            index = queue.tasks[queue.front];
+            queue.front = ((queue.front + 1) % tasks.size());
+            --queue.count;
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Scheduler::work(const size_t worker)
+{
+    while (true) {
+        size_t index = 0;
+        if (pop(worker, index)) {
+            execute(index, queues[worker].get());
+            continue;
+        }
+
+        // No work anywhere; sleep until tasks are pushed or we're stopping.
+        std::unique_lock<std::mutex> lock(wait_mutex);
+        work_cv.wait(lock, [this]() -> bool {
+            return (stopping || (queued.load(std::memory_order_acquire) > 0));
+        });
+        if (stopping) {
+            return;
+        }
+    }
+}
+} /* namespace river */
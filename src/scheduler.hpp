@@ -0,0 +1,371 @@
+#ifndef RIVER_SCHEDULER_HPP
+#define RIVER_SCHEDULER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "channel.hpp"
+#include "flags.hpp"
+#include "link.hpp"
+#include "rivulet.hpp"
+
+namespace river {
+/**
+ * A unit of work run by a Scheduler, along with the river memory it accesses.
+ *
+ * A task declares every channel and rivulet it reads or writes through the
+ * handles it uses to access them. The scheduler relies on these declarations
+ * to run tasks in parallel, so a task must not access any river memory that it
+ * didn't declare.
+ */
+class Task final {
+public:
+    /**
+     * Constructor.
+     *
+     * @param func Function to run.
+     */
+    explicit Task(const std::function<void()> func);
+
+    /**
+     * Declares that the task reads a channel.
+     *
+     * @param channel Channel handle.
+     *
+     * @returns This task.
+     */
+    Task& reads(const ChannelBase& channel);
+
+    /**
+     * Declares that the task reads a channel of flags.
+     *
+     * @param flags Flags handle.
+     *
+     * @returns This task.
+     */
+    Task& reads(const Flags& flags);
+
+    /**
+     * Declares that the task reads a rivulet.
+     *
+     * @param rivulet Rivulet handle.
+     *
+     * @returns This task.
+     */
+    Task& reads(const Rivulet& rivulet);
+
+    /**
+     * Declares that the task writes a channel. Writing implies reading.
+     *
+     * @param channel Channel handle.
+     *
+     * @returns This task.
+     */
+    Task& writes(const ChannelBase& channel);
+
+    /**
+     * Declares that the task writes a channel of flags. Writing implies
+     * reading.
+     *
+     * @param flags Flags handle.
+     *
+     * @returns This task.
+     */
+    Task& writes(const Flags& flags);
+
+    /**
+     * Declares that the task writes a rivulet. Writing implies reading.
+     *
+     * @param rivulet Rivulet handle.
+     *
+     * @returns This task.
+     */
+    Task& writes(const Rivulet& rivulet);
+
+private:
+    /**
+     * Befriend Scheduler so that it can inspect the task accesses.
+     */
+    friend class Scheduler;
+
+    /**
+     * A declared access to river memory.
+     */
+    struct Access final {
+        /**
+         * Link of the accessed handle.
+         */
+        std::shared_ptr<Link> link;
+
+        /**
+         * Whether the access is to the channel (as opposed to the rivulet) at
+         * the link.
+         */
+        bool channel;
+
+        /**
+         * Whether the access is a write.
+         */
+        bool write;
+    };
+
+    /**
+     * Function to run.
+     */
+    std::function<void()> func;
+
+    /**
+     * Declared accesses.
+     */
+    std::vector<Access> accesses;
+
+    /**
+     * Gets whether two accesses conflict, i.e., they touch overlapping river
+     * memory and at least one of them is a write.
+     *
+     * Accesses through handles that are not linked never conflict, since they
+     * have no effect.
+     *
+     * @param a First access.
+     * @param b Second access.
+     *
+     * @returns Whether the accesses conflict.
+     */
+    static bool conflict(const Access& a, const Access& b);
+};
+
+/**
+ * Runs tasks in parallel on a work-stealing thread pool.
+ *
+ * Tasks are run in frames. Within a frame, each task runs exactly once. Two
+ * tasks that conflict, i.e., one writes memory that the other reads or writes,
+ * run in the order they were added to the scheduler. Tasks that don't conflict
+ * may run concurrently. This gives the same result as running the tasks
+ * serially in the order they were added, provided each task only accesses
+ * river memory it declared.
+ *
+ * The scheduler derives a dependency graph from the task declarations the
+ * first time a frame is run after tasks are added, since handles only have
+ * known memory once the river is built. The graph is reused for subsequent
+ * frames.
+ *
+ * Frame boundaries are synchronization points, so the scheduler advances the
+ * epoch of the rivers involved at the start of each frame. The start of a
+ * task whose predecessors just finished only synchronizes with them, so the
+ * race detector is told that the memory the task declared was handed off to
+ * it, rather than advancing the epoch of the whole river.
+ *
+ * @see River::advance_epoch()
+ * @see RaceDetector::hand_off()
+ */
+class Scheduler final {
+public:
+    /**
+     * Error codes that the scheduler interface can return.
+     * @{
+     */
+    static constexpr int32_t ERR_INVALID = 1;
+    /**
+     * @}
+     */
+
+    /**
+     * Constructor.
+     *
+     * @param thread_count Number of worker threads. If 0, tasks are run
+     *                     serially on the thread that runs the frame.
+     */
+    explicit Scheduler(const size_t thread_count);
+
+    /**
+     * Destructor. Stops and joins all worker threads.
+     */
+    ~Scheduler();
+
+    /**
+     * Schedulers are not copyable or movable, since workers hold pointers to
+     * them.
+     * @{
+     */
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+    /**
+     * @}
+     */
+
+    /**
+     * Adds a task to the scheduler.
+     *
+     * The task is run in every subsequent frame.
+     *
+     * @param task Task to add.
+     *
+     * @retval 0           Success.
+     * @retval ERR_INVALID Task has no function.
+     */
+    int32_t add(const Task& task);
+
+    /**
+     * Runs one frame, blocking until all tasks have run.
+     *
+     * This must not be called concurrently with itself or Scheduler::add().
+     * Only the first frame after tasks are added allocates memory.
+     */
+    void run();
+
+private:
+    /**
+     * Queue of ready tasks owned by a worker. The owner pushes and pops at the
+     * back, while other workers steal from the front.
+     *
+     * The queue is a ring buffer with room for every task, allocated when the
+     * dependency graph is built, so that running frames never allocates.
+     */
+    struct Queue final {
+        /**
+         * Protects the queue.
+         */
+        std::mutex mutex;
+
+        /**
+         * Ring buffer of the indices of ready tasks.
+         */
+        std::unique_ptr<size_t[]> tasks;
+
+        /**
+         * Position of the front task in the ring buffer.
+         */
+        size_t front = 0;
+
+        /**
+         * Number of ready tasks.
+         */
+        size_t count = 0;
+    };
+
+    /**
+     * Tasks to run.
+     */
+    std::vector<Task> tasks;
+
+    /**
+     * Whether the dependency graph reflects the current tasks.
+     */
+    bool graph_valid;
+
+    /**
+     * Dependency graph in compressed sparse row form. The successors of task N
+     * are successors[successor_offsets[N]] through
+     * successors[successor_offsets[N + 1] - 1].
+     * @{
+     */
+    std::vector<size_t> successor_offsets;
+    std::vector<size_t> successors;
+    /**
+     * @}
+     */
+
+    /**
+     * Number of predecessors of each task.
+     */
+    std::vector<uint32_t> predecessor_counts;
+
+    /**
+     * Rivers accessed by the tasks.
+     */
+    std::vector<std::shared_ptr<River>> rivers;
+
+    /**
+     * Number of predecessors of each task that have not yet run this frame.
+     */
+    std::unique_ptr<std::atomic<uint32_t>[]> pending;
+
+    /**
+     * Number of tasks that have not yet run this frame.
+     */
+    std::atomic<size_t> remaining;
+
+    /**
+     * Number of ready tasks across all queues.
+     */
+    std::atomic<size_t> queued;
+
+    /**
+     * Worker queues, one per worker.
+     */
+    std::vector<std::unique_ptr<Queue>> queues;
+
+    /**
+     * Worker threads.
+     */
+    std::vector<std::thread> workers;
+
+    /**
+     * Whether workers should exit.
+     */
+    bool stopping;
+
+    /**
+     * Protects waiting on and signaling the condition variables.
+     */
+    std::mutex wait_mutex;
+
+    /**
+     * Signaled when tasks become ready or the scheduler is stopping.
+     */
+    std::condition_variable work_cv;
+
+    /**
+     * Signaled when the last task in a frame finishes.
+     */
+    std::condition_variable done_cv;
+
+    /**
+     * Builds the dependency graph from the task declarations.
+     */
+    void build_graph();
+
+    /**
+     * Runs a task and readies its successors.
+     *
+     * @param index Task index.
+     * @param queue Queue to push newly ready tasks to, or null if running
+     *              serially.
+     */
+    void execute(const size_t index, Queue* const queue);
+
+    /**
+     * Pushes a ready task to a queue and wakes a worker.
+     *
+     * @param index Task index.
+     * @param queue Queue to push to.
+     */
+    void push(const size_t index, Queue& queue);
+
+    /**
+     * Pops a ready task from a worker's own queue, or steals one from another
+     * worker.
+     *
+     * @param      worker Worker index.
+     * @param[out] index  On success, task index.
+     *
+     * @returns Whether a task was found.
+     */
+    bool pop(const size_t worker, size_t& index);
+
+    /**
+     * Worker thread loop.
+     *
+     * @param worker Worker index.
+     */
+    void work(const size_t worker);
+};
+} /* namespace river */
+
+#endif
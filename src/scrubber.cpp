@@ -0,0 +1,82 @@
+#include <algorithm>
+
+#include "scrubber.hpp"
+
+namespace river {
+Scrubber::Scrubber(const std::shared_ptr<River> river_,
+                   const size_t bytes_per_second,
+                   const std::function<void(const Corruption&)> handler_)
+    : river(river_)
+    , bytes_per_period(std::max<size_t>(
+          Checksums::BLOCK_SIZE,
+          (bytes_per_second * PERIOD.count()) / 1000))
+    , handler(handler_)
+    , pass_count(0)
+    , corruption_count(0)
+    , correction_count(0)
+    , stopping(false)
+    , mutex()
+    , stop_cv()
+    , thread(&Scrubber::run, this)
+{
+}
+
+Scrubber::~Scrubber()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    stop_cv.notify_all();
+    thread.join();
+}
+
+uint64_t Scrubber::passes() const
+{
+    return pass_count.load(std::memory_order_relaxed);
+}
+
+uint64_t Scrubber::corruptions() const
+{
+    return corruption_count.load(std::memory_order_relaxed);
+}
+
+uint64_t Scrubber::corrections() const
+{
+    return correction_count.load(std::memory_order_relaxed);
+}
+
+void Scrubber::run()
+{
+    const size_t river_size = river->storage->size();
+    size_t offset = 0;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        // Verify the next stretch of the river without holding the mutex, so
+        // that stopping isn't delayed by verification.
+        if ((river->checksums || river->replicas) && (river_size > 0)) {
+            lock.unlock();
+
+            // Repair before verifying, so that upsets masked by redundancy
+            // aren't reported as corruption.
+            const size_t size =
+                std::min(bytes_per_period, river_size - offset);
+            const size_t repaired = river->repair(offset, size);
+            correction_count.fetch_add(repaired, std::memory_order_relaxed);
+            const size_t corrupted = river->verify(offset, size, handler);
+            corruption_count.fetch_add(corrupted, std::memory_order_relaxed);
+
+            offset += size;
+            if (offset >= river_size) {
+                offset = 0;
+                pass_count.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            lock.lock();
+        }
+
+        stop_cv.wait_for(lock, PERIOD, [this]() -> bool { return stopping; });
+    }
+}
+} /* namespace river */
@@ -0,0 +1,145 @@
+#ifndef RIVER_SCRUBBER_HPP
+#define RIVER_SCRUBBER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "checksums.hpp"
+#include "river.hpp"
+
+namespace river {
+/**
+ * Background thread that continuously repairs and verifies a river.
+ *
+ * The scrubber walks the river backing memory at a fixed rate, wrapping around
+ * at the end, so that corruption is eventually found even in memory that is
+ * never written. Upsets in redundant rivulets are repaired first, and the
+ * memory is then verified against its checksums. The river must have
+ * redundant rivulets or be built with checksums for the scrubber to have any
+ * effect.
+ *
+ * @see Builder::Options::checksums
+ * @see Builder::redundant()
+ */
+class Scrubber final {
+public:
+    /**
+     * Interval between verification steps.
+     */
+    static constexpr std::chrono::milliseconds PERIOD {10};
+
+    /**
+     * Constructor. Starts the scrubber thread.
+     *
+     * @param river            River to verify.
+     * @param bytes_per_second Number of bytes to verify per second. At least
+     *                         one checksummed block is verified per period.
+     * @param handler          Function called from the scrubber thread for
+     *                         each corrupted region found.
+     */
+    Scrubber(const std::shared_ptr<River> river,
+             const size_t bytes_per_second,
+             const std::function<void(const Corruption&)> handler);
+
+    /**
+     * Destructor. Stops and joins the scrubber thread.
+     */
+    ~Scrubber();
+
+    /**
+     * Scrubbers are not copyable or movable, since the thread holds a pointer
+     * to the scrubber.
+     * @{
+     */
+    Scrubber(const Scrubber&) = delete;
+    Scrubber& operator=(const Scrubber&) = delete;
+    /**
+     * @}
+     */
+
+    /**
+     * Gets the number of complete passes over the river so far.
+     *
+     * @returns Pass count.
+     */
+    uint64_t passes() const;
+
+    /**
+     * Gets the number of corrupted regions found so far.
+     *
+     * @returns Corruption count.
+     */
+    uint64_t corruptions() const;
+
+    /**
+     * Gets the number of bytes of redundant memory repaired so far.
+     *
+     * @returns Repaired byte count.
+     */
+    uint64_t corrections() const;
+
+private:
+    /**
+     * Verified river.
+     */
+    const std::shared_ptr<River> river;
+
+    /**
+     * Number of bytes verified per period.
+     */
+    const size_t bytes_per_period;
+
+    /**
+     * Corruption handler.
+     */
+    const std::function<void(const Corruption&)> handler;
+
+    /**
+     * Number of complete passes.
+     */
+    std::atomic<uint64_t> pass_count;
+
+    /**
+     * Number of corrupted regions found.
+     */
+    std::atomic<uint64_t> corruption_count;
+
+    /**
+     * Number of bytes repaired.
+     */
+    std::atomic<uint64_t> correction_count;
+
+    /**
+     * Whether the thread should exit.
+     */
+    bool stopping;
+
+    /**
+     * Protects stopping.
+     */
+    std::mutex mutex;
+
+    /**
+     * Signaled when the scrubber is stopping.
+     */
+    std::condition_variable stop_cv;
+
+    /**
+     * Scrubber thread.
+     */
+    std::thread thread;
+
+    /**
+     * Scrubber thread loop.
+     */
+    void run();
+};
+} /* namespace river */
+
+#endif
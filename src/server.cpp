@@ -0,0 +1,698 @@
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "server.hpp"
+
+namespace river {
+namespace {
+/**
+ * Size of the length that precedes each message, in bytes.
+ */
+constexpr size_t LENGTH_SIZE = sizeof(uint32_t);
+
+/**
+ * Size of the op, request ID, and entry count of each message, in bytes.
+ */
+constexpr size_t HEADER_SIZE =
+    (sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint16_t));
+
+/**
+ * Reads fields from a received message, failing once the message runs out.
+ */
+class MessageReader final {
+public:
+    MessageReader(const uint8_t* const data_, const size_t size_)
+        : data(data_)
+        , size(size_)
+        , pos(0)
+    {
+    }
+
+    /**
+     * Reads an integer field.
+     *
+     * @param[out] value On success, field value.
+     *
+     * @returns Whether the message had the field.
+     */
+    template <typename T>
+    bool get(T& value)
+    {
+        if ((size - pos) < sizeof(T)) {
+            return false;
+        }
+        std::memcpy(&value, data + pos, sizeof(T));
+        pos += sizeof(T);
+        return true;
+    }
+
+    /**
+     * Reads a field of raw bytes.
+     *
+     * @param      length Field length in bytes.
+     * @param[out] bytes  On success, field address.
+     *
+     * @returns Whether the message had the field.
+     */
+    bool get_bytes(const size_t length, const uint8_t*& bytes)
+    {
+        if ((size - pos) < length) {
+            return false;
+        }
+        bytes = (data + pos);
+        pos += length;
+        return true;
+    }
+
+    /**
+     * Reads a path field.
+     *
+     * @param[out] path On success, path.
+     *
+     * @returns Whether the message had the field.
+     */
+    bool get_path(std::string& path)
+    {
+        uint16_t length = 0;
+        const uint8_t* bytes = nullptr;
+        if (!get(length) || !get_bytes(length, bytes)) {
+            return false;
+        }
+        path.assign(reinterpret_cast<const char*>(bytes), length);
+        return true;
+    }
+
+    /**
+     * Gets whether the whole message has been read.
+     *
+     * @returns Whether the whole message has been read.
+     */
+    bool done() const
+    {
+        return (pos == size);
+    }
+
+private:
+    const uint8_t* const data;
+    const size_t size;
+    size_t pos;
+};
+
+/**
+ * Appends an integer to a message.
+ *
+ * @param output Output to append to.
+ * @param value  Value.
+ */
+template <typename T>
+void put(std::vector<uint8_t>& output, const T value)
+{
+    const size_t pos = output.size();
+    output.resize(pos + sizeof(T));
+    std::memcpy(output.data() + pos, &value, sizeof(T));
+}
+
+/**
+ * Appends the start of a message, whose length and entry count are filled
+ * in by end_message().
+ *
+ * @param output Output to append to.
+ * @param op     Message op.
+ * @param id     Request ID.
+ *
+ * @returns Position of the message in the output.
+ */
+size_t begin_message(std::vector<uint8_t>& output,
+                     const Server::Op op,
+                     const uint32_t id)
+{
+    const size_t start = output.size();
+    put(output, uint32_t(0));
+    put(output, static_cast<uint8_t>(op));
+    put(output, id);
+    put(output, uint16_t(0));
+    return start;
+}
+
+/**
+ * Fills in the length and entry count of a message.
+ *
+ * @param output Output holding the message.
+ * @param start  Position of the message in the output.
+ * @param count  Number of entries.
+ */
+void end_message(std::vector<uint8_t>& output,
+                 const size_t start,
+                 const uint16_t count)
+{
+    const uint32_t length =
+        static_cast<uint32_t>(output.size() - start - LENGTH_SIZE);
+    std::memcpy(output.data() + start, &length, sizeof(length));
+    std::memcpy(output.data() + start + LENGTH_SIZE + sizeof(uint8_t)
+                    + sizeof(uint32_t),
+                &count,
+                sizeof(count));
+}
+} /* namespace */
+
+Server::Server(const std::shared_ptr<River> river_, const Options& options_)
+    : river(river_)
+    , options(options_)
+    , targets()
+    , path()
+    , listen_fd(-1)
+    , epoll_fd(-1)
+    , stop_fd(-1)
+    , clients()
+    , thread()
+{
+    assert(river);
+    resolve_targets();
+}
+
+Server::~Server()
+{
+    stop();
+}
+
+void Server::resolve_targets()
+{
+    // Nodes come after their parents in the metadata, so the end of each
+    // subtree, and whether it holds a derived channel, can be found by
+    // propagating up from the last node.
+    const size_t node_count = river->node_count();
+    std::vector<uint32_t> ends(node_count);
+    std::vector<bool> derived(node_count, false);
+    for (size_t i = 0; i < node_count; ++i) {
+        ends[i] = (river->offsets[i] + river->sizes[i]);
+        derived[i] = (river->derivation(static_cast<uint32_t>(i)) != nullptr);
+    }
+    for (size_t i = node_count; i-- > 0;) {
+        const uint32_t parent = river->parents[i];
+        if (parent != River::NO_PARENT) {
+            ends[parent] = std::max(ends[parent], ends[i]);
+            derived[parent] = (derived[parent] || derived[i]);
+        }
+    }
+
+    // Derived channels only hold a cache that's computed on reads through
+    // their handles, so serving them would return stale values and let
+    // writes clobber the cache.
+    targets.reserve(node_count);
+    for (size_t i = 0; i < node_count; ++i) {
+        if (derived[i]) {
+            continue;
+        }
+        targets.emplace(river->path(i),
+                        Target {
+                            .offset = river->offsets[i],
+                            .size = (ends[i] - river->offsets[i]),
+                            .lock_index = river->lock_indices[i],
+                        });
+    }
+}
+
+void Server::read(const Target& target, uint8_t* const dest) const
+{
+    Lock* const lock = river->lock(target.lock_index);
+    if (lock) {
+        lock->acquire();
+    }
+    river->read(target.offset, dest, target.size);
+    if (lock) {
+        lock->release();
+    }
+}
+
+void Server::write(const Target& target, const uint8_t* const src) const
+{
+    Lock* const lock = river->lock(target.lock_index);
+    if (lock) {
+        lock->acquire();
+    }
+    river->write(target.offset, src, target.size);
+    if (lock) {
+        lock->release();
+    }
+}
+
+bool Server::handle(Client& client, const uint8_t* message, const size_t size)
+{
+    MessageReader reader(message, size);
+    uint8_t op = 0;
+    uint32_t id = 0;
+    uint16_t count = 0;
+    if (!reader.get(op) || !reader.get(id) || !reader.get(count)) {
+        return false;
+    }
+
+    std::vector<uint8_t>& output = client.output;
+    const size_t start = begin_message(output, static_cast<Op>(op), id);
+    std::string entry_path;
+    switch (static_cast<Op>(op)) {
+    case Op::READ:
+        for (uint16_t i = 0; i < count; ++i) {
+            if (!reader.get_path(entry_path)) {
+                return false;
+            }
+            const auto target_it = targets.find(entry_path);
+            if (target_it == targets.end()) {
+                put(output, static_cast<uint8_t>(Status::NOTFOUND));
+                put(output, uint32_t(0));
+                continue;
+            }
+
+            // Copy straight into the output, so that the lock is held only
+            // for the copy.
+            const Target& target = target_it->second;
+            put(output, static_cast<uint8_t>(Status::OK));
+            put(output, target.size);
+            const size_t value_pos = output.size();
+            output.resize(value_pos + target.size);
+            read(target, output.data() + value_pos);
+        }
+        break;
+
+    case Op::WRITE:
+        for (uint16_t i = 0; i < count; ++i) {
+            uint32_t value_size = 0;
+            const uint8_t* value = nullptr;
+            if (!reader.get_path(entry_path) || !reader.get(value_size)
+                || !reader.get_bytes(value_size, value)) {
+                return false;
+            }
+            const auto target_it = targets.find(entry_path);
+            if (target_it == targets.end()) {
+                put(output, static_cast<uint8_t>(Status::NOTFOUND));
+            } else if (target_it->second.size != value_size) {
+                put(output, static_cast<uint8_t>(Status::SIZE));
+            } else {
+                write(target_it->second, value);
+                put(output, static_cast<uint8_t>(Status::OK));
+            }
+        }
+        break;
+
+    case Op::SUBSCRIBE: {
+        const bool dupe =
+            std::any_of(client.subscriptions.begin(),
+                        client.subscriptions.end(),
+                        [id](const Subscription& subscription) {
+                            return (subscription.id == id);
+                        });
+        Subscription subscription {
+            .id = id,
+            .indices = {},
+            .targets = {},
+            .versions = {},
+            .values = {},
+            .sent = false,
+        };
+        size_t values_size = 0;
+        for (uint16_t i = 0; i < count; ++i) {
+            if (!reader.get_path(entry_path)) {
+                return false;
+            }
+            const auto target_it = targets.find(entry_path);
+            if (dupe) {
+                put(output, static_cast<uint8_t>(Status::DUPE));
+            } else if (target_it == targets.end()) {
+                put(output, static_cast<uint8_t>(Status::NOTFOUND));
+            } else {
+                subscription.indices.push_back(i);
+                subscription.targets.push_back(target_it->second);
+                values_size += target_it->second.size;
+                put(output, static_cast<uint8_t>(Status::OK));
+            }
+        }
+        if (!dupe) {
+            subscription.versions.resize(subscription.targets.size(), 0);
+            subscription.values.resize(values_size);
+            client.subscriptions.push_back(std::move(subscription));
+        }
+        break;
+    }
+
+    case Op::UNSUBSCRIBE:
+        if (count != 0) {
+            return false;
+        }
+        client.subscriptions.erase(
+            std::remove_if(client.subscriptions.begin(),
+                           client.subscriptions.end(),
+                           [id](const Subscription& subscription) {
+                               return (subscription.id == id);
+                           }),
+            client.subscriptions.end());
+        break;
+
+    default:
+        return false;
+    }
+
+    end_message(output, start, count);
+    return reader.done();
+}
+
+void Server::publish(Client& client)
+{
+    const bool versioned = (river->versions != nullptr);
+    std::vector<uint8_t>& output = client.output;
+    for (Subscription& subscription : client.subscriptions) {
+        const size_t start = begin_message(output, Op::UPDATE, subscription.id);
+        uint16_t count = 0;
+        size_t value_offset = 0;
+        for (size_t i = 0; i < subscription.targets.size(); ++i) {
+            const Target& target = subscription.targets[i];
+            uint8_t* const last_value =
+                (subscription.values.data() + value_offset);
+            value_offset += target.size;
+
+            // Skip targets that weren't stored to since they were last sent.
+            // The version is loaded before the value, so a store that races
+            // with the read is caught by the next poll.
+            const uint64_t version = river->version(target.offset, target.size);
+            if (subscription.sent && versioned
+                && (version == subscription.versions[i])) {
+                continue;
+            }
+            subscription.versions[i] = version;
+
+            // Read the value into the output, and take it back out if it
+            // didn't change.
+            const size_t entry_pos = output.size();
+            put(output, subscription.indices[i]);
+            put(output, target.size);
+            const size_t value_pos = output.size();
+            output.resize(value_pos + target.size);
+            uint8_t* const value = (output.data() + value_pos);
+            read(target, value);
+            if (subscription.sent
+                && (std::memcmp(value, last_value, target.size) == 0)) {
+                output.resize(entry_pos);
+                continue;
+            }
+            std::memcpy(last_value, value, target.size);
+            ++count;
+        }
+
+        if ((count == 0) && subscription.sent) {
+            output.resize(start);
+            continue;
+        }
+        end_message(output, start, count);
+        subscription.sent = true;
+    }
+}
+
+#ifdef __linux__
+int32_t Server::start(const std::string& socket_path)
+{
+    if (thread.joinable() || river->frames()) {
+        return ERR_INVALID;
+    }
+
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.empty()
+        || (socket_path.size() >= sizeof(address.sun_path))) {
+        return ERR_INVALID;
+    }
+    std::memcpy(address.sun_path, socket_path.data(), socket_path.size());
+
+    // Replace any stale socket left behind by an earlier server.
+    unlink(socket_path.c_str());
+    path = socket_path;
+
+    listen_fd =
+        socket(AF_UNIX, (SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC), 0);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    stop_fd = eventfd(0, (EFD_NONBLOCK | EFD_CLOEXEC));
+    if ((listen_fd < 0) || (epoll_fd < 0) || (stop_fd < 0)
+        || (bind(listen_fd,
+                 reinterpret_cast<const sockaddr*>(&address),
+                 sizeof(address))
+            != 0)
+        || (listen(listen_fd, SOMAXCONN) != 0)) {
+        close_all();
+        return ERR_SOCKET;
+    }
+
+    for (const int fd : {listen_fd, stop_fd}) {
+        epoll_event event;
+        std::memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            close_all();
+            return ERR_SOCKET;
+        }
+    }
+
+    thread = std::thread(&Server::run, this);
+    return 0;
+}
+
+void Server::stop()
+{
+    if (!thread.joinable()) {
+        return;
+    }
+
+    const uint64_t signal = 1;
+    const ssize_t written = ::write(stop_fd, &signal, sizeof(signal));
+    assert(written == sizeof(signal));
+    (void)written;
+    thread.join();
+
+    close_all();
+}
+
+void Server::close_all()
+{
+    while (!clients.empty()) {
+        disconnect(clients.begin()->first);
+    }
+    for (int* const fd : {&listen_fd, &epoll_fd, &stop_fd}) {
+        if (*fd >= 0) {
+            close(*fd);
+            *fd = -1;
+        }
+    }
+    if (!path.empty()) {
+        unlink(path.c_str());
+        path.clear();
+    }
+}
+
+void Server::run()
+{
+    constexpr int MAX_EVENTS = 64;
+    epoll_event events[MAX_EVENTS];
+    auto next_poll = (std::chrono::steady_clock::now() + options.period);
+    while (true) {
+        // Wait for events until the next subscription poll.
+        const auto now = std::chrono::steady_clock::now();
+        const int timeout =
+            ((next_poll > now)
+                 ? static_cast<int>(
+                     std::chrono::ceil<std::chrono::milliseconds>(next_poll
+                                                                  - now)
+                         .count())
+                 : 0);
+        const int event_count =
+            epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+        if ((event_count < 0) && (errno != EINTR)) {
+            return;
+        }
+
+        for (int i = 0; i < event_count; ++i) {
+            const int fd = events[i].data.fd;
+            if (fd == stop_fd) {
+                return;
+            }
+            if (fd == listen_fd) {
+                accept_clients();
+                continue;
+            }
+
+            // The client may have been disconnected by an earlier event.
+            const auto client_it = clients.find(fd);
+            if (client_it == clients.end()) {
+                continue;
+            }
+            Client& client = *client_it->second;
+            bool connected = true;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                connected = receive(client);
+            }
+            if (connected && (events[i].events & EPOLLOUT)) {
+                connected = flush(client);
+            }
+            if (!connected) {
+                disconnect(fd);
+            }
+        }
+
+        // Poll subscriptions, skipping clients that are behind.
+        if (std::chrono::steady_clock::now() < next_poll) {
+            continue;
+        }
+        next_poll += options.period;
+        std::vector<int> disconnected;
+        for (const auto& [fd, client] : clients) {
+            const size_t pending =
+                (client->output.size() - client->output_sent);
+            if (pending <= options.max_pending_output) {
+                publish(*client);
+            }
+            if (!flush(*client)) {
+                disconnected.push_back(fd);
+            }
+        }
+        for (const int fd : disconnected) {
+            disconnect(fd);
+        }
+    }
+}
+
+void Server::accept_clients()
+{
+    while (true) {
+        const int fd = accept4(
+            listen_fd, nullptr, nullptr, (SOCK_NONBLOCK | SOCK_CLOEXEC));
+        if (fd < 0) {
+            return;
+        }
+
+        epoll_event event;
+        std::memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            close(fd);
+            continue;
+        }
+
+        clients.emplace(fd,
+                        std::unique_ptr<Client>(new Client {
+                            .fd = fd,
+                            .input = {},
+                            .output = {},
+                            .output_sent = 0,
+                            .watching_output = false,
+                            .subscriptions = {},
+                        }));
+    }
+}
+
+bool Server::receive(Client& client)
+{
+    // Drain the socket.
+    uint8_t buffer[1 << 16];
+    while (true) {
+        const ssize_t received = recv(client.fd, buffer, sizeof(buffer), 0);
+        if (received > 0) {
+            client.input.insert(client.input.end(), buffer, buffer + received);
+            continue;
+        }
+        if (received == 0) {
+            return false;
+        }
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+
+    // Handle each complete message.
+    size_t pos = 0;
+    while ((client.input.size() - pos) >= LENGTH_SIZE) {
+        uint32_t length = 0;
+        std::memcpy(&length, client.input.data() + pos, sizeof(length));
+        if ((length < HEADER_SIZE) || (length > options.max_message_size)) {
+            return false;
+        }
+        if ((client.input.size() - pos - LENGTH_SIZE) < length) {
+            break;
+        }
+        if (!handle(client, client.input.data() + pos + LENGTH_SIZE, length)) {
+            return false;
+        }
+        pos += (LENGTH_SIZE + length);
+    }
+    client.input.erase(client.input.begin(), client.input.begin() + pos);
+
+    return flush(client);
+}
+
+bool Server::flush(Client& client)
+{
+    while (client.output_sent < client.output.size()) {
+        const ssize_t sent = send(client.fd,
+                                  client.output.data() + client.output_sent,
+                                  client.output.size() - client.output_sent,
+                                  MSG_NOSIGNAL);
+        if (sent > 0) {
+            client.output_sent += static_cast<size_t>(sent);
+            continue;
+        }
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+
+    const bool pending = (client.output_sent < client.output.size());
+    if (!pending) {
+        client.output.clear();
+        client.output_sent = 0;
+    }
+
+    // Watch for writability only while output is pending.
+    if (pending != client.watching_output) {
+        epoll_event event;
+        std::memset(&event, 0, sizeof(event));
+        event.events = (pending ? (EPOLLIN | EPOLLOUT) : EPOLLIN);
+        event.data.fd = client.fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client.fd, &event) != 0) {
+            return false;
+        }
+        client.watching_output = pending;
+    }
+
+    return true;
+}
+
+void Server::disconnect(const int fd)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    clients.erase(fd);
+}
+#else
+int32_t Server::start(const std::string&)
+{
+    return ERR_SOCKET;
+}
+
+void Server::stop()
+{
+}
+#endif
+} /* namespace river */
@@ -0,0 +1,383 @@
+#ifndef RIVER_SERVER_HPP
+#define RIVER_SERVER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "river.hpp"
+
+namespace river {
+/**
+ * Server that lets other processes on the same host read, write, and
+ * subscribe to a live river over a Unix domain socket.
+ *
+ * The server runs an epoll loop on its own thread. Each request names any
+ * number of channels or rivulets by path, and is served by copying each one
+ * under its rivulet lock, so locks are held only for the copy and never
+ * across socket I/O. Subscriptions are polled every period, and only
+ * channels and rivulets whose values changed are sent. Rivers built with
+ * Builder::Options::versions skip unchanged values without reading them.
+ *
+ * Accesses from the server bypass the race detector and instrumentation.
+ * Rivers in frame mode aren't supported, since the server can't keep its
+ * accesses from overlapping frame commits. Derived channels, and rivulets
+ * holding any, aren't served and get Status::NOTFOUND, since their values
+ * are only computed on reads through their handles.
+ *
+ * Messages are a 32-bit length of the rest of the message, an 8-bit Op, a
+ * 32-bit request ID, a 16-bit entry count, and the entries. Integers are in
+ * host byte order. Request entries are:
+ *
+ *   * Op::READ, Op::SUBSCRIBE: 16-bit path length, path.
+ *   * Op::WRITE: 16-bit path length, path, 32-bit value size, value.
+ *   * Op::UNSUBSCRIBE: none; the request ID is the subscription's.
+ *
+ * Each request gets a response with the same op, ID, and entry count, whose
+ * entries are:
+ *
+ *   * Op::READ: 8-bit Status, 32-bit value size, value.
+ *   * Op::WRITE, Op::SUBSCRIBE: 8-bit Status.
+ *   * Op::UNSUBSCRIBE: none.
+ *
+ * Subscriptions push Op::UPDATE messages with the subscription's request ID,
+ * whose entries are the 16-bit index of a path in the subscription request,
+ * 32-bit value size, and value. The first update has every path that was
+ * found. Malformed requests close the connection.
+ */
+class Server final {
+public:
+    /**
+     * Error codes that Server::start() can return.
+     * @{
+     */
+    static constexpr int32_t ERR_INVALID = 1;
+    static constexpr int32_t ERR_SOCKET = 2;
+    /**
+     * @}
+     */
+
+    /**
+     * Message operations.
+     */
+    enum class Op : uint8_t {
+        READ = 1,
+        WRITE = 2,
+        SUBSCRIBE = 3,
+        UNSUBSCRIBE = 4,
+        UPDATE = 5,
+    };
+
+    /**
+     * Statuses of response entries.
+     */
+    enum class Status : uint8_t {
+        OK = 0,
+
+        /**
+         * Path is invalid or doesn't exist.
+         */
+        NOTFOUND = 1,
+
+        /**
+         * Written value size doesn't match the channel or rivulet size.
+         */
+        SIZE = 2,
+
+        /**
+         * Subscription request ID is already in use.
+         */
+        DUPE = 3,
+    };
+
+    /**
+     * Options for the server.
+     */
+    struct Options final {
+        /**
+         * Interval between subscription polls.
+         */
+        std::chrono::milliseconds period {10};
+
+        /**
+         * Largest message accepted from a client, in bytes. Clients that send
+         * larger messages are disconnected.
+         */
+        size_t max_message_size = (1 << 20);
+
+        /**
+         * Largest amount of unsent output per client, in bytes. Subscription
+         * updates are held back while a client's output exceeds this, so
+         * that slow clients get coalesced updates.
+         */
+        size_t max_pending_output = (4 << 20);
+    };
+
+    /**
+     * Constructor. The server doesn't listen until started.
+     *
+     * @param river   River to serve.
+     * @param options Server options.
+     */
+    Server(const std::shared_ptr<River> river, const Options& options);
+
+    /**
+     * Destructor. Stops the server.
+     */
+    ~Server();
+
+    /**
+     * Servers are not copyable or movable, since the thread holds a pointer
+     * to the server.
+     * @{
+     */
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+    /**
+     * @}
+     */
+
+    /**
+     * Starts listening on a Unix domain socket and serving on a new thread.
+     *
+     * Any file at the socket path is replaced.
+     *
+     * @param socket_path Socket path.
+     *
+     * @retval 0           Success.
+     * @retval ERR_INVALID Server is already started, the river is in frame
+     *                     mode, or the socket path is too long.
+     * @retval ERR_SOCKET  Socket couldn't be set up, or Unix domain sockets
+     *                     aren't supported on this platform.
+     */
+    int32_t start(const std::string& socket_path);
+
+    /**
+     * Stops serving, disconnects all clients, and removes the socket.
+     *
+     * This has no effect if the server isn't started.
+     */
+    void stop();
+
+private:
+    /**
+     * A channel or rivulet that requests can access.
+     */
+    struct Target final {
+        /**
+         * Byte offset in the river backing memory.
+         */
+        uint32_t offset;
+
+        /**
+         * Size in bytes.
+         */
+        uint32_t size;
+
+        /**
+         * Lock index in the river lock table, or River::NO_LOCK.
+         */
+        uint32_t lock_index;
+    };
+
+    /**
+     * A subscription of a client.
+     */
+    struct Subscription final {
+        /**
+         * Request ID of the subscription.
+         */
+        uint32_t id;
+
+        /**
+         * Index of each found path in the subscription request.
+         */
+        std::vector<uint16_t> indices;
+
+        /**
+         * Target of each found path.
+         */
+        std::vector<Target> targets;
+
+        /**
+         * River version of each target when it was last sent.
+         */
+        std::vector<uint64_t> versions;
+
+        /**
+         * Value of each target when it was last sent, back to back.
+         */
+        std::vector<uint8_t> values;
+
+        /**
+         * Whether the values have been sent at least once.
+         */
+        bool sent;
+    };
+
+    /**
+     * A connected client.
+     */
+    struct Client final {
+        /**
+         * Socket file descriptor.
+         */
+        int fd;
+
+        /**
+         * Received bytes not yet handled.
+         */
+        std::vector<uint8_t> input;
+
+        /**
+         * Bytes to send.
+         */
+        std::vector<uint8_t> output;
+
+        /**
+         * Number of bytes of output already sent.
+         */
+        size_t output_sent;
+
+        /**
+         * Whether the socket is watched for writability.
+         */
+        bool watching_output;
+
+        /**
+         * Subscriptions.
+         */
+        std::vector<Subscription> subscriptions;
+    };
+
+    /**
+     * Served river.
+     */
+    const std::shared_ptr<River> river;
+
+    /**
+     * Server options.
+     */
+    const Options options;
+
+    /**
+     * Target of every node in the river by path.
+     */
+    std::unordered_map<std::string, Target> targets;
+
+    /**
+     * Socket path, or empty if the server isn't started.
+     */
+    std::string path;
+
+    /**
+     * Listening socket file descriptor.
+     */
+    int listen_fd;
+
+    /**
+     * epoll file descriptor.
+     */
+    int epoll_fd;
+
+    /**
+     * eventfd file descriptor signaled to stop the server thread.
+     */
+    int stop_fd;
+
+    /**
+     * Connected clients by socket file descriptor.
+     */
+    std::unordered_map<int, std::unique_ptr<Client>> clients;
+
+    /**
+     * Server thread.
+     */
+    std::thread thread;
+
+    /**
+     * Builds the target of every node in the river.
+     */
+    void resolve_targets();
+
+    /**
+     * Closes all file descriptors.
+     */
+    void close_all();
+
+    /**
+     * Runs the epoll loop until stopped.
+     */
+    void run();
+
+    /**
+     * Accepts pending connections.
+     */
+    void accept_clients();
+
+    /**
+     * Reads from a client and handles complete messages.
+     *
+     * @param client Client.
+     *
+     * @returns Whether the client is still connected.
+     */
+    bool receive(Client& client);
+
+    /**
+     * Handles a message from a client.
+     *
+     * @param client  Client.
+     * @param message Message, after the length.
+     * @param size    Message size in bytes.
+     *
+     * @returns Whether the message was well-formed.
+     */
+    bool handle(Client& client, const uint8_t* message, const size_t size);
+
+    /**
+     * Appends updates of a client's changed subscriptions to its output.
+     *
+     * @param client Client.
+     */
+    void publish(Client& client);
+
+    /**
+     * Sends as much of a client's output as the socket accepts.
+     *
+     * @param client Client.
+     *
+     * @returns Whether the client is still connected.
+     */
+    bool flush(Client& client);
+
+    /**
+     * Disconnects a client.
+     *
+     * @param fd Client socket file descriptor.
+     */
+    void disconnect(const int fd);
+
+    /**
+     * Copies a target's value out of the river under its lock.
+     *
+     * @param target Target.
+     * @param dest   Copy destination.
+     */
+    void read(const Target& target, uint8_t* const dest) const;
+
+    /**
+     * Copies a value into a target in the river under its lock.
+     *
+     * @param target Target.
+     * @param src    Copy source.
+     */
+    void write(const Target& target, const uint8_t* const src) const;
+};
+} /* namespace river */
+
+#endif
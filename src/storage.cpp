@@ -0,0 +1,222 @@
+#include <cassert>
+#include <new>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "storage.hpp"
+
+namespace river {
+Storage::Storage()
+    : memory(nullptr)
+    , memory_size(0)
+    , heap(nullptr)
+    , mapped_size(0)
+    , external(false)
+    , huge(false)
+    , is_locked(false)
+{
+}
+
+Storage::~Storage()
+{
+    free();
+}
+
+int32_t Storage::allocate(const size_t size, const Options& options)
+{
+    free();
+    if (size == 0) {
+        return 0;
+    }
+
+    // Plain heap memory is already zeroed and needs no special handling.
+    const bool special =
+        (options.huge_pages || options.prefault || options.lock);
+    if (!special) {
+        heap.reset(new (std::nothrow) uint8_t[size]());
+        if (!heap) {
+            return ERR_NOMEM;
+        }
+        memory = heap.get();
+        memory_size = size;
+        return 0;
+    }
+
+    if (!map(size, options)) {
+        return ERR_NOMEM;
+    }
+
+    if (options.lock && !lock()) {
+        free();
+        return ERR_NOLOCK;
+    }
+
+    return 0;
+}
+
+int32_t Storage::assign(uint8_t* const buffer,
+                        const size_t size,
+                        const Options& options)
+{
+    assert((reinterpret_cast<uintptr_t>(buffer) % ALIGNMENT) == 0);
+
+    free();
+    memory = buffer;
+    memory_size = size;
+    external = true;
+
+    if (options.lock && (size > 0) && !lock()) {
+        free();
+        return ERR_NOLOCK;
+    }
+
+    return 0;
+}
+
+uint8_t* Storage::data()
+{
+    return memory;
+}
+
+const uint8_t* Storage::data() const
+{
+    return memory;
+}
+
+size_t Storage::size() const
+{
+    return memory_size;
+}
+
+bool Storage::huge_pages() const
+{
+    return huge;
+}
+
+bool Storage::locked() const
+{
+    return is_locked;
+}
+
+bool Storage::lock()
+{
+#ifdef __linux__
+    is_locked = (mlock(memory, memory_size) == 0);
+#endif
+    return is_locked;
+}
+
+void Storage::free()
+{
+#ifdef __linux__
+    // Unmapping also unlocks, but provided memory must be unlocked
+    // explicitly.
+    if (mapped_size > 0) {
+        munmap(memory, mapped_size);
+    } else if (external && is_locked) {
+        munlock(memory, memory_size);
+    }
+#endif
+
+    heap.reset();
+    memory = nullptr;
+    memory_size = 0;
+    mapped_size = 0;
+    external = false;
+    huge = false;
+    is_locked = false;
+}
+
+bool Storage::map(const size_t size, const Options& options)
+{
+#ifdef __linux__
+    const int prot = (PROT_READ | PROT_WRITE);
+    const int flags = (MAP_PRIVATE | MAP_ANONYMOUS);
+    const int populate = (options.prefault ? MAP_POPULATE : 0);
+
+    // Huge page mappings must span whole huge pages.
+    const size_t huge_size =
+        (((size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE) * HUGE_PAGE_SIZE);
+
+    // Try explicit huge pages, which fails unless some are reserved.
+    if (options.huge_pages) {
+        void* const addr = mmap(nullptr,
+                                huge_size,
+                                prot,
+                                (flags | MAP_HUGETLB | populate),
+                                -1,
+                                0);
+        if (addr != MAP_FAILED) {
+            memory = static_cast<uint8_t*>(addr);
+            memory_size = size;
+            mapped_size = huge_size;
+            huge = true;
+            return true;
+        }
+    }
+
+    // Otherwise, map regular pages. For transparent huge pages, the mapping
+    // is over-allocated and trimmed so that it starts on a huge page
+    // boundary, and pages can't be populated until after madvise().
+    const size_t map_size =
+        (options.huge_pages ? (huge_size + HUGE_PAGE_SIZE) : size);
+    void* const addr = mmap(nullptr,
+                            map_size,
+                            prot,
+                            (flags | (options.huge_pages ? 0 : populate)),
+                            -1,
+                            0);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+
+    uint8_t* begin = static_cast<uint8_t*>(addr);
+    size_t mapped = map_size;
+    if (options.huge_pages) {
+        const uintptr_t base = reinterpret_cast<uintptr_t>(addr);
+        const uintptr_t aligned =
+            (((base + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE) * HUGE_PAGE_SIZE);
+        const size_t head = (aligned - base);
+        const size_t tail = (map_size - head - huge_size);
+        if (head > 0) {
+            munmap(addr, head);
+        }
+        if (tail > 0) {
+            munmap(reinterpret_cast<void*>(aligned + huge_size), tail);
+        }
+        begin = reinterpret_cast<uint8_t*>(aligned);
+        mapped = huge_size;
+
+        // The kernel may ignore this, e.g., if transparent huge pages are
+        // disabled, in which case regular pages are used.
+        madvise(begin, mapped, MADV_HUGEPAGE);
+
+        if (options.prefault) {
+            const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            for (size_t offset = 0; offset < mapped; offset += page_size) {
+                static_cast<volatile uint8_t*>(begin)[offset] = 0;
+            }
+        }
+    }
+
+    memory = begin;
+    memory_size = size;
+    mapped_size = mapped;
+    return true;
+#else
+    // Without mmap, huge pages and pre-faulting fall back to heap memory that
+    // is touched up front.
+    heap.reset(new (std::nothrow) uint8_t[size]());
+    if (!heap) {
+        return false;
+    }
+    memory = heap.get();
+    memory_size = size;
+    (void)options;
+    return true;
+#endif
+}
+} /* namespace river */
@@ -0,0 +1,219 @@
+#ifndef RIVER_STORAGE_HPP
+#define RIVER_STORAGE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace river {
+/**
+ * Backing memory of a river.
+ *
+ * Storage is zero-initialized heap memory by default. On Linux, it can instead
+ * be mapped from the kernel with huge pages, pre-faulted, and locked in RAM,
+ * so that accesses see neither TLB misses from small pages nor page faults,
+ * starting from the first access. Storage can also use memory provided by the
+ * caller, e.g., in a static buffer or a dedicated memory section.
+ */
+class Storage final {
+public:
+    /**
+     * Error codes that Storage::allocate() and Storage::assign() can return.
+     * @{
+     */
+    static constexpr int32_t ERR_NOMEM = 1;
+    static constexpr int32_t ERR_NOLOCK = 2;
+    /**
+     * @}
+     */
+
+    /**
+     * Options for allocating storage.
+     */
+    struct Options final {
+        /**
+         * Whether to back the storage with huge pages.
+         *
+         * Explicit huge pages (MAP_HUGETLB) are tried first, which requires
+         * huge pages to be reserved by the system. If that fails, transparent
+         * huge pages are requested with madvise(MADV_HUGEPAGE), which the
+         * kernel may or may not honor. Either way, allocation falls back to
+         * regular pages rather than failing.
+         */
+        bool huge_pages = false;
+
+        /**
+         * Whether to fault in every page of the storage when it's allocated,
+         * rather than on first access.
+         */
+        bool prefault = false;
+
+        /**
+         * Whether to lock the storage in RAM with mlock(), so that it's never
+         * paged out. This usually requires raising RLIMIT_MEMLOCK or having
+         * CAP_IPC_LOCK, and allocation fails if locking fails.
+         */
+        bool lock = false;
+    };
+
+    /**
+     * Alignment required of memory provided by the caller, in bytes. This
+     * is the strictest alignment of any channel.
+     */
+    static constexpr size_t ALIGNMENT = alignof(uint64_t);
+
+    /**
+     * Huge page size assumed when rounding mappings, in bytes.
+     */
+    static constexpr size_t HUGE_PAGE_SIZE = (2 << 20);
+
+    /**
+     * Constructor.
+     *
+     * Storage is empty until allocated.
+     */
+    Storage();
+
+    /**
+     * Destructor. Frees the memory.
+     */
+    ~Storage();
+
+    /**
+     * Storage is not copyable or movable, since the river memory must stay
+     * put.
+     * @{
+     */
+    Storage(const Storage&) = delete;
+    Storage& operator=(const Storage&) = delete;
+    /**
+     * @}
+     */
+
+    /**
+     * Allocates zero-initialized memory, freeing any previous memory.
+     *
+     * @param size    Size in bytes.
+     * @param options Allocation options.
+     *
+     * @retval 0          Success.
+     * @retval ERR_NOMEM  Memory couldn't be allocated.
+     * @retval ERR_NOLOCK Memory couldn't be locked in RAM.
+     */
+    int32_t allocate(const size_t size, const Options& options);
+
+    /**
+     * Uses memory provided by the caller, freeing any previous memory.
+     *
+     * The memory is not freed by the storage, and must outlive it. Its
+     * contents are left as they are. Huge pages and pre-faulting don't apply
+     * to provided memory, but it can be locked in RAM.
+     *
+     * @param buffer  Memory to use. Must be aligned to ALIGNMENT.
+     * @param size    Size of the memory in bytes.
+     * @param options Allocation options.
+     *
+     * @retval 0          Success.
+     * @retval ERR_NOLOCK Memory couldn't be locked in RAM.
+     */
+    int32_t assign(uint8_t* const buffer,
+                   const size_t size,
+                   const Options& options);
+
+    /**
+     * Gets the memory.
+     *
+     * @returns Memory address, or null if the storage is empty.
+     * @{
+     */
+    uint8_t* data();
+    const uint8_t* data() const;
+    /**
+     * @}
+     */
+
+    /**
+     * Gets the size of the memory.
+     *
+     * @returns Size in bytes.
+     */
+    size_t size() const;
+
+    /**
+     * Gets whether the memory is backed by huge pages.
+     *
+     * This is only true for explicit huge pages, since whether transparent
+     * huge pages back the memory is up to the kernel.
+     *
+     * @returns Whether memory is backed by huge pages.
+     */
+    bool huge_pages() const;
+
+    /**
+     * Gets whether the memory is locked in RAM.
+     *
+     * @returns Whether memory is locked.
+     */
+    bool locked() const;
+
+private:
+    /**
+     * Memory, or null if empty.
+     */
+    uint8_t* memory;
+
+    /**
+     * Size of the memory in bytes.
+     */
+    size_t memory_size;
+
+    /**
+     * Heap memory, if the memory isn't mapped.
+     */
+    std::unique_ptr<uint8_t[]> heap;
+
+    /**
+     * Size of the mapping in bytes, or 0 if the memory isn't mapped.
+     */
+    size_t mapped_size;
+
+    /**
+     * Whether the memory was provided by the caller.
+     */
+    bool external;
+
+    /**
+     * Whether the memory is backed by explicit huge pages.
+     */
+    bool huge;
+
+    /**
+     * Whether the memory is locked in RAM.
+     */
+    bool is_locked;
+
+    /**
+     * Locks the memory in RAM.
+     *
+     * @returns Whether the memory was locked.
+     */
+    bool lock();
+
+    /**
+     * Frees the memory.
+     */
+    void free();
+
+    /**
+     * Maps anonymous memory.
+     *
+     * @param size    Size in bytes.
+     * @param options Allocation options.
+     *
+     * @returns Whether the memory was mapped.
+     */
+    bool map(const size_t size, const Options& options);
+};
+} /* namespace river */
+
+#endif
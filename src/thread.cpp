@@ -0,0 +1,13 @@
+#include <atomic>
+
+#include "thread.hpp"
+
+namespace river {
+uint32_t this_thread_id()
+{
+    static std::atomic<uint32_t> next_id(1);
+    static thread_local const uint32_t id =
+        next_id.fetch_add(1, std::memory_order_relaxed);
+    return id;
+}
+} /* namespace river */
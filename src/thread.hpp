@@ -0,0 +1,18 @@
+#ifndef RIVER_THREAD_HPP
+#define RIVER_THREAD_HPP
+
+#include <cstdint>
+
+namespace river {
+/**
+ * Gets a small, process-unique, nonzero ID for the calling thread.
+ *
+ * IDs are assigned in the order threads first call this function. Unlike
+ * std::thread::id, they are cheap to compare and store atomically.
+ *
+ * @returns Thread ID.
+ */
+uint32_t this_thread_id();
+} /* namespace river */
+
+#endif
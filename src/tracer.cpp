@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+#include "thread.hpp"
+#include "tracer.hpp"
+
+namespace river {
+namespace {
+/**
+ * Next tracer serial number. Serial numbers start at 1, so that 0 never
+ * matches a thread's cached ring.
+ */
+std::atomic<uint64_t> next_serial(1);
+} /* namespace */
+
+Tracer::Tracer(const size_t max_threads, const size_t events_per_thread)
+    : serial(next_serial.fetch_add(1, std::memory_order_relaxed))
+    , rings_size(max_threads)
+    , ring_capacity(std::max<size_t>(1, events_per_thread))
+    , rings(new Ring[max_threads])
+    , dropped_count(0)
+    , paths()
+    , lock_roots()
+{
+    for (size_t i = 0; i < rings_size; ++i) {
+        rings[i].thread.store(0, std::memory_order_relaxed);
+        rings[i].head.store(0, std::memory_order_relaxed);
+        rings[i].events.reset(new Event[ring_capacity]);
+    }
+}
+
+void Tracer::export_chrome(std::ostream& os) const
+{
+    // Timestamps are relative to the earliest retained event.
+    uint64_t base_time = UINT64_MAX;
+    for (size_t i = 0; i < rings_size; ++i) {
+        const Ring& ring = rings[i];
+        const uint64_t head = ring.head.load(std::memory_order_acquire);
+        if (head > 0) {
+            const uint64_t first =
+                ((head > ring_capacity) ? (head - ring_capacity) : 0);
+            base_time = std::min(base_time,
+                                 ring.events[first % ring_capacity].time);
+        }
+    }
+
+    os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first_event = true;
+    const auto emit = [&](const uint32_t thread,
+                          const char* const category,
+                          const char* const action,
+                          const std::string& path,
+                          const uint64_t begin,
+                          const uint64_t end) {
+        os << (first_event ? "\n" : ",\n") << "{\"name\":\"" << action << " "
+           << path << "\",\"cat\":\"" << category
+           << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread
+           << ",\"ts\":" << ((begin - base_time) / 1000.0)
+           << ",\"dur\":" << ((end - begin) / 1000.0) << "}";
+        first_event = false;
+    };
+
+    std::vector<Event> open;
+    for (size_t i = 0; i < rings_size; ++i) {
+        const Ring& ring = rings[i];
+        const uint32_t thread = ring.thread.load(std::memory_order_acquire);
+        if (thread == 0) {
+            continue;
+        }
+
+        os << (first_event ? "\n" : ",\n")
+           << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+           << thread << ",\"args\":{\"name\":\"thread " << thread << "\"}}";
+        first_event = false;
+
+        // Match each end event with the begin event at the top of the stack of
+        // open spans. Spans on a thread are properly nested, so a mismatch
+        // only happens when the begin event was overwritten.
+        open.clear();
+        const uint64_t head = ring.head.load(std::memory_order_acquire);
+        const uint64_t first =
+            ((head > ring_capacity) ? (head - ring_capacity) : 0);
+        for (uint64_t j = first; j < head; ++j) {
+            const Event& event = ring.events[j % ring_capacity];
+            const auto matches = [&](const Kind begin_kind) -> bool {
+                return (!open.empty() && (open.back().kind == begin_kind)
+                        && (open.back().index == event.index));
+            };
+
+            switch (event.kind) {
+            case Kind::LOCK_WAIT:
+            case Kind::READ_BEGIN:
+            case Kind::WRITE_BEGIN:
+                open.push_back(event);
+                break;
+            case Kind::LOCK_ACQUIRED:
+                if (matches(Kind::LOCK_WAIT)) {
+                    emit(thread,
+                         "lock",
+                         "wait",
+                         paths[lock_roots[event.index]],
+                         open.back().time,
+                         event.time);
+                    open.pop_back();
+                }
+                open.push_back(event);
+                break;
+            case Kind::LOCK_RELEASE:
+                if (matches(Kind::LOCK_ACQUIRED)) {
+                    emit(thread,
+                         "lock",
+                         "hold",
+                         paths[lock_roots[event.index]],
+                         open.back().time,
+                         event.time);
+                    open.pop_back();
+                }
+                break;
+            case Kind::READ_END:
+            case Kind::WRITE_END: {
+                const bool read = (event.kind == Kind::READ_END);
+                if (matches(read ? Kind::READ_BEGIN : Kind::WRITE_BEGIN)) {
+                    emit(thread,
+                         "access",
+                         (read ? "read" : "write"),
+                         paths[event.index],
+                         open.back().time,
+                         event.time);
+                    open.pop_back();
+                }
+                break;
+            }
+            }
+        }
+    }
+
+    os << "\n]}\n";
+}
+
+uint64_t Tracer::dropped() const
+{
+    return dropped_count.load(std::memory_order_relaxed);
+}
+
+void Tracer::attach(const River& river)
+{
+    paths.clear();
+    for (size_t i = 0; i < river.node_count(); ++i) {
+        paths.push_back(river.path(i));
+    }
+
+    // A lock covers a subtree, whose root is the highest node with the lock.
+    // Parents come before their children, so their roots are already known.
+    lock_roots.assign(paths.size(), River::NO_PARENT);
+    for (size_t i = 0; i < paths.size(); ++i) {
+        const uint32_t lock = river.lock_indices[i];
+        if (lock == River::NO_LOCK) {
+            continue;
+        }
+        const size_t parent = river.parents[i];
+        lock_roots[i] = (((parent != River::NO_PARENT)
+                          && (river.lock_indices[parent] == lock))
+                             ? lock_roots[parent]
+                             : i);
+    }
+}
+
+void Tracer::record(const Kind kind, const size_t index)
+{
+    Ring* const ring = thread_ring();
+    if (!ring) {
+        dropped_count.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // Only the owning thread writes the ring, so the head needs no RMW.
+    const uint64_t head = ring->head.load(std::memory_order_relaxed);
+    Event& event = ring->events[head % ring_capacity];
+    event.time = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+    event.index = static_cast<uint32_t>(index);
+    event.kind = kind;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+Tracer::Ring* Tracer::thread_ring()
+{
+    // Cache the ring of the last tracer this thread recorded to, so that the
+    // common case is a single comparison.
+    static thread_local uint64_t cached_serial = 0;
+    static thread_local Ring* cached_ring = nullptr;
+    if (cached_serial == serial) {
+        return cached_ring;
+    }
+
+    // Find the ring this thread already claimed, or claim an unclaimed one.
+    const uint32_t id = this_thread_id();
+    Ring* found = nullptr;
+    for (size_t i = 0; (i < rings_size) && !found; ++i) {
+        uint32_t owner = rings[i].thread.load(std::memory_order_relaxed);
+        if (owner == 0) {
+            rings[i].thread.compare_exchange_strong(owner,
+                                                    id,
+                                                    std::memory_order_acq_rel);
+            owner = rings[i].thread.load(std::memory_order_relaxed);
+        }
+        if (owner == id) {
+            found = &rings[i];
+        }
+    }
+
+    cached_serial = serial;
+    cached_ring = found;
+    return found;
+}
+} /* namespace river */
@@ -0,0 +1,218 @@
+#ifndef RIVER_TRACER_HPP
+#define RIVER_TRACER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "river.hpp"
+
+namespace river {
+/**
+ * Records lock and access events on a river for offline analysis.
+ *
+ * A tracer is attached to a river when it's built by passing it in
+ * Builder::Options. While attached, every channel, flags, and rivulet access
+ * records when it started waiting for a lock, when it acquired the lock, when
+ * it read or wrote the river, and when it released the lock. Events are kept
+ * in a fixed-size ring buffer per thread, so the most recent events are
+ * retained.
+ *
+ * Recording never allocates or blocks: each thread claims its own ring on its
+ * first event with a compare-and-swap, and then appends with plain stores.
+ * Threads beyond the number of rings aren't traced, and are counted instead.
+ *
+ * Traces can be exported in the Chrome trace event format, which is loaded by
+ * `chrome://tracing` and the Perfetto UI.
+ */
+class Tracer final {
+public:
+    /**
+     * Constructor.
+     *
+     * @param max_threads       Number of threads that can be traced.
+     * @param events_per_thread Capacity of each thread's ring buffer.
+     */
+    Tracer(const size_t max_threads, const size_t events_per_thread);
+
+    /**
+     * Writes the retained events as a Chrome trace event JSON document.
+     *
+     * Lock waits, lock holds, reads, and writes become complete events, named
+     * after the locked rivulet or accessed path. Events whose start or end
+     * was overwritten in the ring buffer are left out.
+     *
+     * This must not be called concurrently with accesses to the traced river.
+     *
+     * @param os Output stream.
+     */
+    void export_chrome(std::ostream& os) const;
+
+    /**
+     * Gets the number of events not recorded because their thread had no
+     * ring.
+     *
+     * @returns Dropped event count.
+     */
+    uint64_t dropped() const;
+
+private:
+    /**
+     * Befriend Builder, ChannelBase, Flags, and Rivulet so that they can
+     * attach the tracer and record events.
+     * @{
+     */
+    friend class Builder;
+    friend class ChannelBase;
+    friend class Flags;
+    friend class Rivulet;
+    /**
+     * @}
+     */
+
+    /**
+     * Kinds of events.
+     */
+    enum class Kind : uint8_t {
+        /**
+         * Started waiting for a lock.
+         */
+        LOCK_WAIT = 0,
+
+        /**
+         * Acquired a lock.
+         */
+        LOCK_ACQUIRED = 1,
+
+        /**
+         * Releasing a lock.
+         */
+        LOCK_RELEASE = 2,
+
+        /**
+         * Started reading.
+         */
+        READ_BEGIN = 3,
+
+        /**
+         * Finished reading.
+         */
+        READ_END = 4,
+
+        /**
+         * Started writing.
+         */
+        WRITE_BEGIN = 5,
+
+        /**
+         * Finished writing.
+         */
+        WRITE_END = 6,
+    };
+
+    /**
+     * A recorded event.
+     */
+    struct Event final {
+        /**
+         * Time of the event in nanoseconds on the steady clock.
+         */
+        uint64_t time;
+
+        /**
+         * Index of the node accessed.
+         */
+        uint32_t index;
+
+        /**
+         * Kind of event.
+         */
+        Kind kind;
+    };
+
+    /**
+     * Ring buffer of the events of one thread.
+     */
+    struct alignas(64) Ring final {
+        /**
+         * ID of the owning thread, or 0 if unclaimed.
+         */
+        std::atomic<uint32_t> thread;
+
+        /**
+         * Total number of events recorded. The next event goes at this index
+         * modulo the ring capacity.
+         */
+        std::atomic<uint64_t> head;
+
+        /**
+         * Events.
+         */
+        std::unique_ptr<Event[]> events;
+    };
+
+    /**
+     * Unique serial number of this tracer, used to cache the calling thread's
+     * ring.
+     */
+    const uint64_t serial;
+
+    /**
+     * Number of rings.
+     */
+    const size_t rings_size;
+
+    /**
+     * Capacity of each ring.
+     */
+    const size_t ring_capacity;
+
+    /**
+     * Per-thread rings.
+     */
+    std::unique_ptr<Ring[]> rings;
+
+    /**
+     * Number of events not recorded.
+     */
+    std::atomic<uint64_t> dropped_count;
+
+    /**
+     * Full paths of the river nodes.
+     */
+    std::vector<std::string> paths;
+
+    /**
+     * For each node, index of the node at the root of the subtree covered by
+     * its lock, or River::NO_PARENT if the node isn't locked.
+     */
+    std::vector<size_t> lock_roots;
+
+    /**
+     * Attaches the tracer to a river.
+     *
+     * @param river River to trace. Must be fully built.
+     */
+    void attach(const River& river);
+
+    /**
+     * Records an event for the calling thread.
+     *
+     * @param kind  Event kind.
+     * @param index Node index.
+     */
+    void record(const Kind kind, const size_t index);
+
+    /**
+     * Gets the ring of the calling thread, claiming one if needed.
+     *
+     * @returns Ring, or null if all rings are claimed by other threads.
+     */
+    Ring* thread_ring();
+};
+} /* namespace river */
+
+#endif
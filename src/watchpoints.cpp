@@ -0,0 +1,84 @@
+#include "watchpoints.hpp"
+
+namespace river {
+Watchpoints::Watchpoints()
+    : groups()
+    , callbacks()
+    , changes()
+{
+}
+
+size_t Watchpoints::evaluate()
+{
+    changes.clear();
+    for (Group& group : groups) {
+        // Read every channel of the group under one lock acquisition. In
+        // frame mode, reads see the front buffer, so no lock is needed.
+        Lock* const lock = group.river->lock(group.lock_index);
+        const bool use_lock = (lock && !group.river->frames());
+        if (use_lock) {
+            lock->acquire();
+        }
+        for (const std::unique_ptr<TypedBase>& typed : group.typed) {
+            typed->gather(*group.river);
+        }
+        if (use_lock) {
+            lock->release();
+        }
+
+        for (const std::unique_ptr<TypedBase>& typed : group.typed) {
+            typed->compare(changes);
+        }
+    }
+
+    for (const uint64_t change : changes) {
+        callbacks[change >> 1]((change & 1) != 0);
+    }
+    return changes.size();
+}
+
+size_t Watchpoints::size() const
+{
+    return callbacks.size();
+}
+
+const std::shared_ptr<Link>& Watchpoints::link(const ChannelBase& channel)
+{
+    return static_cast<const Linkable&>(channel).link;
+}
+
+Watchpoints::Group& Watchpoints::find_group(const Link& link)
+{
+    for (Group& group : groups) {
+        if ((group.river == link.river)
+            && (group.lock_index == link.lock_index)) {
+            return group;
+        }
+    }
+    groups.push_back(Group {
+        .river = link.river,
+        .lock_index = link.lock_index,
+        .typed = {},
+    });
+    return groups.back();
+}
+
+Watchpoints::TypedBase* Watchpoints::find_typed(Group& group,
+                                                const std::type_info& type)
+{
+    for (const std::unique_ptr<TypedBase>& typed : group.typed) {
+        if (*typed->type == type) {
+            return typed.get();
+        }
+    }
+    return nullptr;
+}
+
+void Watchpoints::read(const River& river,
+                       const uint32_t offset,
+                       void* const dest,
+                       const size_t size) noexcept
+{
+    river.read(offset, dest, size);
+}
+} /* namespace river */
@@ -0,0 +1,383 @@
+#ifndef RIVER_WATCHPOINTS_HPP
+#define RIVER_WATCHPOINTS_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+
+#include "channel.hpp"
+#include "river.hpp"
+
+namespace river {
+/**
+ * Engine that checks many threshold conditions on channels at once, e.g.,
+ * fault conditions checked every cycle.
+ *
+ * Each watchpoint compares a channel against a threshold, and calls its
+ * callback when the comparison's result changes. Watchpoints are grouped by
+ * rivulet lock and then by channel type. Evaluating reads every channel
+ * under each lock with a single acquisition, then compares each group's
+ * values against their thresholds in tight loops over contiguous arrays,
+ * which compilers vectorize, and finally calls the callbacks of the
+ * watchpoints whose results changed, after all locks are released.
+ *
+ * Like the IPC server, evaluation reads the river directly, bypassing the
+ * race detector and instrumentation.
+ */
+class Watchpoints final {
+public:
+    /**
+     * Error codes that Watchpoints::add() can return.
+     * @{
+     */
+    static constexpr int32_t ERR_INVALID = 1;
+    /**
+     * @}
+     */
+
+    /**
+     * Comparisons of a channel value against a threshold.
+     */
+    enum class Comparison : uint8_t {
+        LESS = 0,
+        LESS_EQUAL = 1,
+        GREATER = 2,
+        GREATER_EQUAL = 3,
+        EQUAL = 4,
+        NOT_EQUAL = 5,
+    };
+
+    /**
+     * Callback of a watchpoint, which is passed the new result of the
+     * comparison.
+     */
+    using Callback = std::function<void(bool)>;
+
+    /**
+     * Constructor.
+     */
+    Watchpoints();
+
+    /**
+     * Adds a watchpoint.
+     *
+     * The comparison's result starts out false, so the callback is called on
+     * the first evaluation if the comparison holds.
+     *
+     * @tparam T Channel type. Must be arithmetic.
+     *
+     * @param channel    Handle to the watched channel.
+     * @param comparison Comparison of the channel value against the
+     *                   threshold.
+     * @param threshold  Threshold.
+     * @param callback   Function called when the comparison's result
+     *                   changes.
+     *
+     * @retval 0           Success.
+     * @retval ERR_INVALID Channel isn't linked to a river.
+     */
+    template <typename T>
+    int32_t add(const Channel<T>& channel,
+                const Comparison comparison,
+                const T threshold,
+                const Callback& callback)
+    {
+        static_assert(std::is_arithmetic<T>::value,
+                      "watched channels must be arithmetic");
+
+        if (!channel.linked()) {
+            return ERR_INVALID;
+        }
+        const Link& link = *Watchpoints::link(channel);
+
+        Group& group = find_group(link);
+        TypedBase* typed = find_typed(group, typeid(T));
+        if (!typed) {
+            group.typed.emplace_back(new Typed<T>);
+            typed = group.typed.back().get();
+        }
+        Typed<T>& typed_group = *static_cast<Typed<T>*>(typed);
+
+        callbacks.push_back(callback);
+        typed_group.add(comparison,
+                        link.channel_offset,
+                        threshold,
+                        static_cast<uint32_t>(callbacks.size() - 1));
+        changes.reserve(callbacks.size());
+        return 0;
+    }
+
+    /**
+     * Evaluates all watchpoints, and calls the callbacks of those whose
+     * comparison results changed since the last evaluation.
+     *
+     * This never allocates. Callbacks are called on the calling thread after
+     * all locks are released, so they may access the river. They're called
+     * in grouping order, not in the order the watchpoints were added.
+     *
+     * @returns Number of callbacks called.
+     */
+    size_t evaluate();
+
+    /**
+     * Gets the number of watchpoints.
+     *
+     * @returns Watchpoint count.
+     */
+    size_t size() const;
+
+private:
+    /**
+     * Watchpoints of one channel type, and their state.
+     */
+    class TypedBase {
+    public:
+        /**
+         * Destructor.
+         */
+        virtual ~TypedBase() = default;
+
+        /**
+         * Reads the channel values.
+         *
+         * @param river River.
+         */
+        virtual void gather(const River& river) noexcept = 0;
+
+        /**
+         * Compares the channel values read against their thresholds, and
+         * appends the changed results.
+         *
+         * @param[out] changes Changed results.
+         */
+        virtual void compare(std::vector<uint64_t>& changes) noexcept = 0;
+
+        /**
+         * Type of the watched channels.
+         */
+        const std::type_info* type = nullptr;
+    };
+
+    /**
+     * Watchpoints with one comparison, as parallel arrays.
+     *
+     * @tparam T Channel type.
+     */
+    template <typename T>
+    struct Set final {
+        /**
+         * Offset of each channel in the river backing memory.
+         */
+        std::vector<uint32_t> offsets;
+
+        /**
+         * Channel values read by the last evaluation.
+         */
+        std::vector<T> values;
+
+        /**
+         * Thresholds.
+         */
+        std::vector<T> thresholds;
+
+        /**
+         * Comparison results of the last evaluation.
+         */
+        std::vector<uint8_t> results;
+
+        /**
+         * Comparison results when the callbacks were last called.
+         */
+        std::vector<uint8_t> states;
+
+        /**
+         * Callback indices.
+         */
+        std::vector<uint32_t> callbacks;
+    };
+
+    /**
+     * Watchpoints of one channel type.
+     *
+     * @tparam T Channel type.
+     */
+    template <typename T>
+    class Typed final : public TypedBase {
+    public:
+        /**
+         * Type that values are kept as. Bools are kept as bytes, so that
+         * they're stored in plain arrays.
+         */
+        using Value = typename std::
+            conditional<std::is_same<T, bool>::value, uint8_t, T>::type;
+
+        Typed()
+        {
+            type = &typeid(T);
+        }
+
+        /**
+         * Adds a watchpoint.
+         *
+         * @param comparison Comparison.
+         * @param offset     Channel offset in the river backing memory.
+         * @param threshold  Threshold.
+         * @param callback   Callback index.
+         */
+        void add(const Comparison comparison,
+                 const uint32_t offset,
+                 const T threshold,
+                 const uint32_t callback)
+        {
+            Set<Value>& set = sets[static_cast<size_t>(comparison)];
+            set.offsets.push_back(offset);
+            set.values.push_back(Value());
+            set.thresholds.push_back(static_cast<Value>(threshold));
+            set.results.push_back(0);
+            set.states.push_back(0);
+            set.callbacks.push_back(callback);
+        }
+
+        void gather(const River& river) noexcept override
+        {
+            for (Set<Value>& set : sets) {
+                for (size_t i = 0; i < set.offsets.size(); ++i) {
+                    Watchpoints::read(
+                        river, set.offsets[i], &set.values[i], sizeof(T));
+                }
+            }
+        }
+
+        void compare(std::vector<uint64_t>& changes) noexcept override
+        {
+            compare_set(sets[0], changes, std::less<Value>());
+            compare_set(sets[1], changes, std::less_equal<Value>());
+            compare_set(sets[2], changes, std::greater<Value>());
+            compare_set(sets[3], changes, std::greater_equal<Value>());
+            compare_set(sets[4], changes, std::equal_to<Value>());
+            compare_set(sets[5], changes, std::not_equal_to<Value>());
+        }
+
+    private:
+        /**
+         * Watchpoints by comparison.
+         */
+        Set<Value> sets[6];
+
+        /**
+         * Compares the values of a set against their thresholds, and appends
+         * the changed results.
+         *
+         * @param      set     Set.
+         * @param[out] changes Changed results, as callback indices shifted
+         *                     left by one, ORed with the result.
+         * @param      compare Comparison.
+         */
+        template <typename Compare>
+        static void compare_set(Set<Value>& set,
+                                std::vector<uint64_t>& changes,
+                                const Compare compare) noexcept
+        {
+            // Compare in a branch-free loop over contiguous arrays, so that
+            // it's vectorized.
+            const size_t count = set.values.size();
+            const Value* const values = set.values.data();
+            const Value* const thresholds = set.thresholds.data();
+            uint8_t* const results = set.results.data();
+            for (size_t i = 0; i < count; ++i) {
+                results[i] = compare(values[i], thresholds[i]);
+            }
+
+            for (size_t i = 0; i < count; ++i) {
+                if (results[i] != set.states[i]) {
+                    set.states[i] = results[i];
+                    changes.push_back((uint64_t(set.callbacks[i]) << 1)
+                                      | results[i]);
+                }
+            }
+        }
+    };
+
+    /**
+     * Watchpoints on channels protected by the same lock.
+     */
+    struct Group final {
+        /**
+         * River of the channels.
+         */
+        std::shared_ptr<River> river;
+
+        /**
+         * Lock index in the river lock table, or River::NO_LOCK.
+         */
+        uint32_t lock_index;
+
+        /**
+         * Watchpoints by channel type.
+         */
+        std::vector<std::unique_ptr<TypedBase>> typed;
+    };
+
+    /**
+     * Watchpoint groups.
+     */
+    std::vector<Group> groups;
+
+    /**
+     * Callbacks of all watchpoints.
+     */
+    std::vector<Callback> callbacks;
+
+    /**
+     * Changed results found by the current evaluation, with room for every
+     * watchpoint.
+     */
+    std::vector<uint64_t> changes;
+
+    /**
+     * Gets the link of a channel.
+     *
+     * @param channel Channel handle.
+     *
+     * @returns Link, or null if the channel isn't linked.
+     */
+    static const std::shared_ptr<Link>& link(const ChannelBase& channel);
+
+    /**
+     * Finds the group of a channel's lock, adding it if needed.
+     *
+     * @param link Channel link.
+     *
+     * @returns Group.
+     */
+    Group& find_group(const Link& link);
+
+    /**
+     * Finds the watchpoints of a channel type in a group.
+     *
+     * @param group Group.
+     * @param type  Channel type.
+     *
+     * @returns Watchpoints, or null if the group has none of the type.
+     */
+    static TypedBase* find_typed(Group& group, const std::type_info& type);
+
+    /**
+     * Reads a channel value from a river.
+     *
+     * @param river  River.
+     * @param offset Channel offset in the river backing memory.
+     * @param dest   Copy destination.
+     * @param size   Channel size in bytes.
+     */
+    static void read(const River& river,
+                     const uint32_t offset,
+                     void* const dest,
+                     const size_t size) noexcept;
+};
+} /* namespace river */
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef RIVER_TEST_NOOP_LOCK_HPP
+#define RIVER_TEST_NOOP_LOCK_HPP
+
+#include <river>
+
+/**
+ * No-op lock that counts the number of times it has been acquired and released.
+ */
+class NoopLock final : public river::Lock {
+public:
+    uint64_t acquire_count = 0;
+    uint64_t release_count = 0;
+
+    void acquire() final override
+    {
+        ++acquire_count;
+    }
+
+    void release() final override
+    {
+        ++release_count;
+    }
+};
+
+#endif
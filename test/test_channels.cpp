@@ -1,28 +1,10 @@
 #include <river>
 
 #include "CppUTest/TestHarness.h"
+#include "noop_lock.hpp"
 
 using namespace river;
 
-/**
- * No-op lock that counts the number of times it has been acquired and released.
- */
-class NoopLock final : public Lock {
-public:
-    uint64_t acquire_count = 0;
-    uint64_t release_count = 0;
-
-    void acquire() final override
-    {
-        ++acquire_count;
-    }
-
-    void release() final override
-    {
-        ++release_count;
-    }
-};
-
 TEST_GROUP(channels) {};
 
 /**
@@ -187,3 +169,37 @@ TEST(channels, dupe)
     CHECK_EQUAL(0, dupe_same_type.get());
     CHECK_EQUAL(0.0, dupe_dif_type.get());
 }
+
+/**
+ * Handles keep working after the builder releases its metadata tree.
+ */
+TEST(channels, release_tree)
+{
+    Builder builder;
+    Channel<int32_t> foo, bar;
+    CHECK_EQUAL(0, builder.channel("a.b.foo", 1, foo));
+    CHECK_EQUAL(0, builder.channel("a.bar", 2, bar));
+
+    NoopLock* const raw_lock = new NoopLock;
+    CHECK_EQUAL(0, builder.lock("a.b", std::shared_ptr<Lock>(raw_lock)));
+
+    Builder::Options options;
+    options.release_tree = true;
+    CHECK_EQUAL(0, builder.build(options, nullptr));
+
+    // Channels still read and write the river, and the lock still applies.
+    CHECK_EQUAL(1, foo.get());
+    foo.set(3);
+    CHECK_EQUAL(3, foo.get());
+    CHECK_EQUAL(3, raw_lock->acquire_count);
+    bar.set(4);
+    CHECK_EQUAL(4, bar.get());
+    CHECK_EQUAL(3, raw_lock->acquire_count);
+
+    // The builder is empty, so the same paths can be added again.
+    Channel<int32_t> new_foo;
+    CHECK_EQUAL(0, builder.channel("a.b.foo", 5, new_foo));
+    CHECK_EQUAL(0, builder.build());
+    CHECK_EQUAL(5, new_foo.get());
+    CHECK_EQUAL(3, raw_lock->acquire_count);
+}
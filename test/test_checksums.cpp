@@ -0,0 +1,351 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <river>
+
+#include "CppUTest/TestHarness.h"
+#include "crc32c.hpp"
+
+using namespace river;
+
+TEST_GROUP(checksums) {};
+
+namespace {
+/**
+ * Gets the byte offset of a channel in a river's layout.
+ *
+ * @param river River.
+ * @param path  Channel path.
+ *
+ * @returns Byte offset, or SIZE_MAX if the channel isn't in the layout.
+ */
+size_t layout_offset(const River& river, const std::string& path)
+{
+    std::stringstream layout;
+    river.export_layout(layout);
+
+    std::string line;
+    while (std::getline(layout, line)) {
+        std::istringstream fields(line);
+        std::string name;
+        size_t offset = 0;
+        if ((fields >> name >> offset) && (name == path)) {
+            return offset;
+        }
+    }
+    return SIZE_MAX;
+}
+} /* namespace */
+
+/**
+ * CRC-32C matches the standard check value.
+ */
+TEST(checksums, crc32c)
+{
+    const char* const check = "123456789";
+    CHECK_EQUAL(0xE3069283u, crc32c(check, std::strlen(check), 0));
+
+    // Checksums can be computed incrementally.
+    const uint32_t partial = crc32c(check, 4, 0);
+    CHECK_EQUAL(0xE3069283u, crc32c(check + 4, 5, partial));
+
+    // Longer inputs exercise the wide path.
+    uint8_t data[1000];
+    for (size_t i = 0; i < sizeof(data); ++i) {
+        data[i] = static_cast<uint8_t>(i * 7);
+    }
+    CHECK_EQUAL(crc32c(data + 3, 997, crc32c(data, 3, 0)),
+                crc32c(data, sizeof(data), 0));
+
+    // Checksums can be updated from the change of part of the input, whether
+    // the part is followed by fewer bytes than the hardware shifts at once or
+    // by more.
+    const size_t tails[] = {0, 1, 4, 5, 8, 55, 64, 200};
+    for (const size_t tail : tails) {
+        uint8_t modified[sizeof(data)];
+        std::memcpy(modified, data, sizeof(data));
+        const size_t begin = (sizeof(data) - tail - 9);
+        for (size_t i = 0; i < 9; ++i) {
+            modified[begin + i] ^= static_cast<uint8_t>(i + 1);
+        }
+        CHECK_EQUAL(crc32c(modified, sizeof(modified), 0),
+                    crc32c(data, sizeof(data), 0)
+                        ^ crc32c_delta(
+                            data + begin, modified + begin, 9, tail));
+    }
+}
+
+/**
+ * Modifications outside lock/unlock are detected, and only in their own block.
+ */
+TEST(checksums, detect)
+{
+    uint8_t data[200] = {};
+    Checksums checksums(data, sizeof(data));
+    CHECK_EQUAL(4, checksums.block_count());
+
+    // Modifications announced under the lock update the checksums, whether
+    // they cover blocks fully or in part.
+    uint8_t values[70];
+    std::memset(values, 0xAA, sizeof(values));
+    checksums.lock(60, sizeof(values));
+    checksums.update(60, values, sizeof(values));
+    std::memcpy(data + 60, values, sizeof(values));
+    checksums.unlock(60, sizeof(values));
+    for (size_t i = 0; i < checksums.block_count(); ++i) {
+        CHECK_TRUE(checksums.verify(i));
+    }
+
+    // A modification of part of a block doesn't hide corruption elsewhere in
+    // the block.
+    data[10] ^= 0x04;
+    checksums.lock(20, 8);
+    checksums.update(20, values, 8);
+    std::memcpy(data + 20, values, 8);
+    checksums.unlock(20, 8);
+    CHECK_FALSE(checksums.verify(0));
+    data[10] ^= 0x04;
+    CHECK_TRUE(checksums.verify(0));
+
+    // Modifications outside the lock are detected, including in the partial
+    // last block.
+    data[130] ^= 0x01;
+    data[199] ^= 0x80;
+    CHECK_TRUE(checksums.verify(0));
+    CHECK_TRUE(checksums.verify(1));
+    CHECK_FALSE(checksums.verify(2));
+    CHECK_FALSE(checksums.verify(3));
+}
+
+/**
+ * A river built with checksums verifies cleanly through all write paths.
+ */
+TEST(checksums, river)
+{
+    Builder builder;
+    Channel<uint64_t> foo;
+    Channel<double> bar;
+    Rivulet baz;
+    CHECK_EQUAL(0, builder.channel("baz.foo", uint64_t(1), foo));
+    CHECK_EQUAL(0, builder.channel("baz.bar", 2.0, bar));
+    CHECK_EQUAL(0, builder.rivulet("baz", baz));
+
+    Builder::Options options;
+    options.checksums = true;
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(options, &river));
+
+    size_t reports = 0;
+    const auto handler = [&](const Corruption&) { ++reports; };
+    CHECK_EQUAL(0, river->verify(handler));
+
+    foo.set(3);
+    bar.set(4.0);
+    CHECK_EQUAL(0, river->verify(handler));
+
+    const uint8_t data[16] = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+    baz.write(data);
+    CHECK_EQUAL(0, baz.verify(handler));
+    CHECK_EQUAL(0, river->verify(handler));
+    CHECK_EQUAL(0, reports);
+}
+
+/**
+ * Writes through any handle leave corruption of the rest of their block
+ * detected.
+ */
+TEST(checksums, corruption)
+{
+    Builder builder;
+    Channel<uint64_t> foo;
+    Channel<uint64_t> bar;
+    Channel<uint64_t> qux;
+    Flags flags;
+    Rivulet baz;
+    CHECK_EQUAL(0, builder.channel("baz.foo", uint64_t(1), foo));
+    CHECK_EQUAL(0, builder.channel("baz.bar", uint64_t(2), bar));
+    CHECK_EQUAL(0, builder.channel("qux", uint64_t(3), qux));
+    CHECK_EQUAL(0, builder.flags("flags", 64, flags));
+    CHECK_EQUAL(0, builder.rivulet("baz", baz));
+
+    // Build into a buffer so that the river memory can be corrupted.
+    alignas(Storage::ALIGNMENT) static uint8_t buffer[4096];
+    Builder::Options options;
+    options.checksums = true;
+    options.buffer = buffer;
+    options.buffer_size = sizeof(buffer);
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(options, &river));
+    const size_t corrupted = layout_offset(*river, "qux");
+    CHECK_TRUE(corrupted < Checksums::BLOCK_SIZE);
+
+    std::vector<std::string> paths;
+    const auto handler = [&](const Corruption& corruption) {
+        paths = corruption.paths;
+    };
+    const std::function<void()> writes[] = {
+        [&]() { foo.set(4); },
+        [&]() {
+            const uint64_t data[2] = {5, 6};
+            baz.write(data);
+        },
+        [&]() { flags.set(3); },
+        [&]() { flags.clear(3); },
+    };
+    for (const std::function<void()>& write : writes) {
+        buffer[corrupted] ^= 0x01;
+        write();
+        paths.clear();
+        CHECK_EQUAL(1, river->verify(handler));
+        CHECK_TRUE(std::find(paths.begin(), paths.end(), "qux") != paths.end());
+
+        // Undoing the corruption makes the block match again, since the
+        // checksum follows the writes.
+        buffer[corrupted] ^= 0x01;
+        CHECK_EQUAL(0, river->verify(handler));
+    }
+    CHECK_EQUAL(3, qux.get());
+    CHECK_EQUAL(5, foo.get());
+    CHECK_FALSE(flags.test(3));
+}
+
+/**
+ * Committed frames update the checksums of the front buffer.
+ */
+TEST(checksums, frames)
+{
+    Builder builder;
+    Channel<int32_t> foo;
+    CHECK_EQUAL(0, builder.channel("foo", 1, foo));
+
+    Builder::Options options;
+    options.frames = true;
+    options.checksums = true;
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(options, &river));
+
+    foo.set(2);
+    river->commit_frame();
+    CHECK_EQUAL(2, foo.get());
+    CHECK_EQUAL(0, river->verify(nullptr));
+}
+
+/**
+ * Committing a frame leaves corruption of blocks it doesn't commit detected.
+ */
+TEST(checksums, frame_corruption)
+{
+    Builder builder;
+    Channel<std::array<uint8_t, 64>> foo;
+    Channel<uint64_t> bar;
+    CHECK_EQUAL(0, builder.channel("foo", std::array<uint8_t, 64>(), foo));
+    CHECK_EQUAL(0, builder.channel("bar", uint64_t(1), bar));
+
+    alignas(Storage::ALIGNMENT) static uint8_t buffer[4096];
+    Builder::Options options;
+    options.frames = true;
+    options.checksums = true;
+    options.buffer = buffer;
+    options.buffer_size = sizeof(buffer);
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(options, &river));
+    const size_t corrupted = layout_offset(*river, "bar");
+    CHECK_TRUE(corrupted >= Checksums::BLOCK_SIZE);
+
+    buffer[corrupted] ^= 0x01;
+    foo.set(std::array<uint8_t, 64>({{1, 2, 3}}));
+    river->commit_frame();
+    CHECK_EQUAL(2, foo.get()[1]);
+    CHECK_EQUAL(1, river->verify(nullptr));
+    buffer[corrupted] ^= 0x01;
+    CHECK_EQUAL(0, river->verify(nullptr));
+}
+
+/**
+ * The scrubber repeatedly passes over a river while it is being written.
+ */
+TEST(checksums, scrubber)
+{
+    Builder builder;
+    Channel<uint64_t> foo;
+    CHECK_EQUAL(0, builder.channel("foo", uint64_t(0), foo));
+
+    Builder::Options options;
+    options.checksums = true;
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(options, &river));
+
+    size_t reports = 0;
+    Scrubber scrubber(river, 1024 * 1024, [&](const Corruption&) {
+        ++reports;
+    });
+
+    const auto deadline =
+        (std::chrono::steady_clock::now() + std::chrono::seconds(5));
+    uint64_t value = 0;
+    while ((scrubber.passes() < 3)
+           && (std::chrono::steady_clock::now() < deadline)) {
+        foo.set(++value);
+        std::this_thread::yield();
+    }
+
+    CHECK_TRUE(scrubber.passes() >= 3);
+    CHECK_EQUAL(0, scrubber.corruptions());
+    CHECK_EQUAL(0, reports);
+}
+
+/**
+ * The scrubber repairs upsets of redundant memory, and reports corruption of
+ * other memory instead of sealing it while repairing.
+ */
+TEST(checksums, scrubber_corruption)
+{
+    Builder builder;
+    Channel<double> pressure;
+    Channel<uint64_t> time;
+    CHECK_EQUAL(0, builder.channel("control.pressure", 14.7, pressure));
+    CHECK_EQUAL(0, builder.channel("system.time", uint64_t(1), time));
+    CHECK_EQUAL(0, builder.redundant("control"));
+
+    // Build into a buffer so that the river memory can be corrupted.
+    alignas(Storage::ALIGNMENT) static uint8_t buffer[4096];
+    Builder::Options options;
+    options.checksums = true;
+    options.buffer = buffer;
+    options.buffer_size = sizeof(buffer);
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(options, &river));
+    buffer[layout_offset(*river, "control.pressure")] ^= 0x01;
+    buffer[layout_offset(*river, "system.time")] ^= 0x01;
+
+    std::mutex mutex;
+    std::vector<std::string> paths;
+    Scrubber scrubber(river, 1024 * 1024, [&](const Corruption& corruption) {
+        std::lock_guard<std::mutex> lock(mutex);
+        paths.insert(
+            paths.end(), corruption.paths.begin(), corruption.paths.end());
+    });
+
+    const auto deadline =
+        (std::chrono::steady_clock::now() + std::chrono::seconds(5));
+    while ((scrubber.passes() < 2)
+           && (std::chrono::steady_clock::now() < deadline)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    CHECK_TRUE(scrubber.passes() >= 2);
+    CHECK_EQUAL(1, scrubber.corrections());
+    CHECK_TRUE(scrubber.corruptions() >= 2);
+    CHECK_EQUAL(14.7, pressure.get());
+    std::lock_guard<std::mutex> lock(mutex);
+    CHECK_TRUE(std::find(paths.begin(), paths.end(), "system.time")
+               != paths.end());
+}
@@ -0,0 +1,191 @@
+#include <array>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include <river>
+
+#include "CppUTest/TestHarness.h"
+#include "noop_lock.hpp"
+
+using namespace river;
+
+TEST_GROUP(derived) {};
+
+/**
+ * Derived values are computed from their inputs, and only recomputed when an
+ * input changes.
+ */
+TEST(derived, lazy)
+{
+    Builder builder;
+    Channel<double> pressure;
+    Channel<bool> pressure_valid;
+    Channel<std::array<uint8_t, 64>> log;
+    Channel<uint64_t> time;
+    Derived<bool> valve_open;
+    CHECK_EQUAL(0, builder.channel("control.pressure", 14.7, pressure));
+    CHECK_EQUAL(
+        0, builder.channel("control.pressure.valid", true, pressure_valid));
+    CHECK_EQUAL(0,
+                builder.channel("system.log", std::array<uint8_t, 64>(), log));
+    CHECK_EQUAL(0, builder.channel("system.time", uint64_t(0), time));
+    size_t compute_count = 0;
+    const auto open = [&compute_count](const double p, const bool valid) {
+        ++compute_count;
+        return ((p > 14.7) || !valid);
+    };
+    CHECK_EQUAL(0,
+                builder.derived("control.valve_open",
+                                open,
+                                valve_open,
+                                pressure,
+                                pressure_valid));
+
+    // Derived channels do nothing before the river is built.
+    CHECK_FALSE(valve_open.get());
+    CHECK_EQUAL(0, compute_count);
+
+    NoopLock* const lock = new NoopLock;
+    CHECK_EQUAL(0, builder.lock("control", std::shared_ptr<Lock>(lock)));
+    CHECK_EQUAL(0, builder.build());
+
+    // The first read computes the value, and later reads use the cache.
+    CHECK_FALSE(valve_open.get());
+    CHECK_EQUAL(1, compute_count);
+    CHECK_FALSE(valve_open.get());
+    CHECK_EQUAL(1, compute_count);
+
+    // Writing an input invalidates the cache.
+    pressure.set(15.0);
+    CHECK_TRUE(valve_open.get());
+    CHECK_EQUAL(2, compute_count);
+    CHECK_TRUE(valve_open.get());
+    CHECK_EQUAL(2, compute_count);
+
+    pressure.set(14.0);
+    pressure_valid.set(false);
+    CHECK_TRUE(valve_open.get());
+    CHECK_EQUAL(3, compute_count);
+
+    // Writing channels in other 64-byte blocks doesn't.
+    time.set(1);
+    CHECK_TRUE(valve_open.get());
+    CHECK_EQUAL(3, compute_count);
+
+    pressure_valid.set(true);
+    CHECK_FALSE(valve_open.get());
+    CHECK_EQUAL(4, compute_count);
+
+    // Cached reads acquire the lock once.
+    const uint64_t acquire_count = lock->acquire_count;
+    CHECK_FALSE(valve_open.get());
+    CHECK_EQUAL(acquire_count + 1, lock->acquire_count);
+}
+
+/**
+ * Cached values survive frame commits, and change once inputs are committed.
+ */
+TEST(derived, frames)
+{
+    Builder builder;
+    Channel<int32_t> a;
+    Channel<int32_t> b;
+    Derived<int64_t> sum;
+    CHECK_EQUAL(0, builder.channel("a", 1, a));
+    CHECK_EQUAL(0, builder.channel("b", 2, b));
+    CHECK_EQUAL(0,
+                builder.derived(
+                    "sum",
+                    [](const int32_t x, const int32_t y) {
+                        return int64_t(x) + y;
+                    },
+                    sum,
+                    a,
+                    b));
+    Builder::Options options;
+    options.frames = true;
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(options, &river));
+
+    CHECK_EQUAL(3, sum.get());
+    a.set(10);
+    CHECK_EQUAL(3, sum.get());
+    river->commit_frame();
+    CHECK_EQUAL(12, sum.get());
+
+    // Commits of the block holding the cached value keep it current.
+    b.set(2);
+    river->commit_frame();
+    CHECK_EQUAL(12, sum.get());
+}
+
+/**
+ * Inputs must be channels in the same builder.
+ */
+TEST(derived, invalid_inputs)
+{
+    Builder builder;
+    Builder other;
+    Channel<int32_t> input;
+    Channel<int32_t> foreign;
+    Channel<int32_t> unadded;
+    Derived<int32_t> derived;
+    CHECK_EQUAL(0, builder.channel("input", 0, input));
+    CHECK_EQUAL(0, other.channel("foreign", 0, foreign));
+    const auto identity = [](const int32_t x) { return x; };
+
+    CHECK_EQUAL(Builder::ERR_INVALID,
+                builder.derived("derived", identity, derived, unadded));
+    CHECK_EQUAL(Builder::ERR_NOTFOUND,
+                builder.derived("derived", identity, derived, foreign));
+    CHECK_EQUAL(Builder::ERR_DUPE,
+                builder.derived("input", identity, derived, input));
+    CHECK_EQUAL(0, builder.derived("derived", identity, derived, input));
+
+    // Derived channels can't be accessed as channels.
+    Channel<int32_t> lookup;
+    CHECK_EQUAL(Builder::ERR_INVALID, builder.channel("derived", lookup));
+}
+
+/**
+ * Stores over a derived channel's cached value force a recompute.
+ */
+TEST(derived, overwritten)
+{
+    Builder builder;
+    Channel<int32_t> x;
+    Channel<std::array<uint8_t, 64>> pad;
+    Derived<int32_t> twice;
+    Rivulet bar;
+    CHECK_EQUAL(0, builder.channel("foo.x", 1, x));
+    CHECK_EQUAL(0, builder.channel("foo.pad", std::array<uint8_t, 64>(), pad));
+    CHECK_EQUAL(0,
+                builder.derived(
+                    "bar.twice",
+                    [](const int32_t v) { return 2 * v; },
+                    twice,
+                    x));
+    CHECK_EQUAL(0, builder.rivulet("bar", bar));
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(Builder::Options(), &river));
+
+    // The derived channel is in another 64-byte block than its input.
+    std::stringstream layout;
+    river->export_layout(layout);
+    std::map<std::string, size_t> offsets;
+    std::string name;
+    size_t offset = 0;
+    std::string rest;
+    while ((layout >> name >> offset) && std::getline(layout, rest)) {
+        offsets[name] = offset;
+    }
+    CHECK_TRUE((offsets.at("foo.x") / 64) != (offsets.at("bar.twice") / 64));
+
+    // Writing over the cached value doesn't change the derived value.
+    CHECK_EQUAL(2, twice.get());
+    const int32_t overwrite = 999;
+    CHECK_EQUAL(sizeof(overwrite), bar.size());
+    bar.write(&overwrite);
+    CHECK_EQUAL(2, twice.get());
+}
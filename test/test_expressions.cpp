@@ -0,0 +1,137 @@
+#include <array>
+#include <string>
+
+#include <river>
+
+#include "CppUTest/TestHarness.h"
+#include "noop_lock.hpp"
+
+using namespace river;
+
+TEST_GROUP(expressions) {};
+
+/**
+ * Expressions evaluate over the current channel values with C precedence, and
+ * each lock is acquired once per evaluation.
+ */
+TEST(expressions, evaluate)
+{
+    Builder builder;
+    Channel<double> pressure;
+    Channel<bool> valid;
+    Channel<int16_t> offset;
+    Channel<uint64_t> time;
+    Channel<std::array<float, 3>> gains;
+    CHECK_EQUAL(0, builder.channel("control.pressure", 14.7, pressure));
+    CHECK_EQUAL(0, builder.channel("control.pressure.valid", true, valid));
+    CHECK_EQUAL(0, builder.channel("control.offset", int16_t(-3), offset));
+    CHECK_EQUAL(0, builder.channel("system.time", uint64_t(10), time));
+    CHECK_EQUAL(0,
+                builder.channel("control.gains",
+                                std::array<float, 3> {1.0f, 0.5f, 0.25f},
+                                gains));
+    NoopLock* const lock = new NoopLock;
+    CHECK_EQUAL(0, builder.lock("control", std::shared_ptr<Lock>(lock)));
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(&river));
+
+    Expressions expressions(river);
+    const char* const sources[] = {
+        "control.pressure > 14.7 || !control.pressure.valid",
+        "1 + 2 * 3 - 4 / 2",
+        "(1 + 2) * -3",
+        "system.time % 4 + control.offset",
+        "abs(control.offset) + min(system.time, 2) + max(1, 0.5)",
+        "control.gains[1] * 4 + control.gains [ 2 ]",
+        "control.pressure.valid ? control.pressure : -1",
+        "1 < 2 && 2 <= 2 && 3 >= 4 == false && 1 != 2",
+        "-control.pressure",
+    };
+    for (size_t i = 0; i < (sizeof(sources) / sizeof(sources[0])); ++i) {
+        size_t index = SIZE_MAX;
+        CHECK_EQUAL(0, expressions.add(sources[i], index));
+        CHECK_EQUAL(i, index);
+    }
+    CHECK_EQUAL(9, expressions.size());
+
+    // Values are 0 until evaluated.
+    CHECK_EQUAL(0.0, expressions.value(0));
+
+    const uint64_t acquire_count = lock->acquire_count;
+    expressions.evaluate();
+    CHECK_EQUAL(acquire_count + 1, lock->acquire_count);
+    CHECK_EQUAL(0.0, expressions.value(0));
+    CHECK_EQUAL(5.0, expressions.value(1));
+    CHECK_EQUAL(-9.0, expressions.value(2));
+    CHECK_EQUAL(-1.0, expressions.value(3));
+    CHECK_EQUAL(6.0, expressions.value(4));
+    CHECK_EQUAL(2.25, expressions.value(5));
+    CHECK_EQUAL(14.7, expressions.value(6));
+    CHECK_EQUAL(1.0, expressions.value(7));
+    CHECK_EQUAL(-14.7, expressions.value(8));
+
+    pressure.set(20.0);
+    valid.set(false);
+    expressions.evaluate();
+    CHECK_EQUAL(1.0, expressions.value(0));
+    CHECK_EQUAL(-1.0, expressions.value(6));
+    CHECK_EQUAL(-20.0, expressions.value(8));
+}
+
+/**
+ * Malformed expressions and paths that aren't arithmetic channels are
+ * rejected, and leave the engine unchanged.
+ */
+TEST(expressions, invalid)
+{
+    Builder builder;
+    Channel<double> pressure;
+    Channel<std::array<int32_t, 2>> counts;
+    Flags faults;
+    CHECK_EQUAL(0, builder.channel("control.pressure", 14.7, pressure));
+    CHECK_EQUAL(0,
+                builder.channel("control.counts",
+                                std::array<int32_t, 2> {1, 2},
+                                counts));
+    CHECK_EQUAL(0, builder.flags("control.faults", 8, faults));
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(&river));
+
+    Expressions expressions(river);
+    size_t index = SIZE_MAX;
+    const char* const invalid[] = {
+        "",
+        "1 +",
+        "(1",
+        "1 2",
+        "min(1)",
+        "1 ? 2",
+        "control.counts[",
+        "control.pressure = 1",
+        "$",
+    };
+    for (const char* const source : invalid) {
+        CHECK_EQUAL(Expressions::ERR_INVALID, expressions.add(source, index));
+    }
+    const char* const not_found[] = {
+        "control.missing",
+        "control",
+        "control.faults",
+        "control.counts",
+        "control.counts[2]",
+    };
+    for (const char* const source : not_found) {
+        CHECK_EQUAL(Expressions::ERR_NOTFOUND, expressions.add(source, index));
+    }
+    CHECK_EQUAL(SIZE_MAX, index);
+    CHECK_EQUAL(0, expressions.size());
+
+    // Nesting is bounded.
+    const std::string deep = (std::string(1000, '(') + "1"
+                              + std::string(1000, ')'));
+    CHECK_EQUAL(Expressions::ERR_INVALID, expressions.add(deep, index));
+
+    CHECK_EQUAL(0, expressions.add("control.counts[1]", index));
+    expressions.evaluate();
+    CHECK_EQUAL(2.0, expressions.value(index));
+}
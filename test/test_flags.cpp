@@ -0,0 +1,129 @@
+#include <thread>
+#include <vector>
+
+#include <river>
+
+#include "CppUTest/TestHarness.h"
+#include "noop_lock.hpp"
+
+using namespace river;
+
+TEST_GROUP(flags) {};
+
+/**
+ * Flags are packed into bits and can be set, cleared, tested, and counted.
+ */
+TEST(flags, basic)
+{
+    Builder builder;
+    Channel<bool> abort;
+    Flags faults;
+    Rivulet system;
+    CHECK_EQUAL(0, builder.channel("system.abort", false, abort));
+    CHECK_EQUAL(0, builder.flags("system.faults", 5000, faults));
+    CHECK_EQUAL(0, builder.rivulet("system", system));
+
+    CHECK_EQUAL(Builder::ERR_INVALID, builder.flags("system.x", 0, faults));
+    CHECK_EQUAL(Builder::ERR_DUPE, builder.flags("system.abort", 1, faults));
+
+    // Flags do nothing before the river is built.
+    faults.set(0);
+    CHECK_FALSE(faults.test(0));
+    CHECK_EQUAL(0, faults.size());
+
+    CHECK_EQUAL(0, builder.build());
+
+    // The flags are packed into 8-byte words after 7 bytes of padding.
+    CHECK_EQUAL(5000, faults.size());
+    CHECK_EQUAL(8 + (79 * 8), system.size());
+    CHECK_FALSE(faults.any());
+    CHECK_EQUAL(0, faults.count());
+
+    faults.set(0);
+    faults.set(63);
+    faults.set(64);
+    faults.set(4999);
+    faults.set(5000);
+    CHECK_TRUE(faults.test(0));
+    CHECK_FALSE(faults.test(1));
+    CHECK_TRUE(faults.test(63));
+    CHECK_TRUE(faults.test(64));
+    CHECK_TRUE(faults.test(4999));
+    CHECK_FALSE(faults.test(5000));
+    CHECK_TRUE(faults.any());
+    CHECK_EQUAL(4, faults.count());
+
+    faults.clear(0);
+    faults.clear(63);
+    faults.clear(64);
+    CHECK_EQUAL(1, faults.count());
+    faults.clear(4999);
+    CHECK_FALSE(faults.any());
+
+    // Flags don't overlap neighboring channels.
+    CHECK_FALSE(abort.get());
+}
+
+/**
+ * Flags in the same word can be updated concurrently without a lock.
+ */
+TEST(flags, concurrent)
+{
+    static constexpr size_t thread_count = 4;
+    static constexpr size_t flags_per_thread = 64;
+
+    Builder builder;
+    Flags flags;
+    CHECK_EQUAL(0,
+                builder.flags("flags", thread_count * flags_per_thread, flags));
+    CHECK_EQUAL(0, builder.build());
+
+    // Thread N owns every Nth flag, so every word is shared by all threads.
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&flags, t]() {
+            for (size_t i = 0; i < flags_per_thread; ++i) {
+                flags.set((i * thread_count) + t);
+            }
+            for (size_t i = 0; i < flags_per_thread; i += 2) {
+                flags.clear((i * thread_count) + t);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    CHECK_EQUAL(thread_count * flags_per_thread / 2, flags.count());
+}
+
+/**
+ * Flags work with locks, frames, checksums, and redundancy.
+ */
+TEST(flags, options)
+{
+    Builder builder;
+    Flags flags;
+    CHECK_EQUAL(0, builder.flags("faults.flags", 100, flags));
+    CHECK_EQUAL(0, builder.redundant("faults"));
+    NoopLock* const lock = new NoopLock;
+    CHECK_EQUAL(0, builder.lock("faults", std::shared_ptr<Lock>(lock)));
+
+    Builder::Options options;
+    options.frames = true;
+    options.checksums = true;
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(options, &river));
+
+    flags.set(99);
+    CHECK_EQUAL(1, lock->acquire_count);
+    CHECK_FALSE(flags.test(99));
+    river->commit_frame();
+    CHECK_TRUE(flags.test(99));
+    CHECK_EQUAL(1, flags.count());
+
+    // Reads in frame mode don't lock.
+    CHECK_EQUAL(1, lock->acquire_count);
+    CHECK_EQUAL(0, river->repair());
+    CHECK_EQUAL(0, river->verify(nullptr));
+}
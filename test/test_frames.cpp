@@ -0,0 +1,143 @@
+#include <river>
+
+#include "CppUTest/TestHarness.h"
+#include "noop_lock.hpp"
+
+using namespace river;
+
+TEST_GROUP(frames) {};
+
+/**
+ * Writes made during a frame only become visible once the frame is committed.
+ */
+TEST(frames, commit)
+{
+    Builder builder;
+    Channel<int32_t> foo;
+    Channel<double> bar;
+
+    CHECK_EQUAL(0, builder.channel("foo", 1, foo));
+    CHECK_EQUAL(0, builder.channel("bar", 2.0, bar));
+
+    Builder::Options options;
+    options.frames = true;
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(options, &river));
+    CHECK_TRUE(river->frames());
+    CHECK_EQUAL(0, river->frame());
+
+    // Writes are not visible within the frame.
+    foo.set(3);
+    bar.set(4.0);
+    CHECK_EQUAL(1, foo.get());
+    CHECK_EQUAL(2.0, bar.get());
+
+    // Writes are visible after the commit.
+    river->commit_frame();
+    CHECK_EQUAL(1, river->frame());
+    CHECK_EQUAL(3, foo.get());
+    CHECK_EQUAL(4.0, bar.get());
+
+    // Writes from a previous frame are retained when only some channels are
+    // written in the next frame.
+    foo.set(5);
+    river->commit_frame();
+    CHECK_EQUAL(5, foo.get());
+    CHECK_EQUAL(4.0, bar.get());
+}
+
+/**
+ * Dirty blocks spanning many channels are all committed.
+ */
+TEST(frames, many_channels)
+{
+    static constexpr size_t channel_count = 500;
+
+    Builder builder;
+    std::vector<Channel<uint64_t>> channels(channel_count);
+    for (size_t i = 0; i < channel_count; ++i) {
+        CHECK_EQUAL(0,
+                    builder.channel("foo.c" + std::to_string(i),
+                                    uint64_t(0),
+                                    channels[i]));
+    }
+
+    Rivulet foo;
+    CHECK_EQUAL(0, builder.rivulet("foo", foo));
+
+    Builder::Options options;
+    options.frames = true;
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(options, &river));
+
+    // Write every third channel; the rest stay clean.
+    for (size_t i = 0; i < channel_count; i += 3) {
+        channels[i].set(i + 1);
+    }
+    river->commit_frame();
+    for (size_t i = 0; i < channel_count; ++i) {
+        CHECK_EQUAL(((i % 3) == 0 ? (i + 1) : 0), channels[i].get());
+    }
+
+    // Writing the whole rivulet is also deferred until the commit.
+    std::vector<uint64_t> data(channel_count, 7);
+    CHECK_EQUAL(channel_count * sizeof(uint64_t), foo.size());
+    foo.write(data.data());
+    CHECK_EQUAL(1, channels[0].get());
+    river->commit_frame();
+    for (size_t i = 0; i < channel_count; ++i) {
+        CHECK_EQUAL(7, channels[i].get());
+    }
+}
+
+/**
+ * Reads in frame mode don't acquire locks, but writes do.
+ */
+TEST(frames, locks)
+{
+    Builder builder;
+    Channel<int32_t> foo;
+    Rivulet rivulet;
+
+    CHECK_EQUAL(0, builder.channel("foo.bar", 1, foo));
+    CHECK_EQUAL(0, builder.rivulet("foo", rivulet));
+
+    NoopLock* const raw_lock = new NoopLock;
+    CHECK_EQUAL(0, builder.lock("foo", std::shared_ptr<Lock>(raw_lock)));
+
+    Builder::Options options;
+    options.frames = true;
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(options, &river));
+
+    int32_t data = 0;
+    CHECK_EQUAL(1, foo.get());
+    rivulet.read(&data);
+    CHECK_EQUAL(0, raw_lock->acquire_count);
+
+    foo.set(2);
+    rivulet.write(&data);
+    CHECK_EQUAL(2, raw_lock->acquire_count);
+    CHECK_EQUAL(2, raw_lock->release_count);
+}
+
+/**
+ * Committing a river that isn't in frame mode has no effect.
+ */
+TEST(frames, disabled)
+{
+    Builder builder;
+    Channel<int32_t> foo;
+
+    CHECK_EQUAL(0, builder.channel("foo", 1, foo));
+
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(&river));
+    CHECK_TRUE(!river->frames());
+
+    foo.set(2);
+    CHECK_EQUAL(2, foo.get());
+    river->commit_frame();
+    CHECK_EQUAL(0, river->frame());
+    CHECK_EQUAL(2, foo.get());
+}
@@ -0,0 +1,83 @@
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+
+#include <river>
+
+#include "CppUTest/TestHarness.h"
+#include "control_gen.hpp"
+#include "noop_lock.hpp"
+
+using namespace river;
+
+TEST_GROUP(gen) {};
+
+/**
+ * Accessors generated from a schema access the same channels as the handles of
+ * a river built from the schema at runtime.
+ */
+TEST(gen, accessors)
+{
+    Builder builder;
+    std::ifstream schema(RIVER_TEST_SCHEMA);
+    CHECK_EQUAL(0,
+                builder.load_schema(schema, [](const LockKind) {
+                    return std::make_shared<NoopLock>();
+                }));
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(Builder::Options(), &river));
+
+    Channel<uint64_t> time;
+    Channel<double> pressure;
+    Channel<bool> valid;
+    Channel<std::array<int16_t, 3>> gains;
+    Channel<float> limit;
+    Flags faults;
+    CHECK_EQUAL(0, builder.channel("system.time", time));
+    CHECK_EQUAL(0, builder.channel("control.pressure", pressure));
+    CHECK_EQUAL(0, builder.channel("control.pressure.valid", valid));
+    CHECK_EQUAL(0, builder.channel("control.gains", gains));
+    CHECK_EQUAL(0, builder.channel("control.limit", limit));
+    CHECK_EQUAL(0, builder.flags("control.faults", faults));
+
+    Control control;
+    CHECK_TRUE(control.bind(*river));
+    CHECK_EQUAL(sizeof(double), Control::CONTROL_PRESSURE_SIZE);
+    CHECK_EQUAL(sizeof(gains.get()), Control::CONTROL_GAINS_SIZE);
+    CHECK_EQUAL(16, Control::CONTROL_FAULTS_SIZE);
+
+    // Accessors see the initial values and writes through handles.
+    CHECK_EQUAL(14.7, control.control_pressure());
+    CHECK_TRUE(control.control_pressure_valid());
+    CHECK_EQUAL(-2, control.control_gains()[1]);
+    CHECK_EQUAL(0.5f, control.control_limit());
+    time.set(7);
+    CHECK_EQUAL(7, control.system_time());
+    faults.set(65);
+    uint64_t fault_word = 0;
+    std::memcpy(&fault_word,
+                control.control_faults_ptr() + sizeof(fault_word),
+                sizeof(fault_word));
+    CHECK_EQUAL(2, fault_word);
+
+    // Handles see writes through accessors.
+    control.set_control_pressure(15.5);
+    control.set_control_pressure_valid(false);
+    control.set_control_gains({4, 5, 6});
+    control.set_control_limit(0.25f);
+    CHECK_EQUAL(15.5, pressure.get());
+    CHECK_FALSE(valid.get());
+    CHECK_EQUAL(6, gains.get()[2]);
+    CHECK_EQUAL(0.25f, limit.get());
+
+    // Rivers with another layout don't bind.
+    Builder other_builder;
+    std::stringstream other_schema("uint64 system.time\n"
+                                   "float  control.pressure\n");
+    CHECK_EQUAL(0, other_builder.load_schema(other_schema));
+    std::shared_ptr<River> other;
+    CHECK_EQUAL(0, other_builder.build(Builder::Options(), &other));
+    CHECK_FALSE(control.bind(*other));
+}
@@ -0,0 +1,118 @@
+#include <array>
+#include <memory>
+#include <vector>
+
+#include <river>
+
+#include "CppUTest/TestHarness.h"
+
+using namespace river;
+
+TEST_GROUP(history) {};
+
+/**
+ * Writes are aggregated into buckets at each resolution, and queries use the
+ * coarsest resolution that has enough points.
+ */
+TEST(history, aggregate)
+{
+    Builder builder;
+    Channel<double> pressure;
+    Channel<int16_t> offset;
+    Channel<std::array<float, 3>> gains;
+    Channel<uint64_t> time;
+    CHECK_EQUAL(0, builder.channel("control.pressure", 0.0, pressure));
+    CHECK_EQUAL(0, builder.channel("control.offset", int16_t(0), offset));
+    CHECK_EQUAL(
+        0, builder.channel("control.gains", std::array<float, 3>(), gains));
+    CHECK_EQUAL(0, builder.channel("system.time", uint64_t(0), time));
+
+    uint64_t now = 0;
+    History::Options history_options;
+    history_options.resolutions = {{100, 4}, {10, 8}};
+    history_options.clock = [&now]() { return now; };
+    std::shared_ptr<History> history(
+        new History({"control"}, history_options));
+    Builder::Options options;
+    options.history = history;
+    CHECK_EQUAL(0, builder.build(options, nullptr));
+
+    // Write 0, 1, ..., 49 every 2 ns.
+    for (int i = 0; i < 50; ++i) {
+        now = uint64_t(i) * 2;
+        pressure.set(i);
+    }
+    offset.set(-3);
+    time.set(1);
+
+    // 10 ns buckets have enough points.
+    std::vector<History::Point> points;
+    CHECK_EQUAL(0, history->query("control.pressure", 40, 100, 6, points));
+    CHECK_EQUAL(6, points.size());
+    CHECK_EQUAL(40, points[0].time);
+    CHECK_EQUAL(10, points[0].period);
+    CHECK_EQUAL(20.0, points[0].min);
+    CHECK_EQUAL(24.0, points[0].max);
+    CHECK_EQUAL(22.0, points[0].mean);
+    CHECK_EQUAL(5, points[0].count);
+    CHECK_EQUAL(45.0, points[5].min);
+    CHECK_EQUAL(49.0, points[5].max);
+
+    // A single 100 ns bucket satisfies a request for one point.
+    CHECK_EQUAL(0, history->query("control.pressure", 0, 100, 1, points));
+    CHECK_EQUAL(1, points.size());
+    CHECK_EQUAL(0, points[0].time);
+    CHECK_EQUAL(100, points[0].period);
+    CHECK_EQUAL(0.0, points[0].min);
+    CHECK_EQUAL(49.0, points[0].max);
+    CHECK_EQUAL(24.5, points[0].mean);
+    CHECK_EQUAL(50, points[0].count);
+
+    // The 10 ns ring no longer holds the start of the range, so the coarser
+    // resolution is used despite having too few points.
+    CHECK_EQUAL(0, history->query("control.pressure", 0, 100, 10, points));
+    CHECK_EQUAL(1, points.size());
+    CHECK_EQUAL(100, points[0].period);
+
+    // Other channels under the recorded rivulet are recorded too.
+    CHECK_EQUAL(0, history->query("control.offset", 0, 100, 1, points));
+    CHECK_EQUAL(1, points.size());
+    CHECK_EQUAL(-3.0, points[0].mean);
+
+    // Array channels and channels outside the recorded paths aren't.
+    CHECK_EQUAL(History::ERR_NOTFOUND,
+                history->query("control.gains", 0, 100, 1, points));
+    CHECK_EQUAL(History::ERR_NOTFOUND,
+                history->query("system.time", 0, 100, 1, points));
+
+    // Buckets are reused once their ring wraps around.
+    now = 1000;
+    pressure.set(7);
+    CHECK_EQUAL(0, history->query("control.pressure", 900, 1001, 1, points));
+    CHECK_EQUAL(1, points.size());
+    CHECK_EQUAL(1000, points[0].time);
+    CHECK_EQUAL(7.0, points[0].mean);
+    CHECK_EQUAL(1, points[0].count);
+    CHECK_EQUAL(0, history->query("control.pressure", 0, 100, 1, points));
+    CHECK_EQUAL(0, points.size());
+}
+
+/**
+ * Paths that don't match an arithmetic channel fail the build.
+ */
+TEST(history, invalid_paths)
+{
+    Builder builder;
+    Channel<std::array<float, 3>> gains;
+    CHECK_EQUAL(
+        0, builder.channel("control.gains", std::array<float, 3>(), gains));
+
+    Builder::Options options;
+    options.history.reset(new History({"control.missing"}));
+    CHECK_EQUAL(Builder::ERR_INVALID, builder.build(options, nullptr));
+    options.history.reset(new History({"control"}));
+    CHECK_EQUAL(Builder::ERR_INVALID, builder.build(options, nullptr));
+
+    // Handles of a river that failed to build do nothing.
+    gains.set({1.0f, 2.0f, 3.0f});
+}
@@ -0,0 +1,59 @@
+#include <array>
+#include <sstream>
+
+#include <river>
+
+#include "CppUTest/TestHarness.h"
+
+using namespace river;
+
+TEST_GROUP(layout) {};
+
+/**
+ * Layout optimization removes padding and packs hot channels together.
+ */
+TEST(layout, optimize)
+{
+    Builder builder;
+    Channel<uint8_t> cold;
+    Channel<uint32_t> hot;
+    Channel<std::array<uint8_t, 64>> big;
+    Flags flags;
+    Rivulet foo;
+    CHECK_EQUAL(0, builder.channel("foo.cold", uint8_t(1), cold));
+    CHECK_EQUAL(0, builder.flags("foo.flags", 64, flags));
+    CHECK_EQUAL(0, builder.channel("foo.big", {}, big));
+    CHECK_EQUAL(0, builder.channel("foo.hot", uint32_t(2), hot));
+    CHECK_EQUAL(0, builder.rivulet("foo", foo));
+    CHECK_EQUAL(0, builder.hot("foo.hot"));
+    CHECK_EQUAL(0, builder.hot("foo.flags"));
+
+    CHECK_EQUAL(Builder::ERR_NOTFOUND, builder.hot("bar"));
+    CHECK_EQUAL(Builder::ERR_INVALID, builder.hot(""));
+
+    // In declaration order, the flags are preceded by 7 bytes of padding, and
+    // the big channel separates the hot channels.
+    std::stringstream report;
+    Builder::Options options;
+    options.optimize_layout = true;
+    options.layout_report = &report;
+    CHECK_EQUAL(0, builder.build(options, nullptr));
+    CHECK_EQUAL(std::string("before: 84 bytes, 7 bytes padding, 2 cache "
+                            "lines, 2 hot cache lines\n"
+                            "after: 77 bytes, 0 bytes padding, 2 cache "
+                            "lines, 1 hot cache lines\n"),
+                report.str());
+
+    // Hot channels come first, with the aligned flags before the hot value,
+    // followed by the cold channels in declaration order.
+    CHECK_EQUAL(77, foo.size());
+    flags.set(0);
+    hot.set(3);
+    uint8_t data[77];
+    foo.read(data);
+    CHECK_EQUAL(1, data[0]);
+    CHECK_EQUAL(3, data[8]);
+    CHECK_EQUAL(1, data[12]);
+    CHECK_EQUAL(1, cold.get());
+    CHECK_EQUAL(3, hot.get());
+}
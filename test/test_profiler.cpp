@@ -0,0 +1,182 @@
+#include <sstream>
+#include <thread>
+
+#include <river>
+
+#include "CppUTest/TestHarness.h"
+#include "noop_lock.hpp"
+
+using namespace river;
+
+TEST_GROUP(profiler) {};
+
+/**
+ * Handles for the river used by the profiler tests.
+ */
+struct ProfiledRiver {
+    Channel<uint64_t> time;
+    Channel<bool> abort;
+    Channel<double> pressure;
+    Channel<bool> pressure_valid;
+    Channel<bool> valve_open;
+    Channel<int32_t> local;
+
+    /**
+     * Adds the river channels to a builder.
+     *
+     * @param builder Builder.
+     */
+    void add(Builder& builder)
+    {
+        CHECK_EQUAL(0, builder.channel("system.time", uint64_t(0), time));
+        CHECK_EQUAL(0, builder.channel("system.abort", false, abort));
+        CHECK_EQUAL(0, builder.channel("control.pressure", 14.7, pressure));
+        CHECK_EQUAL(0,
+                    builder.channel("control.pressure.valid",
+                                    true,
+                                    pressure_valid));
+        CHECK_EQUAL(0, builder.channel("control.valve_open", false, valve_open));
+        CHECK_EQUAL(0, builder.channel("local.x", 0, local));
+    }
+};
+
+/**
+ * Profiles accesses from several threads and loads the recommended locks into
+ * a new builder.
+ */
+TEST(profiler, recommend_locks)
+{
+    ProfiledRiver profiled;
+    Builder builder;
+    profiled.add(builder);
+
+    Builder::Options options;
+    options.profiler.reset(new Profiler);
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(options, &river));
+
+    // The accesses below are deliberately unsynchronized.
+    river->on_race([](const Race&) {});
+
+    // Thread A writes `system`, `control.pressure`, and `control.valve_open`,
+    // and is the only thread that touches `local`.
+    std::thread([&]() {
+        profiled.time.set(1);
+        profiled.abort.set(true);
+        profiled.pressure.set(15.0);
+        profiled.valve_open.set(profiled.valve_open.get());
+        profiled.local.set(profiled.local.get() + 1);
+    }).join();
+
+    // Thread B reads `system` and also writes `control.pressure`.
+    std::thread([&]() {
+        profiled.time.get();
+        profiled.pressure.set(16.0);
+        profiled.pressure_valid.get();
+    }).join();
+
+    std::stringstream lock_map;
+    options.profiler->recommend_locks(lock_map);
+    CHECK_EQUAL(std::string("system single_writer\n"
+                            "control.pressure multi_writer\n"),
+                lock_map.str());
+
+    // Load the lock map into a builder for a new river with the same layout.
+    ProfiledRiver locked;
+    Builder locked_builder;
+    locked.add(locked_builder);
+
+    std::vector<NoopLock*> locks;
+    const auto make_lock = [&](const LockKind kind) -> std::shared_ptr<Lock> {
+        CHECK_TRUE(kind != LockKind::NONE);
+        locks.push_back(new NoopLock);
+        return std::shared_ptr<Lock>(locks.back());
+    };
+    CHECK_EQUAL(0, locked_builder.load_locks(lock_map, make_lock));
+    CHECK_EQUAL(0, locked_builder.build());
+    CHECK_EQUAL(2, locks.size());
+
+    // Only the recommended rivulets are locked.
+    locked.time.get();
+    locked.abort.get();
+    CHECK_EQUAL(2, locks[0]->acquire_count);
+    locked.pressure.get();
+    locked.pressure_valid.get();
+    CHECK_EQUAL(2, locks[1]->acquire_count);
+    locked.valve_open.get();
+    locked.local.get();
+    CHECK_EQUAL(2, locks[0]->acquire_count);
+    CHECK_EQUAL(2, locks[1]->acquire_count);
+}
+
+/**
+ * Whole-rivulet accesses keep contended locks from being pushed down.
+ */
+TEST(profiler, rivulet_access)
+{
+    Builder builder;
+    Channel<int32_t> a, b;
+    Rivulet foo;
+    CHECK_EQUAL(0, builder.channel("foo.a", 0, a));
+    CHECK_EQUAL(0, builder.channel("foo.b", 0, b));
+    CHECK_EQUAL(0, builder.rivulet("foo", foo));
+
+    Builder::Options options;
+    options.profiler.reset(new Profiler);
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(options, &river));
+
+    // The accesses below are deliberately unsynchronized.
+    river->on_race([](const Race&) {});
+
+    // Without whole-rivulet accesses, each channel only needs its own lock.
+    std::thread([&]() { a.set(1); }).join();
+    std::thread([&]() { b.set(1); }).join();
+    std::stringstream lock_map;
+    options.profiler->recommend_locks(lock_map);
+    CHECK_EQUAL(std::string(""), lock_map.str());
+
+    std::thread([&]() { a.set(2); }).join();
+    std::stringstream contended_map;
+    options.profiler->recommend_locks(contended_map);
+    CHECK_EQUAL(std::string("foo.a multi_writer\n"), contended_map.str());
+
+    // Reading the whole rivulet needs the lock on the rivulet.
+    std::thread([&]() {
+        int32_t data[2];
+        foo.read(data);
+    }).join();
+    std::stringstream rivulet_map;
+    options.profiler->recommend_locks(rivulet_map);
+    CHECK_EQUAL(std::string("foo multi_writer\n"), rivulet_map.str());
+}
+
+/**
+ * Loading a malformed lock map fails.
+ */
+TEST(profiler, load_invalid)
+{
+    Builder builder;
+    Channel<int32_t> foo;
+    CHECK_EQUAL(0, builder.channel("foo.bar", 0, foo));
+
+    const auto make_lock = [](const LockKind) -> std::shared_ptr<Lock> {
+        return std::shared_ptr<Lock>(new NoopLock);
+    };
+
+    std::stringstream bad_kind("foo spin\n");
+    CHECK_EQUAL(Builder::ERR_INVALID, builder.load_locks(bad_kind, make_lock));
+
+    std::stringstream missing_kind("foo\n");
+    CHECK_EQUAL(Builder::ERR_INVALID,
+                builder.load_locks(missing_kind, make_lock));
+
+    std::stringstream bad_path("baz multi_writer\n");
+    CHECK_EQUAL(Builder::ERR_NOTFOUND, builder.load_locks(bad_path, make_lock));
+
+    std::stringstream good("# comment\n\nfoo.bar none\nfoo multi_writer # x\n");
+    CHECK_EQUAL(0, builder.load_locks(good, make_lock));
+
+    std::stringstream dupe("foo.bar single_writer\n");
+    CHECK_EQUAL(Builder::ERR_DUPE, builder.load_locks(dupe, make_lock));
+}
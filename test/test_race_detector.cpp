@@ -0,0 +1,108 @@
+#include <thread>
+
+#include <river>
+
+#include "CppUTest/TestHarness.h"
+#include "noop_lock.hpp"
+
+using namespace river;
+
+TEST_GROUP(race_detector) {};
+
+#ifdef RIVER_RACE_DETECTOR
+
+/**
+ * Writes to an unlocked channel from two threads in the same epoch are
+ * reported, but not once the epoch advances between them.
+ */
+TEST(race_detector, unsynchronized_writes)
+{
+    Builder builder;
+    Channel<int32_t> foo, bar;
+    CHECK_EQUAL(0, builder.channel("foo.bar", 0, foo));
+    CHECK_EQUAL(0, builder.channel("baz", 0, bar));
+
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(&river));
+
+    std::vector<Race> races;
+    river->on_race([&races](const Race& race) { races.push_back(race); });
+
+    // Same thread writing repeatedly is fine.
+    foo.set(1);
+    foo.set(2);
+    CHECK_EQUAL(0, races.size());
+
+    // Another thread writing in the same epoch is a race.
+    std::thread([&]() { foo.set(3); }).join();
+    CHECK_EQUAL(1, races.size());
+    CHECK_TRUE(races[0].kind == Race::Kind::UNSYNCHRONIZED_WRITES);
+    CHECK_EQUAL(std::string("foo.bar"), races[0].path);
+    CHECK_TRUE(races[0].thread != races[0].other_thread);
+    CHECK_EQUAL(river->epoch(), races[0].epoch);
+
+    // Handing off the channel at an epoch boundary is fine.
+    river->advance_epoch();
+    foo.set(4);
+    CHECK_EQUAL(1, races.size());
+
+    // Writing the other channel doesn't involve `foo`.
+    std::thread([&]() { bar.set(1); }).join();
+    CHECK_EQUAL(1, races.size());
+}
+
+/**
+ * Channels covered by locks and whole-rivulet accesses are checked
+ * appropriately.
+ */
+TEST(race_detector, locks_and_rivulets)
+{
+    Builder builder;
+    Channel<int32_t> locked, unlocked;
+    Rivulet unlocked_rivulet;
+    CHECK_EQUAL(0, builder.channel("locked.x", 0, locked));
+    CHECK_EQUAL(0, builder.channel("unlocked.x", 0, unlocked));
+    CHECK_EQUAL(0, builder.rivulet("unlocked", unlocked_rivulet));
+    CHECK_EQUAL(0,
+                builder.lock("locked", std::shared_ptr<Lock>(new NoopLock)));
+
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(&river));
+
+    std::vector<Race> races;
+    river->on_race([&races](const Race& race) { races.push_back(race); });
+
+    // Locked channels are never checked.
+    locked.set(1);
+    std::thread([&]() { locked.set(2); }).join();
+    CHECK_EQUAL(0, races.size());
+
+    // Writing an unlocked rivulet counts as writing each channel in it.
+    unlocked.set(1);
+    std::thread([&]() {
+        const int32_t data = 2;
+        unlocked_rivulet.write(&data);
+    }).join();
+    CHECK_EQUAL(1, races.size());
+    CHECK_EQUAL(std::string("unlocked.x"), races[0].path);
+}
+
+#endif
+
+/**
+ * Setting a race handler is always allowed, even without the detector.
+ */
+TEST(race_detector, handler)
+{
+    Builder builder;
+    Channel<int32_t> foo;
+    CHECK_EQUAL(0, builder.channel("foo", 0, foo));
+
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(&river));
+    river->on_race([](const Race&) {});
+
+    const uint64_t epoch = river->epoch();
+    river->advance_epoch();
+    CHECK_EQUAL(epoch + 1, river->epoch());
+}
@@ -0,0 +1,118 @@
+#include <cstring>
+
+#include <river>
+
+#include "CppUTest/TestHarness.h"
+
+using namespace river;
+
+TEST_GROUP(redundancy) {};
+
+/**
+ * Reads vote out upsets of any single copy, and repairs restore the copies.
+ */
+TEST(redundancy, vote_and_repair)
+{
+    uint8_t data[300] = {};
+    Replicas replicas(data,
+                      {
+                          {.offset = 150, .size = 100},
+                          {.offset = 10, .size = 50},
+                          {.offset = 40, .size = 40},
+                      });
+
+    uint8_t values[260];
+    for (size_t i = 0; i < sizeof(values); ++i) {
+        values[i] = static_cast<uint8_t>(i + 1);
+    }
+    replicas.write(20, values, sizeof(values));
+    CHECK_EQUAL(0, replicas.repair(0, sizeof(data)));
+
+    // Upset the primary in redundant memory and outside of it.
+    data[45] ^= 0x10;
+    data[200] ^= 0xFF;
+    data[100] ^= 0x01;
+
+    // Redundant memory reads back as written; other memory doesn't.
+    uint8_t read[260];
+    replicas.read(20, read, sizeof(read));
+    CHECK_EQUAL(values[45 - 20], read[45 - 20]);
+    CHECK_EQUAL(values[200 - 20], read[200 - 20]);
+    CHECK_EQUAL(values[100 - 20] ^ 0x01, read[100 - 20]);
+
+    // Repairs only touch the requested range.
+    CHECK_EQUAL(1, replicas.repair(0, 100));
+    CHECK_EQUAL(values[45 - 20], data[45]);
+    CHECK_EQUAL(values[200 - 20] ^ 0xFF, data[200]);
+    CHECK_EQUAL(1, replicas.repair(100, 200));
+    CHECK_EQUAL(values[200 - 20], data[200]);
+    CHECK_EQUAL(0, replicas.repair(0, sizeof(data)));
+}
+
+/**
+ * Redundant rivulets behave like any other through handles.
+ */
+TEST(redundancy, river)
+{
+    Builder builder;
+    Channel<uint64_t> time;
+    Channel<double> pressure;
+    Channel<bool> valve_open;
+    Rivulet control;
+    CHECK_EQUAL(0, builder.channel("time", uint64_t(1), time));
+    CHECK_EQUAL(0, builder.channel("control.pressure", 14.7, pressure));
+    CHECK_EQUAL(0, builder.channel("control.valve_open", false, valve_open));
+    CHECK_EQUAL(0, builder.rivulet("control", control));
+
+    CHECK_EQUAL(Builder::ERR_NOTFOUND, builder.redundant("foo"));
+    CHECK_EQUAL(Builder::ERR_INVALID, builder.redundant("control..x"));
+    CHECK_EQUAL(0, builder.redundant("control"));
+    CHECK_EQUAL(Builder::ERR_DUPE, builder.redundant("control"));
+    CHECK_EQUAL(Builder::ERR_DUPE, builder.redundant("control.pressure"));
+
+    Builder::Options options;
+    options.checksums = true;
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(options, &river));
+
+    CHECK_EQUAL(14.7, pressure.get());
+    pressure.set(15.0);
+    valve_open.set(true);
+    time.set(2);
+    CHECK_EQUAL(15.0, pressure.get());
+    CHECK_TRUE(valve_open.get());
+    CHECK_EQUAL(2, time.get());
+
+    struct __attribute__((packed)) {
+        double pressure;
+        bool valve_open;
+    } data;
+    control.read(&data);
+    CHECK_EQUAL(15.0, data.pressure);
+    CHECK_TRUE(data.valve_open);
+
+    CHECK_EQUAL(0, river->repair());
+    CHECK_EQUAL(0, river->verify(nullptr));
+}
+
+/**
+ * Committed frames update every copy of redundant memory.
+ */
+TEST(redundancy, frames)
+{
+    Builder builder;
+    Channel<int32_t> foo;
+    CHECK_EQUAL(0, builder.channel("foo.bar", 1, foo));
+    CHECK_EQUAL(0, builder.redundant("foo"));
+
+    Builder::Options options;
+    options.frames = true;
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(options, &river));
+
+    foo.set(2);
+    CHECK_EQUAL(1, foo.get());
+    river->commit_frame();
+    CHECK_EQUAL(2, foo.get());
+    CHECK_EQUAL(0, river->repair());
+}
@@ -0,0 +1,175 @@
+#include <array>
+#include <string>
+
+#include <unistd.h>
+
+#include <river>
+
+#include "CppUTest/TestHarness.h"
+
+using namespace river;
+
+namespace {
+/**
+ * Gets a shared memory object name unique to this process.
+ */
+std::string log_name()
+{
+    return ("/river_test_" + std::to_string(getpid()));
+}
+
+/**
+ * Handles to a replicated river.
+ */
+struct Handles final {
+    Channel<int32_t> value;
+    Channel<std::array<uint8_t, 1000>> block;
+    std::shared_ptr<River> river;
+
+    /**
+     * Builds the river.
+     *
+     * @param options Build options.
+     *
+     * @returns Builder::build() result.
+     */
+    int32_t build(const Builder::Options& options)
+    {
+        Builder builder;
+        CHECK_EQUAL(0, builder.channel("a.value", 0, value));
+        CHECK_EQUAL(0,
+                    builder.channel(
+                        "b.block", std::array<uint8_t, 1000> {}, block));
+        return builder.build(options, &river);
+    }
+};
+} /* namespace */
+
+TEST_GROUP(replication) {};
+
+/**
+ * The mirror starts from a snapshot, then applies each committed frame.
+ */
+TEST(replication, apply)
+{
+    std::shared_ptr<ReplicationLog> primary_log(new ReplicationLog);
+    CHECK_EQUAL(0, primary_log->create(log_name(), 1 << 14));
+    std::shared_ptr<ReplicationLog> standby_log(new ReplicationLog);
+    CHECK_EQUAL(0, standby_log->open(log_name()));
+
+    Handles primary;
+    Builder::Options primary_options;
+    primary_options.frames = true;
+    primary_options.replicator.reset(new Replicator(primary_log));
+    CHECK_EQUAL(0, primary.build(primary_options));
+
+    Handles standby;
+    CHECK_EQUAL(0, standby.build(Builder::Options()));
+    Mirror mirror(standby.river, standby_log);
+    CHECK_EQUAL(0, mirror.apply());
+    CHECK_EQUAL(0, mirror.frame());
+
+    primary.value.set(5);
+    primary.river->commit_frame();
+    CHECK_EQUAL(0, standby.value.get());
+    CHECK_EQUAL(0, mirror.apply());
+    CHECK_EQUAL(1, mirror.frame());
+    CHECK_EQUAL(5, standby.value.get());
+    CHECK_EQUAL(1, primary_options.replicator->acknowledged());
+
+    // Uncommitted writes aren't replicated.
+    primary.value.set(6);
+    CHECK_EQUAL(0, mirror.apply());
+    CHECK_EQUAL(5, standby.value.get());
+
+    std::array<uint8_t, 1000> block {};
+    block[999] = 7;
+    primary.block.set(block);
+    primary.river->commit_frame();
+    primary.river->commit_frame();
+    CHECK_EQUAL(0, mirror.apply());
+    CHECK_EQUAL(3, mirror.frame());
+    CHECK_EQUAL(6, standby.value.get());
+    CHECK_EQUAL(7, standby.block.get()[999]);
+    CHECK_EQUAL(0, primary_options.replicator->dropped());
+}
+
+/**
+ * Frames that don't fit in the log are dropped, and the mirror catches up
+ * from a snapshot.
+ */
+TEST(replication, catch_up)
+{
+    std::shared_ptr<ReplicationLog> primary_log(new ReplicationLog);
+    CHECK_EQUAL(0, primary_log->create(log_name(), 2048));
+    std::shared_ptr<ReplicationLog> standby_log(new ReplicationLog);
+    CHECK_EQUAL(0, standby_log->open(log_name()));
+
+    Handles primary;
+    Builder::Options primary_options;
+    primary_options.frames = true;
+    primary_options.replicator.reset(new Replicator(primary_log));
+    CHECK_EQUAL(0, primary.build(primary_options));
+    Handles standby;
+    CHECK_EQUAL(0, standby.build(Builder::Options()));
+    Mirror mirror(standby.river, standby_log);
+
+    // Only the first frame fits while the mirror isn't applying.
+    std::array<uint8_t, 1000> block {};
+    for (uint8_t i = 1; i <= 3; ++i) {
+        block[0] = i;
+        primary.block.set(block);
+        primary.river->commit_frame();
+    }
+    CHECK_EQUAL(2, primary_options.replicator->dropped());
+    CHECK_EQUAL(0, mirror.apply());
+    CHECK_EQUAL(1, mirror.frame());
+    CHECK_EQUAL(1, standby.block.get()[0]);
+
+    // The next frame is a snapshot with everything that was dropped.
+    primary.value.set(9);
+    primary.river->commit_frame();
+    CHECK_EQUAL(0, mirror.apply());
+    CHECK_EQUAL(4, mirror.frame());
+    CHECK_EQUAL(3, standby.block.get()[0]);
+    CHECK_EQUAL(9, standby.value.get());
+}
+
+/**
+ * Replication needs frame mode, room for a snapshot, and matching layouts.
+ */
+TEST(replication, invalid)
+{
+    std::shared_ptr<ReplicationLog> log(new ReplicationLog);
+    CHECK_EQUAL(ReplicationLog::ERR_INVALID, log->create(log_name(), 12));
+    CHECK_EQUAL(0, log->create(log_name(), 1024));
+    CHECK_EQUAL(ReplicationLog::ERR_INVALID, log->create(log_name(), 1024));
+
+    Handles handles;
+    Builder::Options options;
+    options.replicator.reset(new Replicator(log));
+    CHECK_EQUAL(Builder::ERR_INVALID, handles.build(options));
+    options.frames = true;
+    CHECK_EQUAL(Builder::ERR_INVALID, handles.build(options));
+
+    std::shared_ptr<ReplicationLog> big_log(new ReplicationLog);
+    CHECK_EQUAL(0, big_log->create(log_name() + "_big", 1 << 12));
+    options.replicator.reset(new Replicator(big_log));
+    CHECK_EQUAL(0, handles.build(options));
+
+    // A replicator can't be attached twice.
+    CHECK_EQUAL(Builder::ERR_INVALID, handles.build(options));
+
+    std::shared_ptr<ReplicationLog> standby_log(new ReplicationLog);
+    CHECK_EQUAL(0, standby_log->open(log_name() + "_big"));
+    Builder builder;
+    Channel<int32_t> value;
+    CHECK_EQUAL(0, builder.channel("a.value", 0, value));
+    std::shared_ptr<River> other;
+    CHECK_EQUAL(0, builder.build(Builder::Options(), &other));
+    Mirror mirror(other, standby_log);
+    CHECK_EQUAL(Mirror::ERR_LAYOUT, mirror.apply());
+
+    ReplicationLog missing;
+    CHECK_EQUAL(ReplicationLog::ERR_SHM, missing.open(log_name() + "_none"));
+}
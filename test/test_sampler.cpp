@@ -0,0 +1,101 @@
+#include <sstream>
+#include <thread>
+
+#include <river>
+
+#include "CppUTest/TestHarness.h"
+
+using namespace river;
+
+TEST_GROUP(sampler) {};
+
+/**
+ * Samples accesses from two threads and lays out a new river from the
+ * profile.
+ */
+TEST(sampler, profile_layout)
+{
+    Builder builder;
+    Channel<uint8_t> a, b, c, d;
+    CHECK_EQUAL(0, builder.channel("foo.a", uint8_t(1), a));
+    CHECK_EQUAL(0, builder.channel("foo.b", uint8_t(2), b));
+    CHECK_EQUAL(0, builder.channel("foo.c", uint8_t(3), c));
+    CHECK_EQUAL(0, builder.channel("foo.d", uint8_t(4), d));
+
+    Builder::Options options;
+    options.sampler.reset(new Sampler(/* max_threads= */ 2, /* period= */ 2));
+    CHECK_EQUAL(0, builder.build(options, nullptr));
+
+    // The first thread accesses `c` and `a`, and the second accesses `d`.
+    // Every second access of each thread is sampled.
+    std::thread([&]() {
+        for (size_t i = 0; i < 4; ++i) {
+            c.set(c.get());
+        }
+        a.get();
+        a.get();
+    }).join();
+    std::thread([&]() {
+        d.get();
+        d.get();
+    }).join();
+
+    // A third thread has no slot.
+    std::thread([&]() { b.get(); }).join();
+    CHECK_EQUAL(1, options.sampler->dropped());
+
+    std::stringstream profile;
+    options.sampler->export_profile(profile);
+    CHECK_EQUAL(std::string("foo.a 0 1 0\n"
+                            "foo.c 0 0 4\n"
+                            "foo.d 1 1 0\n"),
+                profile.str());
+
+    // Lay out the channels of each thread together, hottest first, with
+    // unsampled channels last.
+    Builder profiled_builder;
+    Channel<uint8_t> new_a, new_b, new_c, new_d;
+    Rivulet foo;
+    CHECK_EQUAL(0, profiled_builder.channel("foo.a", uint8_t(1), new_a));
+    CHECK_EQUAL(0, profiled_builder.channel("foo.b", uint8_t(2), new_b));
+    CHECK_EQUAL(0, profiled_builder.channel("foo.c", uint8_t(3), new_c));
+    CHECK_EQUAL(0, profiled_builder.channel("foo.d", uint8_t(4), new_d));
+    CHECK_EQUAL(0, profiled_builder.rivulet("foo", foo));
+    CHECK_EQUAL(0, profiled_builder.load_profile(profile));
+
+    Builder::Options profiled_options;
+    profiled_options.optimize_layout = true;
+    CHECK_EQUAL(0, profiled_builder.build(profiled_options, nullptr));
+
+    uint8_t data[4];
+    foo.read(data);
+    CHECK_EQUAL(3, data[0]);
+    CHECK_EQUAL(1, data[1]);
+    CHECK_EQUAL(4, data[2]);
+    CHECK_EQUAL(2, data[3]);
+}
+
+/**
+ * Loading a malformed profile fails.
+ */
+TEST(sampler, load_invalid)
+{
+    Builder builder;
+    Channel<int32_t> foo;
+    CHECK_EQUAL(0, builder.channel("foo.bar", 0, foo));
+
+    std::stringstream missing_count("foo.bar 0 1\n");
+    CHECK_EQUAL(Builder::ERR_INVALID, builder.load_profile(missing_count));
+
+    std::stringstream bad_count("foo.bar 0 x 1\n");
+    CHECK_EQUAL(Builder::ERR_INVALID, builder.load_profile(bad_count));
+
+    std::stringstream extra("foo.bar 0 1 1 1\n");
+    CHECK_EQUAL(Builder::ERR_INVALID, builder.load_profile(extra));
+
+    std::stringstream bad_path("baz 0 1 1\n");
+    CHECK_EQUAL(Builder::ERR_NOTFOUND, builder.load_profile(bad_path));
+
+    std::stringstream good("# comment\n\nfoo.bar 0 1 1 # x\nfoo 1 0 0\n");
+    CHECK_EQUAL(0, builder.load_profile(good));
+}
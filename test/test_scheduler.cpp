@@ -0,0 +1,189 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <river>
+
+#include "CppUTest/TestHarness.h"
+
+using namespace river;
+
+TEST_GROUP(scheduler) {};
+
+/**
+ * Runs a chain of dependent tasks alongside independent ones and checks that
+ * the chain runs in order.
+ */
+static void run_pipeline(const size_t thread_count)
+{
+    static constexpr size_t stage_count = 20;
+    static constexpr size_t independent_count = 50;
+    static constexpr size_t frame_count = 10;
+
+    Builder builder;
+    std::vector<Channel<uint64_t>> stages(stage_count);
+    std::vector<Channel<uint64_t>> independents(independent_count);
+    for (size_t i = 0; i < stage_count; ++i) {
+        CHECK_EQUAL(0,
+                    builder.channel("stages.s" + std::to_string(i),
+                                    uint64_t(0),
+                                    stages[i]));
+    }
+    for (size_t i = 0; i < independent_count; ++i) {
+        CHECK_EQUAL(0,
+                    builder.channel("independents.i" + std::to_string(i),
+                                    uint64_t(0),
+                                    independents[i]));
+    }
+
+    Rivulet independents_rivulet;
+    CHECK_EQUAL(0, builder.rivulet("independents", independents_rivulet));
+    CHECK_EQUAL(0, builder.build());
+
+    Scheduler scheduler(thread_count);
+
+    // Each stage reads the previous stage and writes its own channel, so
+    // stages must run in order for the last stage to see the first stage's
+    // value propagated through the whole chain.
+    for (size_t i = 0; i < stage_count; ++i) {
+        Task task([&stages, i]() {
+            const uint64_t prev = ((i == 0) ? 0 : stages[i - 1].get());
+            stages[i].set(prev + 1);
+        });
+        task.writes(stages[i]);
+        if (i > 0) {
+            task.reads(stages[i - 1]);
+        }
+        CHECK_EQUAL(0, scheduler.add(task));
+    }
+
+    // Independent tasks each increment their own channel.
+    for (size_t i = 0; i < independent_count; ++i) {
+        Task task([&independents, i]() {
+            independents[i].set(independents[i].get() + 1);
+        });
+        task.writes(independents[i]);
+        CHECK_EQUAL(0, scheduler.add(task));
+    }
+
+    // A final task reads the entire independents rivulet, so it runs after
+    // all of the independent tasks.
+    uint64_t sum = 0;
+    Task sum_task([&]() {
+        std::vector<uint64_t> data(independent_count);
+        independents_rivulet.read(data.data());
+        sum = 0;
+        for (const uint64_t val : data) {
+            sum += val;
+        }
+    });
+    sum_task.reads(independents_rivulet);
+    CHECK_EQUAL(0, scheduler.add(sum_task));
+
+    for (size_t frame = 1; frame <= frame_count; ++frame) {
+        scheduler.run();
+        CHECK_EQUAL(stage_count, stages[stage_count - 1].get());
+        CHECK_EQUAL(frame * independent_count, sum);
+    }
+}
+
+/**
+ * Runs tasks serially.
+ */
+TEST(scheduler, serial)
+{
+    run_pipeline(0);
+}
+
+/**
+ * Runs tasks on a thread pool.
+ */
+TEST(scheduler, parallel)
+{
+    run_pipeline(4);
+}
+
+/**
+ * Adding a task without a function fails.
+ */
+TEST(scheduler, invalid)
+{
+    Scheduler scheduler(1);
+    CHECK_EQUAL(Scheduler::ERR_INVALID, scheduler.add(Task(nullptr)));
+    scheduler.run();
+}
+
+#ifdef RIVER_RACE_DETECTOR
+
+/**
+ * Waits for a flag to be set, giving up after a while so that a scheduling
+ * bug fails the test instead of hanging it.
+ *
+ * @param flag Flag to wait for.
+ */
+static void wait_for(const std::atomic<bool>& flag)
+{
+    const auto deadline =
+        (std::chrono::steady_clock::now() + std::chrono::seconds(10));
+    while (!flag.load(std::memory_order_acquire)
+           && (std::chrono::steady_clock::now() < deadline)) {
+        std::this_thread::yield();
+    }
+}
+
+/**
+ * Starting a dependent task only hands off the memory it declared, so
+ * unsynchronized writes by independent tasks running concurrently are still
+ * reported.
+ */
+TEST(scheduler, hand_off)
+{
+    Builder builder;
+    Channel<int32_t> a, b, shared;
+    CHECK_EQUAL(0, builder.channel("a", 0, a));
+    CHECK_EQUAL(0, builder.channel("b", 0, b));
+    CHECK_EQUAL(0, builder.channel("shared", 0, shared));
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(&river));
+
+    std::vector<Race> races;
+    river->on_race([&races](const Race& race) { races.push_back(race); });
+
+    // The first two tasks are independent, so they run on different workers,
+    // and both write `shared` without declaring it. The second one only writes
+    // it once the third task, which depends on the first, has started.
+    std::atomic<bool> second_started {false};
+    std::atomic<bool> third_started {false};
+    Scheduler scheduler(3);
+    Task first([&]() {
+        wait_for(second_started);
+        a.set(1);
+        shared.set(1);
+    });
+    first.writes(a);
+    Task second([&]() {
+        second_started.store(true, std::memory_order_release);
+        b.set(1);
+        wait_for(third_started);
+        shared.set(2);
+    });
+    second.writes(b);
+    Task third([&]() {
+        third_started.store(true, std::memory_order_release);
+        a.set(2);
+    });
+    third.writes(a);
+    CHECK_EQUAL(0, scheduler.add(first));
+    CHECK_EQUAL(0, scheduler.add(second));
+    CHECK_EQUAL(0, scheduler.add(third));
+    scheduler.run();
+
+    // Only the race on `shared` is reported, and not the declared hand-off of
+    // `a` from the first task to the third.
+    CHECK_TRUE(third_started.load());
+    CHECK_EQUAL(1, races.size());
+    CHECK_TRUE(races[0].kind == Race::Kind::UNSYNCHRONIZED_WRITES);
+    CHECK_EQUAL(std::string("shared"), races[0].path);
+}
+
+#endif
@@ -0,0 +1,249 @@
+#include <array>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+#include <river>
+
+#include "CppUTest/TestHarness.h"
+#include "noop_lock.hpp"
+
+using namespace river;
+
+TEST_GROUP(schema) {};
+
+/**
+ * Loads channels of every kind and a lock from a schema.
+ */
+TEST(schema, load)
+{
+    Builder builder;
+    std::stringstream schema("# type   path                   values\n"
+                             "uint64   system.time\n"
+                             "double   control.pressure       14.7\n"
+                             "bool     control.pressure.valid true\n"
+                             "int16[3] control.gains          1 -2 3\n"
+                             "float[2] control.limits         0.5\n"
+                             "flags[100] control.faults\n"
+                             "\n"
+                             "lock     control multi_writer\n");
+    std::vector<NoopLock*> locks;
+    const auto make_lock = [&](const LockKind) {
+        locks.push_back(new NoopLock);
+        return std::shared_ptr<Lock>(locks.back());
+    };
+    CHECK_EQUAL(0, builder.load_schema(schema, make_lock));
+    CHECK_EQUAL(1, locks.size());
+
+    Channel<uint64_t> time;
+    Channel<double> pressure;
+    Channel<bool> valid;
+    Channel<std::array<int16_t, 3>> gains;
+    Channel<float> gain;
+    Channel<std::array<float, 2>> limits;
+    Flags faults;
+    CHECK_EQUAL(0, builder.channel("system.time", time));
+    CHECK_EQUAL(0, builder.channel("control.pressure", pressure));
+    CHECK_EQUAL(0, builder.channel("control.pressure.valid", valid));
+    CHECK_EQUAL(0, builder.channel("control.gains", gains));
+    CHECK_EQUAL(0, builder.channel("control.limits", limits));
+    CHECK_EQUAL(0, builder.flags("control.faults", faults));
+
+    // Handles must match the declared type.
+    CHECK_EQUAL(Builder::ERR_INVALID, builder.channel("system.time", pressure));
+    CHECK_EQUAL(Builder::ERR_INVALID, builder.channel("control.limits", gain));
+    CHECK_EQUAL(Builder::ERR_INVALID, builder.flags("system.time", faults));
+    CHECK_EQUAL(Builder::ERR_NOTFOUND, builder.channel("control", pressure));
+    CHECK_EQUAL(Builder::ERR_NOTFOUND, builder.channel("foo", pressure));
+
+    CHECK_EQUAL(0, builder.build());
+    CHECK_EQUAL(0, time.get());
+    CHECK_EQUAL(14.7, pressure.get());
+    CHECK_TRUE(valid.get());
+    CHECK_EQUAL(1, gains.get()[0]);
+    CHECK_EQUAL(-2, gains.get()[1]);
+    CHECK_EQUAL(3, gains.get()[2]);
+    CHECK_EQUAL(0.5f, limits.get()[0]);
+    CHECK_EQUAL(0.5f, limits.get()[1]);
+    CHECK_EQUAL(100, faults.size());
+    CHECK_FALSE(faults.any());
+
+    // Only the control rivulet is locked.
+    const uint64_t acquire_count = locks[0]->acquire_count;
+    pressure.set(15.0);
+    CHECK_EQUAL(acquire_count + 1, locks[0]->acquire_count);
+    time.set(1);
+    CHECK_EQUAL(acquire_count + 1, locks[0]->acquire_count);
+}
+
+/**
+ * Handles looked up after building are linked to the built river, and stay
+ * linked to it when the builder builds another river.
+ */
+TEST(schema, lookup_after_build)
+{
+    Builder builder;
+    std::stringstream schema("double    control.pressure 1.5\n"
+                             "flags[10] control.faults\n"
+                             "lock      control multi_writer\n");
+    std::vector<NoopLock*> locks;
+    const auto make_lock = [&](const LockKind) {
+        locks.push_back(new NoopLock);
+        return std::shared_ptr<Lock>(locks.back());
+    };
+    CHECK_EQUAL(0, builder.load_schema(schema, make_lock));
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(Builder::Options(), &river));
+
+    Channel<double> pressure;
+    Flags faults;
+    CHECK_EQUAL(0, builder.channel("control.pressure", pressure));
+    CHECK_EQUAL(0, builder.flags("control.faults", faults));
+    CHECK_TRUE(pressure.linked());
+    CHECK_EQUAL(1.5, pressure.get());
+    CHECK_EQUAL(10, faults.size());
+
+    // Accesses take the rivulet lock.
+    const uint64_t acquire_count = locks[0]->acquire_count;
+    pressure.set(2.5);
+    faults.set(3);
+    CHECK_EQUAL(acquire_count + 2, locks[0]->acquire_count);
+    CHECK_EQUAL(2.5, pressure.get());
+    CHECK_TRUE(faults.test(3));
+
+    std::shared_ptr<River> other;
+    CHECK_EQUAL(0, builder.build(Builder::Options(), &other));
+    Channel<double> other_pressure;
+    CHECK_EQUAL(0, builder.channel("control.pressure", other_pressure));
+    CHECK_EQUAL(1.5, other_pressure.get());
+    CHECK_EQUAL(2.5, pressure.get());
+}
+
+/**
+ * Loading a malformed schema fails.
+ */
+TEST(schema, load_invalid)
+{
+    Builder builder;
+    const auto make_lock = [](const LockKind) {
+        return std::shared_ptr<Lock>(new NoopLock);
+    };
+
+    const char* const invalid[] = {
+        "int32\n",
+        "int24 foo\n",
+        "int32 foo..bar\n",
+        "int32 foo x\n",
+        "int32 foo 1 2\n",
+        "uint8 foo 256\n",
+        "bool foo 2\n",
+        "int32[] foo\n",
+        "int32[0] foo\n",
+        "int32[2 foo\n",
+        "int32[3] foo 1 2\n",
+        "flags foo\n",
+        "flags[8] foo 1\n",
+        "lock foo\n",
+        "lock foo spin\n",
+    };
+    for (const char* const text : invalid) {
+        std::stringstream schema(text);
+        CHECK_EQUAL(Builder::ERR_INVALID,
+                    builder.load_schema(schema, make_lock));
+    }
+
+    std::stringstream missing_lock("lock baz multi_writer\n");
+    CHECK_EQUAL(Builder::ERR_NOTFOUND,
+                builder.load_schema(missing_lock, make_lock));
+
+    // Lines before an error are kept.
+    std::stringstream partial("int32 foo # x\nint32 foo\n");
+    CHECK_EQUAL(Builder::ERR_DUPE, builder.load_schema(partial, make_lock));
+    Channel<int32_t> foo;
+    CHECK_EQUAL(0, builder.channel("foo", foo));
+
+    // Locks need a lock factory, unless the path needs no lock.
+    std::stringstream no_factory("lock foo multi_writer\n");
+    CHECK_EQUAL(Builder::ERR_INVALID, builder.load_schema(no_factory));
+    std::stringstream no_lock("lock foo none\n");
+    CHECK_EQUAL(0, builder.load_schema(no_lock));
+}
+
+/**
+ * Rivers built from the same schema have the same layout, which can be
+ * accessed directly.
+ */
+TEST(schema, layout)
+{
+    const char* const text = "uint64 system.time 7\n"
+                             "double control.pressure 14.7\n"
+                             "int16[2] control.gains 1 2\n"
+                             "flags[8] control.faults\n";
+    std::shared_ptr<River> rivers[2];
+    Channel<uint64_t> time;
+    for (std::shared_ptr<River>& river : rivers) {
+        Builder builder;
+        std::stringstream schema(text);
+        CHECK_EQUAL(0, builder.load_schema(schema));
+        CHECK_EQUAL(0, builder.channel("system.time", time));
+        CHECK_EQUAL(0, builder.build(Builder::Options(), &river));
+    }
+
+    std::stringstream layout;
+    rivers[0]->export_layout(layout);
+    CHECK_EQUAL(std::string("system.time 0 8 uint64\n"
+                            "control.pressure 8 8 double\n"
+                            "control.gains 16 4 int16\n"
+                            "control.faults 24 8 bytes\n"),
+                layout.str());
+    CHECK_EQUAL(rivers[0]->layout_hash(), rivers[1]->layout_hash());
+
+    // Direct memory is the river memory.
+    uint8_t* const memory = rivers[1]->direct_memory();
+    CHECK_TRUE(memory != nullptr);
+    uint64_t value = 0;
+    std::memcpy(&value, memory, sizeof(value));
+    CHECK_EQUAL(7, value);
+    time.set(8);
+    std::memcpy(&value, memory, sizeof(value));
+    CHECK_EQUAL(8, value);
+
+    // A different layout has a different hash, including one that only
+    // differs in element types.
+    Builder builder;
+    std::stringstream schema("uint32 system.time\n");
+    CHECK_EQUAL(0, builder.load_schema(schema));
+    std::shared_ptr<River> other;
+    CHECK_EQUAL(0, builder.build(Builder::Options(), &other));
+    CHECK_TRUE(rivers[0]->layout_hash() != other->layout_hash());
+    Builder types_builder;
+    std::stringstream types_schema("int64 system.time 7\n"
+                                   "uint64 control.pressure\n"
+                                   "uint16[2] control.gains 1 2\n"
+                                   "flags[8] control.faults\n");
+    CHECK_EQUAL(0, types_builder.load_schema(types_schema));
+    std::shared_ptr<River> types_river;
+    CHECK_EQUAL(0, types_builder.build(Builder::Options(), &types_river));
+    CHECK_TRUE(rivers[0]->layout_hash() != types_river->layout_hash());
+
+    // Frame mode rivers can't be accessed directly.
+    std::stringstream frames_schema(text);
+    Builder frames_builder;
+    CHECK_EQUAL(0, frames_builder.load_schema(frames_schema));
+    Builder::Options options;
+    options.frames = true;
+    std::shared_ptr<River> frames_river;
+    CHECK_EQUAL(0, frames_builder.build(options, &frames_river));
+    CHECK_TRUE(frames_river->direct_memory() == nullptr);
+
+    // Neither can rivers that keep versions, since direct writes wouldn't
+    // bump them.
+    std::stringstream versions_schema(text);
+    Builder versions_builder;
+    CHECK_EQUAL(0, versions_builder.load_schema(versions_schema));
+    Builder::Options versions_options;
+    versions_options.versions = true;
+    std::shared_ptr<River> versions_river;
+    CHECK_EQUAL(0, versions_builder.build(versions_options, &versions_river));
+    CHECK_TRUE(versions_river->direct_memory() == nullptr);
+}
@@ -0,0 +1,375 @@
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <river>
+
+#include "CppUTest/TestHarness.h"
+
+using namespace river;
+
+namespace {
+/**
+ * Mutex lock, since the server thread accesses the river concurrently.
+ */
+class MutexLock final : public Lock {
+public:
+    void acquire() noexcept override
+    {
+        mutex.lock();
+    }
+
+    void release() noexcept override
+    {
+        mutex.unlock();
+    }
+
+private:
+    std::mutex mutex;
+};
+
+/**
+ * Message received from the server.
+ */
+struct Message final {
+    Server::Op op;
+    uint32_t id;
+    uint16_t count;
+    std::vector<uint8_t> entries;
+    size_t pos;
+
+    template <typename T>
+    T get()
+    {
+        T value;
+        std::memcpy(&value, entries.data() + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+};
+
+/**
+ * Blocking client of a server.
+ */
+class Client final {
+public:
+    explicit Client(const std::string& path)
+        : fd(socket(AF_UNIX, SOCK_STREAM, 0))
+        , request()
+        , count(0)
+    {
+        sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, path.data(), path.size());
+        connected = (connect(fd,
+                             reinterpret_cast<const sockaddr*>(&address),
+                             sizeof(address))
+                     == 0);
+    }
+
+    ~Client()
+    {
+        close(fd);
+    }
+
+    bool connected;
+
+    void begin(const Server::Op op, const uint32_t id)
+    {
+        request.clear();
+        count = 0;
+        put(static_cast<uint8_t>(op));
+        put(id);
+        put(uint16_t(0));
+    }
+
+    void path(const std::string& path)
+    {
+        put(static_cast<uint16_t>(path.size()));
+        request.insert(request.end(), path.begin(), path.end());
+        ++count;
+    }
+
+    template <typename T>
+    void value(const T& value)
+    {
+        put(static_cast<uint32_t>(sizeof(value)));
+        put(value);
+    }
+
+    void send()
+    {
+        std::memcpy(request.data() + 5, &count, sizeof(count));
+        const uint32_t length = static_cast<uint32_t>(request.size());
+        write_all(&length, sizeof(length));
+        write_all(request.data(), request.size());
+    }
+
+    Message receive()
+    {
+        uint32_t length = 0;
+        read_all(&length, sizeof(length));
+        std::vector<uint8_t> body(length);
+        read_all(body.data(), length);
+
+        Message message {};
+        message.op = static_cast<Server::Op>(body[0]);
+        std::memcpy(&message.id, &body[1], sizeof(message.id));
+        std::memcpy(&message.count, &body[5], sizeof(message.count));
+        message.entries.assign(body.begin() + 7, body.end());
+        return message;
+    }
+
+private:
+    const int fd;
+    std::vector<uint8_t> request;
+    uint16_t count;
+
+    template <typename T>
+    void put(const T& value)
+    {
+        const uint8_t* const bytes = reinterpret_cast<const uint8_t*>(&value);
+        request.insert(request.end(), bytes, bytes + sizeof(value));
+    }
+
+    void write_all(const void* const data, const size_t size)
+    {
+        CHECK_EQUAL(ssize_t(size), ::write(fd, data, size));
+    }
+
+    void read_all(void* const data, const size_t size)
+    {
+        size_t received = 0;
+        while (received < size) {
+            const ssize_t ret = ::read(fd,
+                                       static_cast<uint8_t*>(data) + received,
+                                       size - received);
+            CHECK_TRUE(ret > 0);
+            received += static_cast<size_t>(ret);
+        }
+    }
+};
+
+/**
+ * Gets a socket path unique to this process.
+ */
+std::string socket_path()
+{
+    return ("/tmp/river_test_" + std::to_string(getpid()) + ".sock");
+}
+} /* namespace */
+
+TEST_GROUP(server) {};
+
+/**
+ * Clients read and write channels and rivulets by path.
+ */
+TEST(server, read_write)
+{
+    Builder builder;
+    Channel<int32_t> a;
+    Channel<double> b;
+    CHECK_EQUAL(0, builder.channel("foo.a", 1, a));
+    CHECK_EQUAL(0, builder.channel("foo.b", 2.5, b));
+    CHECK_EQUAL(0, builder.lock("foo", std::make_shared<MutexLock>()));
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(Builder::Options(), &river));
+
+    Server server(river, Server::Options());
+    const std::string path = socket_path();
+    CHECK_EQUAL(0, server.start(path));
+    CHECK_EQUAL(Server::ERR_INVALID, server.start(path));
+    Client client(path);
+    CHECK_TRUE(client.connected);
+
+    client.begin(Server::Op::READ, 1);
+    client.path("foo.a");
+    client.path("foo");
+    client.path("bar");
+    client.send();
+    Message read = client.receive();
+    CHECK_TRUE(read.op == Server::Op::READ);
+    CHECK_EQUAL(1, read.id);
+    CHECK_EQUAL(3, read.count);
+    CHECK_EQUAL(uint8_t(Server::Status::OK), read.get<uint8_t>());
+    CHECK_EQUAL(sizeof(int32_t), read.get<uint32_t>());
+    CHECK_EQUAL(1, read.get<int32_t>());
+    CHECK_EQUAL(uint8_t(Server::Status::OK), read.get<uint8_t>());
+    CHECK_EQUAL(sizeof(int32_t) + sizeof(double), read.get<uint32_t>());
+    CHECK_EQUAL(1, read.get<int32_t>());
+    CHECK_EQUAL(2.5, read.get<double>());
+    CHECK_EQUAL(uint8_t(Server::Status::NOTFOUND), read.get<uint8_t>());
+    CHECK_EQUAL(0, read.get<uint32_t>());
+
+    client.begin(Server::Op::WRITE, 2);
+    client.path("foo.a");
+    client.value(int32_t(5));
+    client.path("foo.b");
+    client.value(int32_t(5));
+    client.send();
+    Message write = client.receive();
+    CHECK_TRUE(write.op == Server::Op::WRITE);
+    CHECK_EQUAL(2, write.count);
+    CHECK_EQUAL(uint8_t(Server::Status::OK), write.get<uint8_t>());
+    CHECK_EQUAL(uint8_t(Server::Status::SIZE), write.get<uint8_t>());
+    CHECK_EQUAL(5, a.get());
+    CHECK_EQUAL(2.5, b.get());
+
+    server.stop();
+    CHECK_TRUE(access(path.c_str(), F_OK) != 0);
+}
+
+/**
+ * Subscriptions get every value, then only changed values.
+ */
+TEST(server, subscribe)
+{
+    Builder builder;
+    Channel<int32_t> a;
+    Channel<double> b;
+    CHECK_EQUAL(0, builder.channel("foo.a", 1, a));
+    CHECK_EQUAL(0, builder.channel("foo.b", 2.5, b));
+    CHECK_EQUAL(0, builder.lock("foo", std::make_shared<MutexLock>()));
+    Builder::Options options;
+    options.versions = true;
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(options, &river));
+
+    Server::Options server_options;
+    server_options.period = std::chrono::milliseconds(1);
+    Server server(river, server_options);
+    const std::string path = socket_path();
+    CHECK_EQUAL(0, server.start(path));
+    Client client(path);
+    CHECK_TRUE(client.connected);
+
+    client.begin(Server::Op::SUBSCRIBE, 7);
+    client.path("foo.a");
+    client.path("bar");
+    client.path("foo.b");
+    client.send();
+    Message subscribe = client.receive();
+    CHECK_TRUE(subscribe.op == Server::Op::SUBSCRIBE);
+    CHECK_EQUAL(3, subscribe.count);
+    CHECK_EQUAL(uint8_t(Server::Status::OK), subscribe.get<uint8_t>());
+    CHECK_EQUAL(uint8_t(Server::Status::NOTFOUND), subscribe.get<uint8_t>());
+    CHECK_EQUAL(uint8_t(Server::Status::OK), subscribe.get<uint8_t>());
+
+    Message first = client.receive();
+    CHECK_TRUE(first.op == Server::Op::UPDATE);
+    CHECK_EQUAL(7, first.id);
+    CHECK_EQUAL(2, first.count);
+    CHECK_EQUAL(0, first.get<uint16_t>());
+    CHECK_EQUAL(sizeof(int32_t), first.get<uint32_t>());
+    CHECK_EQUAL(1, first.get<int32_t>());
+    CHECK_EQUAL(2, first.get<uint16_t>());
+    CHECK_EQUAL(sizeof(double), first.get<uint32_t>());
+    CHECK_EQUAL(2.5, first.get<double>());
+
+    // Only the changed channel is sent.
+    b.set(3.5);
+    Message update = client.receive();
+    CHECK_TRUE(update.op == Server::Op::UPDATE);
+    CHECK_EQUAL(1, update.count);
+    CHECK_EQUAL(2, update.get<uint16_t>());
+    CHECK_EQUAL(sizeof(double), update.get<uint32_t>());
+    CHECK_EQUAL(3.5, update.get<double>());
+
+    // Subscription IDs are unique per client.
+    client.begin(Server::Op::SUBSCRIBE, 7);
+    client.path("foo.a");
+    client.send();
+    Message dupe = client.receive();
+    CHECK_EQUAL(uint8_t(Server::Status::DUPE), dupe.get<uint8_t>());
+
+    // Nothing more is sent after unsubscribing.
+    client.begin(Server::Op::UNSUBSCRIBE, 7);
+    client.send();
+    Message unsubscribe = client.receive();
+    CHECK_TRUE(unsubscribe.op == Server::Op::UNSUBSCRIBE);
+    CHECK_EQUAL(0, unsubscribe.count);
+    a.set(2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    client.begin(Server::Op::READ, 8);
+    client.path("foo.a");
+    client.send();
+    Message read = client.receive();
+    CHECK_TRUE(read.op == Server::Op::READ);
+    CHECK_EQUAL(8, read.id);
+}
+
+/**
+ * Derived channels and rivulets holding them aren't served.
+ */
+TEST(server, derived)
+{
+    Builder builder;
+    Channel<int32_t> a;
+    Derived<int32_t> twice;
+    CHECK_EQUAL(0, builder.channel("foo.a", 1, a));
+    CHECK_EQUAL(0,
+                builder.derived(
+                    "bar.twice",
+                    [](const int32_t x) { return (2 * x); },
+                    twice,
+                    a));
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(Builder::Options(), &river));
+
+    Server server(river, Server::Options());
+    const std::string path = socket_path();
+    CHECK_EQUAL(0, server.start(path));
+    Client client(path);
+    CHECK_TRUE(client.connected);
+
+    client.begin(Server::Op::READ, 1);
+    client.path("foo.a");
+    client.path("bar.twice");
+    client.path("bar");
+    client.send();
+    Message read = client.receive();
+    CHECK_EQUAL(3, read.count);
+    CHECK_EQUAL(uint8_t(Server::Status::OK), read.get<uint8_t>());
+    CHECK_EQUAL(sizeof(int32_t), read.get<uint32_t>());
+    CHECK_EQUAL(1, read.get<int32_t>());
+    CHECK_EQUAL(uint8_t(Server::Status::NOTFOUND), read.get<uint8_t>());
+    CHECK_EQUAL(0, read.get<uint32_t>());
+    CHECK_EQUAL(uint8_t(Server::Status::NOTFOUND), read.get<uint8_t>());
+    CHECK_EQUAL(0, read.get<uint32_t>());
+
+    client.begin(Server::Op::WRITE, 2);
+    client.path("bar.twice");
+    client.value(int32_t(7));
+    client.send();
+    Message write = client.receive();
+    CHECK_EQUAL(1, write.count);
+    CHECK_EQUAL(uint8_t(Server::Status::NOTFOUND), write.get<uint8_t>());
+    CHECK_EQUAL(2, twice.get());
+
+    server.stop();
+}
+
+/**
+ * Rivers in frame mode can't be served.
+ */
+TEST(server, frames)
+{
+    Builder builder;
+    Channel<int32_t> a;
+    CHECK_EQUAL(0, builder.channel("a", 1, a));
+    Builder::Options options;
+    options.frames = true;
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(options, &river));
+
+    Server server(river, Server::Options());
+    CHECK_EQUAL(Server::ERR_INVALID, server.start(socket_path()));
+}
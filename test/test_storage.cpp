@@ -0,0 +1,164 @@
+#include <cstring>
+
+#include <river>
+
+#include "CppUTest/TestHarness.h"
+
+using namespace river;
+
+TEST_GROUP(storage) {};
+
+/**
+ * Storage is zeroed and writable however it's allocated.
+ */
+TEST(storage, allocate)
+{
+    const size_t size = (3 * Storage::HUGE_PAGE_SIZE) / 2;
+    Storage::Options options;
+    for (int i = 0; i < 4; ++i) {
+        options.huge_pages = ((i & 1) != 0);
+        options.prefault = ((i & 2) != 0);
+
+        Storage storage;
+        CHECK_EQUAL(0, storage.allocate(size, options));
+        CHECK_EQUAL(size, storage.size());
+        CHECK_FALSE(storage.locked());
+        CHECK_EQUAL(0, storage.data()[0]);
+        CHECK_EQUAL(0, storage.data()[size - 1]);
+        storage.data()[size - 1] = 1;
+        CHECK_EQUAL(1, storage.data()[size - 1]);
+
+        // Explicit huge pages are only used if some are reserved.
+        if (!options.huge_pages) {
+            CHECK_FALSE(storage.huge_pages());
+        }
+    }
+
+    // Locking may not be permitted, but must be reported either way.
+    Storage storage;
+    options.lock = true;
+    const int32_t lock_ret = storage.allocate(4096, options);
+    CHECK_TRUE((lock_ret == 0) || (lock_ret == Storage::ERR_NOLOCK));
+    CHECK_EQUAL((lock_ret == 0), storage.locked());
+
+    // Reallocating frees the previous memory.
+    CHECK_EQUAL(0, storage.allocate(0, Storage::Options()));
+    CHECK_EQUAL(0, storage.size());
+    CHECK_FALSE(storage.locked());
+}
+
+/**
+ * A river built on pre-faulted huge pages works like any other.
+ */
+TEST(storage, river)
+{
+    Builder builder;
+    Channel<uint64_t> foo;
+    CHECK_EQUAL(0, builder.channel("foo", uint64_t(1), foo));
+
+    Builder::Options options;
+    options.huge_pages = true;
+    options.prefault = true;
+    CHECK_EQUAL(0, builder.build(options, nullptr));
+
+    CHECK_EQUAL(1, foo.get());
+    foo.set(2);
+    CHECK_EQUAL(2, foo.get());
+}
+
+/**
+ * A river can be built into a buffer provided by the caller.
+ */
+TEST(storage, buffer)
+{
+    Builder builder;
+    Channel<uint8_t> foo;
+    Flags bar;
+    CHECK_EQUAL(0, builder.channel("foo", uint8_t(1), foo));
+    CHECK_EQUAL(0, builder.flags("bar", 64, bar));
+
+    // The flags are aligned after the channel.
+    Builder::Options options;
+    CHECK_EQUAL(16, builder.required_size(options));
+
+    alignas(Storage::ALIGNMENT) static uint8_t buffer[17];
+
+    // Misaligned and undersized buffers are rejected, and leave handles
+    // unlinked until the river is built successfully.
+    options.buffer = (buffer + 1);
+    options.buffer_size = 16;
+    CHECK_EQUAL(Builder::ERR_INVALID, builder.build(options, nullptr));
+    CHECK_FALSE(foo.linked());
+    options.buffer = buffer;
+    options.buffer_size = 15;
+    CHECK_EQUAL(Builder::ERR_NOMEM, builder.build(options, nullptr));
+    CHECK_FALSE(foo.linked());
+
+    // The river lives in the buffer.
+    options.buffer_size = sizeof(buffer);
+    CHECK_EQUAL(0, builder.build(options, nullptr));
+    CHECK_TRUE(foo.linked());
+    CHECK_EQUAL(1, buffer[0]);
+    foo.set(2);
+    bar.set(0);
+    CHECK_EQUAL(2, buffer[0]);
+    CHECK_EQUAL(1, buffer[8]);
+
+    // A failed rebuild leaves handles looked up later linked to the river.
+    options.buffer_size = 1;
+    CHECK_EQUAL(Builder::ERR_NOMEM, builder.build(options, nullptr));
+    Channel<uint8_t> lookup;
+    CHECK_EQUAL(0, builder.channel("foo", lookup));
+    CHECK_TRUE(lookup.linked());
+    CHECK_EQUAL(2, lookup.get());
+    lookup.set(3);
+    CHECK_EQUAL(3, buffer[0]);
+}
+
+/**
+ * The back buffer, checksums, and replicas are placed in the buffer after the
+ * river storage.
+ */
+TEST(storage, buffer_parts)
+{
+    Builder builder;
+    Channel<uint64_t> foo;
+    Channel<uint64_t> bar;
+    CHECK_EQUAL(0, builder.channel("foo", uint64_t(1), foo));
+    CHECK_EQUAL(0, builder.channel("baz.bar", uint64_t(2), bar));
+    CHECK_EQUAL(0, builder.redundant("baz"));
+
+    // The storage is followed by the back buffer, the checksums, and the two
+    // replicas of the redundant channel.
+    Builder::Options options;
+    options.frames = true;
+    options.checksums = true;
+    const size_t replicas_offset = (32 + Checksums::memory_size(16));
+    const size_t size = (replicas_offset + 16);
+    CHECK_EQUAL(size, builder.required_size(options));
+
+    alignas(Storage::ALIGNMENT) static uint8_t buffer[256];
+    options.buffer = buffer;
+    options.buffer_size = (size - 1);
+    CHECK_EQUAL(Builder::ERR_NOMEM, builder.build(options, nullptr));
+    options.buffer_size = size;
+    std::shared_ptr<River> river;
+    CHECK_EQUAL(0, builder.build(options, &river));
+
+    // Frame writes go to the back buffer, and commits copy them to the
+    // storage and the replicas.
+    uint64_t value = 0;
+    bar.set(3);
+    std::memcpy(&value, buffer + 24, sizeof(value));
+    CHECK_EQUAL(3, value);
+    std::memcpy(&value, buffer + 8, sizeof(value));
+    CHECK_EQUAL(2, value);
+    river->commit_frame();
+    for (const size_t offset :
+         {size_t(8), replicas_offset, (replicas_offset + 8)}) {
+        std::memcpy(&value, buffer + offset, sizeof(value));
+        CHECK_EQUAL(3, value);
+    }
+    CHECK_EQUAL(3, bar.get());
+    CHECK_EQUAL(0, river->verify([](const Corruption&) {}));
+}
@@ -0,0 +1,100 @@
+#include <sstream>
+#include <thread>
+
+#include <river>
+
+#include "CppUTest/TestHarness.h"
+#include "noop_lock.hpp"
+
+using namespace river;
+
+TEST_GROUP(tracer) {};
+
+/**
+ * Counts the occurrences of a substring.
+ *
+ * @param str    String to search.
+ * @param substr Substring to count.
+ *
+ * @returns Number of occurrences.
+ */
+static size_t count(const std::string& str, const std::string& substr)
+{
+    size_t occurrences = 0;
+    for (size_t pos = str.find(substr); pos != std::string::npos;
+         pos = str.find(substr, pos + 1)) {
+        ++occurrences;
+    }
+    return occurrences;
+}
+
+/**
+ * Lock and access events are exported as Chrome trace events.
+ */
+TEST(tracer, export_chrome)
+{
+    Builder builder;
+    Channel<uint64_t> time;
+    Channel<double> pressure;
+    Rivulet control;
+    CHECK_EQUAL(0, builder.channel("system.time", uint64_t(0), time));
+    CHECK_EQUAL(0, builder.channel("control.pressure", 14.7, pressure));
+    CHECK_EQUAL(0, builder.rivulet("control", control));
+    CHECK_EQUAL(0,
+                builder.lock("control", std::shared_ptr<Lock>(new NoopLock)));
+
+    Builder::Options options;
+    options.tracer.reset(new Tracer(4, 64));
+    CHECK_EQUAL(0, builder.build(options, nullptr));
+
+    time.set(1);
+    pressure.get();
+    double data = 0.0;
+    control.write(&data);
+
+    std::stringstream trace;
+    options.tracer->export_chrome(trace);
+    const std::string json = trace.str();
+    CHECK_EQUAL(0, json.find("{\"displayTimeUnit\":\"ns\",\"traceEvents\":["));
+    CHECK_EQUAL(1, count(json, "\"name\":\"thread_name\""));
+    CHECK_EQUAL(1, count(json, "\"name\":\"write system.time\""));
+    CHECK_EQUAL(1, count(json, "\"name\":\"read control.pressure\""));
+    CHECK_EQUAL(1, count(json, "\"name\":\"write control\""));
+
+    // Locks are named after the locked rivulet, whichever handle took them.
+    CHECK_EQUAL(2, count(json, "\"name\":\"wait control\""));
+    CHECK_EQUAL(2, count(json, "\"name\":\"hold control\""));
+    CHECK_EQUAL(0, options.tracer->dropped());
+}
+
+/**
+ * Only the most recent events are kept, and spans cut off by the ring buffer
+ * are left out.
+ */
+TEST(tracer, ring)
+{
+    Builder builder;
+    Channel<int32_t> foo;
+    CHECK_EQUAL(0, builder.channel("foo", 0, foo));
+    CHECK_EQUAL(0, builder.lock("foo", std::shared_ptr<Lock>(new NoopLock)));
+
+    // Each locked write records 5 events, so the oldest retained event is the
+    // middle of a write.
+    Builder::Options options;
+    options.tracer.reset(new Tracer(1, 12));
+    CHECK_EQUAL(0, builder.build(options, nullptr));
+    for (int32_t i = 0; i < 10; ++i) {
+        foo.set(i);
+    }
+
+    std::stringstream trace;
+    options.tracer->export_chrome(trace);
+    const std::string json = trace.str();
+    CHECK_EQUAL(2, count(json, "\"name\":\"write foo\""));
+    CHECK_EQUAL(2, count(json, "\"name\":\"hold foo\""));
+    CHECK_EQUAL(2, count(json, "\"name\":\"wait foo\""));
+
+    // Threads beyond the ring count are dropped.
+    std::thread([&]() { foo.set(0); }).join();
+    CHECK_EQUAL(5, options.tracer->dropped());
+}
@@ -0,0 +1,96 @@
+#include <vector>
+
+#include <river>
+
+#include "CppUTest/TestHarness.h"
+#include "noop_lock.hpp"
+
+using namespace river;
+
+TEST_GROUP(watchpoints) {};
+
+/**
+ * Callbacks are called when comparison results change, and each lock is
+ * acquired once per evaluation.
+ */
+TEST(watchpoints, evaluate)
+{
+    Builder builder;
+    Channel<int32_t> speed;
+    Channel<double> pressure;
+    Channel<bool> valid;
+    Channel<uint8_t> mode;
+    CHECK_EQUAL(0, builder.channel("engine.speed", 0, speed));
+    CHECK_EQUAL(0, builder.channel("engine.pressure", 1.0, pressure));
+    CHECK_EQUAL(0, builder.channel("engine.valid", true, valid));
+    CHECK_EQUAL(0, builder.channel("system.mode", uint8_t(0), mode));
+    NoopLock* const lock = new NoopLock;
+    CHECK_EQUAL(0, builder.lock("engine", std::shared_ptr<Lock>(lock)));
+    CHECK_EQUAL(0, builder.build());
+
+    using Comparison = Watchpoints::Comparison;
+    std::vector<int> events;
+    const auto record = [&events](const int id) {
+        return [&events, id](const bool active) {
+            events.push_back(active ? id : -id);
+        };
+    };
+    Watchpoints watchpoints;
+    CHECK_EQUAL(0,
+                watchpoints.add(speed, Comparison::GREATER, 100, record(1)));
+    CHECK_EQUAL(
+        0, watchpoints.add(speed, Comparison::LESS_EQUAL, -5, record(2)));
+    CHECK_EQUAL(0,
+                watchpoints.add(pressure, Comparison::LESS, 0.5, record(3)));
+    CHECK_EQUAL(0,
+                watchpoints.add(valid, Comparison::EQUAL, false, record(4)));
+    CHECK_EQUAL(
+        0, watchpoints.add(mode, Comparison::NOT_EQUAL, uint8_t(0), record(5)));
+    CHECK_EQUAL(5, watchpoints.size());
+
+    // Nothing holds yet.
+    const uint64_t acquire_count = lock->acquire_count;
+    CHECK_EQUAL(0, watchpoints.evaluate());
+    CHECK_EQUAL(acquire_count + 1, lock->acquire_count);
+
+    speed.set(101);
+    pressure.set(0.25);
+    mode.set(2);
+    CHECK_EQUAL(3, watchpoints.evaluate());
+    CHECK_EQUAL(3, events.size());
+    CHECK_EQUAL(1, events[0]);
+    CHECK_EQUAL(3, events[1]);
+    CHECK_EQUAL(5, events[2]);
+
+    // Only edges are reported.
+    speed.set(150);
+    CHECK_EQUAL(0, watchpoints.evaluate());
+
+    events.clear();
+    speed.set(-5);
+    valid.set(false);
+    mode.set(0);
+    const uint64_t last_acquire_count = lock->acquire_count;
+    CHECK_EQUAL(4, watchpoints.evaluate());
+    CHECK_EQUAL(last_acquire_count + 1, lock->acquire_count);
+    CHECK_EQUAL(4, events.size());
+    CHECK_EQUAL(2, events[0]);
+    CHECK_EQUAL(-1, events[1]);
+    CHECK_EQUAL(4, events[2]);
+    CHECK_EQUAL(-5, events[3]);
+}
+
+/**
+ * Channels must be linked to be watched.
+ */
+TEST(watchpoints, unlinked)
+{
+    Channel<int32_t> channel;
+    Watchpoints watchpoints;
+    CHECK_EQUAL(Watchpoints::ERR_INVALID,
+                watchpoints.add(channel,
+                                Watchpoints::Comparison::EQUAL,
+                                0,
+                                [](const bool) {}));
+    CHECK_EQUAL(0, watchpoints.size());
+}
@@ -0,0 +1,507 @@
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <river>
+
+using namespace river;
+
+/**
+ * Harness checking that river accesses never allocate once the river is built.
+ *
+ * Every allocation made through operator new, or through malloc and friends
+ * on glibc, is counted while a workload runs. Each workload builds rivers and
+ * handles up front, then exercises every access path many times from several
+ * threads. Any allocation in the exercised region fails the harness.
+ *
+ * The harness replaces the global allocator, so it's a separate executable
+ * rather than part of the unit tests, whose framework tracks allocations
+ * itself.
+ *
+ * Usage: zero_alloc
+ */
+
+namespace {
+/**
+ * Whether allocations are currently counted.
+ */
+std::atomic<bool> armed {false};
+
+/**
+ * Number of allocations counted.
+ */
+std::atomic<size_t> allocation_count {0};
+
+/**
+ * Counts an allocation if armed.
+ */
+void count_allocation()
+{
+    if (armed.load(std::memory_order_relaxed)) {
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+} /* namespace */
+
+#ifdef __GLIBC__
+// Intercept the C allocator, so that allocations that bypass operator new are
+// caught too. glibc allows replacing malloc as long as all of these are
+// replaced together.
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+
+void* malloc(size_t size)
+{
+    count_allocation();
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    count_allocation();
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    count_allocation();
+    return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+    count_allocation();
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    count_allocation();
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size)
+{
+    count_allocation();
+    *ptr = __libc_memalign(alignment, size);
+    return (*ptr ? 0 : ENOMEM);
+}
+
+void free(void* ptr)
+{
+    __libc_free(ptr);
+}
+}
+#endif
+
+// Count allocations through operator new. The array and nothrow forms forward
+// to these.
+void* operator new(const size_t size)
+{
+#ifndef __GLIBC__
+    count_allocation();
+#endif
+    void* const ptr = std::malloc(size);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new(const size_t size, const std::align_val_t alignment)
+{
+#ifndef __GLIBC__
+    count_allocation();
+#endif
+    const size_t align = static_cast<size_t>(alignment);
+    void* const ptr =
+        std::aligned_alloc(align, ((size + align - 1) / align) * align);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* const ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* const ptr, const std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* const ptr, const size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* const ptr,
+                     const size_t,
+                     const std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+namespace {
+/**
+ * Spin lock. Like all locks, it must not allocate or throw.
+ */
+class SpinLock final : public Lock {
+public:
+    void acquire() noexcept override
+    {
+        while (locked.exchange(true, std::memory_order_acquire)) {
+            while (locked.load(std::memory_order_relaxed)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    void release() noexcept override
+    {
+        locked.store(false, std::memory_order_release);
+    }
+
+private:
+    std::atomic<bool> locked {false};
+};
+
+/**
+ * Number of iterations of each workload per thread.
+ */
+constexpr size_t ITERATIONS = 10000;
+
+/**
+ * Number of threads running each workload.
+ */
+constexpr size_t THREAD_COUNT = 4;
+
+/**
+ * Handles to a river with one of every kind of channel, rivulet, and lock.
+ *
+ * Rivulets written by one thread and read by others are locked, so that the
+ * race detector, if compiled in, has nothing to report. Reporting a race
+ * allocates.
+ */
+struct Handles final {
+    Channel<uint64_t> time;
+    Channel<double> pressure;
+    Channel<bool> valid;
+    Derived<bool> valve_open;
+    Flags faults;
+    Rivulet control;
+    Rivulet locked;
+    Channel<int32_t> locked_value;
+    std::shared_ptr<River> river;
+
+    /**
+     * Builds the river.
+     *
+     * @param options Build options.
+     *
+     * @returns Whether the river was built.
+     */
+    bool build(const Builder::Options& options)
+    {
+        Builder builder;
+        return ((builder.channel("system.time", uint64_t(0), time) == 0)
+                && (builder.channel("control.pressure", 14.7, pressure) == 0)
+                && (builder.channel("control.pressure.valid", true, valid)
+                    == 0)
+                && (builder.derived(
+                        "control.valve_open",
+                        [](const double pressure, const bool valid) {
+                            return ((pressure > 14.7) || !valid);
+                        },
+                        valve_open,
+                        pressure,
+                        valid)
+                    == 0)
+                && (builder.flags("control.faults", 100, faults) == 0)
+                && (builder.rivulet("control", control) == 0)
+                && (builder.channel("shared.value", 0, locked_value) == 0)
+                && (builder.rivulet("shared", locked) == 0)
+                && (builder.lock("system", std::make_shared<SpinLock>()) == 0)
+                && (builder.lock("control", std::make_shared<SpinLock>())
+                    == 0)
+                && (builder.lock("shared", std::make_shared<SpinLock>()) == 0)
+                && (builder.redundant("control") == 0)
+                && (builder.build(options, &river) == 0));
+    }
+};
+
+static_assert(noexcept(std::declval<Channel<int>&>().set(0)));
+static_assert(noexcept(std::declval<const Channel<int>&>().get()));
+static_assert(noexcept(std::declval<const Derived<int>&>().get()));
+static_assert(noexcept(std::declval<Rivulet&>().write(nullptr)));
+static_assert(noexcept(std::declval<const Rivulet&>().read(nullptr)));
+static_assert(noexcept(std::declval<Flags&>().set(0)));
+static_assert(noexcept(std::declval<Flags&>().clear(0)));
+static_assert(noexcept(std::declval<const Flags&>().test(0)));
+static_assert(noexcept(std::declval<const Flags&>().any()));
+static_assert(noexcept(std::declval<const Flags&>().count()));
+static_assert(noexcept(std::declval<River&>().commit_frame()));
+static_assert(noexcept(std::declval<River&>().advance_epoch()));
+static_assert(noexcept(std::declval<Mirror&>().apply()));
+
+/**
+ * Exercises every access path of a river.
+ *
+ * @param handles River handles.
+ * @param thread  Index of the calling thread.
+ */
+void exercise(Handles& handles, const size_t thread)
+{
+    uint8_t control[64];
+    uint8_t locked[sizeof(int32_t)];
+    for (size_t i = 0; i < ITERATIONS; ++i) {
+        // Each thread writes its own flag, and only thread 0 writes the other
+        // channels outside of the `shared` rivulet.
+        handles.faults.set(thread);
+        handles.faults.test(thread);
+        handles.faults.any();
+        handles.faults.count();
+        handles.faults.clear(thread);
+        handles.time.get();
+        handles.pressure.get();
+        handles.valid.get();
+        handles.valve_open.get();
+        handles.control.read(control);
+        handles.locked.read(locked);
+        handles.locked_value.get();
+        handles.locked.write(locked);
+        handles.locked_value.set(static_cast<int32_t>(i));
+        if (thread == 0) {
+            handles.time.set(i);
+            handles.pressure.set(static_cast<double>(i));
+            handles.valid.set((i % 2) == 0);
+        }
+    }
+}
+
+/**
+ * Runs a workload with allocations counted.
+ *
+ * @param name     Workload name.
+ * @param workload Workload, which is run on several threads at once.
+ * @param after    Run on the calling thread after the workload threads have
+ *                 joined.
+ *
+ * @returns Whether the workload made no allocations.
+ */
+bool check(const char* const name,
+           const std::function<void(size_t)>& workload,
+           const std::function<void()>& after)
+{
+    // Start the threads before counting allocations, since starting a thread
+    // allocates.
+    std::atomic<bool> go {false};
+    std::atomic<size_t> done {0};
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < THREAD_COUNT; ++i) {
+        threads.emplace_back([&, i]() {
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            workload(i);
+            done.fetch_add(1, std::memory_order_release);
+        });
+    }
+
+    allocation_count.store(0);
+    armed.store(true);
+    go.store(true, std::memory_order_release);
+    while (done.load(std::memory_order_acquire) < THREAD_COUNT) {
+        std::this_thread::yield();
+    }
+    after();
+    armed.store(false);
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    const size_t count = allocation_count.load();
+    std::printf("%-36s %s (%zu allocations)\n",
+                name,
+                ((count == 0) ? "ok" : "FAILED"),
+                count);
+    return (count == 0);
+}
+} /* namespace */
+
+int main()
+{
+    bool ok = true;
+
+    Handles plain;
+    if (!plain.build(Builder::Options())) {
+        std::fprintf(stderr, "failed to build river\n");
+        return 1;
+    }
+    ok &= check(
+        "plain",
+        [&](const size_t thread) { exercise(plain, thread); },
+        []() {});
+
+    // Frames, checksums, replicas, versions, and replication add work on
+    // every write and commit.
+    std::shared_ptr<ReplicationLog> primary_log(new ReplicationLog);
+    std::shared_ptr<ReplicationLog> standby_log(new ReplicationLog);
+    if ((primary_log->create("/river_zero_alloc", 1 << 16) != 0)
+        || (standby_log->open("/river_zero_alloc") != 0)) {
+        std::fprintf(stderr, "failed to create replication log\n");
+        return 1;
+    }
+    Builder::Options checked_options;
+    checked_options.frames = true;
+    checked_options.checksums = true;
+    checked_options.versions = true;
+    checked_options.replicator.reset(new Replicator(primary_log));
+    Handles checked;
+    Handles standby;
+    if (!checked.build(checked_options)
+        || !standby.build(Builder::Options())) {
+        std::fprintf(stderr, "failed to build checked river\n");
+        return 1;
+    }
+    Mirror mirror(standby.river, standby_log);
+
+    // Get the initial snapshot out of the way, so that frames replicate only
+    // the committed blocks.
+    checked.river->commit_frame();
+    mirror.apply();
+    const std::function<void(const Corruption&)> on_corruption =
+        [](const Corruption&) {};
+    ok &= check(
+        "frames+checksums+tmr+replication",
+        [&](const size_t thread) { exercise(checked, thread); },
+        [&]() {
+            checked.river->commit_frame();
+            mirror.apply();
+            checked.river->advance_epoch();
+            checked.river->verify(on_corruption);
+            checked.river->repair();
+        });
+
+    // Instrumentation records every access.
+    Builder::Options instrumented_options;
+    instrumented_options.profiler.reset(new Profiler);
+    instrumented_options.tracer.reset(new Tracer(THREAD_COUNT, 1 << 10));
+    instrumented_options.sampler.reset(new Sampler(THREAD_COUNT, 16));
+    Handles instrumented;
+    if (!instrumented.build(instrumented_options)) {
+        std::fprintf(stderr, "failed to build instrumented river\n");
+        return 1;
+    }
+    ok &= check(
+        "profiler+tracer+sampler",
+        [&](const size_t thread) { exercise(instrumented, thread); },
+        []() {});
+
+    // Scheduled frames, after the first one builds the dependency graph.
+    Scheduler scheduler(THREAD_COUNT);
+    for (size_t i = 0; i < THREAD_COUNT; ++i) {
+        scheduler.add(Task([&plain, i]() { exercise(plain, i); })
+                          .writes(plain.control)
+                          .writes(plain.time)
+                          .writes(plain.locked));
+    }
+    scheduler.run();
+    ok &= check(
+        "scheduler",
+        [](const size_t) {},
+        [&]() {
+            for (size_t i = 0; i < 10; ++i) {
+                scheduler.run();
+            }
+        });
+
+    // Watchpoint evaluation, while the watched channels change.
+    size_t edge_count = 0;
+    Watchpoints watchpoints;
+    watchpoints.add(plain.time,
+                    Watchpoints::Comparison::GREATER,
+                    uint64_t(ITERATIONS / 2),
+                    [&edge_count](const bool) { ++edge_count; });
+    watchpoints.add(plain.pressure,
+                    Watchpoints::Comparison::LESS,
+                    100.0,
+                    [&edge_count](const bool) { ++edge_count; });
+    watchpoints.add(plain.valid,
+                    Watchpoints::Comparison::EQUAL,
+                    false,
+                    [&edge_count](const bool) { ++edge_count; });
+    watchpoints.add(plain.locked_value,
+                    Watchpoints::Comparison::GREATER_EQUAL,
+                    0,
+                    [&edge_count](const bool) { ++edge_count; });
+    ok &= check(
+        "watchpoints",
+        [&](const size_t thread) {
+            exercise(plain, thread);
+            if (thread == 0) {
+                for (size_t i = 0; i < ITERATIONS; ++i) {
+                    watchpoints.evaluate();
+                }
+            }
+        },
+        []() {});
+
+    // Expression evaluation, while the channels read change.
+    Expressions expressions(plain.river);
+    size_t expression_index = 0;
+    expressions.add("control.pressure > 14.7 || !control.pressure.valid",
+                    expression_index);
+    expressions.add("abs(shared.value - system.time) / 2", expression_index);
+    ok &= check(
+        "expressions",
+        [&](const size_t thread) {
+            exercise(plain, thread);
+            if (thread == 0) {
+                for (size_t i = 0; i < ITERATIONS; ++i) {
+                    expressions.evaluate();
+                }
+            }
+        },
+        []() {});
+
+    // History records every write of the recorded channels, and queries reuse
+    // their result capacity.
+    Builder::Options history_options;
+    history_options.history.reset(
+        new History({"system.time", "control", "shared.value"}));
+    Handles recorded;
+    if (!recorded.build(history_options)) {
+        std::fprintf(stderr, "failed to build recorded river\n");
+        return 1;
+    }
+    const std::string path = "control.pressure";
+    std::vector<History::Point> points;
+    points.reserve(1024);
+    ok &= check(
+        "history",
+        [&](const size_t thread) { exercise(recorded, thread); },
+        [&]() {
+            const uint64_t now = history_options.history->now();
+            history_options.history->query(
+                path, now - 60000000000ull, now, 60, points);
+        });
+
+    return (ok ? 0 : 1);
+}